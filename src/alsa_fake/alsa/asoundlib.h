@@ -0,0 +1,108 @@
+#ifndef ALSA_FAKE_ASOUNDLIB_H_INCLUDED
+#define ALSA_FAKE_ASOUNDLIB_H_INCLUDED
+
+
+#include <stddef.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+
+
+/* the part of the libasound api the tools use, with the same values */
+
+typedef struct _snd_pcm snd_pcm_t;
+typedef struct _snd_pcm_hw_params snd_pcm_hw_params_t;
+typedef struct _snd_pcm_sw_params snd_pcm_sw_params_t;
+
+typedef struct _snd_pcm_channel_area
+{
+  void* addr;
+  unsigned int first;
+  unsigned int step;
+} snd_pcm_channel_area_t;
+
+typedef long snd_pcm_sframes_t;
+typedef unsigned long snd_pcm_uframes_t;
+
+typedef enum
+{
+  SND_PCM_STREAM_PLAYBACK = 0,
+  SND_PCM_STREAM_CAPTURE
+} snd_pcm_stream_t;
+
+typedef enum
+{
+  SND_PCM_FORMAT_UNKNOWN = -1,
+  SND_PCM_FORMAT_S16_LE = 2,
+  SND_PCM_FORMAT_S24_LE = 6,
+  SND_PCM_FORMAT_S32_LE = 10,
+  SND_PCM_FORMAT_FLOAT_LE = 14,
+  SND_PCM_FORMAT_S24_3LE = 32
+} snd_pcm_format_t;
+
+typedef enum
+{
+  SND_PCM_ACCESS_RW_INTERLEAVED = 3
+} snd_pcm_access_t;
+
+#define SND_PCM_NONBLOCK 0x00000001
+#define SND_PCM_NO_AUTO_FORMAT 0x00040000
+
+
+int snd_pcm_open(snd_pcm_t**, const char*, snd_pcm_stream_t, int);
+int snd_pcm_close(snd_pcm_t*);
+snd_pcm_stream_t snd_pcm_stream(snd_pcm_t*);
+int snd_pcm_nonblock(snd_pcm_t*, int);
+
+int snd_pcm_hw_params_malloc(snd_pcm_hw_params_t**);
+void snd_pcm_hw_params_free(snd_pcm_hw_params_t*);
+int snd_pcm_hw_params_any(snd_pcm_t*, snd_pcm_hw_params_t*);
+int snd_pcm_hw_params_set_access
+(snd_pcm_t*, snd_pcm_hw_params_t*, snd_pcm_access_t);
+int snd_pcm_hw_params_test_format
+(snd_pcm_t*, snd_pcm_hw_params_t*, snd_pcm_format_t);
+int snd_pcm_hw_params_set_format
+(snd_pcm_t*, snd_pcm_hw_params_t*, snd_pcm_format_t);
+int snd_pcm_hw_params_set_rate_resample
+(snd_pcm_t*, snd_pcm_hw_params_t*, unsigned int);
+int snd_pcm_hw_params_set_rate
+(snd_pcm_t*, snd_pcm_hw_params_t*, unsigned int, int);
+int snd_pcm_hw_params_set_rate_near
+(snd_pcm_t*, snd_pcm_hw_params_t*, unsigned int*, int*);
+int snd_pcm_hw_params_set_channels
+(snd_pcm_t*, snd_pcm_hw_params_t*, unsigned int);
+int snd_pcm_hw_params_set_channels_near
+(snd_pcm_t*, snd_pcm_hw_params_t*, unsigned int*);
+int snd_pcm_hw_params(snd_pcm_t*, snd_pcm_hw_params_t*);
+
+int snd_pcm_sw_params_malloc(snd_pcm_sw_params_t**);
+void snd_pcm_sw_params_free(snd_pcm_sw_params_t*);
+int snd_pcm_sw_params_current(snd_pcm_t*, snd_pcm_sw_params_t*);
+int snd_pcm_sw_params_set_avail_min
+(snd_pcm_t*, snd_pcm_sw_params_t*, snd_pcm_uframes_t);
+int snd_pcm_sw_params_set_start_threshold
+(snd_pcm_t*, snd_pcm_sw_params_t*, snd_pcm_uframes_t);
+int snd_pcm_sw_params(snd_pcm_t*, snd_pcm_sw_params_t*);
+
+int snd_pcm_prepare(snd_pcm_t*);
+int snd_pcm_start(snd_pcm_t*);
+int snd_pcm_drop(snd_pcm_t*);
+int snd_pcm_drain(snd_pcm_t*);
+int snd_pcm_resume(snd_pcm_t*);
+int snd_pcm_wait(snd_pcm_t*, int);
+int snd_pcm_delay(snd_pcm_t*, snd_pcm_sframes_t*);
+snd_pcm_sframes_t snd_pcm_avail_update(snd_pcm_t*);
+snd_pcm_sframes_t snd_pcm_readi(snd_pcm_t*, void*, snd_pcm_uframes_t);
+snd_pcm_sframes_t snd_pcm_writei(snd_pcm_t*, const void*, snd_pcm_uframes_t);
+
+int snd_pcm_poll_descriptors_count(snd_pcm_t*);
+int snd_pcm_poll_descriptors(snd_pcm_t*, struct pollfd*, unsigned int);
+int snd_pcm_poll_descriptors_revents
+(snd_pcm_t*, struct pollfd*, unsigned int, unsigned short*);
+
+int snd_pcm_format_physical_width(snd_pcm_format_t);
+const char* snd_pcm_format_name(snd_pcm_format_t);
+const char* snd_strerror(int);
+
+
+#endif /* ! ALSA_FAKE_ASOUNDLIB_H_INCLUDED */
@@ -0,0 +1,607 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/timerfd.h>
+#include "alsa/asoundlib.h"
+
+
+/* a libasound stand-in, to run the tools without a sound card */
+
+/* cards are clocked by CLOCK_MONOTONIC, and tuned by the environment: */
+/*   ALSA_FAKE_ISKEW, ALSA_FAKE_OSKEW: capture and playback skews, ppm */
+/*   ALSA_FAKE_FMTS: formats the card takes, as snd_pcm_format_t values */
+/*   ALSA_FAKE_MAXCHAN: channels of the card, 8 by default */
+/*   ALSA_FAKE_OPATH: file the played frames are written to */
+/* capture gives a sine of 440 * (c + 1) Hz at -6 dBFS on chan c. a pcm */
+/* opened without SND_PCM_NO_AUTO_FORMAT takes any format, as the plug */
+/* layer of the default pcm does. */
+
+/* frames of the device buffer */
+#define FAKE_NBUF 16384
+
+struct _snd_pcm_hw_params
+{
+  snd_pcm_format_t fmt;
+  unsigned int rate;
+  unsigned int nchan;
+};
+
+struct _snd_pcm_sw_params
+{
+  snd_pcm_uframes_t avail_min;
+};
+
+struct _snd_pcm
+{
+  snd_pcm_stream_t stm;
+  int mode;
+  double ppm;
+
+  snd_pcm_format_t fmt;
+  unsigned int rate;
+  unsigned int nchan;
+  snd_pcm_uframes_t avail_min;
+
+  /* hardware position at start, and frames ever moved by the app */
+  unsigned int is_running;
+  double t0;
+  uint64_t base;
+  uint64_t appl;
+
+  /* wakes pollers every eighth of avail_min */
+  int tfd;
+
+  FILE* ofile;
+};
+
+
+static double fake_get_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+
+static uint64_t fake_get_hw(const snd_pcm_t* p)
+{
+  const double r = (double)p->rate * (1.0 + p->ppm / 1000000.0);
+  if (p->is_running == 0) return p->base;
+  return p->base + (uint64_t)((fake_get_time() - p->t0) * r);
+}
+
+
+static snd_pcm_sframes_t fake_get_avail(const snd_pcm_t* p)
+{
+  /* -EPIPE on overrun or underrun */
+
+  const uint64_t hw = fake_get_hw(p);
+
+  if (p->stm == SND_PCM_STREAM_CAPTURE)
+  {
+    if ((hw - p->appl) > FAKE_NBUF) return -EPIPE;
+    return (snd_pcm_sframes_t)(hw - p->appl);
+  }
+
+  if (p->is_running && (hw > p->appl)) return -EPIPE;
+  return FAKE_NBUF - (snd_pcm_sframes_t)(p->appl - hw);
+}
+
+
+static void fake_arm(snd_pcm_t* p)
+{
+  struct itimerspec its;
+  const long ns = (long)((1000000000.0 * p->avail_min) / (p->rate * 8.0));
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = ns / 1000000000;
+  its.it_value.tv_nsec = ns % 1000000000;
+  its.it_interval = its.it_value;
+  timerfd_settime(p->tfd, 0, &its, NULL);
+}
+
+
+static int fake_has_fmt(const snd_pcm_t* p, snd_pcm_format_t fmt)
+{
+  const char* const s = getenv("ALSA_FAKE_FMTS");
+  const char* q;
+  char* e;
+
+  if ((s == NULL) || ((p->mode & SND_PCM_NO_AUTO_FORMAT) == 0)) return 1;
+
+  for (q = s; *q; q = e)
+  {
+    if (strtol(q, &e, 10) == (long)fmt) return 1;
+    if (e == q) ++e;
+    else if (*e == ',') ++e;
+  }
+
+  return 0;
+}
+
+
+static unsigned int fake_get_maxchan(void)
+{
+  const char* const s = getenv("ALSA_FAKE_MAXCHAN");
+  if (s == NULL) return 8;
+  return (unsigned int)strtoul(s, NULL, 10);
+}
+
+
+/* pcm */
+
+int snd_pcm_open
+(snd_pcm_t** pp, const char* name, snd_pcm_stream_t stm, int mode)
+{
+  const char* s;
+  snd_pcm_t* p;
+
+  p = calloc(1, sizeof(snd_pcm_t));
+  if (p == NULL) return -ENOMEM;
+
+  p->stm = stm;
+  p->mode = mode;
+  p->fmt = SND_PCM_FORMAT_S16_LE;
+  p->rate = 44100;
+  p->nchan = 1;
+  p->avail_min = 1024;
+
+  s = getenv((stm == SND_PCM_STREAM_CAPTURE) ?
+	     "ALSA_FAKE_ISKEW" : "ALSA_FAKE_OSKEW");
+  if (s != NULL) p->ppm = strtod(s, NULL);
+
+  p->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (p->tfd == -1)
+  {
+    free(p);
+    return -errno;
+  }
+
+  /* opened here, so that writes do not allocate */
+  s = getenv("ALSA_FAKE_OPATH");
+  if ((stm == SND_PCM_STREAM_PLAYBACK) && (s != NULL))
+  {
+    p->ofile = fopen(s, "w");
+    if (p->ofile == NULL)
+    {
+      close(p->tfd);
+      free(p);
+      return -errno;
+    }
+  }
+
+  *pp = p;
+
+  return 0;
+}
+
+
+int snd_pcm_close(snd_pcm_t* p)
+{
+  if (p->ofile != NULL) fclose(p->ofile);
+  close(p->tfd);
+  free(p);
+  return 0;
+}
+
+
+snd_pcm_stream_t snd_pcm_stream(snd_pcm_t* p)
+{
+  return p->stm;
+}
+
+
+int snd_pcm_nonblock(snd_pcm_t* p, int x)
+{
+  if (x) p->mode |= SND_PCM_NONBLOCK;
+  else p->mode &= ~SND_PCM_NONBLOCK;
+  return 0;
+}
+
+
+/* hw params */
+
+int snd_pcm_hw_params_malloc(snd_pcm_hw_params_t** h)
+{
+  *h = calloc(1, sizeof(snd_pcm_hw_params_t));
+  return (*h == NULL) ? -ENOMEM : 0;
+}
+
+
+void snd_pcm_hw_params_free(snd_pcm_hw_params_t* h)
+{
+  free(h);
+}
+
+
+int snd_pcm_hw_params_any(snd_pcm_t* p, snd_pcm_hw_params_t* h)
+{
+  h->fmt = p->fmt;
+  h->rate = p->rate;
+  h->nchan = p->nchan;
+  return 0;
+}
+
+
+int snd_pcm_hw_params_set_access
+(snd_pcm_t* p, snd_pcm_hw_params_t* h, snd_pcm_access_t a)
+{
+  return (a == SND_PCM_ACCESS_RW_INTERLEAVED) ? 0 : -EINVAL;
+}
+
+
+int snd_pcm_hw_params_test_format
+(snd_pcm_t* p, snd_pcm_hw_params_t* h, snd_pcm_format_t fmt)
+{
+  return fake_has_fmt(p, fmt) ? 0 : -EINVAL;
+}
+
+
+int snd_pcm_hw_params_set_format
+(snd_pcm_t* p, snd_pcm_hw_params_t* h, snd_pcm_format_t fmt)
+{
+  if (fake_has_fmt(p, fmt) == 0) return -EINVAL;
+  h->fmt = fmt;
+  return 0;
+}
+
+
+int snd_pcm_hw_params_set_rate_resample
+(snd_pcm_t* p, snd_pcm_hw_params_t* h, unsigned int x)
+{
+  return 0;
+}
+
+
+int snd_pcm_hw_params_set_rate
+(snd_pcm_t* p, snd_pcm_hw_params_t* h, unsigned int rate, int dir)
+{
+  h->rate = rate;
+  return 0;
+}
+
+
+int snd_pcm_hw_params_set_rate_near
+(snd_pcm_t* p, snd_pcm_hw_params_t* h, unsigned int* rate, int* dir)
+{
+  h->rate = *rate;
+  return 0;
+}
+
+
+int snd_pcm_hw_params_set_channels
+(snd_pcm_t* p, snd_pcm_hw_params_t* h, unsigned int nchan)
+{
+  if ((nchan == 0) || (nchan > fake_get_maxchan())) return -EINVAL;
+  h->nchan = nchan;
+  return 0;
+}
+
+
+int snd_pcm_hw_params_set_channels_near
+(snd_pcm_t* p, snd_pcm_hw_params_t* h, unsigned int* nchan)
+{
+  if (*nchan > fake_get_maxchan()) *nchan = fake_get_maxchan();
+  if (*nchan == 0) *nchan = 1;
+  h->nchan = *nchan;
+  return 0;
+}
+
+
+int snd_pcm_hw_params(snd_pcm_t* p, snd_pcm_hw_params_t* h)
+{
+  p->fmt = h->fmt;
+  p->rate = h->rate;
+  p->nchan = h->nchan;
+  return snd_pcm_prepare(p);
+}
+
+
+/* sw params */
+
+int snd_pcm_sw_params_malloc(snd_pcm_sw_params_t** s)
+{
+  *s = calloc(1, sizeof(snd_pcm_sw_params_t));
+  return (*s == NULL) ? -ENOMEM : 0;
+}
+
+
+void snd_pcm_sw_params_free(snd_pcm_sw_params_t* s)
+{
+  free(s);
+}
+
+
+int snd_pcm_sw_params_current(snd_pcm_t* p, snd_pcm_sw_params_t* s)
+{
+  s->avail_min = p->avail_min;
+  return 0;
+}
+
+
+int snd_pcm_sw_params_set_avail_min
+(snd_pcm_t* p, snd_pcm_sw_params_t* s, snd_pcm_uframes_t n)
+{
+  s->avail_min = n ? n : 1;
+  return 0;
+}
+
+
+int snd_pcm_sw_params_set_start_threshold
+(snd_pcm_t* p, snd_pcm_sw_params_t* s, snd_pcm_uframes_t n)
+{
+  /* playback starts on the first write, capture on snd_pcm_start */
+  return 0;
+}
+
+
+int snd_pcm_sw_params(snd_pcm_t* p, snd_pcm_sw_params_t* s)
+{
+  p->avail_min = s->avail_min;
+  return 0;
+}
+
+
+/* state */
+
+int snd_pcm_prepare(snd_pcm_t* p)
+{
+  p->is_running = 0;
+  p->base = p->appl;
+  return 0;
+}
+
+
+int snd_pcm_start(snd_pcm_t* p)
+{
+  if (p->is_running) return 0;
+  p->is_running = 1;
+  p->t0 = fake_get_time();
+  fake_arm(p);
+  return 0;
+}
+
+
+int snd_pcm_drop(snd_pcm_t* p)
+{
+  p->is_running = 0;
+  return 0;
+}
+
+
+int snd_pcm_drain(snd_pcm_t* p)
+{
+  /* until the queued frames are played, or an underrun */
+
+  snd_pcm_sframes_t n;
+
+  if (p->stm == SND_PCM_STREAM_PLAYBACK)
+  {
+    while (p->is_running)
+    {
+      n = fake_get_avail(p);
+      if ((n < 0) || (n >= FAKE_NBUF)) break ;
+      usleep(1000);
+    }
+  }
+
+  p->is_running = 0;
+
+  return 0;
+}
+
+
+int snd_pcm_resume(snd_pcm_t* p)
+{
+  return -ENOSYS;
+}
+
+
+int snd_pcm_wait(snd_pcm_t* p, int ms)
+{
+  const double t = fake_get_time() + (double)ms / 1000.0;
+  snd_pcm_sframes_t n;
+
+  while (1)
+  {
+    n = fake_get_avail(p);
+    if (n < 0) return (int)n;
+    if ((snd_pcm_uframes_t)n >= p->avail_min) return 1;
+    if ((ms >= 0) && (fake_get_time() >= t)) return 0;
+    usleep(1000);
+  }
+}
+
+
+int snd_pcm_delay(snd_pcm_t* p, snd_pcm_sframes_t* d)
+{
+  const snd_pcm_sframes_t n = fake_get_avail(p);
+
+  if (n < 0) return (int)n;
+
+  if (p->stm == SND_PCM_STREAM_CAPTURE) *d = n;
+  else *d = FAKE_NBUF - n;
+
+  return 0;
+}
+
+
+snd_pcm_sframes_t snd_pcm_avail_update(snd_pcm_t* p)
+{
+  return fake_get_avail(p);
+}
+
+
+/* transfers */
+
+static void fake_put(const snd_pcm_t* p, uint8_t* q, double x)
+{
+  int16_t s16;
+  int32_t s32;
+  float f;
+
+  switch (p->fmt)
+  {
+  case SND_PCM_FORMAT_S16_LE:
+    s16 = (int16_t)(x * 32767.0);
+    memcpy(q, &s16, sizeof(s16));
+    break ;
+
+  case SND_PCM_FORMAT_S24_LE:
+  case SND_PCM_FORMAT_S24_3LE:
+    s32 = (int32_t)(x * 8388607.0);
+    memcpy(q, &s32, snd_pcm_format_physical_width(p->fmt) / 8);
+    break ;
+
+  case SND_PCM_FORMAT_S32_LE:
+    s32 = (int32_t)(x * 2147483647.0);
+    memcpy(q, &s32, sizeof(s32));
+    break ;
+
+  case SND_PCM_FORMAT_FLOAT_LE:
+    f = (float)x;
+    memcpy(q, &f, sizeof(f));
+    break ;
+
+  default:
+    break ;
+  }
+}
+
+
+snd_pcm_sframes_t snd_pcm_readi
+(snd_pcm_t* p, void* buf, snd_pcm_uframes_t n)
+{
+  const size_t w = (size_t)snd_pcm_format_physical_width(p->fmt) / 8;
+  snd_pcm_sframes_t navail;
+  double t;
+  size_t i;
+  size_t c;
+
+  if (p->is_running == 0) snd_pcm_start(p);
+
+  navail = fake_get_avail(p);
+  if (navail < 0) return navail;
+  if (navail == 0) return -EAGAIN;
+  if (n > (snd_pcm_uframes_t)navail) n = (snd_pcm_uframes_t)navail;
+
+  for (i = 0; i != n; ++i)
+  {
+    t = (double)(p->appl + i) / (double)p->rate;
+    for (c = 0; c != p->nchan; ++c)
+    {
+      fake_put
+      (
+       p, (uint8_t*)buf + (i * p->nchan + c) * w,
+       0.5 * sin(2.0 * M_PI * 440.0 * (double)(c + 1) * t)
+      );
+    }
+  }
+
+  p->appl += (uint64_t)n;
+
+  return (snd_pcm_sframes_t)n;
+}
+
+
+snd_pcm_sframes_t snd_pcm_writei
+(snd_pcm_t* p, const void* buf, snd_pcm_uframes_t n)
+{
+  const size_t w = (size_t)snd_pcm_format_physical_width(p->fmt) / 8;
+  snd_pcm_sframes_t navail;
+
+  navail = fake_get_avail(p);
+  if (navail < 0) return navail;
+  if (navail == 0) return -EAGAIN;
+  if (n > (snd_pcm_uframes_t)navail) n = (snd_pcm_uframes_t)navail;
+
+  if (p->ofile != NULL) fwrite(buf, w * p->nchan, n, p->ofile);
+
+  p->appl += (uint64_t)n;
+  if (p->is_running == 0) snd_pcm_start(p);
+
+  return (snd_pcm_sframes_t)n;
+}
+
+
+/* poll */
+
+int snd_pcm_poll_descriptors_count(snd_pcm_t* p)
+{
+  return 1;
+}
+
+
+int snd_pcm_poll_descriptors
+(snd_pcm_t* p, struct pollfd* pfds, unsigned int n)
+{
+  if (n == 0) return 0;
+  pfds->fd = p->tfd;
+  pfds->events = POLLIN;
+  return 1;
+}
+
+
+int snd_pcm_poll_descriptors_revents
+(snd_pcm_t* p, struct pollfd* pfds, unsigned int n, unsigned short* revents)
+{
+  snd_pcm_sframes_t navail;
+  uint64_t x;
+
+  if (read(p->tfd, &x, sizeof(x)) == -1) x = 0;
+
+  *revents = 0;
+  navail = fake_get_avail(p);
+
+  if ((navail < 0) || ((snd_pcm_uframes_t)navail >= p->avail_min))
+  {
+    if (p->stm == SND_PCM_STREAM_CAPTURE) *revents = POLLIN;
+    else *revents = POLLOUT;
+  }
+
+  if (navail < 0) *revents |= POLLERR;
+
+  return 0;
+}
+
+
+/* formats */
+
+int snd_pcm_format_physical_width(snd_pcm_format_t fmt)
+{
+  switch (fmt)
+  {
+  case SND_PCM_FORMAT_S16_LE: return 16;
+  case SND_PCM_FORMAT_S24_3LE: return 24;
+  case SND_PCM_FORMAT_S24_LE:
+  case SND_PCM_FORMAT_S32_LE:
+  case SND_PCM_FORMAT_FLOAT_LE: return 32;
+  default: return -EINVAL;
+  }
+}
+
+
+const char* snd_pcm_format_name(snd_pcm_format_t fmt)
+{
+  switch (fmt)
+  {
+  case SND_PCM_FORMAT_S16_LE: return "S16_LE";
+  case SND_PCM_FORMAT_S24_LE: return "S24_LE";
+  case SND_PCM_FORMAT_S32_LE: return "S32_LE";
+  case SND_PCM_FORMAT_FLOAT_LE: return "FLOAT_LE";
+  case SND_PCM_FORMAT_S24_3LE: return "S24_3LE";
+  default: return NULL;
+  }
+}
+
+
+const char* snd_strerror(int err)
+{
+  return strerror(-err);
+}
@@ -0,0 +1,2 @@
+#!/usr/bin/env sh
+gcc -Wall -O2 -I. -c alsa_fake.c && ar rcs libasound.a alsa_fake.o
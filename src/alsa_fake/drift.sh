@@ -0,0 +1,11 @@
+#!/usr/bin/env sh
+
+# the live loop on fake cards whose clocks drift: ./drift.sh [ms]
+# ISKEW and OSKEW set the skews, in ppm. the drift reports should settle
+# at the target latency, with a ratio of ISKEW - OSKEW, and no xruns.
+
+sh build.sh || exit 1
+(cd .. && sh build.sh -Ialsa_fake -Lalsa_fake -o alsa_fake/a.out) || exit 1
+
+ALSA_FAKE_ISKEW=${ISKEW:-300} ALSA_FAKE_OSKEW=${OSKEW:--200} \
+./a.out -drift yes -stats yes -dur ${1:-180000}
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+
+/* set in the threads that must not allocate */
+static __thread unsigned int arena_is_rt = 0;
+
+static size_t arena_nfault = 0;
+
+
+int arena_init(arena_handle_t* arena, size_t size)
+{
+  void* p;
+
+  p = mmap
+  (
+   NULL, size, PROT_READ | PROT_WRITE,
+   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+  );
+  if (p == MAP_FAILED) return -1;
+
+  arena->base = p;
+  arena->size = size;
+  arena->off = 0;
+
+  return 0;
+}
+
+
+void arena_fini(arena_handle_t* arena)
+{
+  munmap(arena->base, arena->size);
+}
+
+
+size_t arena_get_size(size_t size)
+{
+  /* taken by a block of size bytes. one aligned on more than */
+  /* ARENA_ALIGN takes at most arena_get_size(size + align). */
+
+  return (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+}
+
+
+void* arena_alloc(arena_handle_t* arena, size_t size)
+{
+  /* ARENA_ALIGN aligned and zeroed, NULL if the range is exhausted */
+
+  uint8_t* p;
+
+  size = arena_get_size(size);
+  if (size > (arena->size - arena->off)) return NULL;
+
+  p = arena->base + arena->off;
+  arena->off += size;
+
+  /* anonymous pages read as zero, the write backs them now */
+  memset(p, 0, size);
+
+  return p;
+}
+
+
+void* arena_alloc_aligned(arena_handle_t* arena, size_t size, size_t align)
+{
+  /* align is a power of 2, at least ARENA_ALIGN: for O_DIRECT, pages */
+
+  const uintptr_t x = (uintptr_t)(arena->base + arena->off);
+  const size_t pad = (size_t)(-x & (align - 1));
+
+  if (pad > (arena->size - arena->off)) return NULL;
+  arena->off += pad;
+
+  return arena_alloc(arena, size);
+}
+
+
+void arena_enter_rt(void)
+{
+  arena_is_rt = 1;
+}
+
+
+void arena_leave_rt(void)
+{
+  arena_is_rt = 0;
+}
+
+
+size_t arena_get_nfault(void)
+{
+  return __atomic_load_n(&arena_nfault, __ATOMIC_RELAXED);
+}
+
+
+#ifdef ARENA_CHECK
+
+/* interposed for the whole process, forwarded to glibc. reports are */
+/* formatted by hand: stdio may allocate. */
+
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+extern void* __libc_memalign(size_t, size_t);
+extern void __libc_free(void*);
+
+static void arena_fault(const char* name, const void* caller)
+{
+  static const char hex[] = "0123456789abcdef";
+  static const char at[] = " in the audio thread, at 0x";
+  char buf[96];
+  uintptr_t x = (uintptr_t)caller;
+  size_t nmax;
+  size_t n;
+  size_t i;
+  const char* s;
+
+  __atomic_add_fetch(&arena_nfault, 1, __ATOMIC_RELAXED);
+
+  /* "arena: <name> in the audio thread, at 0x<caller>" */
+  /* the name is cut to what is left after the rest */
+  nmax = sizeof(buf) - (sizeof(at) - 1) - 2 * sizeof(uintptr_t) - 1;
+
+  n = 0;
+  for (s = "arena: "; *s; ++s) buf[n++] = *s;
+  for (s = name; *s && (n != nmax); ++s) buf[n++] = *s;
+  for (s = at; *s; ++s) buf[n++] = *s;
+  for (i = 0; i != (2 * sizeof(uintptr_t)); ++i)
+    buf[n++] = hex[(x >> (4 * (2 * sizeof(uintptr_t) - 1 - i))) & 0xf];
+  buf[n++] = '\n';
+
+  if (write(STDERR_FILENO, buf, n) == -1) {}
+
+  s = getenv("ARENA_CHECK");
+  if ((s != NULL) && (strcmp(s, "abort") == 0)) abort();
+}
+
+
+void* malloc(size_t size)
+{
+  if (arena_is_rt) arena_fault("malloc", __builtin_return_address(0));
+  return __libc_malloc(size);
+}
+
+
+void* calloc(size_t n, size_t size)
+{
+  if (arena_is_rt) arena_fault("calloc", __builtin_return_address(0));
+  return __libc_calloc(n, size);
+}
+
+
+void* realloc(void* p, size_t size)
+{
+  if (arena_is_rt) arena_fault("realloc", __builtin_return_address(0));
+  return __libc_realloc(p, size);
+}
+
+
+void free(void* p)
+{
+  if (p == NULL) return ;
+  if (arena_is_rt) arena_fault("free", __builtin_return_address(0));
+  __libc_free(p);
+}
+
+
+void* memalign(size_t align, size_t size)
+{
+  if (arena_is_rt) arena_fault("memalign", __builtin_return_address(0));
+  return __libc_memalign(align, size);
+}
+
+
+void* aligned_alloc(size_t align, size_t size)
+{
+  if (arena_is_rt) arena_fault("aligned_alloc", __builtin_return_address(0));
+  return __libc_memalign(align, size);
+}
+
+
+int posix_memalign(void** p, size_t align, size_t size)
+{
+  void* q;
+
+  if (arena_is_rt) arena_fault("posix_memalign", __builtin_return_address(0));
+
+  if ((align % sizeof(void*)) || (align & (align - 1))) return EINVAL;
+  q = __libc_memalign(align, size);
+  if (q == NULL) return ENOMEM;
+  *p = q;
+
+  return 0;
+}
+
+#endif /* ARENA_CHECK */
@@ -0,0 +1,41 @@
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* memory of a session, taken once at setup for the buffers its period */
+/* loop uses: device rings, conversion blocks, transforms. the range is */
+/* sized once the devices are negotiated, as the sum of arena_get_size */
+/* of the blocks. allocations bump a pointer in it, and are freed all */
+/* at once. pages are touched as they are handed out, not in the loop. */
+
+/* built with ARENA_CHECK defined, malloc and its relatives are */
+/* interposed: a call from a thread between arena_enter_rt and */
+/* arena_leave_rt is reported on stderr, and aborts if the variable */
+/* ARENA_CHECK is set to abort in the environment. */
+
+/* a cache line, more than simd loads and fftw need */
+#define ARENA_ALIGN 64
+
+typedef struct arena_handle
+{
+  uint8_t* base;
+  size_t size;
+  size_t off;
+} arena_handle_t;
+
+
+int arena_init(arena_handle_t*, size_t);
+void arena_fini(arena_handle_t*);
+size_t arena_get_size(size_t);
+void* arena_alloc(arena_handle_t*, size_t);
+void* arena_alloc_aligned(arena_handle_t*, size_t, size_t);
+void arena_enter_rt(void);
+void arena_leave_rt(void);
+size_t arena_get_nfault(void);
+
+
+#endif /* ! ARENA_H_INCLUDED */
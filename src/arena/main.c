@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "arena.h"
+#include "util.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+  /* allocations, and their size */
+  size_t n;
+  size_t size;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->n = 4096;
+  cmd->size = 4096;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-n") == 0)
+    {
+      cmd->n = (size_t)strtoul(v, NULL, 10);
+      if (cmd->n == 0) goto on_error;
+    }
+    else if (strcmp(k, "-size") == 0)
+    {
+      cmd->size = (size_t)strtoul(v, NULL, 10);
+      if (cmd->size == 0) goto on_error;
+    }
+    else goto on_error;
+  }
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* main */
+
+/* the cost of arena allocations, touched, against malloc and memset. */
+/* then one malloc in rt: reported if built with -DARENA_CHECK. */
+
+int main(int ac, char** av)
+{
+  arena_handle_t arena;
+  cmd_handle_t cmd;
+  void** ps;
+  void* p;
+  double t;
+  double tarena;
+  double tmalloc;
+  size_t i;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  ps = malloc(cmd.n * sizeof(void*));
+  if (ps == NULL)
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (arena_init(&arena, cmd.n * arena_get_size(cmd.size)))
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  t = util_get_time();
+  for (i = 0; i != cmd.n; ++i)
+  {
+    if (arena_alloc(&arena, cmd.size) == NULL)
+    {
+      PERROR();
+      goto on_error_2;
+    }
+  }
+  tarena = util_get_time() - t;
+
+  t = util_get_time();
+  for (i = 0; i != cmd.n; ++i)
+  {
+    ps[i] = malloc(cmd.size);
+    if (ps[i] == NULL) break ;
+    memset(ps[i], 0, cmd.size);
+  }
+  tmalloc = util_get_time() - t;
+  cmd.n = i;
+  for (i = 0; i != cmd.n; ++i) free(ps[i]);
+
+  printf
+  (
+   "%zu allocations of %zu bytes: arena %.1f ns, malloc %.1f ns\n",
+   cmd.n, cmd.size,
+   (tarena * 1e9) / (double)cmd.n, (tmalloc * 1e9) / (double)cmd.n
+  );
+
+  arena_enter_rt();
+  /* through volatile, or the pair is optimized out */
+  p = malloc(1);
+  if (p != NULL) *(volatile uint8_t*)p = 0;
+  free(p);
+  arena_leave_rt();
+
+  printf("faults in rt: %zu\n", arena_get_nfault());
+
+  err = 0;
+
+ on_error_2:
+  arena_fini(&arena);
+ on_error_1:
+  free(ps);
+ on_error_0:
+  return err;
+}
@@ -1,2 +1,2 @@
 #!/usr/bin/env sh
-gcc -Wall -O2 main.c -lasound -lfftw3
+gcc -Wall -O2 -Imeter -Iresampl -Iwav -Itrace -Istats -Iarena -Ifanout -Isimd -Ifixed -Iutil main.c meter/meter.c resampl/resampl.c wav/wav.c wav/wav_io.c wav/wav_fmt.c trace/trace.c stats/stats.c arena/arena.c fanout/fanout.c simd/simd.c fixed/fixed.c util/util.c -lasound -lfftw3 -lm -lpthread -lrt "$@"
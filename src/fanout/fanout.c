@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "wav_fmt.h"
+#include "fanout.h"
+#include "util.h"
+
+
+static size_t get_size(size_t nframe, size_t nchan)
+{
+  return sizeof(fanout_shm_t) + nframe * nchan * sizeof(float);
+}
+
+
+static float* get_data(fanout_shm_t* shm)
+{
+  return (float*)((uint8_t*)shm + sizeof(fanout_shm_t));
+}
+
+
+/* producer */
+
+int fanout_create
+(fanout_handle_t* fan, const char* name, unsigned int fsampl, size_t nchan)
+{
+  fanout_shm_t* shm;
+  size_t nframe;
+
+  for (nframe = 1; nframe < (FANOUT_NSECS * fsampl); nframe *= 2) ;
+
+  if (util_get_shm_name(fan->name, sizeof(fan->name), name))
+    goto on_error_0;
+
+  fan->fd = shm_open(fan->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fan->fd == -1) goto on_error_0;
+
+  fan->size = get_size(nframe, nchan);
+  if (ftruncate(fan->fd, (off_t)fan->size)) goto on_error_2;
+
+  shm = mmap
+    (NULL, fan->size, PROT_READ | PROT_WRITE, MAP_SHARED, fan->fd, 0);
+  if (shm == MAP_FAILED) goto on_error_2;
+
+  /* the pages are touched now rather than on the first periods */
+  memset(shm, 0, fan->size);
+
+  shm->version = FANOUT_VERSION;
+  shm->fsampl = fsampl;
+  shm->nchan = (uint32_t)nchan;
+  shm->nframe = nframe;
+  shm->pid = (int32_t)getpid();
+  __atomic_store_n(&shm->magic, FANOUT_MAGIC, __ATOMIC_RELEASE);
+
+  fan->shm = shm;
+  fan->data = get_data(shm);
+  fan->slot = NULL;
+
+  return 0;
+
+ on_error_2:
+  close(fan->fd);
+  shm_unlink(fan->name);
+ on_error_0:
+  return -1;
+}
+
+
+void fanout_destroy(fanout_handle_t* fan)
+{
+  /* attached clients keep their mapping, the name goes */
+
+  munmap(fan->shm, fan->size);
+  close(fan->fd);
+  shm_unlink(fan->name);
+}
+
+
+void fanout_write
+(fanout_handle_t* fan, const double* buf, size_t dist, size_t n)
+{
+  /* n frames from nchan rows dist apart, converted in the ring. n is */
+  /* less than half the ring: clients skip to there. */
+
+  fanout_shm_t* const shm = fan->shm;
+  const size_t nchan = shm->nchan;
+  const size_t mask = shm->nframe - 1;
+  const uint64_t head = shm->head;
+  size_t off;
+  size_t i;
+  size_t k;
+
+  /* the frames overwritten are given up before they are: the fence */
+  /* orders the end with the stores of the conversion */
+  __atomic_store_n(&shm->wend, head + n, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  for (i = 0; i != n; i += k)
+  {
+    off = (size_t)((head + i) & mask);
+    k = shm->nframe - off;
+    if (k > (n - i)) k = n - i;
+    wav_fmt_from_planar
+      (WAV_FMT_FLOAT, fan->data + off * nchan, buf + i, dist, nchan, k);
+  }
+
+  __atomic_store_n(&shm->head, head + n, __ATOMIC_RELEASE);
+
+  /* ordered with the waiter count, see fanout_wait */
+  __atomic_add_fetch(&shm->seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&shm->nwaiter, __ATOMIC_SEQ_CST) == 0) return ;
+
+  syscall(SYS_futex, &shm->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+size_t fanout_get_nlag(fanout_handle_t* fan, size_t* nclient)
+{
+  /* clients more than half the ring behind. slots of processes gone */
+  /* are freed. not for the period loop: one syscall per client. */
+
+  fanout_shm_t* const shm = fan->shm;
+  const uint64_t head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+  fanout_slot_t* s;
+  int32_t pid;
+  size_t nlag = 0;
+  size_t i;
+
+  *nclient = 0;
+
+  for (i = 0; i != FANOUT_NSLOT; ++i)
+  {
+    s = &shm->slots[i];
+
+    pid = __atomic_load_n(&s->pid, __ATOMIC_ACQUIRE);
+    if (pid == 0) continue ;
+
+    if (kill((pid_t)pid, 0) && (errno == ESRCH))
+    {
+      __atomic_compare_exchange_n
+	(&s->pid, &pid, 0, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+      continue ;
+    }
+
+    ++*nclient;
+    if ((head - __atomic_load_n(&s->pos, __ATOMIC_RELAXED)) > (shm->nframe / 2))
+      ++nlag;
+  }
+
+  return nlag;
+}
+
+
+/* clients */
+
+int fanout_attach(fanout_handle_t* fan, const char* name)
+{
+  fanout_shm_t* shm;
+  fanout_slot_t* s;
+  struct stat st;
+  int32_t pid;
+  size_t i;
+
+  if (util_get_shm_name(fan->name, sizeof(fan->name), name))
+    goto on_error_0;
+
+  fan->fd = shm_open(fan->name, O_RDWR, 0);
+  if (fan->fd == -1) goto on_error_0;
+
+  if (fstat(fan->fd, &st)) goto on_error_2;
+  if (st.st_size < (off_t)sizeof(fanout_shm_t)) goto on_error_2;
+
+  /* the header, then all of it */
+
+  shm = mmap(NULL, sizeof(fanout_shm_t), PROT_READ, MAP_SHARED, fan->fd, 0);
+  if (shm == MAP_FAILED) goto on_error_2;
+
+  fan->size = 0;
+  if ((__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) == FANOUT_MAGIC) &&
+      (shm->version == FANOUT_VERSION))
+    fan->size = get_size(shm->nframe, shm->nchan);
+  munmap(shm, sizeof(fanout_shm_t));
+
+  if (fan->size == 0) goto on_error_2;
+  if (st.st_size < (off_t)fan->size) goto on_error_2;
+
+  shm = mmap
+    (NULL, fan->size, PROT_READ | PROT_WRITE, MAP_SHARED, fan->fd, 0);
+  if (shm == MAP_FAILED) goto on_error_2;
+
+  /* a free slot, from the head on */
+
+  for (i = 0; i != FANOUT_NSLOT; ++i)
+  {
+    s = &shm->slots[i];
+    pid = 0;
+    if (__atomic_compare_exchange_n
+	(&s->pid, &pid, (int32_t)getpid(), 0,
+	 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      break ;
+  }
+
+  if (i == FANOUT_NSLOT) goto on_error_3;
+
+  s->nskip = 0;
+  __atomic_store_n
+  (
+   &s->pos, __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE),
+   __ATOMIC_RELEASE
+  );
+
+  fan->shm = shm;
+  fan->data = get_data(shm);
+  fan->slot = s;
+
+  return 0;
+
+ on_error_3:
+  munmap(shm, fan->size);
+ on_error_2:
+  close(fan->fd);
+ on_error_0:
+  return -1;
+}
+
+
+void fanout_detach(fanout_handle_t* fan)
+{
+  __atomic_store_n(&fan->slot->pid, 0, __ATOMIC_RELEASE);
+  munmap(fan->shm, fan->size);
+  close(fan->fd);
+}
+
+
+size_t fanout_read(fanout_handle_t* fan, float* buf, size_t n)
+{
+  /* up to n interleaved frames, 0 if none or if they were overwritten */
+  /* during the copy. frames lost are added to the slot nskip. */
+
+  const fanout_shm_t* const shm = fan->shm;
+  fanout_slot_t* const s = fan->slot;
+  const size_t nchan = shm->nchan;
+  const size_t mask = shm->nframe - 1;
+  uint64_t head;
+  uint64_t wend;
+  uint64_t pos;
+  size_t off;
+  size_t i;
+  size_t k;
+
+  head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+  pos = s->pos;
+
+  if ((head - pos) > shm->nframe)
+  {
+    s->nskip += head - shm->nframe / 2 - pos;
+    pos = head - shm->nframe / 2;
+  }
+
+  if ((uint64_t)n > (head - pos)) n = (size_t)(head - pos);
+
+  for (i = 0; i != n; i += k)
+  {
+    off = (size_t)((pos + i) & mask);
+    k = shm->nframe - off;
+    if (k > (n - i)) k = n - i;
+    memcpy
+      (buf + i * nchan, fan->data + off * nchan, k * nchan * sizeof(float));
+  }
+
+  /* the oldest frame copied must not have been given up to a write, */
+  /* even one not published yet: if the copy read any frame it */
+  /* converted, the fence makes its end visible */
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  wend = __atomic_load_n(&shm->wend, __ATOMIC_RELAXED);
+
+  if ((wend - pos) > shm->nframe)
+  {
+    head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+    s->nskip += head - shm->nframe / 2 - pos;
+    __atomic_store_n(&s->pos, head - shm->nframe / 2, __ATOMIC_RELEASE);
+    return 0;
+  }
+
+  __atomic_store_n(&s->pos, pos + n, __ATOMIC_RELEASE);
+
+  return n;
+}
+
+
+int fanout_wait(fanout_handle_t* fan, unsigned int ms)
+{
+  /* until frames are written after the cursor, or ms elapse */
+
+  fanout_shm_t* const shm = fan->shm;
+  struct timespec ts;
+  uint32_t seq;
+
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (long)(ms % 1000) * 1000000;
+
+  __atomic_add_fetch(&shm->nwaiter, 1, __ATOMIC_SEQ_CST);
+  seq = __atomic_load_n(&shm->seq, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&shm->head, __ATOMIC_ACQUIRE) == fan->slot->pos)
+    syscall(SYS_futex, &shm->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+
+  __atomic_sub_fetch(&shm->nwaiter, 1, __ATOMIC_SEQ_CST);
+
+  return 0;
+}
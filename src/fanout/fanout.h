@@ -0,0 +1,97 @@
+#ifndef FANOUT_H_INCLUDED
+#define FANOUT_H_INCLUDED
+
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+
+
+/* the processed stream of the live loop, to any number of processes. */
+/* one producer writes interleaved floats to a ring in a shared memory */
+/* segment, then publishes its head. clients attach to a slot, that */
+/* holds their read cursor, and copy from it. */
+
+/* the producer never waits: it does not look at cursors while writing, */
+/* and overwrites what a slow client has not read. before converting a */
+/* block, it publishes where the block ends. a client finds it fell */
+/* behind from the head, or from that end being a ring past its cursor */
+/* once it copied: it skips to half the ring behind the head, and */
+/* counts the frames lost. */
+
+/* clients may sleep on a futex word, the producer only wakes them if */
+/* one is waiting. */
+
+#define FANOUT_MAGIC 0x6f6e6166
+#define FANOUT_VERSION 2
+#define FANOUT_NSLOT 16
+
+/* ring, at least, in seconds: rounded up to a power of 2 of frames */
+#define FANOUT_NSECS 2
+
+typedef struct fanout_slot
+{
+  /* owner, 0 if free */
+  int32_t pid;
+  uint32_t pad;
+
+  /* next frame to read, frames skipped */
+  uint64_t pos;
+  uint64_t nskip;
+
+} __attribute__((aligned(64))) fanout_slot_t;
+
+typedef struct fanout_shm
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t fsampl;
+  uint32_t nchan;
+  uint64_t nframe;
+  int32_t pid;
+
+  /* futex, bumped on writes, and the clients waiting on it */
+  uint32_t seq;
+  uint32_t nwaiter;
+
+  /* frames written, on its own line, then the end of those being */
+  /* written: head until a write starts */
+  uint64_t head __attribute__((aligned(64)));
+  uint64_t wend;
+
+  fanout_slot_t slots[FANOUT_NSLOT];
+
+  /* then the ring, nframe interleaved frames of nchan floats */
+
+} fanout_shm_t;
+
+typedef struct fanout_handle
+{
+  /* shm_open name, with its leading slash */
+  char name[NAME_MAX + 1];
+  int fd;
+  size_t size;
+  fanout_shm_t* shm;
+  float* data;
+
+  /* client side, NULL for the producer */
+  fanout_slot_t* slot;
+
+} fanout_handle_t;
+
+
+/* producer */
+int fanout_create
+(fanout_handle_t*, const char*, unsigned int, size_t);
+void fanout_destroy(fanout_handle_t*);
+void fanout_write(fanout_handle_t*, const double*, size_t, size_t);
+size_t fanout_get_nlag(fanout_handle_t*, size_t*);
+
+/* clients */
+int fanout_attach(fanout_handle_t*, const char*);
+void fanout_detach(fanout_handle_t*);
+size_t fanout_read(fanout_handle_t*, float*, size_t);
+int fanout_wait(fanout_handle_t*, unsigned int);
+
+
+#endif /* ! FANOUT_H_INCLUDED */
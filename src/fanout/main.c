@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <math.h>
+#include "fanout.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+#define CMD_FLAG_OPATH (1 << 0)
+  uint32_t flags;
+  const char* name;
+  const char* opath;
+  /* in ms, 0 until interrupted */
+  unsigned int dur;
+  /* per read, in us, to stand for a slow client */
+  unsigned int lag;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->flags = 0;
+  cmd->name = "aspect";
+  cmd->opath = NULL;
+  cmd->dur = 0;
+  cmd->lag = 0;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-name") == 0)
+    {
+      cmd->name = v;
+    }
+    else if (strcmp(k, "-opath") == 0)
+    {
+      /* raw interleaved floats */
+      cmd->flags |= CMD_FLAG_OPATH;
+      cmd->opath = v;
+    }
+    else if (strcmp(k, "-dur") == 0)
+    {
+      cmd->dur = (unsigned int)strtoul(v, NULL, 10);
+      if (cmd->dur == 0) goto on_error;
+    }
+    else if (strcmp(k, "-lag") == 0)
+    {
+      cmd->lag = (unsigned int)strtoul(v, NULL, 10);
+    }
+    else goto on_error;
+  }
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* main */
+
+/* a client: reads the stream, reports the level and frames skipped */
+/* every second, and writes it if asked to. */
+
+#define NREAD 1024
+
+static volatile unsigned int is_sigint = 0;
+
+static void on_sigint(int n)
+{
+  is_sigint = 1;
+}
+
+
+int main(int ac, char** av)
+{
+  fanout_handle_t fan;
+  cmd_handle_t cmd;
+  FILE* file = NULL;
+  float* buf;
+  uint64_t nmax = (uint64_t)-1;
+  uint64_t nread = 0;
+  uint64_t report;
+  double sum = 0.0;
+  size_t nsampl;
+  size_t n;
+  size_t i;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (fanout_attach(&fan, cmd.name))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  buf = malloc(NREAD * fan.shm->nchan * sizeof(float));
+  if (buf == NULL)
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  if (cmd.flags & CMD_FLAG_OPATH)
+  {
+    file = fopen(cmd.opath, "w");
+    if (file == NULL)
+    {
+      PERROR();
+      goto on_error_2;
+    }
+  }
+
+  printf
+  (
+   "%s: %u Hz, %u chan, ring of %llu frames\n",
+   cmd.name, fan.shm->fsampl, fan.shm->nchan,
+   (unsigned long long)fan.shm->nframe
+  );
+
+  if (cmd.dur) nmax = ((uint64_t)cmd.dur * fan.shm->fsampl) / 1000;
+  report = fan.shm->fsampl;
+
+  signal(SIGINT, on_sigint);
+
+  while ((is_sigint == 0) && (nread < nmax))
+  {
+    n = fanout_read(&fan, buf, NREAD);
+
+    if (n == 0)
+    {
+      fanout_wait(&fan, 100);
+      continue ;
+    }
+
+    nsampl = n * fan.shm->nchan;
+    for (i = 0; i != nsampl; ++i) sum += (double)buf[i] * (double)buf[i];
+
+    if (file != NULL)
+    {
+      if (fwrite(buf, sizeof(float), nsampl, file) != nsampl)
+      {
+	PERROR();
+	goto on_error_3;
+      }
+    }
+
+    nread += (uint64_t)n;
+
+    if (nread >= report)
+    {
+      printf
+      (
+       "%.1f s, %6.1f dBFS, skipped %llu\n",
+       (double)nread / (double)fan.shm->fsampl,
+       10.0 * log10(sum / (double)(fan.shm->fsampl * fan.shm->nchan)),
+       (unsigned long long)fan.slot->nskip
+      );
+      fflush(stdout);
+      sum = 0.0;
+      report += fan.shm->fsampl;
+    }
+
+    if (cmd.lag) usleep(cmd.lag);
+  }
+
+  err = 0;
+
+ on_error_3:
+  if (file != NULL) fclose(file);
+ on_error_2:
+  free(buf);
+ on_error_1:
+  fanout_detach(&fan);
+ on_error_0:
+  return err;
+}
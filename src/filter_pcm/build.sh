@@ -4,5 +4,7 @@ CFLAGS=`sdl2-config --cflags`
 LFLAGS=`sdl2-config --static-libs`
 LFLAGS="$LFLAGS -lasound"
 LFLAGS="$LFLAGS -lfftw3"
+LFLAGS="$LFLAGS -lm"
+LFLAGS="$LFLAGS -lpthread"
 
-gcc -Wall -O2 $CFLAGS main.c $LFLAGS
+gcc -Wall -O2 $CFLAGS -I../pitch -I../trace -I../simd -I../util -I../arena main.c ../pitch/pitch.c ../trace/trace.c ../simd/simd.c ../util/util.c ../arena/arena.c $LFLAGS
@@ -12,6 +12,10 @@
 #include <alsa/asoundlib.h>
 #include <fftw3.h>
 #include <SDL.h>
+#include "pitch.h"
+#include "trace.h"
+#include "simd.h"
+#include "arena.h"
 
 
 #define PERROR(__s) \
@@ -29,6 +33,14 @@ static void on_sigint(int n)
 }
 
 
+static volatile unsigned int is_sigusr1 = 0;
+
+static void on_sigusr1(int n)
+{
+  is_sigusr1 = 1;
+}
+
+
 /* cmdline */
 
 enum cmdline_id
@@ -39,6 +51,8 @@ enum cmdline_id
   CMDLINE_ID_OPCM,
   CMDLINE_ID_DUR,
   CMDLINE_ID_FILT,
+  CMDLINE_ID_PITCH,
+  CMDLINE_ID_TRACE,
   CMDLINE_ID_INVALID = 32
 };
 
@@ -50,6 +64,7 @@ typedef struct
   const char* ipcm;
   const char* opcm;
   unsigned int dur_ms;
+  const char* trace;
 } cmdline_t;
 
 static int get_cmdline(cmdline_t* cmd, int ac, char** av)
@@ -60,6 +75,7 @@ static int get_cmdline(cmdline_t* cmd, int ac, char** av)
   cmd->ipcm = NULL;
   cmd->opcm = NULL;
   cmd->dur_ms = 0;
+  cmd->trace = NULL;
 
   if ((ac % 2)) goto on_error;
 
@@ -89,6 +105,17 @@ static int get_cmdline(cmdline_t* cmd, int ac, char** av)
       if (strcmp(v, "yes") == 0) cmd->flags |= CMDLINE_FLAG(FILT);
       else cmd->flags &= ~CMDLINE_FLAG(FILT);
     }
+    else if (strcmp(k, "-pitch") == 0)
+    {
+      if (strcmp(v, "yes") == 0) cmd->flags |= CMDLINE_FLAG(PITCH);
+      else cmd->flags &= ~CMDLINE_FLAG(PITCH);
+    }
+    else if (strcmp(k, "-trace") == 0)
+    {
+      /* dumped there on SIGUSR1 and at exit */
+      cmd->flags |= CMDLINE_FLAG(TRACE);
+      cmd->trace = v;
+    }
     else goto on_error;
   }
 
@@ -142,6 +169,8 @@ static void pcm_init_desc(pcm_desc_t* desc)
 
 static int pcm_open(pcm_handle_t* pcm, const pcm_desc_t* desc)
 {
+  /* the buffer is taken by pcm_alloc, once the session is sized */
+
   const snd_pcm_format_t fmt = SND_PCM_FORMAT_S16_LE;
   snd_pcm_stream_t stm;
   int err;
@@ -208,8 +237,7 @@ static int pcm_open(pcm_handle_t* pcm, const pcm_desc_t* desc)
   pcm->rpos = 0;
   pcm->wpos = 0;
   pcm->nsampl = (size_t)desc->fsampl * 10;
-  pcm->buf = malloc(pcm->nsampl * pcm->scale);
-  if (pcm->buf == NULL) goto on_error_3;
+  pcm->buf = NULL;
 
   return 0;
 
@@ -225,9 +253,23 @@ static int pcm_open(pcm_handle_t* pcm, const pcm_desc_t* desc)
 }
 
 
+static size_t pcm_get_size(const pcm_handle_t* pcm)
+{
+  return arena_get_size(pcm->nsampl * pcm->scale);
+}
+
+
+static int pcm_alloc(pcm_handle_t* pcm, arena_handle_t* arena)
+{
+  pcm->buf = arena_alloc(arena, pcm->nsampl * pcm->scale);
+  if (pcm->buf == NULL) return -1;
+  return 0;
+}
+
+
 static void pcm_close(pcm_handle_t* pcm)
 {
-  free(pcm->buf);
+  /* the buffer goes with the arena */
   snd_pcm_hw_params_free(pcm->hw_params);
   snd_pcm_sw_params_free(pcm->sw_params);
   snd_pcm_close(pcm->pcm);
@@ -290,39 +332,43 @@ typedef struct
   double* spectrum;
 } mod_handle_t;
 
-static int mod_open(mod_handle_t* mod, size_t n)
+static size_t mod_get_size(size_t n)
+{
+  return
+    arena_get_size((n / 2 + 1) * sizeof(fftw_complex)) +
+    arena_get_size((n / 2 + 1) * sizeof(double));
+}
+
+static int mod_open(mod_handle_t* mod, size_t n, arena_handle_t* arena)
 {
   mod->n = n;
 
-  mod->buf = fftw_malloc((n / 2 + 1) * sizeof(fftw_complex));
+  /* arena blocks are aligned as fftw_malloc ones */
+  mod->buf = arena_alloc(arena, (n / 2 + 1) * sizeof(fftw_complex));
   if (mod->buf == NULL) goto on_error_0;
 
+  mod->spectrum = arena_alloc(arena, (n / 2 + 1) * sizeof(double));
+  if (mod->spectrum == NULL) goto on_error_0;
+
   mod->fplan = fftw_plan_dft_r2c_1d(n, mod->buf, mod->buf, FFTW_ESTIMATE);
-  if (mod->fplan == NULL) goto on_error_1;
+  if (mod->fplan == NULL) goto on_error_0;
 
   mod->bplan = fftw_plan_dft_c2r_1d(n, mod->buf, mod->buf, FFTW_ESTIMATE);
-  if (mod->bplan == NULL) goto on_error_2;
-
-  mod->spectrum = malloc((n / 2 + 1) * sizeof(double));
-  if (mod->spectrum == NULL) goto on_error_3;
+  if (mod->bplan == NULL) goto on_error_1;
 
   return 0;
 
- on_error_3:
-  fftw_destroy_plan(mod->bplan);
- on_error_2:
-  fftw_destroy_plan(mod->fplan);
  on_error_1:
-  fftw_free(mod->buf);
+  fftw_destroy_plan(mod->fplan);
  on_error_0:
   return -1;
 }
 
 static void mod_close(mod_handle_t* mod)
 {
+  /* buffers go with the arena */
   fftw_destroy_plan(mod->bplan);
   fftw_destroy_plan(mod->fplan);
-  fftw_free(mod->buf);
 }
 
 static size_t mod_apply
@@ -347,19 +393,10 @@ static size_t mod_apply
   {
     double sum = 0.0;
 
-    for (i = 0; i != n / 2 + 1; ++i)
-    {
-      const double re = ((fftw_complex*)mod->buf)[i][0];
-      const double im = ((fftw_complex*)mod->buf)[i][1];
-      sum += sqrt(re * re + im * im);
-    }
+    simd_mag(mod->spectrum, (const double*)mod->buf, n / 2 + 1);
 
-    for (i = 0; i != n / 2 + 1; ++i)
-    {
-      const double re = ((fftw_complex*)mod->buf)[i][0];
-      const double im = ((fftw_complex*)mod->buf)[i][1];
-      mod->spectrum[i] = sqrt(re * re + im * im) / sum;
-    }
+    for (i = 0; i != n / 2 + 1; ++i) sum += mod->spectrum[i];
+    for (i = 0; i != n / 2 + 1; ++i) mod->spectrum[i] /= sum;
   }
 
   /* TODO: process mod->buf, fftw_complex format */
@@ -428,6 +465,10 @@ typedef struct
 } ui_desc_t;
 
 
+/* f0 track range, log scale */
+#define UI_F0_MIN 60.0
+#define UI_F0_MAX 1500.0
+
 typedef struct
 {
   SDL_Window* win;
@@ -436,6 +477,12 @@ typedef struct
   uint8_t* buf;
   unsigned int w;
   unsigned int h;
+
+  /* f0 track, one column per hop, scrolling */
+  double* f0;
+  size_t f0_pos;
+  double fmin;
+  double fmax;
 } ui_handle_t;
 
 
@@ -446,7 +493,16 @@ static void ui_init_desc(ui_desc_t* desc)
 }
 
 
-static int ui_open(ui_handle_t* ui, const ui_desc_t* desc)
+static size_t ui_get_size(const ui_desc_t* desc)
+{
+  return
+    arena_get_size(desc->w * desc->h * sizeof(Uint32)) +
+    arena_get_size(desc->w * sizeof(double));
+}
+
+
+static int ui_open
+(ui_handle_t* ui, const ui_desc_t* desc, arena_handle_t* arena)
 {
   if (SDL_Init(SDL_INIT_VIDEO)) goto on_error_0;
 
@@ -476,9 +532,16 @@ static int ui_open(ui_handle_t* ui, const ui_desc_t* desc)
   );
   if (ui->tex == NULL) goto on_error_3;
 
-  ui->buf = malloc(desc->w * desc->h * sizeof(Uint32));
+  /* zeroed by the arena */
+  ui->buf = arena_alloc(arena, desc->w * desc->h * sizeof(Uint32));
   if (ui->buf == NULL) goto on_error_4;
 
+  ui->f0 = arena_alloc(arena, desc->w * sizeof(double));
+  if (ui->f0 == NULL) goto on_error_4;
+  ui->f0_pos = 0;
+  ui->fmin = UI_F0_MIN;
+  ui->fmax = UI_F0_MAX;
+
   ui->w = desc->w;
   ui->h = desc->h;
 
@@ -497,17 +560,9 @@ static int ui_open(ui_handle_t* ui, const ui_desc_t* desc)
 }
 
 
-static int ui_open_default(ui_handle_t* ui)
-{
-  ui_desc_t desc;
-  ui_init_desc(&desc);
-  return ui_open(ui, &desc);
-}
-
-
 static void ui_close(ui_handle_t* ui)
 {
-  free(ui->buf);
+  /* buffers go with the arena */
   SDL_DestroyTexture(ui->tex);
   SDL_DestroyRenderer(ui->ren);
   SDL_DestroyWindow(ui->win);
@@ -542,6 +597,34 @@ static void ui_draw_bar
 }
 
 
+static void ui_push_f0(ui_handle_t* ui, double f0)
+{
+  ui->f0[ui->f0_pos] = f0;
+  ui->f0_pos = (ui->f0_pos + 1) % ui->w;
+}
+
+
+static void ui_draw_f0(ui_handle_t* ui)
+{
+  /* oldest on the left, unvoiced hops are not drawn */
+
+  const double scale = (double)(ui->h - 2) / log(ui->fmax / ui->fmin);
+  unsigned int x;
+  unsigned int y;
+
+  for (x = 0; x != ui->w; ++x)
+  {
+    const double f0 = ui->f0[(ui->f0_pos + x) % ui->w];
+
+    if ((f0 < ui->fmin) || (f0 > ui->fmax)) continue ;
+
+    y = ui->h - 2 - (unsigned int)(log(f0 / ui->fmin) * scale);
+    ui_put_pixel(ui, x, y + 0, 0x0000ff00);
+    ui_put_pixel(ui, x, y + 1, 0x0000ff00);
+  }
+}
+
+
 static int ui_handle_events
 (ui_handle_t* ui, const double* spectrum, size_t n)
 {
@@ -563,12 +646,16 @@ static int ui_handle_events
 
   ui_clear_buf(ui);
 
+  if (n > ui->w) n = ui->w;
+
   for (i = 0; i != n; ++i)
   {
     const double x = spectrum[i] * (double)ui->h;
     ui_draw_bar(ui, i, (unsigned int)x, 1);
   }
 
+  ui_draw_f0(ui);
+
   SDL_RenderClear(ui->ren);
   SDL_UpdateTexture(ui->tex, NULL, ui->buf, ui->w * sizeof(Uint32));
   SDL_RenderCopy(ui->ren, ui->tex, NULL, NULL);
@@ -580,13 +667,21 @@ static int ui_handle_events
 
 /* main */
 
+/* 11.6 ms at 44.1 kHz */
+#define PITCH_HOP 512
+#define PITCH_MAX_PER_READ 8
+
 int main(int ac, char** av)
 {
   pcm_desc_t desc;
   pcm_handle_t ipcm;
   pcm_handle_t opcm;
   mod_handle_t mod;
+  ui_desc_t ui_desc;
   ui_handle_t ui;
+  arena_handle_t arena;
+  pitch_handle_t pitch;
+  double f0[PITCH_MAX_PER_READ];
   int err;
   cmdline_t cmd;
   size_t i;
@@ -595,24 +690,55 @@ int main(int ac, char** av)
 
   if (get_cmdline(&cmd, ac - 1, av + 1)) goto on_error_0;
 
+  if (cmd.flags & CMDLINE_FLAG(TRACE))
+  {
+    if (trace_init()) goto on_error_0;
+    trace_attach("main");
+  }
+
   pcm_init_desc(&desc);
   desc.flags |= PCM_FLAG_IN;
   if (cmd.flags & CMDLINE_FLAG(IPCM)) desc.name = cmd.ipcm;
-  if (pcm_open(&ipcm, &desc)) goto on_error_0;
+  if (pcm_open(&ipcm, &desc)) goto on_error_1;
 
   pcm_init_desc(&desc);
   desc.flags |= PCM_FLAG_OUT;
   if (cmd.flags & CMDLINE_FLAG(OPCM)) desc.name = cmd.opcm;
-  if (pcm_open(&opcm, &desc)) goto on_error_1;
+  if (pcm_open(&opcm, &desc)) goto on_error_2;
 
-  if (mod_open(&mod, 1024)) goto on_error_2;
+  /* buffers of the session, sized up front */
 
-  if (ui_open_default(&ui)) goto on_error_3;
+  ui_init_desc(&ui_desc);
 
-  if (pcm_start(&ipcm)) goto on_error_4;
-  if (pcm_start(&opcm)) goto on_error_4;
+  if (arena_init
+      (
+       &arena,
+       pcm_get_size(&ipcm) + pcm_get_size(&opcm) +
+       mod_get_size(1024) + ui_get_size(&ui_desc)
+      ))
+    PERROR_GOTO("arena", on_error_3);
+
+  if (pcm_alloc(&ipcm, &arena)) goto on_error_4;
+  if (pcm_alloc(&opcm, &arena)) goto on_error_4;
+
+  if (mod_open(&mod, 1024, &arena)) goto on_error_4;
+
+  if (ui_open(&ui, &ui_desc, &arena)) goto on_error_5;
+
+  if (cmd.flags & CMDLINE_FLAG(PITCH))
+  {
+    if (pitch_init(&pitch, desc.fsampl, UI_F0_MIN, UI_F0_MAX, PITCH_HOP))
+      goto on_error_6;
+  }
+
+  if (pcm_start(&ipcm)) goto on_error_7;
+  if (pcm_start(&opcm)) goto on_error_7;
 
   signal(SIGINT, on_sigint);
+  signal(SIGUSR1, on_sigusr1);
+
+  /* the loop allocates nothing, but the trace snapshot */
+  arena_enter_rt();
 
   for (i = 0; is_sigint == 0; i += 1)
   {
@@ -620,10 +746,21 @@ int main(int ac, char** av)
     size_t navail;
     size_t off;
 
+    if (is_sigusr1)
+    {
+      is_sigusr1 = 0;
+      arena_leave_rt();
+      if (cmd.flags & CMDLINE_FLAG(TRACE)) trace_dump(cmd.trace);
+      arena_enter_rt();
+    }
+
     /* read ipcm */
 
+    trace_begin("wait");
     err = snd_pcm_wait(ipcm.pcm, -1);
+    trace_end("wait");
     if (is_sigint) break ;
+    if (err == -EINTR) continue ;
     if (err < 0) goto on_ipcm_xrun;
 
     navail = (size_t)snd_pcm_avail_update(ipcm.pcm);
@@ -633,12 +770,41 @@ int main(int ac, char** av)
     if (nsampl > navail) nsampl = navail;
 
     off = ipcm.wpos * ipcm.scale;
+    trace_begin("read");
     err = snd_pcm_readi(ipcm.pcm, ipcm.buf + off, nsampl);
+    trace_end("read");
     if (err < 0) goto on_ipcm_xrun;
 
     ipcm.wpos += (size_t)err;
     if (ipcm.wpos == ipcm.nsampl) ipcm.wpos = 0;
 
+    /* pitch, at most PITCH_MAX_PER_READ hops per read */
+
+    if (cmd.flags & CMDLINE_FLAG(PITCH))
+    {
+      size_t n;
+      size_t j;
+
+      trace_begin("pitch");
+      n = pitch_add_int16
+      (
+       &pitch, (const int16_t*)(ipcm.buf + off), (size_t)err, ipcm.nchan,
+       f0, PITCH_MAX_PER_READ
+      );
+      trace_end("pitch");
+
+      for (j = 0; j != n; ++j) ui_push_f0(&ui, f0[j]);
+
+      /* otherwise the ui is refreshed with the spectrum */
+      if (n && ((cmd.flags & CMDLINE_FLAG(FILT)) == 0))
+      {
+	trace_begin("ui");
+	err = ui_handle_events(&ui, NULL, 0);
+	trace_end("ui");
+	if (err) break ;
+      }
+    }
+
     /* apply modifier */
 
   redo_mod:
@@ -647,11 +813,19 @@ int main(int ac, char** av)
 
     if (cmd.flags & CMDLINE_FLAG(FILT))
     {
-      const size_t n = mod_apply(&mod, ipcm.buf, ipcm.nsampl, ipcm.rpos, nsampl);
+      size_t n;
+
+      trace_begin("fft");
+      n = mod_apply(&mod, ipcm.buf, ipcm.nsampl, ipcm.rpos, nsampl);
+      trace_end("fft");
+
       nsampl = n;
       if (nsampl)
       {
-	if (ui_handle_events(&ui, mod.spectrum, mod.n / 2 + 1)) break ;
+	trace_begin("ui");
+	err = ui_handle_events(&ui, mod.spectrum, mod.n / 2 + 1);
+	trace_end("ui");
+	if (err) break ;
       }
     }
 
@@ -661,14 +835,18 @@ int main(int ac, char** av)
     {
       const size_t n = ipcm.nsampl - ipcm.rpos;
       off = ipcm.rpos * ipcm.scale;
+      trace_begin("write");
       err = snd_pcm_writei(opcm.pcm, ipcm.buf + off, n);
+      trace_end("write");
       if (err < 0) goto on_opcm_xrun;
       nsampl -= n;
       ipcm.rpos = 0;
     }
 
     off = ipcm.rpos * ipcm.scale;
+    trace_begin("write");
     err = snd_pcm_writei(opcm.pcm, ipcm.buf + off, nsampl);
+    trace_end("write");
     if (err < 0) goto on_opcm_xrun;
     ipcm.rpos += nsampl;
     if (ipcm.rpos == ipcm.nsampl) ipcm.rpos = 0;
@@ -678,24 +856,52 @@ int main(int ac, char** av)
     continue ;
 
   on_ipcm_xrun:
-    if (pcm_recover_xrun(&ipcm, err)) PERROR_GOTO("", on_error_4);
+    trace_mark("xrun", 0);
+    if (pcm_recover_xrun(&ipcm, err)) PERROR_GOTO("", on_error_7);
     continue ;
 
   on_opcm_xrun:
-    if (pcm_recover_xrun(&opcm, err)) PERROR_GOTO("", on_error_4);
+    trace_mark("xrun", 1);
+    if (pcm_recover_xrun(&opcm, err)) PERROR_GOTO("", on_error_7);
     continue ;
   }
 
   err = 0;
 
- on_error_4:
+ on_error_7:
+  arena_leave_rt();
+  if (cmd.flags & CMDLINE_FLAG(PITCH))
+  {
+    if (pitch.nhop)
+    {
+      printf
+      (
+       "pitch: %llu hops, mean %.1f us, max %.1f us, %llu over %.1f us\n",
+       (unsigned long long)pitch.nhop,
+       (pitch.time_sum * 1000000.0) / (double)pitch.nhop,
+       pitch.time_max * 1000000.0,
+       (unsigned long long)pitch.nover, pitch.budget * 1000000.0
+      );
+    }
+
+    pitch_fini(&pitch);
+  }
+ on_error_6:
   ui_close(&ui);
- on_error_3:
+ on_error_5:
   mod_close(&mod);
- on_error_2:
+ on_error_4:
+  arena_fini(&arena);
+ on_error_3:
   pcm_close(&opcm);
- on_error_1:
+ on_error_2:
   pcm_close(&ipcm);
+ on_error_1:
+  if (cmd.flags & CMDLINE_FLAG(TRACE))
+  {
+    trace_dump(cmd.trace);
+    trace_fini();
+  }
  on_error_0:
   return err;
 }
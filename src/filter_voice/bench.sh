@@ -0,0 +1,22 @@
+#!/usr/bin/env sh
+
+# time each -io mode on a cold page cache: ./bench.sh big.wav [args]
+# the input pages are evicted before each run, the output removed.
+
+[ -f "$1" ] || { echo "usage: $0 path.wav [args]"; exit 1; }
+ipath=$1
+shift
+opath=${TMPDIR:-/tmp}/filter_voice_bench.wav
+
+for io in mmap pread uring; do
+  rm -f $opath
+  sync
+  dd if=$ipath iflag=nocache count=0 status=none
+  t0=`date +%s.%N`
+  ./a.out -ipath $ipath -opath $opath -io $io "$@" || exit 1
+  sync
+  t1=`date +%s.%N`
+  awk "BEGIN { printf \"$io: %.3f s\\n\", $t1 - $t0 }"
+done
+
+rm -f $opath
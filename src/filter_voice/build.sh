@@ -1,2 +1,2 @@
 #!/usr/bin/env sh
-gcc -Wall -O2 -I../wav main.c ../wav/wav.c -lm -lfftw3
+gcc -Wall -O2 -I../wav -I../resampl -I../util main.c ../wav/wav.c ../wav/wav_io.c ../resampl/resampl.c ../util/util.c -lm -lfftw3 -lpthread
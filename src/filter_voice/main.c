@@ -2,15 +2,28 @@
 #include <stdint.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <fftw3.h>
 #include "wav.h"
+#include "wav_io.h"
+#include "resampl.h"
+#include "util.h"
 
 
 #if 1
 #include <stdio.h>
+/* stdout may carry the samples */
 #define PERROR() \
- do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+ do { fprintf(stderr, "[!] %s,%u\n", __FILE__, __LINE__); } while(0)
 #else
 #define PERROR()
 #endif
@@ -23,11 +36,40 @@ typedef struct
 {
 #define CMD_FLAG_IPATH (1 << 0)
 #define CMD_FLAG_OPATH (1 << 1)
+#define CMD_FLAG_VAD_REPORT (1 << 2)
+#define CMD_FLAG_IRAW (1 << 3)
+#define CMD_FLAG_ORAW (1 << 4)
+#define CMD_FLAG_OFORMAT (1 << 5)
+#define CMD_FLAG_BATCH (1 << 6)
   uint32_t flags;
   const char* ipath;
   const char* opath;
   size_t nband;
   double bands[32 * 2];
+#define VAD_MODE_NONE 0
+#define VAD_MODE_ZERO 1
+#define VAD_MODE_PASS 2
+  unsigned int vad_mode;
+  double vad_thresh;
+  /* raw input format */
+  size_t nchan;
+  unsigned int fsampl;
+  /* output rate, 0 to keep the input one */
+  unsigned int orate;
+  /* manifest or directory */
+  const char* batch;
+  const char* odir;
+  const char* journal;
+  size_t njob;
+  char journal_buf[PATH_MAX];
+  /* file access: mapped whole, or blocks queued by wav_io */
+#define CMD_IO_MMAP 0
+#define CMD_IO_URING 1
+#define CMD_IO_PREAD 2
+  unsigned int io;
+  /* stft cache directory, and its size in bytes */
+  const char* cache;
+  size_t cache_max;
 } cmd_handle_t;
 
 static int cmd_parse_band(const char* s, double* lo, double* hi)
@@ -64,6 +106,18 @@ static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
   cmd->ipath = NULL;
   cmd->opath = NULL;
   cmd->nband = 0;
+  cmd->vad_mode = VAD_MODE_NONE;
+  cmd->vad_thresh = -50.0;
+  cmd->nchan = 1;
+  cmd->fsampl = 44100;
+  cmd->orate = 0;
+  cmd->batch = NULL;
+  cmd->odir = NULL;
+  cmd->journal = NULL;
+  cmd->njob = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+  cmd->io = CMD_IO_MMAP;
+  cmd->cache = NULL;
+  cmd->cache_max = (size_t)4 << 30;
 
   if ((ac % 2)) goto on_error;
 
@@ -97,15 +151,585 @@ static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
 
       ++cmd->nband;
     }
+    else if (strcmp(k, "-vad") == 0)
+    {
+      if (strcmp(v, "no") == 0) cmd->vad_mode = VAD_MODE_NONE;
+      else if (strcmp(v, "zero") == 0) cmd->vad_mode = VAD_MODE_ZERO;
+      else if (strcmp(v, "pass") == 0) cmd->vad_mode = VAD_MODE_PASS;
+      else goto on_error;
+    }
+    else if (strcmp(k, "-vad_thresh") == 0)
+    {
+      /* dBFS */
+      cmd->vad_thresh = strtod(v, NULL);
+      if (cmd->vad_thresh >= 0.0) goto on_error;
+    }
+    else if (strcmp(k, "-vad_report") == 0)
+    {
+      if (strcmp(v, "yes") == 0) cmd->flags |= CMD_FLAG_VAD_REPORT;
+      else cmd->flags &= ~CMD_FLAG_VAD_REPORT;
+    }
+    else if (strcmp(k, "-iformat") == 0)
+    {
+      if (strcmp(v, "wav") == 0) cmd->flags &= ~CMD_FLAG_IRAW;
+      else if (strcmp(v, "raw") == 0) cmd->flags |= CMD_FLAG_IRAW;
+      else goto on_error;
+    }
+    else if (strcmp(k, "-oformat") == 0)
+    {
+      cmd->flags |= CMD_FLAG_OFORMAT;
+      if (strcmp(v, "wav") == 0) cmd->flags &= ~CMD_FLAG_ORAW;
+      else if (strcmp(v, "raw") == 0) cmd->flags |= CMD_FLAG_ORAW;
+      else goto on_error;
+    }
+    else if (strcmp(k, "-nchan") == 0)
+    {
+      cmd->nchan = (size_t)strtoul(v, NULL, 10);
+      if (cmd->nchan == 0) goto on_error;
+    }
+    else if (strcmp(k, "-fsampl") == 0)
+    {
+      cmd->fsampl = (unsigned int)strtoul(v, NULL, 10);
+      if (cmd->fsampl == 0) goto on_error;
+    }
+    else if (strcmp(k, "-io") == 0)
+    {
+      if (strcmp(v, "mmap") == 0) cmd->io = CMD_IO_MMAP;
+      else if (strcmp(v, "uring") == 0) cmd->io = CMD_IO_URING;
+      else if (strcmp(v, "pread") == 0) cmd->io = CMD_IO_PREAD;
+      else goto on_error;
+    }
+    else if (strcmp(k, "-cache") == 0)
+    {
+      cmd->cache = v;
+    }
+    else if (strcmp(k, "-cache_max") == 0)
+    {
+      /* in MB */
+      cmd->cache_max = (size_t)strtoul(v, NULL, 10) << 20;
+    }
+    else if (strcmp(k, "-orate") == 0)
+    {
+      cmd->orate = (unsigned int)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-batch") == 0)
+    {
+      cmd->flags |= CMD_FLAG_BATCH;
+      cmd->batch = v;
+    }
+    else if (strcmp(k, "-odir") == 0)
+    {
+      cmd->odir = v;
+    }
+    else if (strcmp(k, "-journal") == 0)
+    {
+      cmd->journal = v;
+    }
+    else if (strcmp(k, "-njob") == 0)
+    {
+      cmd->njob = (size_t)strtoul(v, NULL, 10);
+    }
     else goto on_error;
   }
 
+  if (cmd->njob == 0) cmd->njob = 1;
+
+  if ((cmd->flags & CMD_FLAG_BATCH) && (cmd->journal == NULL))
+  {
+    /* next to the outputs, or to the manifest */
+    const char* const dir = cmd->odir ? cmd->odir : cmd->batch;
+    if (cmd->odir == NULL)
+      snprintf(cmd->journal_buf, sizeof(cmd->journal_buf), "%s.journal", dir);
+    else
+      snprintf(cmd->journal_buf, sizeof(cmd->journal_buf), "%s/journal", dir);
+    cmd->journal = cmd->journal_buf;
+  }
+
+  /* output format follows the input one by default */
+  if ((cmd->flags & CMD_FLAG_OFORMAT) == 0)
+  {
+    if (cmd->flags & CMD_FLAG_IRAW) cmd->flags |= CMD_FLAG_ORAW;
+  }
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* voice activity detection */
+
+/* a cheap pre-pass over the int16 samples marks the chunks holding */
+/* no voice, so that the filter can skip their forward and inverse */
+/* transforms. a chunk is silent if its energy is below the threshold, */
+/* or if it is barely above it but crosses zero as often as a broadband */
+/* noise does. voiced marks are then dilated by one chunk on each side, */
+/* so that onsets and tails straddling a chunk boundary are kept. */
+
+typedef struct
+{
+  unsigned int mode;
+  double thresh;
+
+  size_t n;
+  size_t nchan;
+  size_t nchunk;
+  size_t nvoiced;
+
+  /* nchan * nchunk entries, non zero if voiced */
+  uint8_t* map;
+
+  double mark_time;
+  double filter_time;
+
+} vad_handle_t;
+
+static int vad_init
+(
+ vad_handle_t* vad,
+ unsigned int mode, double thresh,
+ size_t nchan, size_t nsampl, size_t n
+)
+{
+  vad->mode = mode;
+  vad->thresh = thresh;
+  vad->n = n;
+  vad->nchan = nchan;
+  vad->nchunk = 0;
+  vad->nvoiced = 0;
+  vad->mark_time = 0.0;
+  vad->filter_time = 0.0;
+  vad->map = NULL;
+
+  /* streams are marked as they come, without map */
+  if (nsampl == WAV_NSAMPL_STREAM) return 0;
+
+  vad->nchunk = (nsampl + n - 1) / n;
+  vad->map = malloc(nchan * vad->nchunk + 1);
+  if (vad->map == NULL) return -1;
+
+  return 0;
+}
+
+static void vad_fini(vad_handle_t* vad)
+{
+  free(vad->map);
+}
+
+static unsigned int vad_is_voiced
+(const int16_t* buf, size_t n, size_t w, double thresh)
+{
+  /* zero crossing rate above which a low level chunk is seen as noise */
+  static const double zcr_noise = 0.25;
+  /* margin above thresh in which the zero crossing rate is considered */
+  static const double zcr_margin = 10.0;
+
+  double sum;
+  double db;
+  size_t nzc;
+  size_t i;
+
+  if (n == 0) return 0;
+
+  sum = 0.0;
+  nzc = 0;
+
+  for (i = 0; i != n; ++i, buf += w)
+  {
+    const double x = (double)buf[0];
+    sum += x * x;
+    if ((i != 0) && ((buf[0] ^ buf[-(ssize_t)w]) < 0)) ++nzc;
+  }
+
+  if (sum == 0.0) return 0;
+
+  db = 10.0 * log10(sum / ((double)n * 32768.0 * 32768.0));
+
+  if (db < thresh) return 0;
+
+  if (db < (thresh + zcr_margin))
+  {
+    if (((double)nzc / (double)n) > zcr_noise) return 0;
+  }
+
+  return 1;
+}
+
+static void vad_mark
+(vad_handle_t* vad, const uint8_t* ibuf, size_t nsampl, size_t wsampl)
+{
+  const size_t w = vad->n * vad->nchan * wsampl;
+  const double t = util_get_time();
+  uint8_t* map;
+  size_t i;
+  size_t j;
+
+  vad->nvoiced = 0;
+
+  for (i = 0; i != vad->nchan; ++i, ibuf += wsampl)
+  {
+    const uint8_t* p = ibuf;
+
+    map = vad->map + i * vad->nchunk;
+
+    for (j = 0; j != vad->nchunk; ++j, p += w)
+    {
+      size_t r = nsampl - j * vad->n;
+      if (r > vad->n) r = vad->n;
+      map[j] = vad_is_voiced
+	((const int16_t*)p, r, vad->nchan, vad->thresh) ? 2 : 0;
+    }
+
+    /* dilate, 2 marks a chunk voiced by itself, 1 by a neighbor */
+
+    for (j = 0; j != vad->nchunk; ++j)
+    {
+      if (map[j] != 2) continue ;
+      if ((j != 0) && (map[j - 1] == 0)) map[j - 1] = 1;
+      if (((j + 1) != vad->nchunk) && (map[j + 1] == 0)) map[j + 1] = 1;
+    }
+
+    for (j = 0; j != vad->nchunk; ++j) if (map[j]) ++vad->nvoiced;
+  }
+
+  vad->mark_time = util_get_time() - t;
+}
+
+static void vad_report(const vad_handle_t* vad, FILE* file)
+{
+  static const size_t width = 64;
+
+  const size_t ntotal = vad->nchan * vad->nchunk;
+  double chunk_time;
+  double full_time;
+  size_t i;
+  size_t j;
+
+  fprintf
+  (
+   file,
+   "vad: %zu samples per chunk, '#' voiced, '.' silent\n", vad->n
+  );
+
+  /* streams keep no map */
+
+  for (i = 0; (vad->map != NULL) && (i != vad->nchan); ++i)
+  {
+    const uint8_t* const map = vad->map + i * vad->nchunk;
+
+    for (j = 0; j != vad->nchunk; ++j)
+    {
+      if ((j % width) == 0) fprintf(file, "vad: chan %zu @%08zu ", i, j);
+      fprintf(file, "%c", map[j] ? '#' : '.');
+      if ((((j + 1) % width) == 0) || ((j + 1) == vad->nchunk))
+	fprintf(file, "\n");
+    }
+  }
+
+  fprintf
+  (
+   file,
+   "vad: %zu / %zu chunks voiced (%.1f%%)\n",
+   vad->nvoiced, ntotal,
+   ntotal ? (100.0 * (double)vad->nvoiced) / (double)ntotal : 0.0
+  );
+
+  /* the cost of a full run is extrapolated from the transformed chunks */
+
+  if (vad->nvoiced)
+  {
+    chunk_time = vad->filter_time / (double)vad->nvoiced;
+    full_time = chunk_time * (double)ntotal;
+
+    fprintf
+    (
+     file,
+     "vad: pre-pass %.3f s, filter %.3f s, without vad ~%.3f s, speedup ~%.2fx\n",
+     vad->mark_time, vad->filter_time, full_time,
+     full_time / (vad->mark_time + vad->filter_time)
+    );
+  }
+  else
+  {
+    fprintf
+    (
+     file,
+     "vad: pre-pass %.3f s, filter %.3f s, no chunk transformed\n",
+     vad->mark_time, vad->filter_time
+    );
+  }
+
+  fflush(file);
+}
+
+
+/* stft cache */
+
+/* tuning the bands means filtering the same file again and again, the */
+/* forward transforms being the same each time. with -cache, they are */
+/* kept in a sidecar file per input and transform size, mapped shared: */
+/* a chunk is transformed once by whatever run first needs it, later */
+/* runs only apply their mask and the inverse transform. the sidecar */
+/* is named by a hash of the samples, so that a modified file misses. */
+/* sidecars are created sparse, at their full size. the least recently */
+/* used ones are removed until the new one fits in -cache_max. */
+
+#define CACHE_MAGIC "FVSTFT01"
+#define CACHE_ALIGN 4096
+
+typedef struct
+{
+  uint8_t magic[8];
+  uint64_t hash;
+  uint64_t n;
+  uint64_t nchan;
+  uint64_t nsampl;
+  uint64_t fsampl;
+} cache_header_t;
+
+typedef struct
+{
+  int fd;
+  uint8_t* map;
+  size_t size;
+
+  size_t nchunk;
+  size_t nbin;
+
+  /* per chan, then per chunk */
+  uint8_t* valid;
+  fftw_complex* spec;
+
+} cache_handle_t;
+
+typedef struct
+{
+  time_t mtime;
+  off_t size;
+  char* path;
+} cache_entry_t;
+
+static uint64_t cache_hash(const wav_handle_t* w, size_t n)
+{
+  /* multiply rotate over words, fast enough to be hidden by the mmap */
+  /* page faults. the format is hashed too. */
+
+  static const uint64_t k = 0x9e3779b97f4a7c15ULL;
+  const uint8_t* p = wav_get_sampl_buf((wav_handle_t*)w);
+  const size_t size = w->nsampl * w->nchan * w->wsampl;
+  uint64_t h = k ^ (uint64_t)n;
+  uint64_t x;
+  size_t i;
+
+  h = (h ^ w->nchan) * k;
+  h = (h ^ w->nsampl) * k;
+  h = (h ^ w->fsampl) * k;
+
+  for (i = 0; (i + 8) <= size; i += 8)
+  {
+    memcpy(&x, p + i, sizeof(x));
+    h = (h ^ x) * k;
+    h ^= h >> 29;
+  }
+
+  for (; i != size; ++i)
+  {
+    h = (h ^ p[i]) * k;
+    h ^= h >> 29;
+  }
+
+  return h;
+}
+
+static int cache_cmp_entry(const void* a, const void* b)
+{
+  const cache_entry_t* const x = a;
+  const cache_entry_t* const y = b;
+  if (x->mtime < y->mtime) return -1;
+  if (x->mtime > y->mtime) return 1;
   return 0;
+}
+
+static int cache_evict(const char* dir, size_t size, size_t max)
+{
+  /* remove the oldest sidecars until size more bytes fit in max */
+
+  cache_entry_t* entries = NULL;
+  cache_entry_t* tmp;
+  size_t nentry = 0;
+  size_t maxentry = 0;
+  size_t total = 0;
+  struct dirent* de;
+  struct stat st;
+  char* path;
+  size_t len;
+  size_t i;
+  DIR* d;
+  int err = -1;
+
+  if (size > max) return -1;
+
+  d = opendir(dir);
+  if (d == NULL) return -1;
+
+  while ((de = readdir(d)) != NULL)
+  {
+    len = strlen(de->d_name);
+    if ((len < 5) || strcmp(de->d_name + len - 5, ".stft")) continue ;
+
+    path = malloc(strlen(dir) + 1 + len + 1);
+    if (path == NULL) goto on_error;
+    sprintf(path, "%s/%s", dir, de->d_name);
+
+    if (stat(path, &st))
+    {
+      free(path);
+      continue ;
+    }
+
+    if (nentry == maxentry)
+    {
+      maxentry = maxentry ? maxentry * 2 : 64;
+      tmp = realloc(entries, maxentry * sizeof(cache_entry_t));
+      if (tmp == NULL)
+      {
+	free(path);
+	goto on_error;
+      }
+      entries = tmp;
+    }
+
+    entries[nentry].mtime = st.st_mtime;
+    entries[nentry].size = st.st_size;
+    entries[nentry].path = path;
+    ++nentry;
+    total += (size_t)st.st_size;
+  }
+
+  qsort(entries, nentry, sizeof(cache_entry_t), cache_cmp_entry);
+
+  for (i = 0; (i != nentry) && ((total + size) > max); ++i)
+  {
+    if (unlink(entries[i].path) == 0) total -= (size_t)entries[i].size;
+  }
+
+  if ((total + size) <= max) err = 0;
 
  on_error:
+  for (i = 0; i != nentry; ++i) free(entries[i].path);
+  free(entries);
+  closedir(d);
+  return err;
+}
+
+static int cache_create
+(const char* path, size_t size, const cache_header_t* h)
+{
+  /* built aside then renamed, concurrent runs see a whole header */
+
+  char tmp[PATH_MAX + 16];
+  int fd;
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+  fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 00644);
+  if (fd == -1) goto on_error_0;
+
+  if (ftruncate(fd, (off_t)size)) goto on_error_1;
+  if (pwrite(fd, h, sizeof(*h), 0) != (ssize_t)sizeof(*h)) goto on_error_1;
+  if (rename(tmp, path)) goto on_error_1;
+
+  return fd;
+
+ on_error_1:
+  close(fd);
+  unlink(tmp);
+ on_error_0:
+  return -1;
+}
+
+static int cache_open
+(
+ cache_handle_t* c,
+ const char* dir, size_t max,
+ const wav_handle_t* w, size_t n
+)
+{
+  cache_header_t h;
+  char path[PATH_MAX];
+  struct stat st;
+  size_t soff;
+
+  c->nchunk = (w->nsampl + n - 1) / n;
+  c->nbin = n / 2 + 1;
+
+  soff = CACHE_ALIGN + w->nchan * c->nchunk;
+  soff = (soff + CACHE_ALIGN - 1) & ~(size_t)(CACHE_ALIGN - 1);
+  c->size = soff + w->nchan * c->nchunk * c->nbin * sizeof(fftw_complex);
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+  h.hash = cache_hash(w, n);
+  h.n = (uint64_t)n;
+  h.nchan = (uint64_t)w->nchan;
+  h.nsampl = (uint64_t)w->nsampl;
+  h.fsampl = (uint64_t)w->fsampl;
+
+  snprintf
+  (
+   path, sizeof(path), "%s/%016llx-%zu.stft",
+   dir, (unsigned long long)h.hash, n
+  );
+
+  c->fd = open(path, O_RDWR);
+  if (c->fd != -1)
+  {
+    cache_header_t x;
+
+    /* a hash collision or a truncated file is replaced */
+    if (fstat(c->fd, &st) || ((size_t)st.st_size != c->size) ||
+	(pread(c->fd, &x, sizeof(x), 0) != (ssize_t)sizeof(x)) ||
+	memcmp(&x, &h, sizeof(x)))
+    {
+      close(c->fd);
+      c->fd = -1;
+      unlink(path);
+    }
+  }
+
+  if (c->fd == -1)
+  {
+    if (cache_evict(dir, c->size, max)) goto on_error_0;
+    c->fd = cache_create(path, c->size, &h);
+    if (c->fd == -1) goto on_error_0;
+  }
+
+  c->map = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+  if (c->map == MAP_FAILED) goto on_error_1;
+
+  madvise(c->map, c->size, MADV_SEQUENTIAL);
+
+  c->valid = c->map + CACHE_ALIGN;
+  c->spec = (fftw_complex*)(c->map + soff);
+
+  /* recently used, for eviction */
+  futimens(c->fd, NULL);
+
+  return 0;
+
+ on_error_1:
+  close(c->fd);
+ on_error_0:
   return -1;
 }
 
+static void cache_close(cache_handle_t* c)
+{
+  munmap(c->map, c->size);
+  close(c->fd);
+}
+
 
 /* filter */
 
@@ -115,16 +739,38 @@ typedef struct
   fftw_plan fplan;
   fftw_plan bplan;
   size_t n;
+  double fsampl;
 
   const double* bands;
   size_t nband;
 
+  /* forward transforms of the current chan, if cached */
+  fftw_complex* spec;
+  uint8_t* spec_valid;
+
 } filter_handle_t;
 
+static size_t filter_get_nsampl(unsigned int fsampl)
+{
+  /* resolution: 5 Hz */
+  /* fres = fsampl / (nsampl * 2) */
+  /* nsampl = fsampl / (5 * 2), 4410 at 44100 Hz */
+  /* thus, the next power of 2: 8192 at 44100 or 48000 Hz */
+
+  size_t n;
+  for (n = 1; n < ((size_t)fsampl / 10); n *= 2) ;
+  return n;
+}
+
 static int filter_init
-(filter_handle_t* f, size_t n, const double* bands, size_t nband)
+(
+ filter_handle_t* f,
+ size_t n, unsigned int fsampl,
+ const double* bands, size_t nband
+)
 {
   f->n = n;
+  f->fsampl = (double)fsampl;
 
   f->buf = fftw_malloc((n / 2 + 1) * sizeof(fftw_complex));
   if (f->buf == NULL) goto on_error_0;
@@ -138,6 +784,9 @@ static int filter_init
   f->bands = bands;
   f->nband = nband;
 
+  f->spec = NULL;
+  f->spec_valid = NULL;
+
   return 0;
 
  on_error_2:
@@ -171,7 +820,9 @@ static void double_to_int16
 
 static void filter_one_chunk(filter_handle_t* f)
 {
-  static const double fsampl = 44100;
+  /* f->buf holds the forward transform */
+
+  const double fsampl = f->fsampl;
 #if 0
   static const double flo = 200.0;
   static const double fhi = 1000.0;
@@ -182,8 +833,6 @@ static void filter_one_chunk(filter_handle_t* f)
   size_t i;
   size_t j;
 
-  fftw_execute(f->fplan);
-
 #if 0
   for (i = 0; i != ilo; ++i)
   {
@@ -220,35 +869,71 @@ static void filter_one_chunk(filter_handle_t* f)
   for (i = 0; i != f->n; ++i) ((double*)f->buf)[i] /= f->n;
 }
 
+static void copy_int16
+(int16_t* obuf, const int16_t* ibuf, size_t n, size_t w)
+{
+  size_t i;
+  for (i = 0; i != n; ++i, ibuf += w, obuf += w) *obuf = *ibuf;
+}
+
+static void zero_int16(int16_t* obuf, size_t n, size_t w)
+{
+  size_t i;
+  for (i = 0; i != n; ++i, obuf += w) *obuf = 0;
+}
+
 static void filter_one_chan
 (
  filter_handle_t* f,
  uint8_t* obuf, const uint8_t* ibuf,
- size_t nchan, size_t nsampl, size_t wsampl
+ size_t nchan, size_t nsampl, size_t wsampl,
+ const uint8_t* vad_map, unsigned int vad_mode
 )
 {
-  /* filter one chan by chunk of f->n samples */
+  /* filter one chan by chunk of f->n samples, the last one partial */
 
-  const size_t n = nsampl / f->n;
+  const size_t n = (nsampl + f->n - 1) / f->n;
   const size_t w = f->n * nchan * wsampl;
+  const size_t nbin = f->n / 2 + 1;
   size_t i;
-
-  /* unused since assuming int16 */
-  wsampl = wsampl;
+  size_t j;
+  size_t r;
 
   for (i = 0; i != n; ++i, obuf += w, ibuf += w)
   {
-    int16_to_double(f->buf, (const int16_t*)ibuf, f->n, nchan);
-    filter_one_chunk(f);
-    double_to_int16((int16_t*)obuf, f->buf, f->n, nchan);
-  }
+    r = nsampl - i * f->n;
+    if (r > f->n) r = f->n;
+
+    if ((vad_map != NULL) && (vad_map[i] == 0))
+    {
+      /* silent chunk, no transform */
+      if (vad_mode == VAD_MODE_PASS)
+	copy_int16((int16_t*)obuf, (const int16_t*)ibuf, r, nchan);
+      else
+	zero_int16((int16_t*)obuf, r, nchan);
+      continue ;
+    }
+
+    /* the sidecar is shared: a valid byte is released once its */
+    /* spectrum is stored, and acquired before the spectrum is read */
+    if ((f->spec != NULL) &&
+	__atomic_load_n(&f->spec_valid[i], __ATOMIC_ACQUIRE))
+    {
+      memcpy(f->buf, f->spec + i * nbin, nbin * sizeof(fftw_complex));
+    }
+    else
+    {
+      int16_to_double(f->buf, (const int16_t*)ibuf, r, nchan);
+      for (j = r; j != f->n; ++j) ((double*)f->buf)[j] = 0.0;
+      fftw_execute(f->fplan);
+
+      if (f->spec != NULL)
+      {
+	memcpy(f->spec + i * nbin, f->buf, nbin * sizeof(fftw_complex));
+	__atomic_store_n(&f->spec_valid[i], 1, __ATOMIC_RELEASE);
+      }
+    }
 
-  /* remaining partial chunk */
-  if ((n * f->n) != nsampl)
-  {
-    const size_t r = nsampl - (n * f->n);
-    int16_to_double(f->buf, (const int16_t*)ibuf, r, nchan);
-    for (i = r; i != f->n; ++i) ((double*)f->buf)[i] = 0.0;
     filter_one_chunk(f);
     double_to_int16((int16_t*)obuf, f->buf, r, nchan);
   }
@@ -256,54 +941,1109 @@ static void filter_one_chan
 
 static int filter_voice
 (
+ filter_handle_t* f,
  uint8_t* obuf, const uint8_t* ibuf,
  size_t nchan, size_t nsampl, size_t wsampl,
- const double* bands, size_t nband
+ vad_handle_t* vad,
+ cache_handle_t* cache
 )
 {
-  filter_handle_t f;
+  /* f is initialized for the file rate */
+
+  const uint8_t* vad_map = NULL;
+  unsigned int vad_mode = VAD_MODE_NONE;
+  double t;
   size_t i;
 
-  /* resolution: 5 Hz */
-  /* fres = fsampl / (nsampl * 2) */
-  /* nsampl = 44100 / (5 * 2) = 4410 */
-  /* thus, nsampl of 8192 (next power of 2) */
+  if (vad != NULL)
+  {
+    vad_mark(vad, ibuf, nsampl, wsampl);
+    vad_map = vad->map;
+    vad_mode = vad->mode;
+  }
 
-  if (filter_init(&f, 8192, bands, nband)) return -1;
+  t = util_get_time();
 
   for (i = 0; i != nchan; ++i, ibuf += wsampl, obuf += wsampl)
   {
-    filter_one_chan(&f, obuf, ibuf, nchan, nsampl, wsampl);
+    if (cache != NULL)
+    {
+      f->spec = cache->spec + i * cache->nchunk * cache->nbin;
+      f->spec_valid = cache->valid + i * cache->nchunk;
+    }
+
+    filter_one_chan(f, obuf, ibuf, nchan, nsampl, wsampl, vad_map, vad_mode);
+    if (vad_map != NULL) vad_map += vad->nchunk;
   }
 
-  filter_fini(&f);
+  f->spec = NULL;
+  f->spec_valid = NULL;
+
+  if (vad != NULL) vad->filter_time = util_get_time() - t;
 
   return 0;
 }
 
 
-/* main */
+/* stream */
 
-int main(int ac, char** av)
+/* blocks of filter_get_nsampl frames are read from ifd, filtered as */
+/* the file mode does its chunks, and written to ofd. the output is */
+/* thus the same, and memory does not depend on the stream length. */
+/* with vad, a block is filtered once the next one is read so that */
+/* marks are dilated as in file mode: this block is the only lookahead. */
+/* with -io uring or pread, seekable files go through wav_io instead, */
+/* so that the next blocks are read, or the previous ones written, */
+/* while this one is filtered. */
+
+static size_t stream_read(int fd, wav_io_t* io, void* buf, size_t size)
 {
+  if (io != NULL) return wav_io_read(io, buf, size);
+  return wav_read_full(fd, buf, size);
+}
+
+static int write_full(int fd, const void* buf, size_t size)
+{
+  size_t n = 0;
+  ssize_t r;
+
+  while (n != size)
+  {
+    r = write(fd, (const uint8_t*)buf + n, size - n);
+    if (r > 0) n += (size_t)r;
+    else if ((r == -1) && (errno == EINTR)) continue ;
+    else return -1;
+  }
+
+  return 0;
+}
+
+typedef struct
+{
+  int fd;
+  wav_io_t* io;
+  size_t frame;
+
+  /* output rate conversion, if any */
+  resampl_handle_t* r;
+  int16_t* rbuf;
+  size_t nskip;
+
+  size_t nout;
+  size_t nmax;
+
+} stream_out_t;
+
+static int stream_write(stream_out_t* so, const uint8_t* buf, size_t n)
+{
+  /* the resampler delay is compensated as in file mode */
+
+  size_t k = 0;
+
+  if (so->r != NULL)
+  {
+    n = resampl_int16(so->r, so->rbuf, (const int16_t*)buf, n);
+    buf = (const uint8_t*)so->rbuf;
+    k = n < so->nskip ? n : so->nskip;
+    so->nskip -= k;
+    n -= k;
+  }
+
+  if (n > (so->nmax - so->nout)) n = so->nmax - so->nout;
+
+  buf += k * so->frame;
+  if (so->io != NULL)
+  {
+    if (wav_io_write(so->io, buf, n * so->frame)) return -1;
+  }
+  else if (write_full(so->fd, buf, n * so->frame)) return -1;
+  so->nout += n;
+
+  return 0;
+}
+
+static int stream_flush
+(stream_out_t* so, const uint8_t* zeros, size_t nzero, size_t nin)
+{
+  /* zeros are converted until the whole signal is */
+
+  if (so->r == NULL) return 0;
+
+  so->nmax = resampl_get_nout(so->r, nin);
+
+  while (so->nout < so->nmax)
+  {
+    if (stream_write(so, zeros, nzero)) return -1;
+  }
+
+  return 0;
+}
+
+static int filter_stream
+(
+ int ifd, int ofd,
+ const cmd_handle_t* cmd,
+ vad_handle_t* vad
+)
+{
+  filter_handle_t f;
+  resampl_handle_t rs;
+  stream_out_t so;
+  wav_io_t iio_;
+  wav_io_t oio;
+  wav_io_t* iio;
   wav_handle_t iw;
   wav_handle_t ow;
-  cmd_handle_t cmd;
+  uint8_t* ibufs[2];
+  uint8_t* obuf;
+  size_t n;
+  size_t frame;
+  size_t nleft;
+  size_t nin;
+  size_t nblock;
+  size_t r;
+  size_t i;
+  size_t k;
+  off_t hpos = (off_t)-1;
+  /* per chan marks of the previous, pending and last read blocks */
+  uint8_t* marks[3];
+  uint8_t* map;
+  uint8_t* tmp;
+  double t;
   int err = -1;
 
-  if (cmd_init(&cmd, ac - 1, av + 1))
+  if (cmd->flags & CMD_FLAG_IRAW)
+  {
+    iw.nchan = cmd->nchan;
+    iw.wsampl = 2;
+    iw.nsampl = WAV_NSAMPL_STREAM;
+    iw.fsampl = cmd->fsampl;
+  }
+  else if (wav_read_header(&iw, ifd))
   {
     PERROR();
     goto on_error_0;
   }
 
-  if ((cmd.flags & CMD_FLAG_IPATH) == 0)
+  if ((iw.wsampl != 2) || (iw.fsampl == 0))
   {
     PERROR();
     goto on_error_0;
   }
 
-  if ((cmd.flags & CMD_FLAG_OPATH) == 0)
+  n = filter_get_nsampl(iw.fsampl);
+  frame = iw.nchan * iw.wsampl;
+  nleft = iw.nsampl;
+
+  ow = iw;
+
+  so.fd = ofd;
+  so.io = NULL;
+  so.frame = frame;
+  so.r = NULL;
+  so.rbuf = NULL;
+  so.nskip = 0;
+  so.nout = 0;
+  so.nmax = WAV_NSAMPL_STREAM;
+
+  if (cmd->orate && (cmd->orate != iw.fsampl))
+  {
+    if (resampl_init(&rs, iw.fsampl, cmd->orate, iw.nchan))
+    {
+      PERROR();
+      goto on_error_0;
+    }
+
+    so.r = &rs;
+    so.nskip = resampl_get_delay(&rs);
+
+    ow.fsampl = cmd->orate;
+    if (iw.nsampl != WAV_NSAMPL_STREAM)
+      ow.nsampl = resampl_get_nout(&rs, iw.nsampl);
+  }
+
+  if ((cmd->flags & CMD_FLAG_ORAW) == 0)
+  {
+    /* patched once done if ofd can seek */
+    hpos = lseek(ofd, 0, SEEK_CUR);
+    if (wav_write_header(&ow, ofd))
+    {
+      PERROR();
+      goto on_error_1;
+    }
+  }
+
+  iio = NULL;
+  so.io = NULL;
+
+  if (cmd->io != CMD_IO_MMAP)
+  {
+    /* pipes keep to read and write */
+
+    uint32_t flags = 0;
+    off_t size = (off_t)-1;
+    off_t pos;
+
+    if (cmd->io == CMD_IO_URING) flags = WAV_IO_FLAG_URING;
+
+    pos = lseek(ifd, 0, SEEK_CUR);
+    if (pos != (off_t)-1)
+    {
+      if (nleft != WAV_NSAMPL_STREAM) size = (off_t)(nleft * frame);
+      if (wav_io_init(&iio_, ifd, pos, size, WAV_IO_FLAG_READ | flags))
+      {
+	PERROR();
+	goto on_error_1;
+      }
+      iio = &iio_;
+    }
+
+    pos = lseek(ofd, 0, SEEK_CUR);
+    if (pos != (off_t)-1)
+    {
+      if (wav_io_init(&oio, ofd, pos, -1, WAV_IO_FLAG_WRITE | flags))
+      {
+	PERROR();
+	goto on_error_2;
+      }
+      so.io = &oio;
+    }
+  }
+
+  if (filter_init(&f, n, iw.fsampl, cmd->bands, cmd->nband))
+  {
+    PERROR();
+    goto on_error_3;
+  }
+
+  ibufs[0] = malloc(3 * n * frame + 4 * iw.nchan);
+  if (ibufs[0] == NULL)
+  {
+    PERROR();
+    goto on_error_4;
+  }
+
+  if (so.r != NULL)
+  {
+    so.rbuf = malloc(resampl_get_max_out(so.r, n) * frame);
+    if (so.rbuf == NULL)
+    {
+      PERROR();
+      goto on_error_5;
+    }
+  }
+
+  ibufs[1] = ibufs[0] + n * frame;
+  obuf = ibufs[1] + n * frame;
+  marks[0] = obuf + n * frame;
+  marks[1] = marks[0] + iw.nchan;
+  marks[2] = marks[1] + iw.nchan;
+  map = marks[2] + iw.nchan;
+  memset(marks[0], 0, 3 * iw.nchan);
+
+  if (vad != NULL)
+  {
+    vad->n = n;
+    vad->nchan = iw.nchan;
+    vad->nchunk = 0;
+    vad->nvoiced = 0;
+  }
+
+  nin = 0;
+  nblock = 0;
+  k = 0;
+
+  while (1)
+  {
+    /* read the next block, bounded by the data size if known */
+
+    r = n;
+    if ((nleft != WAV_NSAMPL_STREAM) && (r > nleft)) r = nleft;
+    r = stream_read(ifd, iio, ibufs[k], r * frame) / frame;
+    if (nleft != WAV_NSAMPL_STREAM) nleft -= r;
+    nin += r;
+
+    if (vad == NULL)
+    {
+      if (r == 0) break ;
+
+      for (i = 0; i != iw.nchan; ++i)
+      {
+	filter_one_chan
+	(
+	 &f, obuf + i * iw.wsampl, ibufs[k] + i * iw.wsampl,
+	 iw.nchan, r, iw.wsampl, NULL, VAD_MODE_NONE
+	);
+      }
+
+      if (stream_write(&so, obuf, r))
+      {
+	PERROR();
+	goto on_error_5;
+      }
+
+      continue ;
+    }
+
+    t = util_get_time();
+    for (i = 0; i != iw.nchan; ++i)
+    {
+      marks[2][i] = (uint8_t)vad_is_voiced
+	((const int16_t*)ibufs[k] + i, r, iw.nchan, vad->thresh);
+    }
+    vad->mark_time += util_get_time() - t;
+
+    /* filter the pending block, now that its successor is known */
+
+    if (nblock)
+    {
+      for (i = 0; i != iw.nchan; ++i)
+      {
+	map[i] = 0;
+	if (marks[0][i] | marks[2][i]) map[i] = 1;
+	if (marks[1][i]) map[i] = 2;
+	if (map[i]) ++vad->nvoiced;
+      }
+
+      t = util_get_time();
+      for (i = 0; i != iw.nchan; ++i)
+      {
+	filter_one_chan
+	(
+	 &f, obuf + i * iw.wsampl, ibufs[k ^ 1] + i * iw.wsampl,
+	 iw.nchan, nblock, iw.wsampl, map + i, vad->mode
+	);
+      }
+      vad->filter_time += util_get_time() - t;
+      ++vad->nchunk;
+
+      if (stream_write(&so, obuf, nblock))
+      {
+	PERROR();
+	goto on_error_5;
+      }
+    }
+
+    if (r == 0) break ;
+
+    nblock = r;
+    k ^= 1;
+    tmp = marks[0];
+    marks[0] = marks[1];
+    marks[1] = marks[2];
+    marks[2] = tmp;
+  }
+
+  memset(obuf, 0, n * frame);
+  if (stream_flush(&so, obuf, n, nin))
+  {
+    PERROR();
+    goto on_error_5;
+  }
+
+  if (so.io != NULL)
+  {
+    /* all written before the header is patched */
+    err = wav_io_fini(so.io);
+    so.io = NULL;
+    if (err)
+    {
+      PERROR();
+      goto on_error_5;
+    }
+    err = -1;
+  }
+
+  /* a seekable output gets the real sizes */
+
+  if ((hpos != (off_t)-1) && (ow.nsampl != so.nout))
+  {
+    ow.nsampl = so.nout;
+    if ((lseek(ofd, hpos, SEEK_SET) != hpos) || wav_write_header(&ow, ofd))
+    {
+      PERROR();
+      goto on_error_5;
+    }
+  }
+
+  err = 0;
+
+ on_error_5:
+  free(so.rbuf);
+  free(ibufs[0]);
+ on_error_4:
+  filter_fini(&f);
+ on_error_3:
+  if (so.io != NULL) wav_io_fini(so.io);
+ on_error_2:
+  if (iio != NULL) wav_io_fini(iio);
+ on_error_1:
+  if (so.r != NULL) resampl_fini(so.r);
+ on_error_0:
+  return err;
+}
+
+
+/* main */
+
+static int main_stream(const cmd_handle_t* cmd)
+{
+  /* "-" is stdin or stdout */
+
+  vad_handle_t vad;
+  vad_handle_t* vadp = NULL;
+  int ifd = 0;
+  int ofd = 1;
+  int err = -1;
+
+  if (strcmp(cmd->ipath, "-"))
+  {
+    ifd = open(cmd->ipath, O_RDONLY);
+    if (ifd == -1)
+    {
+      PERROR();
+      goto on_error_0;
+    }
+  }
+
+  if (strcmp(cmd->opath, "-"))
+  {
+    ofd = open(cmd->opath, O_RDWR | O_CREAT | O_TRUNC, 00644);
+    if (ofd == -1)
+    {
+      PERROR();
+      goto on_error_1;
+    }
+  }
+
+  if (cmd->vad_mode != VAD_MODE_NONE)
+  {
+    /* sizes set once the format is known */
+    vad_init(&vad, cmd->vad_mode, cmd->vad_thresh, 0, WAV_NSAMPL_STREAM, 0);
+    vadp = &vad;
+  }
+
+  if (filter_stream(ifd, ofd, cmd, vadp))
+  {
+    PERROR();
+    goto on_error_2;
+  }
+
+  if ((vadp != NULL) && (cmd->flags & CMD_FLAG_VAD_REPORT))
+    vad_report(vadp, stderr);
+
+  err = 0;
+
+ on_error_2:
+  if (vadp != NULL) vad_fini(vadp);
+  if (ofd != 1) close(ofd);
+ on_error_1:
+  if (ifd != 0) close(ifd);
+ on_error_0:
+  return err;
+}
+
+static int resample_wav
+(wav_handle_t* ow, wav_handle_t* iw, unsigned int orate)
+{
+  /* whole file conversion into a new ow */
+
+  resampl_handle_t r;
+
+  if (resampl_init(&r, iw->fsampl, orate, iw->nchan)) goto on_error_0;
+
+  if (wav_create
+      (ow, iw->nchan, iw->wsampl, resampl_get_nout(&r, iw->nsampl), orate))
+    goto on_error_1;
+
+  if (resampl_int16_whole
+      (&r, wav_get_sampl_buf(ow), wav_get_sampl_buf(iw), iw->nsampl))
+    goto on_error_2;
+
+  resampl_fini(&r);
+
+  return 0;
+
+ on_error_2:
+  wav_close(ow);
+ on_error_1:
+  resampl_fini(&r);
+ on_error_0:
+  return -1;
+}
+
+/* batch */
+
+/* files are listed by a manifest, one input path per line with an */
+/* optional tab separated output path, or by a directory. workers pick */
+/* them in order. each keeps its fft plans and output buffer from one */
+/* file to the next, and hints the kernel to read the next file in the */
+/* list while filtering its own. completed files are appended to a */
+/* journal, and skipped when the same batch is run again. outputs are */
+/* renamed in place once written, an interrupted file is thus redone. */
+
+typedef struct
+{
+  char* ipath;
+  char* opath;
+} batch_item_t;
+
+typedef struct
+{
+  const cmd_handle_t* cmd;
+
+  batch_item_t* items;
+  size_t nitem;
+  size_t maxitem;
+  size_t nskip;
+
+  pthread_mutex_t lock;
+  size_t next;
+  size_t ndone;
+  size_t nerr;
+  double secs;
+  double t;
+  int journal_fd;
+
+} batch_handle_t;
+
+typedef struct
+{
+  pthread_t thread;
+  batch_handle_t* b;
+
+  filter_handle_t f;
+  unsigned int has_f;
+
+  /* reused output, of omax bytes of samples */
+  wav_handle_t ow;
+  size_t omax;
+
+} batch_job_t;
+
+/* the fftw planner is not thread safe */
+static pthread_mutex_t batch_plan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int batch_add
+(batch_handle_t* b, const char* ipath, const char* opath)
+{
+  batch_item_t* it;
+  const char* name;
+  size_t size;
+
+  if (b->nitem == b->maxitem)
+  {
+    const size_t max = b->maxitem ? b->maxitem * 2 : 1024;
+    it = realloc(b->items, max * sizeof(batch_item_t));
+    if (it == NULL) return -1;
+    b->items = it;
+    b->maxitem = max;
+  }
+
+  it = &b->items[b->nitem];
+
+  it->ipath = strdup(ipath);
+  if (it->ipath == NULL) return -1;
+
+  if (opath != NULL)
+  {
+    it->opath = strdup(opath);
+  }
+  else
+  {
+    /* same name in the output directory */
+    if (b->cmd->odir == NULL) goto on_error;
+    name = strrchr(ipath, '/');
+    name = (name == NULL) ? ipath : name + 1;
+    size = strlen(b->cmd->odir) + 1 + strlen(name) + 1;
+    it->opath = malloc(size);
+    if (it->opath != NULL)
+      snprintf(it->opath, size, "%s/%s", b->cmd->odir, name);
+  }
+
+  if (it->opath == NULL) goto on_error;
+
+  ++b->nitem;
+
+  return 0;
+
+ on_error:
+  free(it->ipath);
+  return -1;
+}
+
+static int batch_cmp_str(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static int batch_list_dir(batch_handle_t* b, const char* path)
+{
+  /* the wav files of path, by name */
+
+  struct dirent* de;
+  char** names = NULL;
+  char** tmp;
+  size_t nname = 0;
+  size_t max = 0;
+  size_t len;
+  size_t i;
+  char* s;
+  DIR* dir;
+  int err = -1;
+
+  dir = opendir(path);
+  if (dir == NULL) return -1;
+
+  while ((de = readdir(dir)) != NULL)
+  {
+    len = strlen(de->d_name);
+    if ((len < 4) || strcasecmp(de->d_name + len - 4, ".wav")) continue ;
+
+    if (nname == max)
+    {
+      max = max ? max * 2 : 1024;
+      tmp = realloc(names, max * sizeof(char*));
+      if (tmp == NULL) goto on_error;
+      names = tmp;
+    }
+
+    s = malloc(strlen(path) + 1 + len + 1);
+    if (s == NULL) goto on_error;
+    sprintf(s, "%s/%s", path, de->d_name);
+    names[nname++] = s;
+  }
+
+  qsort(names, nname, sizeof(char*), batch_cmp_str);
+
+  for (i = 0; i != nname; ++i)
+    if (batch_add(b, names[i], NULL)) goto on_error;
+
+  err = 0;
+
+ on_error:
+  for (i = 0; i != nname; ++i) free(names[i]);
+  free(names);
+  closedir(dir);
+  return err;
+}
+
+static int batch_list_manifest(batch_handle_t* b, const char* path)
+{
+  char* line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  char* opath;
+  FILE* file;
+  int err = 0;
+
+  file = fopen(path, "r");
+  if (file == NULL) return -1;
+
+  while ((len = getline(&line, &size, file)) != -1)
+  {
+    while (len && ((line[len - 1] == '\n') || (line[len - 1] == '\r')))
+      line[--len] = 0;
+    if ((len == 0) || (line[0] == '#')) continue ;
+
+    opath = strchr(line, '\t');
+    if (opath != NULL) *opath++ = 0;
+
+    if (batch_add(b, line, opath))
+    {
+      err = -1;
+      break ;
+    }
+  }
+
+  free(line);
+  fclose(file);
+
+  return err;
+}
+
+static int batch_skip_done(batch_handle_t* b)
+{
+  /* drop the items the journal marks as done */
+
+  char** done = NULL;
+  char** tmp;
+  size_t ndone = 0;
+  size_t max = 0;
+  char* line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  size_t i;
+  size_t j;
+  FILE* file;
+  int err = -1;
+
+  file = fopen(b->cmd->journal, "r");
+  if (file == NULL) return 0;
+
+  while ((len = getline(&line, &size, file)) != -1)
+  {
+    if ((len < 4) || memcmp(line, "ok\t", 3)) continue ;
+    if (line[len - 1] == '\n') line[--len] = 0;
+
+    if (ndone == max)
+    {
+      max = max ? max * 2 : 1024;
+      tmp = realloc(done, max * sizeof(char*));
+      if (tmp == NULL) goto on_error;
+      done = tmp;
+    }
+
+    done[ndone] = strdup(line + 3);
+    if (done[ndone] == NULL) goto on_error;
+    ++ndone;
+  }
+
+  qsort(done, ndone, sizeof(char*), batch_cmp_str);
+
+  for (i = 0, j = 0; i != b->nitem; ++i)
+  {
+    batch_item_t* const it = &b->items[i];
+
+    if (bsearch(&it->ipath, done, ndone, sizeof(char*), batch_cmp_str))
+    {
+      free(it->ipath);
+      free(it->opath);
+      ++b->nskip;
+      continue ;
+    }
+
+    b->items[j++] = *it;
+  }
+
+  b->nitem = j;
+
+  err = 0;
+
+ on_error:
+  for (i = 0; i != ndone; ++i) free(done[i]);
+  free(done);
+  free(line);
+  fclose(file);
+  return err;
+}
+
+static int batch_get_filter(batch_job_t* job, unsigned int fsampl)
+{
+  /* plans only depend on the size, shared by close rates */
+
+  const cmd_handle_t* const cmd = job->b->cmd;
+  const size_t n = filter_get_nsampl(fsampl);
+  int err = 0;
+
+  if (job->has_f && (job->f.n == n))
+  {
+    job->f.fsampl = (double)fsampl;
+    return 0;
+  }
+
+  pthread_mutex_lock(&batch_plan_lock);
+  if (job->has_f) filter_fini(&job->f);
+  job->has_f = 0;
+  if (filter_init(&job->f, n, fsampl, cmd->bands, cmd->nband)) err = -1;
+  else job->has_f = 1;
+  pthread_mutex_unlock(&batch_plan_lock);
+
+  return err;
+}
+
+static int batch_get_output(batch_job_t* job, const wav_handle_t* iw)
+{
+  const size_t size = iw->nsampl * iw->nchan * iw->wsampl;
+  size_t hsize;
+
+  if ((job->omax == 0) || (size > job->omax))
+  {
+    if (job->omax) wav_close(&job->ow);
+    job->omax = 0;
+    if (wav_create2(&job->ow, iw)) return -1;
+    job->omax = size;
+    return 0;
+  }
+
+  hsize = (uint8_t*)wav_get_sampl_buf(&job->ow) - (uint8_t*)job->ow.data;
+
+  job->ow.nchan = iw->nchan;
+  job->ow.wsampl = iw->wsampl;
+  job->ow.nsampl = iw->nsampl;
+  job->ow.fsampl = iw->fsampl;
+  job->ow.size = hsize + size;
+
+  return 0;
+}
+
+static int batch_one(batch_job_t* job, const batch_item_t* it, double* secs)
+{
+  const cmd_handle_t* const cmd = job->b->cmd;
+  wav_handle_t iw;
+  wav_handle_t rw;
+  wav_handle_t* ow;
+  vad_handle_t vad;
+  vad_handle_t* vadp = NULL;
+  char* tmp;
+  int err = -1;
+
+  tmp = malloc(strlen(it->opath) + sizeof(".tmp"));
+  if (tmp == NULL) goto on_error_0;
+  sprintf(tmp, "%s.tmp", it->opath);
+
+  if (wav_open(&iw, it->ipath)) goto on_error_1;
+  madvise(iw.data, iw.size, MADV_SEQUENTIAL);
+
+  if (iw.wsampl != 2) goto on_error_2;
+
+  if (batch_get_filter(job, iw.fsampl)) goto on_error_2;
+  if (batch_get_output(job, &iw)) goto on_error_2;
+  ow = &job->ow;
+
+  if (cmd->vad_mode != VAD_MODE_NONE)
+  {
+    if (vad_init(&vad, cmd->vad_mode, cmd->vad_thresh,
+		 iw.nchan, iw.nsampl, job->f.n))
+      goto on_error_2;
+    vadp = &vad;
+  }
+
+  err = filter_voice
+  (
+   &job->f,
+   wav_get_sampl_buf(ow), (const void*)wav_get_sampl_buf(&iw),
+   iw.nchan, iw.nsampl, iw.wsampl,
+   vadp, NULL
+  );
+
+  if (vadp != NULL) vad_fini(vadp);
+  if (err) goto on_error_2;
+  err = -1;
+
+  if (cmd->orate && (cmd->orate != iw.fsampl))
+  {
+    if (resample_wav(&rw, ow, cmd->orate)) goto on_error_2;
+    ow = &rw;
+  }
+
+  if (wav_write(ow, tmp) == 0)
+  {
+    if (rename(tmp, it->opath) == 0) err = 0;
+    else unlink(tmp);
+  }
+
+  if (ow == &rw) wav_close(&rw);
+
+  *secs = (double)iw.nsampl / (double)iw.fsampl;
+
+ on_error_2:
+  wav_close(&iw);
+ on_error_1:
+  free(tmp);
+ on_error_0:
+  return err;
+}
+
+static void* batch_main(void* arg)
+{
+  batch_job_t* const job = arg;
+  batch_handle_t* const b = job->b;
+  const batch_item_t* it;
+  char line[PATH_MAX + 8];
+  double secs;
+  size_t len;
+  int err;
+  int fd;
+
+  while (1)
+  {
+    pthread_mutex_lock(&b->lock);
+
+    it = NULL;
+    if (b->next != b->nitem) it = &b->items[b->next++];
+
+    /* read ahead the next file while this one is filtered */
+    if (b->next != b->nitem)
+    {
+      fd = open(b->items[b->next].ipath, O_RDONLY);
+      if (fd != -1)
+      {
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+      }
+    }
+
+    pthread_mutex_unlock(&b->lock);
+
+    if (it == NULL) break ;
+
+    secs = 0.0;
+    err = batch_one(job, it, &secs);
+
+    len = (size_t)snprintf
+      (line, sizeof(line), "%s\t%s\n", err ? "err" : "ok", it->ipath);
+    if (len >= sizeof(line)) len = sizeof(line) - 1;
+
+    pthread_mutex_lock(&b->lock);
+
+    /* a single append, whole lines even if interrupted */
+    if (write(b->journal_fd, line, len) != (ssize_t)len) PERROR();
+
+    ++b->ndone;
+    b->secs += secs;
+    if (err)
+    {
+      ++b->nerr;
+      fprintf(stderr, "failed: %s\n", it->ipath);
+    }
+
+    if (((b->ndone % 100) == 0) || (b->ndone == b->nitem))
+    {
+      const double t = util_get_time() - b->t;
+      printf
+      (
+       "%zu / %zu files, %zu failed, %.1fx realtime\n",
+       b->ndone, b->nitem, b->nerr, b->secs / (t > 0.0 ? t : 1e-9)
+      );
+      fflush(stdout);
+    }
+
+    pthread_mutex_unlock(&b->lock);
+  }
+
+  return NULL;
+}
+
+static int main_batch(const cmd_handle_t* cmd)
+{
+  batch_handle_t b;
+  batch_job_t* jobs;
+  struct stat st;
+  size_t nthread;
+  size_t i;
+  int err = -1;
+
+  b.cmd = cmd;
+  b.items = NULL;
+  b.nitem = 0;
+  b.maxitem = 0;
+  b.nskip = 0;
+  b.next = 0;
+  b.ndone = 0;
+  b.nerr = 0;
+  b.secs = 0.0;
+
+  if (stat(cmd->batch, &st))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (S_ISDIR(st.st_mode)) err = batch_list_dir(&b, cmd->batch);
+  else err = batch_list_manifest(&b, cmd->batch);
+
+  if (err)
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  err = -1;
+
+  if (batch_skip_done(&b))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  printf("%zu files, %zu already done\n", b.nitem, b.nskip);
+  fflush(stdout);
+
+  b.journal_fd = open(cmd->journal, O_WRONLY | O_CREAT | O_APPEND, 00644);
+  if (b.journal_fd == -1)
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (pthread_mutex_init(&b.lock, NULL))
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  jobs = malloc(cmd->njob * sizeof(batch_job_t));
+  if (jobs == NULL)
+  {
+    PERROR();
+    goto on_error_2;
+  }
+
+  for (i = 0; i != cmd->njob; ++i)
+  {
+    jobs[i].b = &b;
+    jobs[i].has_f = 0;
+    jobs[i].omax = 0;
+  }
+
+  b.t = util_get_time();
+
+  for (nthread = 1; nthread != cmd->njob; ++nthread)
+  {
+    batch_job_t* const job = &jobs[nthread];
+    if (pthread_create(&job->thread, NULL, batch_main, job)) break ;
+  }
+
+  batch_main(&jobs[0]);
+
+  for (i = 1; i != nthread; ++i) pthread_join(jobs[i].thread, NULL);
+
+  for (i = 0; i != cmd->njob; ++i)
+  {
+    if (jobs[i].has_f) filter_fini(&jobs[i].f);
+    if (jobs[i].omax) wav_close(&jobs[i].ow);
+  }
+
+  free(jobs);
+
+  printf
+  (
+   "done: %zu files, %zu failed, %.1f s of audio in %.3f s\n",
+   b.ndone, b.nerr, b.secs, util_get_time() - b.t
+  );
+
+  if (b.nerr == 0) err = 0;
+
+ on_error_2:
+  pthread_mutex_destroy(&b.lock);
+ on_error_1:
+  close(b.journal_fd);
+ on_error_0:
+  for (i = 0; i != b.nitem; ++i)
+  {
+    free(b.items[i].ipath);
+    free(b.items[i].opath);
+  }
+  free(b.items);
+  return err;
+}
+
+
+int main(int ac, char** av)
+{
+  wav_handle_t iw;
+  wav_handle_t ow;
+  wav_handle_t rw;
+  cmd_handle_t cmd;
+  filter_handle_t f;
+  vad_handle_t vad;
+  vad_handle_t* vadp = NULL;
+  cache_handle_t cache;
+  cache_handle_t* cachep = NULL;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
   {
     PERROR();
     goto on_error_0;
@@ -320,45 +2060,123 @@ int main(int ac, char** av)
     cmd.nband = 1;
   }
 
-  if (wav_open(&iw, cmd.ipath))
+  if (cmd.flags & CMD_FLAG_BATCH)
+  {
+    err = main_batch(&cmd);
+    goto on_error_0;
+  }
+
+  if ((cmd.flags & CMD_FLAG_IPATH) == 0)
   {
     PERROR();
     goto on_error_0;
   }
 
-  if (iw.wsampl != 2)
+  if ((cmd.flags & CMD_FLAG_OPATH) == 0)
   {
-    /* only int16_t supported */
     PERROR();
     goto on_error_0;
   }
 
-  if (iw.fsampl != 44100)
+  if ((strcmp(cmd.ipath, "-") == 0) || (strcmp(cmd.opath, "-") == 0) ||
+      (cmd.io != CMD_IO_MMAP))
+  {
+    err = main_stream(&cmd);
+    goto on_error_0;
+  }
+
+  if (wav_open(&iw, cmd.ipath))
   {
     PERROR();
     goto on_error_0;
   }
 
+  if (iw.wsampl != 2)
+  {
+    /* only int16_t supported */
+    PERROR();
+    goto on_error_1;
+  }
+
   if (wav_create2(&ow, &iw))
   {
     PERROR();
     goto on_error_1;
   }
 
-  filter_voice
+  if (cmd.vad_mode != VAD_MODE_NONE)
+  {
+    if (vad_init(&vad, cmd.vad_mode, cmd.vad_thresh,
+		 iw.nchan, iw.nsampl, filter_get_nsampl(iw.fsampl)))
+    {
+      PERROR();
+      goto on_error_2;
+    }
+
+    vadp = &vad;
+  }
+
+  if (filter_init
+      (&f, filter_get_nsampl(iw.fsampl), iw.fsampl, cmd.bands, cmd.nband))
+  {
+    PERROR();
+    goto on_error_3;
+  }
+
+  if (cmd.cache != NULL)
+  {
+    /* filtered anyway if the cache cannot be used */
+    if (cache_open
+	(&cache, cmd.cache, cmd.cache_max, &iw, filter_get_nsampl(iw.fsampl)))
+      PERROR();
+    else
+      cachep = &cache;
+  }
+
+  err = filter_voice
   (
+   &f,
    wav_get_sampl_buf(&ow), (const void*)wav_get_sampl_buf(&iw),
    iw.nchan, iw.nsampl, iw.wsampl,
-   cmd.bands, cmd.nband
+   vadp, cachep
   );
 
+  if (cachep != NULL) cache_close(cachep);
+
+  filter_fini(&f);
+
+  if (err)
+  {
+    PERROR();
+    goto on_error_3;
+  }
+
+  err = -1;
+
+  if ((vadp != NULL) && (cmd.flags & CMD_FLAG_VAD_REPORT))
+    vad_report(vadp, stdout);
+
+  if (cmd.orate && (cmd.orate != ow.fsampl))
+  {
+    if (resample_wav(&rw, &ow, cmd.orate))
+    {
+      PERROR();
+      goto on_error_3;
+    }
+
+    wav_close(&ow);
+    ow = rw;
+  }
+
   if (wav_write(&ow, cmd.opath))
   {
     PERROR();
-    goto on_error_2;
+    goto on_error_3;
   }
 
   err = 0;
+ on_error_3:
+  if (vadp != NULL) vad_fini(vadp);
  on_error_2:
   wav_close(&ow);
  on_error_1:
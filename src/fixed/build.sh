@@ -0,0 +1,2 @@
+#!/usr/bin/env sh
+gcc -Wall -O2 -I. -I../util main.c fixed.c ../util/util.c -lfftw3 -lm
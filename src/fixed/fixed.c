@@ -0,0 +1,364 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "fixed.h"
+
+
+static inline int16_t fixed_sat(int64_t x)
+{
+  if (x > INT16_MAX) return INT16_MAX;
+  if (x < INT16_MIN) return INT16_MIN;
+  return (int16_t)x;
+}
+
+
+static inline int32_t fixed_get_q30(double x)
+{
+  /* x in [-1, 1], 1 excluded */
+
+  const int64_t q = lrint(x * (double)(1 << 30));
+  return q >= (1 << 30) ? (1 << 30) - 1 : (int32_t)q;
+}
+
+
+static inline int64_t fixed_shr(int64_t x, int s)
+{
+  /* right by s rounded, or left by -s */
+
+  if (s > 0) return (x + ((int64_t)1 << (s - 1))) >> s;
+  return x * ((int64_t)1 << -s);
+}
+
+
+static inline int64_t fixed_abs(int64_t x)
+{
+  return x < 0 ? -x : x;
+}
+
+
+static int fixed_get_shift(int64_t m)
+{
+  /* the shift bringing the largest part m in (FIXED_MAX / 2, FIXED_MAX] */
+
+  int s;
+
+  if (m == 0) return 0;
+
+  for (s = 0; fixed_shr(m, s) > FIXED_MAX; ++s) ;
+  if (s) return s;
+
+  for (; (m << 1) <= FIXED_MAX; m <<= 1) --s;
+  return s;
+}
+
+
+size_t fixed_get_size(size_t n)
+{
+  /* one block, for all the tables and buffers */
+  return (7 * n + 2 * (n / 2 + 1)) * 4 + n * 2;
+}
+
+
+int fixed_init_mem(fixed_handle_t* fixed, size_t n, size_t nchan, void* mem)
+{
+  /* tables and buffers in mem, fixed_get_size bytes, that the caller */
+  /* owns */
+
+  const size_t nmask = n / 2 + 1;
+  int32_t* p;
+  double a;
+  size_t i;
+  size_t j;
+  unsigned int k;
+
+  if ((n < 2) || (n > FIXED_NMAX) || (n & (n - 1))) return -1;
+  if (nchan == 0) return -1;
+
+  fixed->n = n;
+  fixed->nchan = nchan;
+  for (k = 0; ((size_t)1 << k) != n; ++k) ;
+  fixed->log2n = k;
+  fixed->mem = NULL;
+
+  fixed->z = mem;
+
+  p = fixed->z;
+  p += 2 * n;
+  fixed->y = p;
+  p += 2 * n;
+  fixed->x = p;
+  p += 2 * n;
+  fixed->mask = p;
+  p += nmask;
+  fixed->xmask = p;
+  p += nmask;
+  fixed->tw = p;
+  p += n;
+  fixed->rev = (uint16_t*)p;
+
+  for (i = 0; i != n; ++i)
+  {
+    for (j = 0, k = 0; k != fixed->log2n; ++k)
+      j |= ((i >> k) & 1) << (fixed->log2n - 1 - k);
+    fixed->rev[i] = (uint16_t)j;
+  }
+
+  for (i = 0; i != n / 2; ++i)
+  {
+    a = (2.0 * M_PI * (double)i) / (double)n;
+    fixed->tw[2 * i + 0] = fixed_get_q30(cos(a));
+    fixed->tw[2 * i + 1] = fixed_get_q30(-sin(a));
+  }
+
+  for (i = 0; i != nmask; ++i) fixed->mask[i] = 1 << FIXED_MASK_Q;
+
+  return 0;
+}
+
+
+int fixed_init(fixed_handle_t* fixed, size_t n, size_t nchan)
+{
+  void* p;
+
+  p = malloc(fixed_get_size(n));
+  if (p == NULL) return -1;
+
+  if (fixed_init_mem(fixed, n, nchan, p))
+  {
+    free(p);
+    return -1;
+  }
+
+  fixed->mem = p;
+
+  return 0;
+}
+
+
+void fixed_fini(fixed_handle_t* fixed)
+{
+  free(fixed->mem);
+}
+
+
+static int fixed_fft(fixed_handle_t* fixed, int32_t* z, int64_t m, int is_inv)
+{
+  /* in place, from bit reversed order. m is the largest part of z. */
+  /* returns the block exponent e: the transform is z times 2^e. */
+
+  const size_t n = fixed->n;
+  const int32_t sgn = is_inv ? -1 : 1;
+  int32_t* a;
+  int32_t* b;
+  int64_t wr;
+  int64_t wi;
+  int64_t tr;
+  int64_t ti;
+  int64_t x;
+  size_t half;
+  size_t step;
+  size_t i;
+  size_t j;
+  int e = 0;
+  int s;
+
+  for (half = 1, step = n / 2; half != n; half *= 2, step /= 2)
+  {
+    s = fixed_get_shift(m);
+    if (s)
+    {
+      for (i = 0; i != 2 * n; ++i) z[i] = (int32_t)fixed_shr(z[i], s);
+      e += s;
+    }
+
+    m = 0;
+
+    for (i = 0; i != n; i += 2 * half)
+    {
+      for (j = 0; j != half; ++j)
+      {
+	wr = fixed->tw[2 * j * step + 0];
+	wi = sgn * fixed->tw[2 * j * step + 1];
+
+	a = z + 2 * (i + j);
+	b = a + 2 * half;
+
+	tr = (b[0] * wr - b[1] * wi + (1 << 29)) >> 30;
+	ti = (b[1] * wr + b[0] * wi + (1 << 29)) >> 30;
+
+	/* at most FIXED_MAX * (1 + sqrt(2)): no overflow */
+	x = a[0] - tr;
+	b[0] = (int32_t)x;
+	if (fixed_abs(x) > m) m = fixed_abs(x);
+	x = a[1] - ti;
+	b[1] = (int32_t)x;
+	if (fixed_abs(x) > m) m = fixed_abs(x);
+	x = a[0] + tr;
+	a[0] = (int32_t)x;
+	if (fixed_abs(x) > m) m = fixed_abs(x);
+	x = a[1] + ti;
+	a[1] = (int32_t)x;
+	if (fixed_abs(x) > m) m = fixed_abs(x);
+      }
+    }
+  }
+
+  return e;
+}
+
+
+static int fixed_mask
+(fixed_handle_t* fixed, int32_t* y, const int32_t* mask, int64_t* m)
+{
+  /* y is z under mask, bit reversed for the inverse. the gains are */
+  /* even: bin k and n - k share one. returns the exponent of y, and */
+  /* its largest part in m. */
+
+  const size_t n = fixed->n;
+  const int32_t* const z = fixed->z;
+  int64_t g;
+  int64_t x;
+  int64_t mm = 0;
+  size_t i;
+  size_t k;
+  int s;
+
+  for (i = 0; i != n; ++i)
+  {
+    g = mask[i <= n / 2 ? i : n - i];
+    x = fixed_abs(z[2 * i + 0] * g);
+    if (x > mm) mm = x;
+    x = fixed_abs(z[2 * i + 1] * g);
+    if (x > mm) mm = x;
+  }
+
+  s = fixed_get_shift(mm);
+  *m = 0;
+
+  for (i = 0; i != n; ++i)
+  {
+    g = mask[i <= n / 2 ? i : n - i];
+    k = fixed->rev[i];
+    x = fixed_shr(z[2 * i + 0] * g, s);
+    y[2 * k + 0] = (int32_t)x;
+    if (fixed_abs(x) > *m) *m = fixed_abs(x);
+    x = fixed_shr(z[2 * i + 1] * g, s);
+    y[2 * k + 1] = (int32_t)x;
+    if (fixed_abs(x) > *m) *m = fixed_abs(x);
+  }
+
+  return s - FIXED_MASK_Q;
+}
+
+
+static int fixed_apply_mask
+(fixed_handle_t* fixed, int32_t* y, const int32_t* mask, int e)
+{
+  /* samples of the forward transform z, of exponent e, under mask. */
+  /* they are left in y, saturated to 16 bits. */
+
+  int64_t m;
+  size_t i;
+
+  e += fixed_mask(fixed, y, mask, &m);
+  e += fixed_fft(fixed, y, m, 1);
+
+  /* the inverse is unnormalized */
+  e -= (int)fixed->log2n;
+
+  if (e > 32) e = 32;
+  for (i = 0; i != 2 * fixed->n; ++i) y[i] = fixed_sat(fixed_shr(y[i], -e));
+
+  return e;
+}
+
+
+static int16_t* fixed_get_frame
+(fixed_handle_t* fixed, int16_t* buf, size_t size, size_t off, size_t i)
+{
+  i += off;
+  if (i >= size) i -= size;
+  return buf + i * fixed->nchan;
+}
+
+
+void fixed_apply
+(
+ fixed_handle_t* fixed,
+ int16_t* buf, size_t size, size_t off,
+ const double* xmask
+)
+{
+  /* the n frames from off of the ring buf of size frames, in place. */
+  /* xmask, if not NULL, replaces the mask from this block on, and the */
+  /* outputs under both are crossfaded over the block. */
+
+  const size_t n = fixed->n;
+  const size_t nmask = n / 2 + 1;
+  int32_t* const z = fixed->z;
+  int32_t* const y = fixed->y;
+  int32_t* const x = fixed->x;
+  int16_t* p;
+  int64_t m;
+  int64_t w;
+  double g;
+  size_t i;
+  size_t k;
+  size_t c;
+  int is_pair;
+  int e;
+
+  if (xmask != NULL)
+  {
+    for (i = 0; i != nmask; ++i)
+    {
+      g = xmask[i] * (double)(1 << FIXED_MASK_Q);
+      if (g > (double)INT32_MAX) g = (double)INT32_MAX;
+      fixed->xmask[i] = g < 0.0 ? 0 : (int32_t)lrint(g);
+    }
+  }
+
+  for (c = 0; c < fixed->nchan; c += 2)
+  {
+    /* an odd channel out goes alone, with a null imaginary part */
+    is_pair = (c + 1) < fixed->nchan;
+
+    m = 0;
+    for (i = 0; i != n; ++i)
+    {
+      p = fixed_get_frame(fixed, buf, size, off, i) + c;
+      k = fixed->rev[i];
+      z[2 * k + 0] = p[0];
+      z[2 * k + 1] = is_pair ? p[1] : 0;
+      if (fixed_abs(p[0]) > m) m = fixed_abs(p[0]);
+      if (is_pair && (fixed_abs(p[1]) > m)) m = fixed_abs(p[1]);
+    }
+
+    e = fixed_fft(fixed, z, m, 0);
+
+    fixed_apply_mask(fixed, y, fixed->mask, e);
+
+    if (xmask != NULL)
+    {
+      fixed_apply_mask(fixed, x, fixed->xmask, e);
+
+      for (i = 0; i != 2 * n; ++i)
+      {
+	/* in Q15, below 1 */
+	w = (int64_t)(((i / 2) << 15) / n);
+	y[i] += (int32_t)((((int64_t)x[i] - y[i]) * w + (1 << 14)) >> 15);
+      }
+    }
+
+    for (i = 0; i != n; ++i)
+    {
+      p = fixed_get_frame(fixed, buf, size, off, i) + c;
+      p[0] = (int16_t)y[2 * i + 0];
+      if (is_pair) p[1] = (int16_t)y[2 * i + 1];
+    }
+  }
+
+  if (xmask != NULL)
+    memcpy(fixed->mask, fixed->xmask, nmask * sizeof(int32_t));
+}
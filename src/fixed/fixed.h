@@ -0,0 +1,59 @@
+#ifndef FIXED_H_INCLUDED
+#define FIXED_H_INCLUDED
+
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* the spectral modifier in fixed point, for hosts where double */
+/* transforms cost too much. blocks are taken from and written back to */
+/* an interleaved S16 ring, in place, and transformed in 32 bits. */
+
+/* channels go by pairs, as the real and imaginary parts of one complex */
+/* transform: masks are real and even, so the parts stay apart. the */
+/* transform is radix 2 with Q30 twiddles and a block exponent: before */
+/* each pass the block is shifted for its largest part to be at most */
+/* FIXED_MAX, that a butterfly cannot overflow from. outputs saturate. */
+
+#define FIXED_MAX (1 << 29)
+
+/* mask gains are Q24, up to 128 */
+#define FIXED_MASK_Q 24
+
+/* largest transform, for 16 bit indices */
+#define FIXED_NMAX 65536
+
+typedef struct fixed_handle
+{
+  size_t n;
+  unsigned int log2n;
+  size_t nchan;
+
+  /* bit reversed indices, and n / 2 twiddles as cos and -sin pairs */
+  uint16_t* rev;
+  int32_t* tw;
+
+  /* n / 2 + 1 gains in use */
+  int32_t* mask;
+  int32_t* xmask;
+
+  /* a transformed pair, and its inverses under either mask */
+  int32_t* z;
+  int32_t* y;
+  int32_t* x;
+
+  /* all of the above, if fixed_init took it */
+  void* mem;
+
+} fixed_handle_t;
+
+
+size_t fixed_get_size(size_t);
+int fixed_init(fixed_handle_t*, size_t, size_t);
+int fixed_init_mem(fixed_handle_t*, size_t, size_t, void*);
+void fixed_fini(fixed_handle_t*);
+void fixed_apply(fixed_handle_t*, int16_t*, size_t, size_t, const double*);
+
+
+#endif /* ! FIXED_H_INCLUDED */
@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fftw3.h>
+#include "fixed.h"
+#include "util.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+  size_t n;
+  size_t nchan;
+  size_t nblock;
+  /* peak of the test signal, in dBFS */
+  double level;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->n = 512;
+  cmd->nchan = 2;
+  cmd->nblock = 1000;
+  cmd->level = -1.0;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-n") == 0)
+    {
+      cmd->n = (size_t)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-nchan") == 0)
+    {
+      cmd->nchan = (size_t)strtoul(v, NULL, 10);
+      if (cmd->nchan == 0) goto on_error;
+    }
+    else if (strcmp(k, "-nblock") == 0)
+    {
+      cmd->nblock = (size_t)strtoul(v, NULL, 10);
+      if (cmd->nblock == 0) goto on_error;
+    }
+    else if (strcmp(k, "-level") == 0)
+    {
+      cmd->level = strtod(v, NULL);
+      if (cmd->level > 0.0) goto on_error;
+    }
+    else goto on_error;
+  }
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* double path, as the modifier of the main program */
+
+typedef struct
+{
+  double* buf;
+  fftw_plan fplan;
+  fftw_plan bplan;
+  size_t n;
+  size_t nchan;
+  size_t dist;
+} ref_handle_t;
+
+static int ref_init(ref_handle_t* ref, size_t n, size_t nchan)
+{
+  const int nn = (int)n;
+
+  ref->n = n;
+  ref->nchan = nchan;
+  ref->dist = 2 * (n / 2 + 1);
+
+  ref->buf = fftw_malloc(nchan * ref->dist * sizeof(double));
+  if (ref->buf == NULL) goto on_error_0;
+
+  ref->fplan = fftw_plan_many_dft_r2c
+  (
+   1, &nn, (int)nchan,
+   ref->buf, NULL, 1, (int)ref->dist,
+   (fftw_complex*)ref->buf, NULL, 1, (int)ref->dist / 2,
+   FFTW_ESTIMATE
+  );
+  if (ref->fplan == NULL) goto on_error_1;
+
+  ref->bplan = fftw_plan_many_dft_c2r
+  (
+   1, &nn, (int)nchan,
+   (fftw_complex*)ref->buf, NULL, 1, (int)ref->dist / 2,
+   ref->buf, NULL, 1, (int)ref->dist,
+   FFTW_ESTIMATE
+  );
+  if (ref->bplan == NULL) goto on_error_2;
+
+  return 0;
+
+ on_error_2:
+  fftw_destroy_plan(ref->fplan);
+ on_error_1:
+  fftw_free(ref->buf);
+ on_error_0:
+  return -1;
+}
+
+static void ref_fini(ref_handle_t* ref)
+{
+  fftw_destroy_plan(ref->bplan);
+  fftw_destroy_plan(ref->fplan);
+  fftw_free(ref->buf);
+}
+
+static void ref_apply
+(ref_handle_t* ref, const int16_t* in, double* out, const double* mask)
+{
+  /* n interleaved frames of in, to as many of out, in sample units */
+
+  const double scale = 1.0 / (32768.0 * (double)ref->n);
+  double* p;
+  size_t i;
+  size_t c;
+
+  for (c = 0; c != ref->nchan; ++c)
+  {
+    p = ref->buf + c * ref->dist;
+    for (i = 0; i != ref->n; ++i)
+      p[i] = (double)in[i * ref->nchan + c] / 32768.0;
+  }
+
+  fftw_execute(ref->fplan);
+
+  for (c = 0; c != ref->nchan; ++c)
+  {
+    p = ref->buf + c * ref->dist;
+    for (i = 0; i != (ref->n / 2 + 1); ++i)
+    {
+      p[2 * i + 0] *= mask[i];
+      p[2 * i + 1] *= mask[i];
+    }
+  }
+
+  fftw_execute(ref->bplan);
+
+  for (c = 0; c != ref->nchan; ++c)
+  {
+    p = ref->buf + c * ref->dist;
+    for (i = 0; i != ref->n; ++i)
+      out[i * ref->nchan + c] = p[i] * scale * 32768.0 * 32768.0;
+  }
+}
+
+
+/* main */
+
+/* blocks of tones and noise at -level dBFS, through a mask of a cut */
+/* and a boost, in double and in fixed point. the double output is the */
+/* reference: the error of the fixed one is given as a signal to noise */
+/* ratio, next to that of the double output rounded to 16 bits, the */
+/* best a S16 output can do. */
+
+int main(int ac, char** av)
+{
+  cmd_handle_t cmd;
+  ref_handle_t ref;
+  fixed_handle_t fixed;
+  int16_t* in;
+  int16_t* out;
+  double* dout;
+  double* mask;
+  double a;
+  double x;
+  double esig = 0.0;
+  double efix = 0.0;
+  double eround = 0.0;
+  double emax = 0.0;
+  double tref = 0.0;
+  double tfix = 0.0;
+  double t;
+  size_t nsampl;
+  size_t b;
+  size_t i;
+  size_t c;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (fixed_init(&fixed, cmd.n, cmd.nchan))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (ref_init(&ref, cmd.n, cmd.nchan))
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  nsampl = cmd.n * cmd.nchan;
+
+  in = malloc(nsampl * sizeof(int16_t));
+  out = malloc(nsampl * sizeof(int16_t));
+  dout = malloc(nsampl * sizeof(double));
+  mask = malloc((cmd.n / 2 + 1) * sizeof(double));
+
+  if ((in == NULL) || (out == NULL) || (dout == NULL) || (mask == NULL))
+  {
+    PERROR();
+    goto on_error_3;
+  }
+
+  /* -24 dB over the low eighth of the band, +6 dB in the upper half */
+  for (i = 0; i != (cmd.n / 2 + 1); ++i)
+  {
+    if (i < cmd.n / 16) mask[i] = pow(10.0, -24.0 / 20.0);
+    else if (i >= cmd.n / 4) mask[i] = pow(10.0, 6.0 / 20.0);
+    else mask[i] = 1.0;
+  }
+
+  a = 32767.0 * pow(10.0, cmd.level / 20.0);
+  srand(0);
+
+  for (b = 0; b != cmd.nblock; ++b)
+  {
+    for (i = 0; i != cmd.n; ++i)
+    {
+      for (c = 0; c != cmd.nchan; ++c)
+      {
+	const double k = (double)(b * cmd.n + i);
+	x = 0.3 * sin(0.0123 * k * (double)(c + 1));
+	x += 0.2 * sin(0.7 * k + (double)c);
+	x += 0.2 * sin(2.1 * k);
+	x += 0.2 * (2.0 * (double)rand() / (double)RAND_MAX - 1.0);
+	in[i * cmd.nchan + c] = (int16_t)lrint(a * x);
+      }
+    }
+
+    memcpy(out, in, nsampl * sizeof(int16_t));
+
+    t = util_get_time();
+    ref_apply(&ref, in, dout, mask);
+    tref += util_get_time() - t;
+
+    t = util_get_time();
+    fixed_apply(&fixed, out, cmd.n, 0, b == 0 ? mask : NULL);
+    tfix += util_get_time() - t;
+
+    /* the first block is crossfaded from the unit mask */
+    if (b == 0) continue ;
+
+    for (i = 0; i != nsampl; ++i)
+    {
+      x = dout[i] < -32768.0 ? -32768.0 : dout[i] > 32767.0 ? 32767.0 : dout[i];
+      esig += x * x;
+      efix += ((double)out[i] - x) * ((double)out[i] - x);
+      eround += (round(x) - x) * (round(x) - x);
+      if (fabs((double)out[i] - x) > emax) emax = fabs((double)out[i] - x);
+    }
+  }
+
+  printf
+  (
+   "n %zu, nchan %zu, level %.1f dBFS\n"
+   "snr: fixed %.1f dB, rounded double %.1f dB, max error %.1f lsb\n"
+   "time per frame: fixed %.1f ns, double %.1f ns\n",
+   cmd.n, cmd.nchan, cmd.level,
+   10.0 * log10(esig / efix), 10.0 * log10(esig / eround), emax,
+   (tfix * 1e9) / (double)(cmd.nblock * cmd.n),
+   (tref * 1e9) / (double)(cmd.nblock * cmd.n)
+  );
+
+  err = 0;
+
+ on_error_3:
+  free(in);
+  free(out);
+  free(dout);
+  free(mask);
+  ref_fini(&ref);
+ on_error_1:
+  fixed_fini(&fixed);
+ on_error_0:
+  return err;
+}
@@ -0,0 +1,2 @@
+#!/usr/bin/env sh
+gcc -Wall -O2 -I../wav -I../resampl -I../util main.c ../wav/wav.c ../resampl/resampl.c ../util/util.c -lm -lfftw3 -lpthread
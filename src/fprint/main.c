@@ -0,0 +1,1212 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fftw3.h>
+#include "wav.h"
+#include "resampl.h"
+#include "util.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+#define CMD_MAX_IPATH 32
+
+typedef struct
+{
+#define CMD_FLAG_DB (1 << 0)
+#define CMD_FLAG_INDEX (1 << 1)
+#define CMD_FLAG_QUERY (1 << 2)
+  uint32_t flags;
+  const char* db;
+  size_t nipath;
+  const char* ipaths[CMD_MAX_IPATH];
+  size_t njob;
+  size_t mem;
+  size_t nmatch;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->flags = 0;
+  cmd->db = NULL;
+  cmd->nipath = 0;
+  cmd->njob = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+  cmd->mem = 512;
+  cmd->nmatch = 3;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-do") == 0)
+    {
+      if (strcmp(v, "index") == 0) cmd->flags |= CMD_FLAG_INDEX;
+      else if (strcmp(v, "query") == 0) cmd->flags |= CMD_FLAG_QUERY;
+      else goto on_error;
+    }
+    else if (strcmp(k, "-db") == 0)
+    {
+      cmd->flags |= CMD_FLAG_DB;
+      cmd->db = v;
+    }
+    else if (strcmp(k, "-ipath") == 0)
+    {
+      if (cmd->nipath == CMD_MAX_IPATH) goto on_error;
+      cmd->ipaths[cmd->nipath++] = v;
+    }
+    else if (strcmp(k, "-njob") == 0)
+    {
+      cmd->njob = (size_t)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-mem") == 0)
+    {
+      /* MB of postings hashed before merging into the index */
+      cmd->mem = (size_t)strtoul(v, NULL, 10);
+      if (cmd->mem == 0) goto on_error;
+    }
+    else if (strcmp(k, "-nmatch") == 0)
+    {
+      cmd->nmatch = (size_t)strtoul(v, NULL, 10);
+    }
+    else goto on_error;
+  }
+
+  if (cmd->njob == 0) cmd->njob = 1;
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* fingerprint */
+
+/* files are mixed down and resampled to FP_RATE, then framed: hashes */
+/* and times do not depend on the rate of the file. */
+/* in each frame the strongest bin of a few octave bands is kept if it */
+/* is a local maximum standing above the frame average. every peak */
+/* (anchor) is paired with the first FP_FAN peaks following it within */
+/* FP_MAX_DT frames. a pair hashes to f1:9 f2:9 dt:6 bits. */
+
+#define FP_RATE 11025
+#define FP_N 1024
+#define FP_HOP 512
+#define FP_FAN 3
+#define FP_MAX_DT 64
+#define FP_NBAND 6
+#define FP_HASH_BITS 24
+
+static const size_t fp_bands[FP_NBAND + 1] = { 2, 8, 16, 32, 64, 128, 512 };
+
+typedef struct
+{
+  uint32_t hash;
+  uint32_t fid;
+  uint32_t t;
+} __attribute__((packed)) fp_post_t;
+
+typedef struct
+{
+  fp_post_t* p;
+  size_t n;
+  size_t max;
+} fp_vec_t;
+
+typedef struct
+{
+  uint32_t t;
+  uint32_t f;
+  uint32_t nfan;
+} fp_peak_t;
+
+typedef struct
+{
+  /* shared plan and window */
+  fftw_plan plan;
+  const double* win;
+
+  void* buf;
+  double mag[FP_N / 2 + 1];
+
+  /* peaks of the last FP_MAX_DT frames */
+  fp_peak_t peaks[FP_MAX_DT * FP_NBAND];
+  size_t npeak;
+
+} fp_handle_t;
+
+static void fp_vec_init(fp_vec_t* v)
+{
+  v->p = NULL;
+  v->n = 0;
+  v->max = 0;
+}
+
+static void fp_vec_fini(fp_vec_t* v)
+{
+  free(v->p);
+}
+
+static int fp_vec_push(fp_vec_t* v, uint32_t hash, uint32_t fid, uint32_t t)
+{
+  if (v->n == v->max)
+  {
+    const size_t max = v->max ? v->max * 2 : 4096;
+    fp_post_t* const p = realloc(v->p, max * sizeof(fp_post_t));
+    if (p == NULL) return -1;
+    v->p = p;
+    v->max = max;
+  }
+
+  v->p[v->n].hash = hash;
+  v->p[v->n].fid = fid;
+  v->p[v->n].t = t;
+  ++v->n;
+
+  return 0;
+}
+
+static int fp_add_peak
+(fp_handle_t* fp, fp_vec_t* v, uint32_t fid, uint32_t t, uint32_t f)
+{
+  /* pair with the pending anchors, then become one */
+
+  size_t i;
+  size_t j;
+
+  for (i = 0, j = 0; i != fp->npeak; ++i)
+  {
+    fp_peak_t* const a = &fp->peaks[i];
+    const uint32_t dt = t - a->t;
+
+    /* anchors too old or with all their targets are dropped */
+    if ((dt >= FP_MAX_DT) || (a->nfan == FP_FAN)) continue ;
+
+    if (dt)
+    {
+      const uint32_t h = (a->f << 15) | (f << 6) | dt;
+      if (fp_vec_push(v, h, fid, a->t)) return -1;
+      ++a->nfan;
+    }
+
+    fp->peaks[j++] = *a;
+  }
+
+  fp->npeak = j;
+
+  if (fp->npeak == (sizeof(fp->peaks) / sizeof(fp->peaks[0]))) return 0;
+
+  fp->peaks[fp->npeak].t = t;
+  fp->peaks[fp->npeak].f = f;
+  fp->peaks[fp->npeak].nfan = 0;
+  ++fp->npeak;
+
+  return 0;
+}
+
+static int fp_analyze_frame
+(fp_handle_t* fp, fp_vec_t* v, const double* x, uint32_t fid, uint32_t t)
+{
+  /* the peaks of the FP_N samples x, at FP_RATE */
+
+  const fftw_complex* const cbuf = fp->buf;
+  double* const rbuf = fp->buf;
+  double mean;
+  size_t j;
+  size_t k;
+
+  for (j = 0; j != FP_N; ++j) rbuf[j] = x[j] * fp->win[j];
+
+  fftw_execute_dft_r2c(fp->plan, fp->buf, fp->buf);
+
+  mean = 0.0;
+  for (j = 0; j != (FP_N / 2 + 1); ++j)
+  {
+    const double re = cbuf[j][0];
+    const double im = cbuf[j][1];
+    fp->mag[j] = log(re * re + im * im + 1.0);
+    mean += fp->mag[j];
+  }
+  mean /= (double)(FP_N / 2 + 1);
+
+  for (j = 0; j != FP_NBAND; ++j)
+  {
+    /* about -66 dBFS */
+    static const double floor_db = 2.0 * 9.7;
+
+    size_t f = fp_bands[j];
+
+    for (k = fp_bands[j]; k != fp_bands[j + 1]; ++k)
+      if (fp->mag[k] > fp->mag[f]) f = k;
+
+    if (fp->mag[f] < floor_db) continue ;
+    if (fp->mag[f] < (mean + 1.0)) continue ;
+    if (fp->mag[f] <= fp->mag[f - 1]) continue ;
+    if (fp->mag[f] < fp->mag[f + 1]) continue ;
+
+    if (fp_add_peak(fp, v, fid, t, (uint32_t)f)) return -1;
+  }
+
+  return 0;
+}
+
+static int fp_analyze
+(fp_handle_t* fp, fp_vec_t* v, const wav_handle_t* w, uint32_t fid)
+{
+  /* append the postings of w to v, return -1 on error */
+
+  /* blocks of the file are mixed down to in, resampled at the end of */
+  /* x, and framed from its start. the resampler delay is dropped. */
+
+  const int16_t* const sampl = wav_get_sampl_buf((wav_handle_t*)w);
+  const double scale = 1.0 / (double)w->nchan;
+  resampl_handle_t r;
+  double* in;
+  double* x;
+  size_t nx = 0;
+  size_t nskip;
+  size_t nout;
+  size_t n;
+  size_t i;
+  size_t j;
+  size_t k;
+  uint32_t t = 0;
+  int err = -1;
+
+  if (resampl_init(&r, w->fsampl, FP_RATE, 1)) goto on_error_0;
+  nskip = resampl_get_delay(&r);
+
+  in = malloc(RESAMPL_NBLOCK * sizeof(double));
+  if (in == NULL) goto on_error_1;
+
+  x = malloc((FP_N + resampl_get_max_out(&r, RESAMPL_NBLOCK)) * sizeof(double));
+  if (x == NULL) goto on_error_2;
+
+  fp->npeak = 0;
+
+  for (i = 0; i != w->nsampl; i += n)
+  {
+    n = w->nsampl - i;
+    if (n > RESAMPL_NBLOCK) n = RESAMPL_NBLOCK;
+
+    for (j = 0; j != n; ++j)
+    {
+      const int16_t* const p = sampl + (i + j) * w->nchan;
+      double sum = 0.0;
+      for (k = 0; k != w->nchan; ++k) sum += (double)p[k];
+      in[j] = sum * scale;
+    }
+
+    nout = resampl_planar(&r, x + nx, 0, in, 0, n);
+
+    if (nskip)
+    {
+      k = nout < nskip ? nout : nskip;
+      memmove(x + nx, x + nx + k, (nout - k) * sizeof(double));
+      nout -= k;
+      nskip -= k;
+    }
+
+    for (nx += nout; nx >= FP_N; nx -= FP_HOP, ++t)
+    {
+      if (fp_analyze_frame(fp, v, x, fid, t)) goto on_error_3;
+      memmove(x, x + FP_HOP, (nx - FP_HOP) * sizeof(double));
+    }
+  }
+
+  err = 0;
+
+ on_error_3:
+  free(x);
+ on_error_2:
+  free(in);
+ on_error_1:
+  resampl_fini(&r);
+ on_error_0:
+  return err;
+}
+
+
+/* index file */
+
+/* the index is a single mmap-able file: a header, the file table and */
+/* its path strings, the postings sorted by hash, fid and time, and a */
+/* directory giving the first posting of each hash prefix. updates */
+/* write a new file next to the old one and rename it over. */
+
+#define FP_DIR_BITS 22
+#define FP_MAGIC "FPIDX002"
+
+typedef struct
+{
+  uint8_t magic[8];
+  uint32_t nfile;
+  uint32_t dir_bits;
+  uint64_t npost;
+  uint64_t off_file;
+  uint64_t off_str;
+  uint64_t off_post;
+  uint64_t off_dir;
+} __attribute__((packed)) fp_header_t;
+
+typedef struct
+{
+  uint64_t size;
+  int64_t mtime;
+  uint64_t path_off;
+  uint32_t path_len;
+  uint32_t pad;
+} __attribute__((packed)) fp_file_t;
+
+typedef struct
+{
+  void* data;
+  size_t size;
+  const fp_header_t* h;
+  const fp_file_t* files;
+  const char* strs;
+  const fp_post_t* posts;
+  const uint64_t* dir;
+} fp_index_t;
+
+static int fp_index_open(fp_index_t* x, const char* path)
+{
+  struct stat st;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1) goto on_error_0;
+
+  if (fstat(fd, &st)) goto on_error_1;
+  if ((size_t)st.st_size < sizeof(fp_header_t)) goto on_error_1;
+
+  x->size = (size_t)st.st_size;
+  x->data = mmap(NULL, x->size, PROT_READ, MAP_SHARED, fd, 0);
+  if (x->data == MAP_FAILED) goto on_error_1;
+
+  x->h = x->data;
+  if (memcmp(x->h->magic, FP_MAGIC, 8)) goto on_error_2;
+  if (x->h->dir_bits != FP_DIR_BITS) goto on_error_2;
+  if (x->h->off_dir + (((uint64_t)1 << FP_DIR_BITS) + 1) * 8 > x->size)
+    goto on_error_2;
+
+  x->files = (const fp_file_t*)((const uint8_t*)x->data + x->h->off_file);
+  x->strs = (const char*)x->data + x->h->off_str;
+  x->posts = (const fp_post_t*)((const uint8_t*)x->data + x->h->off_post);
+  x->dir = (const uint64_t*)((const uint8_t*)x->data + x->h->off_dir);
+
+  close(fd);
+
+  return 0;
+
+ on_error_2:
+  munmap(x->data, x->size);
+ on_error_1:
+  close(fd);
+ on_error_0:
+  return -1;
+}
+
+static void fp_index_close(fp_index_t* x)
+{
+  munmap(x->data, x->size);
+}
+
+static void fp_index_init_empty(fp_index_t* x)
+{
+  static const fp_header_t h = { FP_MAGIC, 0, FP_DIR_BITS, 0, 0, 0, 0, 0 };
+
+  x->data = NULL;
+  x->size = 0;
+  x->h = &h;
+  x->files = NULL;
+  x->strs = NULL;
+  x->posts = NULL;
+  x->dir = NULL;
+}
+
+
+/* file list */
+
+typedef struct
+{
+  char* path;
+  uint64_t size;
+  int64_t mtime;
+  /* index in the new file table */
+  uint32_t fid;
+  /* 1 + index in the old file table, 0 if not indexed */
+  unsigned int is_old;
+  /* cleared if the file is dropped from the index */
+  unsigned int is_valid;
+} fp_entry_t;
+
+typedef struct
+{
+  fp_entry_t* p;
+  size_t n;
+  size_t max;
+} fp_list_t;
+
+static int fp_list_add
+(fp_list_t* l, const char* path, uint64_t size, int64_t mtime)
+{
+  fp_entry_t* e;
+
+  if (l->n == l->max)
+  {
+    const size_t max = l->max ? l->max * 2 : 256;
+    e = realloc(l->p, max * sizeof(fp_entry_t));
+    if (e == NULL) return -1;
+    l->p = e;
+    l->max = max;
+  }
+
+  e = &l->p[l->n];
+  e->path = strdup(path);
+  if (e->path == NULL) return -1;
+  e->size = size;
+  e->mtime = mtime;
+  e->fid = (uint32_t)l->n;
+  e->is_old = 0;
+  e->is_valid = 1;
+  ++l->n;
+
+  return 0;
+}
+
+static void fp_list_fini(fp_list_t* l)
+{
+  size_t i;
+  for (i = 0; i != l->n; ++i) free(l->p[i].path);
+  free(l->p);
+}
+
+static int fp_list_scan(fp_list_t* l, const char* path)
+{
+  /* add path if a wav file, or the wav files below it if a directory */
+
+  char rpath[PATH_MAX];
+  struct stat st;
+  struct dirent* de;
+  DIR* dir;
+  size_t len;
+  int err = 0;
+
+  if (realpath(path, rpath) == NULL) return -1;
+  if (stat(rpath, &st)) return -1;
+
+  if (S_ISREG(st.st_mode))
+  {
+    len = strlen(rpath);
+    if ((len < 4) || strcasecmp(rpath + len - 4, ".wav")) return 0;
+    return fp_list_add
+      (l, rpath, (uint64_t)st.st_size, (int64_t)st.st_mtime);
+  }
+
+  if (S_ISDIR(st.st_mode) == 0) return 0;
+
+  dir = opendir(rpath);
+  if (dir == NULL) return -1;
+
+  while ((de = readdir(dir)) != NULL)
+  {
+    char sub[PATH_MAX];
+
+    if (de->d_name[0] == '.') continue ;
+    if ((size_t)snprintf(sub, sizeof(sub), "%s/%s", rpath, de->d_name)
+	>= sizeof(sub))
+      continue ;
+
+    if (fp_list_scan(l, sub))
+    {
+      err = -1;
+      break ;
+    }
+  }
+
+  closedir(dir);
+
+  return err;
+}
+
+
+/* index build */
+
+/* new files are handed out to the jobs one at a time. a job appends */
+/* the postings of its files to its own vector, and the batch ends once */
+/* the vectors hold about cmd->mem MB. the batch is then sorted and */
+/* merged with the current index into a new one. */
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  fp_entry_t** todo;
+  size_t ntodo;
+  size_t next;
+  size_t max_post;
+  size_t npost;
+
+  fftw_plan plan;
+  const double* win;
+
+} fp_build_t;
+
+typedef struct
+{
+  pthread_t thread;
+  fp_build_t* b;
+  fp_handle_t fp;
+  fp_vec_t posts;
+  int err;
+} fp_job_t;
+
+static void* fp_job_main(void* arg)
+{
+  fp_job_t* const job = arg;
+  fp_build_t* const b = job->b;
+  fp_entry_t* e;
+  wav_handle_t w;
+  size_t n;
+
+  while (1)
+  {
+    pthread_mutex_lock(&b->lock);
+    e = NULL;
+    if ((b->next != b->ntodo) && (b->npost < b->max_post))
+      e = b->todo[b->next++];
+    pthread_mutex_unlock(&b->lock);
+
+    if (e == NULL) break ;
+
+    /* prefetch the next file while hashing this one */
+    pthread_mutex_lock(&b->lock);
+    if (b->next != b->ntodo)
+    {
+      const int fd = open(b->todo[b->next]->path, O_RDONLY);
+      if (fd != -1)
+      {
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+      }
+    }
+    pthread_mutex_unlock(&b->lock);
+
+    if (wav_open(&w, e->path))
+    {
+      /* unreadable or unsupported, indexed as empty */
+      printf("skipping %s\n", e->path);
+      continue ;
+    }
+
+    madvise(w.data, w.size, MADV_SEQUENTIAL);
+
+    n = job->posts.n;
+    if (w.wsampl == 2)
+    {
+      if (fp_analyze(&job->fp, &job->posts, &w, e->fid)) job->err = -1;
+    }
+    else
+    {
+      printf("skipping %s\n", e->path);
+    }
+
+    wav_close(&w);
+
+    if (job->err) break ;
+
+    pthread_mutex_lock(&b->lock);
+    b->npost += job->posts.n - n;
+    pthread_mutex_unlock(&b->lock);
+  }
+
+  return NULL;
+}
+
+static int fp_post_cmp(const void* a, const void* b)
+{
+  const fp_post_t* const x = a;
+  const fp_post_t* const y = b;
+
+  if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+  if (x->fid != y->fid) return x->fid < y->fid ? -1 : 1;
+  if (x->t != y->t) return x->t < y->t ? -1 : 1;
+  return 0;
+}
+
+static int fp_write_index
+(
+ const char* path,
+ const fp_index_t* old,
+ const fp_list_t* l, size_t nfile,
+ const fp_post_t* posts, size_t nposts
+)
+{
+  /* merge the old postings of the valid files with the new ones. only */
+  /* the first nfile entries of l are written, the others are pending. */
+
+  const size_t ndir = ((size_t)1 << FP_DIR_BITS) + 1;
+  const unsigned int shift = FP_HASH_BITS - FP_DIR_BITS;
+  char tmp[PATH_MAX];
+  fp_header_t h;
+  fp_file_t f;
+  uint64_t* dir;
+  uint32_t* remap;
+  uint64_t off;
+  uint64_t npost;
+  size_t i;
+  size_t j;
+  size_t k;
+  size_t d;
+  FILE* file;
+  int err = -1;
+
+  if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp))
+    goto on_error_0;
+
+  dir = malloc(ndir * sizeof(uint64_t));
+  if (dir == NULL) goto on_error_0;
+
+  /* old fid to new fid, UINT32_MAX if dropped */
+  remap = malloc((old->h->nfile + 1) * sizeof(uint32_t));
+  if (remap == NULL) goto on_error_1;
+  for (i = 0; i != old->h->nfile; ++i) remap[i] = UINT32_MAX;
+  for (i = 0; i != nfile; ++i)
+  {
+    const fp_entry_t* const e = &l->p[i];
+    if (e->is_old) remap[e->is_old - 1] = e->fid;
+  }
+
+  file = fopen(tmp, "w");
+  if (file == NULL) goto on_error_2;
+
+  /* header, rewritten at the end */
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, FP_MAGIC, 8);
+  h.nfile = (uint32_t)nfile;
+  h.dir_bits = FP_DIR_BITS;
+  if (fwrite(&h, sizeof(h), 1, file) != 1) goto on_error_3;
+
+  /* file table then strings */
+
+  h.off_file = sizeof(h);
+  h.off_str = h.off_file + nfile * sizeof(fp_file_t);
+
+  for (i = 0, off = 0; i != nfile; ++i)
+  {
+    const fp_entry_t* const e = &l->p[i];
+    f.size = e->size;
+    f.mtime = e->mtime;
+    f.path_off = off;
+    f.path_len = (uint32_t)strlen(e->path);
+    f.pad = 0;
+    off += f.path_len + 1;
+    if (fwrite(&f, sizeof(f), 1, file) != 1) goto on_error_3;
+  }
+
+  for (i = 0; i != nfile; ++i)
+  {
+    const char* const s = l->p[i].path;
+    if (fwrite(s, strlen(s) + 1, 1, file) != 1) goto on_error_3;
+  }
+
+  /* postings, 8 bytes aligned */
+
+  h.off_post = (h.off_str + off + 7) & ~(uint64_t)7;
+  if (fseek(file, (long)h.off_post, SEEK_SET)) goto on_error_3;
+
+  i = 0;
+  j = 0;
+  d = 0;
+  npost = 0;
+  k = (size_t)old->h->npost;
+
+  while (1)
+  {
+    fp_post_t p;
+
+    /* skip old postings of dropped files */
+    while ((i != k) && (remap[old->posts[i].fid] == UINT32_MAX)) ++i;
+
+    if ((i == k) && (j == nposts)) break ;
+
+    if (i == k) p = posts[j++];
+    else
+    {
+      p = old->posts[i];
+      p.fid = remap[p.fid];
+      if ((j != nposts) && (fp_post_cmp(&posts[j], &p) < 0)) p = posts[j++];
+      else ++i;
+    }
+
+    for (; d <= (p.hash >> shift); ++d) dir[d] = npost;
+
+    if (fwrite(&p, sizeof(p), 1, file) != 1) goto on_error_3;
+    ++npost;
+  }
+
+  for (; d != ndir; ++d) dir[d] = npost;
+
+  h.npost = npost;
+  h.off_dir = h.off_post + npost * sizeof(fp_post_t);
+  if (fwrite(dir, sizeof(uint64_t), ndir, file) != ndir) goto on_error_3;
+
+  rewind(file);
+  if (fwrite(&h, sizeof(h), 1, file) != 1) goto on_error_3;
+
+  if (fflush(file)) goto on_error_3;
+  if (fsync(fileno(file))) goto on_error_3;
+
+  err = 0;
+
+ on_error_3:
+  if (fclose(file)) err = -1;
+  if (err == 0) err = rename(tmp, path);
+  if (err) unlink(tmp);
+ on_error_2:
+  free(remap);
+ on_error_1:
+  free(dir);
+ on_error_0:
+  return err;
+}
+
+static int fp_build_index(const cmd_handle_t* cmd)
+{
+  fp_index_t old;
+  fp_list_t l;
+  fp_build_t b;
+  fp_job_t* jobs;
+  fp_vec_t all;
+  double win[FP_N];
+  void* buf;
+  size_t nold;
+  size_t ninit;
+  size_t nthread;
+  size_t i;
+  size_t j;
+  double t;
+  int err = -1;
+
+  t = util_get_time();
+
+  l.p = NULL;
+  l.n = 0;
+  l.max = 0;
+
+  if (fp_index_open(&old, cmd->db)) fp_index_init_empty(&old);
+
+  /* old files first, then the scanned ones. unchanged files are kept, */
+  /* changed files are dropped from the old ones and hashed again. */
+
+  for (i = 0; i != old.h->nfile; ++i)
+  {
+    const fp_file_t* const f = &old.files[i];
+    if (fp_list_add(&l, old.strs + f->path_off, f->size, f->mtime))
+      goto on_error_0;
+    l.p[i].is_old = (unsigned int)(i + 1);
+  }
+
+  for (i = 0; i != cmd->nipath; ++i)
+  {
+    if (fp_list_scan(&l, cmd->ipaths[i])) goto on_error_0;
+  }
+
+  for (i = old.h->nfile; i != l.n; ++i)
+  {
+    fp_entry_t* const e = &l.p[i];
+
+    for (j = 0; j != i; ++j)
+    {
+      if (l.p[j].is_valid == 0) continue ;
+      if (strcmp(l.p[j].path, e->path) == 0) break ;
+    }
+
+    if (j == i) continue ;
+
+    if (l.p[j].is_old &&
+	((l.p[j].size != e->size) || (l.p[j].mtime != e->mtime)))
+    {
+      l.p[j].is_valid = 0;
+      continue ;
+    }
+
+    /* unchanged, or listed twice */
+    e->is_valid = 0;
+  }
+
+  /* compact, fids follow the list order and new files come last */
+
+  nold = 0;
+  for (i = 0, j = 0; i != l.n; ++i)
+  {
+    if (l.p[i].is_valid == 0)
+    {
+      free(l.p[i].path);
+      continue ;
+    }
+    if (l.p[i].is_old) ++nold;
+    l.p[j] = l.p[i];
+    l.p[j].fid = (uint32_t)j;
+    ++j;
+  }
+  l.n = j;
+
+  b.todo = malloc((l.n + 1) * sizeof(fp_entry_t*));
+  if (b.todo == NULL) goto on_error_0;
+  b.ntodo = 0;
+  for (i = nold; i != l.n; ++i) b.todo[b.ntodo++] = &l.p[i];
+
+  printf("%zu files indexed, %zu to hash\n", nold, b.ntodo);
+
+  if ((b.ntodo == 0) && (nold == (size_t)old.h->nfile) && old.data)
+  {
+    err = 0;
+    goto on_error_1;
+  }
+
+  /* plan once, execute from all the jobs */
+
+  for (i = 0; i != FP_N; ++i)
+    win[i] = 0.5 - 0.5 * cos((2.0 * M_PI * (double)i) / (double)FP_N);
+
+  buf = fftw_malloc((FP_N / 2 + 1) * sizeof(fftw_complex));
+  if (buf == NULL) goto on_error_1;
+  b.plan = fftw_plan_dft_r2c_1d(FP_N, buf, buf, FFTW_ESTIMATE);
+  fftw_free(buf);
+  if (b.plan == NULL) goto on_error_1;
+  b.win = win;
+
+  b.next = 0;
+  b.max_post = (cmd->mem << 20) / sizeof(fp_post_t);
+
+  if (pthread_mutex_init(&b.lock, NULL)) goto on_error_2;
+
+  jobs = malloc(cmd->njob * sizeof(fp_job_t));
+  if (jobs == NULL) goto on_error_3;
+
+  for (ninit = 0; ninit != cmd->njob; ++ninit)
+  {
+    fp_job_t* const job = &jobs[ninit];
+    job->b = &b;
+    job->fp.plan = b.plan;
+    job->fp.win = b.win;
+    job->fp.buf = fftw_malloc((FP_N / 2 + 1) * sizeof(fftw_complex));
+    if (job->fp.buf == NULL) goto on_error_4;
+    fp_vec_init(&job->posts);
+    job->err = 0;
+  }
+
+  do
+  {
+    /* one batch, at least one file */
+
+    b.npost = 0;
+
+    for (nthread = 1; nthread != cmd->njob; ++nthread)
+    {
+      fp_job_t* const job = &jobs[nthread];
+      if (pthread_create(&job->thread, NULL, fp_job_main, job)) break ;
+    }
+
+    fp_job_main(&jobs[0]);
+
+    for (i = 1; i != nthread; ++i) pthread_join(jobs[i].thread, NULL);
+
+    for (i = 0; i != cmd->njob; ++i) if (jobs[i].err) goto on_error_4;
+
+    /* gather, sort and merge. files not hashed yet are pending and */
+    /* not part of this index version. */
+
+    fp_vec_init(&all);
+    for (i = 0; i != cmd->njob; ++i)
+    {
+      fp_vec_t* const v = &jobs[i].posts;
+      for (j = 0; j != v->n; ++j)
+      {
+	if (fp_vec_push(&all, v->p[j].hash, v->p[j].fid, v->p[j].t))
+	{
+	  fp_vec_fini(&all);
+	  goto on_error_4;
+	}
+      }
+      fp_vec_fini(v);
+      fp_vec_init(v);
+    }
+
+    qsort(all.p, all.n, sizeof(fp_post_t), fp_post_cmp);
+
+    err = fp_write_index(cmd->db, &old, &l, nold + b.next, all.p, all.n);
+    fp_vec_fini(&all);
+    if (err) goto on_error_4;
+    err = -1;
+
+    printf
+    (
+     "%zu / %zu files hashed, %zu postings\n",
+     b.next, b.ntodo, (size_t)b.npost
+    );
+
+    /* the new index becomes the old one */
+
+    if (old.data != NULL) fp_index_close(&old);
+    if (fp_index_open(&old, cmd->db))
+    {
+      fp_index_init_empty(&old);
+      goto on_error_4;
+    }
+
+    for (i = 0; i != (nold + b.next); ++i)
+      l.p[i].is_old = (unsigned int)(i + 1);
+
+  } while (b.next != b.ntodo);
+
+  printf("done in %.3f s\n", util_get_time() - t);
+
+  err = 0;
+
+ on_error_4:
+  for (i = 0; i != ninit; ++i)
+  {
+    fftw_free(jobs[i].fp.buf);
+    fp_vec_fini(&jobs[i].posts);
+  }
+  free(jobs);
+ on_error_3:
+  pthread_mutex_destroy(&b.lock);
+ on_error_2:
+  fftw_destroy_plan(b.plan);
+ on_error_1:
+  free(b.todo);
+ on_error_0:
+  if (old.data != NULL) fp_index_close(&old);
+  fp_list_fini(&l);
+  return err;
+}
+
+
+/* query */
+
+/* every hash of the clip looks its postings up through the directory. */
+/* a match votes for its file and its time offset relative to the clip, */
+/* votes are then counted by sorting them. */
+
+typedef struct
+{
+  uint32_t fid;
+  int32_t off;
+  size_t nvote;
+} fp_match_t;
+
+static int fp_vote_cmp(const void* a, const void* b)
+{
+  const uint64_t x = *(const uint64_t*)a;
+  const uint64_t y = *(const uint64_t*)b;
+  if (x != y) return x < y ? -1 : 1;
+  return 0;
+}
+
+static int fp_query(const cmd_handle_t* cmd)
+{
+  const unsigned int shift = FP_HASH_BITS - FP_DIR_BITS;
+  fp_index_t x;
+  fp_handle_t fp;
+  fp_vec_t q;
+  fp_match_t* matches;
+  uint64_t* votes;
+  size_t nvote;
+  size_t maxvote;
+  wav_handle_t w;
+  double win[FP_N];
+  double t;
+  size_t i;
+  size_t j;
+  size_t k;
+  int err = -1;
+
+  if (cmd->nipath != 1) goto on_error_0;
+
+  if (fp_index_open(&x, cmd->db)) goto on_error_0;
+
+  if (wav_open(&w, cmd->ipaths[0])) goto on_error_1;
+  if (w.wsampl != 2) goto on_error_2;
+
+  t = util_get_time();
+
+  for (i = 0; i != FP_N; ++i)
+    win[i] = 0.5 - 0.5 * cos((2.0 * M_PI * (double)i) / (double)FP_N);
+  fp.win = win;
+
+  fp.buf = fftw_malloc((FP_N / 2 + 1) * sizeof(fftw_complex));
+  if (fp.buf == NULL) goto on_error_2;
+  fp.plan = fftw_plan_dft_r2c_1d(FP_N, fp.buf, fp.buf, FFTW_ESTIMATE);
+  if (fp.plan == NULL) goto on_error_3;
+
+  fp_vec_init(&q);
+  if (fp_analyze(&fp, &q, &w, 0)) goto on_error_4;
+
+  /* collect votes, keyed by fid then offset */
+
+  nvote = 0;
+  maxvote = 4096;
+  votes = malloc(maxvote * sizeof(uint64_t));
+  if (votes == NULL) goto on_error_4;
+
+  for (i = 0; i != q.n; ++i)
+  {
+    const uint32_t h = q.p[i].hash;
+    const uint64_t lo = x.dir[h >> shift];
+    const uint64_t hi = x.dir[(h >> shift) + 1];
+
+    for (j = (size_t)lo; j != (size_t)hi; ++j)
+    {
+      const fp_post_t* const p = &x.posts[j];
+      uint32_t off;
+
+      if (p->hash < h) continue ;
+      if (p->hash > h) break ;
+
+      if (nvote == maxvote)
+      {
+	uint64_t* const tmp = realloc(votes, 2 * maxvote * sizeof(uint64_t));
+	if (tmp == NULL) goto on_error_5;
+	votes = tmp;
+	maxvote *= 2;
+      }
+
+      /* biased offset, so that clips starting before 0 sort correctly */
+      off = (uint32_t)((int64_t)p->t - (int64_t)q.p[i].t + 0x80000000LL);
+      votes[nvote++] = ((uint64_t)p->fid << 32) | (uint64_t)off;
+    }
+  }
+
+  qsort(votes, nvote, sizeof(uint64_t), fp_vote_cmp);
+
+  /* best runs, one per file */
+
+  matches = calloc(x.h->nfile + 1, sizeof(fp_match_t));
+  if (matches == NULL) goto on_error_5;
+
+  for (i = 0; i != nvote; i = j)
+  {
+    fp_match_t* m;
+
+    for (j = i + 1; (j != nvote) && (votes[j] == votes[i]); ++j) ;
+
+    m = &matches[votes[i] >> 32];
+    if ((j - i) <= m->nvote) continue ;
+    m->fid = (uint32_t)(votes[i] >> 32);
+    m->off = (int32_t)((int64_t)(uint32_t)votes[i] - 0x80000000LL);
+    m->nvote = j - i;
+  }
+
+  t = util_get_time() - t;
+
+  printf
+  (
+   "%zu hashes, %zu candidates, %.3f ms\n",
+   q.n, nvote, t * 1000.0
+  );
+
+  for (k = 0; k != cmd->nmatch; ++k)
+  {
+    fp_match_t* best = NULL;
+    double sec;
+
+    for (i = 0; i != x.h->nfile; ++i)
+    {
+      if (matches[i].nvote == 0) continue ;
+      if ((best == NULL) || (matches[i].nvote > best->nvote))
+	best = &matches[i];
+    }
+
+    if (best == NULL) break ;
+
+    sec = ((double)best->off * FP_HOP) / (double)FP_RATE;
+    printf
+    (
+     "%zu votes, at %.2f s, %s\n",
+     best->nvote, sec, x.strs + x.files[best->fid].path_off
+    );
+
+    best->nvote = 0;
+  }
+
+  err = 0;
+
+  free(matches);
+ on_error_5:
+  free(votes);
+ on_error_4:
+  fp_vec_fini(&q);
+  fftw_destroy_plan(fp.plan);
+ on_error_3:
+  fftw_free(fp.buf);
+ on_error_2:
+  wav_close(&w);
+ on_error_1:
+  fp_index_close(&x);
+ on_error_0:
+  return err;
+}
+
+
+/* main */
+
+int main(int ac, char** av)
+{
+  cmd_handle_t cmd;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if ((cmd.flags & CMD_FLAG_DB) == 0)
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (cmd.flags & CMD_FLAG_INDEX)
+  {
+    err = fp_build_index(&cmd);
+  }
+  else if (cmd.flags & CMD_FLAG_QUERY)
+  {
+    err = fp_query(&cmd);
+  }
+
+  if (err) PERROR();
+
+ on_error_0:
+  return err;
+}
@@ -2,15 +2,43 @@
 /* http://www.alsa-project.org/alsa-doc/alsa-lib/pcm.html */
 
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
+#include <math.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
 #include <alsa/asoundlib.h>
 #include <fftw3.h>
+#include "meter.h"
+#include "resampl.h"
+#include "wav.h"
+#include "wav_io.h"
+#include "wav_fmt.h"
+#include "trace.h"
+#include "stats.h"
+#include "arena.h"
+#include "fanout.h"
+#include "simd.h"
+#include "fixed.h"
+#include "util.h"
 
 
 #define PERROR(__s) \
@@ -28,8 +56,19 @@ static void on_sigint(int n)
 }
 
 
+static volatile unsigned int is_sigusr1 = 0;
+
+static void on_sigusr1(int n)
+{
+  is_sigusr1 = 1;
+}
+
+
 /* cmdline */
 
+/* seconds read ahead of the playback */
+#define PLAY_AHEAD_SECS 4
+
 enum cmdline_id
 {
   CMDLINE_ID_REC = 0,
@@ -38,6 +77,24 @@ enum cmdline_id
   CMDLINE_ID_OPCM,
   CMDLINE_ID_DUR,
   CMDLINE_ID_FILT,
+  CMDLINE_ID_METER,
+  CMDLINE_ID_IRATE,
+  CMDLINE_ID_ORATE,
+  CMDLINE_ID_OPATH,
+  CMDLINE_ID_ODIRECT,
+  CMDLINE_ID_IPATH,
+  CMDLINE_ID_AHEAD,
+  CMDLINE_ID_SEEK,
+  CMDLINE_ID_NCHAN,
+  CMDLINE_ID_FMT,
+  CMDLINE_ID_STATS,
+  CMDLINE_ID_DRIFT,
+  CMDLINE_ID_LATENCY,
+  CMDLINE_ID_TRACE,
+  CMDLINE_ID_SHM,
+  CMDLINE_ID_CTL,
+  CMDLINE_ID_FANOUT,
+  CMDLINE_ID_FIXED,
   CMDLINE_ID_INVALID = 32
 };
 
@@ -49,6 +106,19 @@ typedef struct
   const char* ipcm;
   const char* opcm;
   unsigned int dur_ms;
+  unsigned int irate;
+  unsigned int orate;
+  const char* opath;
+  const char* ipath;
+  size_t ahead_s;
+  uint64_t seek;
+  size_t nchan;
+  uint32_t fmts;
+  unsigned int latency_ms;
+  const char* trace;
+  const char* shm;
+  const char* ctl;
+  const char* fanout;
 } cmdline_t;
 
 static int get_cmdline(cmdline_t* cmd, int ac, char** av)
@@ -59,6 +129,19 @@ static int get_cmdline(cmdline_t* cmd, int ac, char** av)
   cmd->ipcm = NULL;
   cmd->opcm = NULL;
   cmd->dur_ms = 0;
+  cmd->irate = 44100;
+  cmd->orate = 44100;
+  cmd->opath = NULL;
+  cmd->ipath = NULL;
+  cmd->ahead_s = PLAY_AHEAD_SECS;
+  cmd->seek = 0;
+  cmd->nchan = 1;
+  cmd->fmts = (uint32_t)-1;
+  cmd->latency_ms = 0;
+  cmd->trace = NULL;
+  cmd->shm = NULL;
+  cmd->ctl = NULL;
+  cmd->fanout = NULL;
 
   if ((ac % 2)) goto on_error;
 
@@ -88,6 +171,122 @@ static int get_cmdline(cmdline_t* cmd, int ac, char** av)
       if (strcmp(v, "yes") == 0) cmd->flags |= CMDLINE_FLAG(FILT);
       else cmd->flags &= ~CMDLINE_FLAG(FILT);
     }
+    else if (strcmp(k, "-meter") == 0)
+    {
+      if (strcmp(v, "yes") == 0) cmd->flags |= CMDLINE_FLAG(METER);
+      else cmd->flags &= ~CMDLINE_FLAG(METER);
+    }
+    else if (strcmp(k, "-irate") == 0)
+    {
+      cmd->flags |= CMDLINE_FLAG(IRATE);
+      cmd->irate = (unsigned int)strtoul(v, NULL, 10);
+      if (cmd->irate == 0) goto on_error;
+    }
+    else if (strcmp(k, "-orate") == 0)
+    {
+      cmd->flags |= CMDLINE_FLAG(ORATE);
+      cmd->orate = (unsigned int)strtoul(v, NULL, 10);
+      if (cmd->orate == 0) goto on_error;
+    }
+    else if (strcmp(k, "-dur") == 0)
+    {
+      /* in milliseconds */
+      cmd->flags |= CMDLINE_FLAG(DUR);
+      cmd->dur_ms = (unsigned int)strtoul(v, NULL, 10);
+      if (cmd->dur_ms == 0) goto on_error;
+    }
+    else if (strcmp(k, "-opath") == 0)
+    {
+      cmd->flags |= CMDLINE_FLAG(OPATH);
+      cmd->opath = v;
+    }
+    else if (strcmp(k, "-odirect") == 0)
+    {
+      if (strcmp(v, "yes") == 0) cmd->flags |= CMDLINE_FLAG(ODIRECT);
+      else cmd->flags &= ~CMDLINE_FLAG(ODIRECT);
+    }
+    else if (strcmp(k, "-ipath") == 0)
+    {
+      cmd->flags |= CMDLINE_FLAG(IPATH);
+      cmd->ipath = v;
+    }
+    else if (strcmp(k, "-ahead") == 0)
+    {
+      /* in seconds */
+      cmd->flags |= CMDLINE_FLAG(AHEAD);
+      cmd->ahead_s = (size_t)strtoul(v, NULL, 10);
+      if (cmd->ahead_s == 0) goto on_error;
+    }
+    else if (strcmp(k, "-seek") == 0)
+    {
+      /* in frames */
+      cmd->flags |= CMDLINE_FLAG(SEEK);
+      cmd->seek = (uint64_t)strtoull(v, NULL, 10);
+    }
+    else if (strcmp(k, "-nchan") == 0)
+    {
+      /* requested, the device may give another count */
+      cmd->flags |= CMDLINE_FLAG(NCHAN);
+      cmd->nchan = (size_t)strtoul(v, NULL, 10);
+      if (cmd->nchan == 0) goto on_error;
+    }
+    else if (strcmp(k, "-fmt") == 0)
+    {
+      /* restricts the capture format, negotiated otherwise */
+      unsigned int f;
+      for (f = 0; f != WAV_FMT_COUNT; ++f)
+	if (strcasecmp(v, wav_fmt_get_name(f)) == 0) break ;
+      if (f == WAV_FMT_COUNT) goto on_error;
+      cmd->flags |= CMDLINE_FLAG(FMT);
+      cmd->fmts = 1 << f;
+    }
+    else if (strcmp(k, "-stats") == 0)
+    {
+      if (strcmp(v, "yes") == 0) cmd->flags |= CMDLINE_FLAG(STATS);
+      else cmd->flags &= ~CMDLINE_FLAG(STATS);
+    }
+    else if (strcmp(k, "-drift") == 0)
+    {
+      if (strcmp(v, "yes") == 0) cmd->flags |= CMDLINE_FLAG(DRIFT);
+      else cmd->flags &= ~CMDLINE_FLAG(DRIFT);
+    }
+    else if (strcmp(k, "-latency") == 0)
+    {
+      /* in milliseconds, from capture to playback */
+      cmd->flags |= CMDLINE_FLAG(LATENCY);
+      cmd->latency_ms = (unsigned int)strtoul(v, NULL, 10);
+      if (cmd->latency_ms == 0) goto on_error;
+    }
+    else if (strcmp(k, "-trace") == 0)
+    {
+      /* dumped there on SIGUSR1 and at exit */
+      cmd->flags |= CMDLINE_FLAG(TRACE);
+      cmd->trace = v;
+    }
+    else if (strcmp(k, "-shm") == 0)
+    {
+      /* statistics segment name, for stats/ to read */
+      cmd->flags |= CMDLINE_FLAG(SHM);
+      cmd->shm = v;
+    }
+    else if (strcmp(k, "-ctl") == 0)
+    {
+      /* control socket path, implies the modifier */
+      cmd->flags |= CMDLINE_FLAG(CTL);
+      cmd->ctl = v;
+    }
+    else if (strcmp(k, "-fanout") == 0)
+    {
+      /* processed stream segment name, for fanout/ clients */
+      cmd->flags |= CMDLINE_FLAG(FANOUT);
+      cmd->fanout = v;
+    }
+    else if (strcmp(k, "-fixed") == 0)
+    {
+      /* the modifier in fixed point, on S16 capture */
+      if (strcmp(v, "yes") == 0) cmd->flags |= CMDLINE_FLAG(FIXED);
+      else cmd->flags &= ~CMDLINE_FLAG(FIXED);
+    }
     else goto on_error;
   }
 
@@ -110,14 +309,43 @@ typedef struct
   size_t nchan;
   size_t wchan;
   size_t scale;
+  unsigned int fsampl;
+  unsigned int fmt;
 
+  /* in the device format */
   uint8_t* buf;
   size_t rpos;
   size_t wpos;
   size_t nsampl;
 
+  /* nchan rows of PCM_NPLANAR frames, for conversions */
+  double* planar;
+
 } pcm_handle_t;
 
+#define PCM_NPLANAR 4096
+
+/* frames per wakeup */
+#define PCM_NPERIOD 1024
+
+/* native formats. a device taking several is given the first one */
+
+static const struct
+{
+  unsigned int fmt;
+  snd_pcm_format_t snd;
+} pcm_fmts[] =
+{
+  { WAV_FMT_S32, SND_PCM_FORMAT_S32_LE },
+  { WAV_FMT_FLOAT, SND_PCM_FORMAT_FLOAT_LE },
+  { WAV_FMT_S24, SND_PCM_FORMAT_S24_LE },
+  { WAV_FMT_S24_3, SND_PCM_FORMAT_S24_3LE },
+  { WAV_FMT_S16, SND_PCM_FORMAT_S16_LE }
+};
+
+#define PCM_NFMT (sizeof(pcm_fmts) / sizeof(pcm_fmts[0]))
+#define PCM_FMT_MASK(__f) (1 << (uint32_t)(__f))
+
 
 typedef struct
 {
@@ -127,6 +355,9 @@ typedef struct
   const char* name;
   size_t nchan;
   unsigned int fsampl;
+  /* accepted formats, and the preferred one if in the mask */
+  uint32_t fmts;
+  unsigned int fmt;
 } pcm_desc_t;
 
 
@@ -136,20 +367,52 @@ static void pcm_init_desc(pcm_desc_t* desc)
   desc->name = "default";
   desc->nchan = 1;
   desc->fsampl = 44100;
+  desc->fmts = (uint32_t)-1;
+  desc->fmt = WAV_FMT_COUNT;
 }
 
 
-static int pcm_open(pcm_handle_t* pcm, const pcm_desc_t* desc)
+static int pcm_find_fmt(pcm_handle_t* pcm, const pcm_desc_t* desc)
+{
+  /* the preferred format if the device takes it, else the first one */
+
+  size_t i;
+
+  for (i = 0; i != PCM_NFMT; ++i)
+  {
+    if (pcm_fmts[i].fmt != desc->fmt) continue ;
+    if ((desc->fmts & PCM_FMT_MASK(desc->fmt)) == 0) break ;
+    if (snd_pcm_hw_params_test_format
+	(pcm->pcm, pcm->hw_params, pcm_fmts[i].snd) == 0)
+      return (int)i;
+  }
+
+  for (i = 0; i != PCM_NFMT; ++i)
+  {
+    if ((desc->fmts & PCM_FMT_MASK(pcm_fmts[i].fmt)) == 0) continue ;
+    if (snd_pcm_hw_params_test_format
+	(pcm->pcm, pcm->hw_params, pcm_fmts[i].snd) == 0)
+      return (int)i;
+  }
+
+  return -1;
+}
+
+
+#define PCM_NO_FMT (-2)
+
+static int pcm_open_hw(pcm_handle_t* pcm, const pcm_desc_t* desc, int mode)
 {
-  const snd_pcm_format_t fmt = SND_PCM_FORMAT_S16_LE;
+  /* open, and fill hw_params up to the format. return the format index */
+  /* in pcm_fmts, PCM_NO_FMT if the pcm takes none of desc, -1 on error */
+
   snd_pcm_stream_t stm;
   int err;
 
   if (desc->flags & PCM_FLAG_IN) stm = SND_PCM_STREAM_CAPTURE;
   else stm = SND_PCM_STREAM_PLAYBACK;
 
-  err = snd_pcm_open
-    (&pcm->pcm, desc->name, stm, SND_PCM_NONBLOCK);
+  err = snd_pcm_open(&pcm->pcm, desc->name, stm, mode);
   if (err) PERROR_GOTO(snd_strerror(err), on_error_0);
 
   err = snd_pcm_hw_params_malloc(&pcm->hw_params);
@@ -162,21 +425,63 @@ static int pcm_open(pcm_handle_t* pcm, const pcm_desc_t* desc)
     (pcm->pcm, pcm->hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
   if (err) PERROR_GOTO(snd_strerror(err), on_error_2);
 
+  err = pcm_find_fmt(pcm, desc);
+  if (err >= 0) return err;
+
+  err = PCM_NO_FMT;
+
+ on_error_2:
+  snd_pcm_hw_params_free(pcm->hw_params);
+ on_error_1:
+  snd_pcm_close(pcm->pcm);
+ on_error_0:
+  return (err == PCM_NO_FMT) ? PCM_NO_FMT : -1;
+}
+
+
+static int pcm_open(pcm_handle_t* pcm, const pcm_desc_t* desc)
+{
+  snd_pcm_format_t fmt;
+  unsigned int nchan;
+  unsigned int rate;
+  int err;
+
+  /* the native format, so that alsa-lib does not convert. plug pcms, */
+  /* default among them, take any format and convert it: the formats */
+  /* are first tested without automatic conversion, so that only those */
+  /* of the slave are. if desc allows none of them, alsa-lib converts. */
+
+  err = pcm_open_hw(pcm, desc, SND_PCM_NONBLOCK | SND_PCM_NO_AUTO_FORMAT);
+  if (err == PCM_NO_FMT) err = pcm_open_hw(pcm, desc, SND_PCM_NONBLOCK);
+  if (err == PCM_NO_FMT) PERROR_GOTO("no supported format", on_error_0);
+  if (err < 0) goto on_error_0;
+  pcm->fmt = pcm_fmts[err].fmt;
+  fmt = pcm_fmts[err].snd;
+
   err = snd_pcm_hw_params_set_format(pcm->pcm, pcm->hw_params, fmt);
   if (err) PERROR_GOTO(snd_strerror(err), on_error_2);
 
-  err = snd_pcm_hw_params_set_rate
-    (pcm->pcm, pcm->hw_params, desc->fsampl, 0);
+  /* nor resample: the nearest rate the device runs at */
+
+  err = snd_pcm_hw_params_set_rate_resample(pcm->pcm, pcm->hw_params, 0);
   if (err) PERROR_GOTO(snd_strerror(err), on_error_2);
 
-  pcm->nchan = desc->nchan;
-  pcm->wchan = (size_t)snd_pcm_format_physical_width(fmt) / 8;
-  pcm->scale = pcm->nchan * pcm->wchan;
+  rate = desc->fsampl;
+  err = snd_pcm_hw_params_set_rate_near
+    (pcm->pcm, pcm->hw_params, &rate, NULL);
+  if (err) PERROR_GOTO(snd_strerror(err), on_error_2);
 
-  err = snd_pcm_hw_params_set_channels
-    (pcm->pcm, pcm->hw_params, desc->nchan);
+  /* the nearest count the device supports */
+  nchan = (unsigned int)desc->nchan;
+  err = snd_pcm_hw_params_set_channels_near
+    (pcm->pcm, pcm->hw_params, &nchan);
   if (err) PERROR_GOTO(snd_strerror(err), on_error_2);
-  
+
+  pcm->nchan = (size_t)nchan;
+  pcm->fsampl = rate;
+  pcm->wchan = wav_fmt_get_width(pcm->fmt);
+  pcm->scale = pcm->nchan * pcm->wchan;
+
   err = snd_pcm_hw_params(pcm->pcm, pcm->hw_params);
   if (err) PERROR_GOTO(snd_strerror(err), on_error_2);
 
@@ -188,7 +493,7 @@ static int pcm_open(pcm_handle_t* pcm, const pcm_desc_t* desc)
 
 #if 1
   err = snd_pcm_sw_params_set_avail_min
-    (pcm->pcm, pcm->sw_params, 1024);
+    (pcm->pcm, pcm->sw_params, PCM_NPERIOD);
   if (err) PERROR_GOTO(snd_strerror(err), on_error_3);
 #endif
 
@@ -204,11 +509,12 @@ static int pcm_open(pcm_handle_t* pcm, const pcm_desc_t* desc)
   err = snd_pcm_prepare(pcm->pcm);
   if (err) PERROR_GOTO(snd_strerror(err), on_error_3);
 
+  /* buffers are taken by pcm_alloc, once the session is sized */
   pcm->rpos = 0;
   pcm->wpos = 0;
-  pcm->nsampl = (size_t)desc->fsampl * 10;
-  pcm->buf = malloc(pcm->nsampl * pcm->scale);
-  if (pcm->buf == NULL) goto on_error_3;
+  pcm->nsampl = (size_t)pcm->fsampl * 10;
+  pcm->buf = NULL;
+  pcm->planar = NULL;
 
   return 0;
 
@@ -216,7 +522,6 @@ static int pcm_open(pcm_handle_t* pcm, const pcm_desc_t* desc)
   snd_pcm_sw_params_free(pcm->sw_params);
  on_error_2:
   snd_pcm_hw_params_free(pcm->hw_params);
- on_error_1:
   snd_pcm_close(pcm->pcm);
  on_error_0:
   return -1;
@@ -224,9 +529,29 @@ static int pcm_open(pcm_handle_t* pcm, const pcm_desc_t* desc)
 }
 
 
+static size_t pcm_get_size(const pcm_handle_t* pcm)
+{
+  return
+    arena_get_size(pcm->nsampl * pcm->scale) +
+    arena_get_size(pcm->nchan * PCM_NPLANAR * sizeof(double));
+}
+
+
+static int pcm_alloc(pcm_handle_t* pcm, arena_handle_t* arena)
+{
+  pcm->buf = arena_alloc(arena, pcm->nsampl * pcm->scale);
+  if (pcm->buf == NULL) return -1;
+
+  pcm->planar = arena_alloc(arena, pcm->nchan * PCM_NPLANAR * sizeof(double));
+  if (pcm->planar == NULL) return -1;
+
+  return 0;
+}
+
+
 static void pcm_close(pcm_handle_t* pcm)
 {
-  free(pcm->buf);
+  /* buffers go with the arena */
   snd_pcm_hw_params_free(pcm->hw_params);
   snd_pcm_sw_params_free(pcm->sw_params);
   snd_pcm_close(pcm->pcm);
@@ -235,10 +560,149 @@ static void pcm_close(pcm_handle_t* pcm)
 
 static int pcm_start(pcm_handle_t* pcm)
 {
+  /* playback starts on its first write, rather than empty */
+  if (snd_pcm_stream(pcm->pcm) == SND_PCM_STREAM_PLAYBACK) return 0;
   return snd_pcm_start(pcm->pcm);
 }
 
 
+static size_t pcm_queue
+(
+ pcm_handle_t* pcm, resampl_handle_t* r,
+ const double* buf, size_t dist, size_t n
+)
+{
+  /* queue n frames at the input rate, from nchan rows dist apart, for */
+  /* pcm_flush. if r is not NULL, they are first converted to the pcm */
+  /* rate. samples are then converted once, to the pcm format, into the */
+  /* ring of pcm->buf. return the count of frames dropped, if full. */
+
+  const double* p;
+  size_t pdist;
+  size_t nfree;
+  size_t nout;
+  size_t ndrop = 0;
+  size_t i;
+  size_t j;
+  size_t k;
+
+  while (n)
+  {
+    k = n;
+    if (k > PCM_NPLANAR) k = PCM_NPLANAR;
+    nout = k;
+    p = buf;
+    pdist = dist;
+
+    if (r != NULL)
+    {
+      /* bounded so that outputs fit in pcm->planar */
+      if (resampl_get_max_out(r, k) > PCM_NPLANAR)
+	k = resampl_get_max_in(r, PCM_NPLANAR);
+      nout = resampl_planar(r, pcm->planar, PCM_NPLANAR, buf, dist, k);
+      p = pcm->planar;
+      pdist = PCM_NPLANAR;
+    }
+
+    /* one frame is kept free, to tell full from empty */
+    nfree = (pcm->rpos + pcm->nsampl - pcm->wpos - 1) % pcm->nsampl;
+    if (nout > nfree)
+    {
+      ndrop += nout - nfree;
+      nout = nfree;
+    }
+
+    for (i = 0; i != nout; i += j)
+    {
+      j = pcm->nsampl - pcm->wpos;
+      if (j > (nout - i)) j = nout - i;
+      wav_fmt_from_planar
+      (
+       pcm->fmt, pcm->buf + pcm->wpos * pcm->scale,
+       p + i, pdist, pcm->nchan, j
+      );
+      pcm->wpos += j;
+      if (pcm->wpos == pcm->nsampl) pcm->wpos = 0;
+    }
+
+    buf += k;
+    n -= k;
+  }
+
+  return ndrop;
+}
+
+
+static int pcm_flush(pcm_handle_t* pcm)
+{
+  /* write queued frames, as many as the device takes without waiting. */
+  /* return 0, or a negative error as writei. */
+
+  snd_pcm_sframes_t err;
+  size_t n;
+
+  while (pcm->rpos != pcm->wpos)
+  {
+    if (pcm->wpos > pcm->rpos) n = pcm->wpos - pcm->rpos;
+    else n = pcm->nsampl - pcm->rpos;
+
+    err = snd_pcm_writei(pcm->pcm, pcm->buf + pcm->rpos * pcm->scale, n);
+    if (err == -EAGAIN) break ;
+    if (err < 0) return (int)err;
+
+    pcm->rpos += (size_t)err;
+    if (pcm->rpos == pcm->nsampl) pcm->rpos = 0;
+    if ((size_t)err != n) break ;
+  }
+
+  return 0;
+}
+
+
+static size_t pcm_get_queued(const pcm_handle_t* pcm)
+{
+  return (pcm->wpos + pcm->nsampl - pcm->rpos) % pcm->nsampl;
+}
+
+
+static void pcm_pad(pcm_handle_t* pcm, size_t n)
+{
+  /* queue n frames of silence, all zero bytes in any format */
+
+  size_t nfree;
+  size_t k;
+
+  nfree = (pcm->rpos + pcm->nsampl - pcm->wpos - 1) % pcm->nsampl;
+  if (n > nfree) n = nfree;
+
+  for (; n; n -= k)
+  {
+    k = pcm->nsampl - pcm->wpos;
+    if (k > n) k = n;
+    memset(pcm->buf + pcm->wpos * pcm->scale, 0, k * pcm->scale);
+    pcm->wpos += k;
+    if (pcm->wpos == pcm->nsampl) pcm->wpos = 0;
+  }
+}
+
+
+static void pcm_meter
+(pcm_handle_t* pcm, meter_handle_t* meter, const uint8_t* buf, size_t n)
+{
+  /* n frames of buf, in the pcm format, through pcm->planar */
+
+  size_t k;
+
+  for (; n; n -= k, buf += k * pcm->scale)
+  {
+    k = n;
+    if (k > PCM_NPLANAR) k = PCM_NPLANAR;
+    wav_fmt_to_planar(pcm->fmt, pcm->planar, PCM_NPLANAR, buf, pcm->nchan, k);
+    meter_add_planar(meter, pcm->planar, PCM_NPLANAR, k);
+  }
+}
+
+
 static int pcm_recover_xrun(pcm_handle_t* pcm, int err)
 {
   switch (err)
@@ -247,7 +711,7 @@ static int pcm_recover_xrun(pcm_handle_t* pcm, int err)
     /* underrun */
     err = snd_pcm_prepare(pcm->pcm);
     if (err < 0) PERROR_GOTO(snd_strerror(err), on_error);
-    snd_pcm_start(pcm->pcm);
+    pcm_start(pcm);
     break ;
 
   case -ESTRPIPE:
@@ -264,7 +728,7 @@ static int pcm_recover_xrun(pcm_handle_t* pcm, int err)
       if (err < 0) PERROR_GOTO(snd_strerror(err), on_error);
     }
 
-    snd_pcm_start(pcm->pcm);
+    pcm_start(pcm);
 
     break ;
 
@@ -277,36 +741,217 @@ static int pcm_recover_xrun(pcm_handle_t* pcm, int err)
 }
 
 
+static void pcm_init_stats(const pcm_handle_t* pcm, stats_dev_t* dev)
+{
+  dev->fsampl = pcm->fsampl;
+  dev->nchan = (uint32_t)pcm->nchan;
+  dev->size = pcm->nsampl;
+}
+
+
+static void pcm_get_stats(const pcm_handle_t* pcm, stats_dev_t* dev)
+{
+  /* frames in the device, and in the ring: not read yet for capture, */
+  /* not written yet for playback */
+
+  snd_pcm_sframes_t delay;
+
+  if (snd_pcm_delay(pcm->pcm, &delay) == 0) stats_add_delay(dev, delay);
+  stats_add_fill(dev, pcm_get_queued(pcm));
+}
+
+
+/* drift */
+/* http://kokkinizita.linuxaudio.org/papers/usingdll.pdf */
+
+/* capture and playback on different cards run from different clocks. */
+/* the time a frame spends in flight, from its capture to its playback, */
+/* is measured after each capture and steered to a target by trimming */
+/* the resampler ratio. the loop is of second order: its integral term */
+/* settles on the relative skew of the clocks. measurements are low */
+/* passed first, as device pointers often move by whole periods. */
+
+/* default target, in ms, and the least in capture periods: playback */
+/* must outlast the wait for the next one */
+#define DRIFT_LATENCY_MS 40
+#define DRIFT_MIN_PERIODS 2
+
+/* loop natural frequency and measurement low pass, in Hz */
+#define DRIFT_FN 0.01
+#define DRIFT_FC 0.05
+
+typedef struct
+{
+  /* target, in seconds */
+  double target;
+
+  /* loop gains */
+  double b;
+  double c;
+
+  /* low passed error, integral */
+  double z1;
+  double z2;
+
+  /* last update, 0 before the first */
+  double t;
+
+  double ratio;
+
+} drift_handle_t;
+
+
+static void drift_init(drift_handle_t* drift, double target)
+{
+  /* critically damped, for a natural pulsation w: b = 2 w, c = w^2 */
+
+  const double w = 2.0 * M_PI * DRIFT_FN;
+
+  drift->target = target;
+  drift->b = 2.0 * w;
+  drift->c = w * w;
+  drift->z1 = 0.0;
+  drift->z2 = 0.0;
+  drift->t = 0.0;
+  drift->ratio = 1.0;
+}
+
+
+static int drift_measure
+(const pcm_handle_t* ipcm, const pcm_handle_t* opcm, double* latency)
+{
+  /* seconds from the capture device pointer to the playback one: */
+  /* frames not read yet, read but not processed, queued, and written */
+  /* but not played. the resampler delay is constant, and left out. */
+
+  snd_pcm_sframes_t idelay;
+  snd_pcm_sframes_t odelay;
+  size_t n;
+
+  if (snd_pcm_delay(ipcm->pcm, &idelay)) return -1;
+  if (snd_pcm_delay(opcm->pcm, &odelay)) return -1;
+
+  n = (ipcm->wpos + ipcm->nsampl - ipcm->rpos) % ipcm->nsampl;
+
+  *latency =
+    ((double)idelay + (double)n) / (double)ipcm->fsampl +
+    ((double)odelay + (double)pcm_get_queued(opcm)) / (double)opcm->fsampl;
+
+  return 0;
+}
+
+
+static double drift_update(drift_handle_t* drift, double latency, double t)
+{
+  /* update with the latency measured at t, return the new ratio: */
+  /* output frames per input, relative to the nominal rates */
+
+  const double dt = t - drift->t;
+  const double e = latency - drift->target;
+
+  if (drift->t == 0.0)
+  {
+    drift->t = t;
+    return drift->ratio;
+  }
+
+  drift->t = t;
+
+  drift->z1 += (1.0 - exp(-2.0 * M_PI * DRIFT_FC * dt)) * (e - drift->z1);
+  drift->z2 += drift->c * dt * drift->z1;
+
+  /* no windup past what the resampler follows */
+  if (drift->z2 > RESAMPL_MAX_DEV) drift->z2 = RESAMPL_MAX_DEV;
+  else if (drift->z2 < -RESAMPL_MAX_DEV) drift->z2 = -RESAMPL_MAX_DEV;
+
+  /* too much in flight, fewer frames out */
+  drift->ratio = 1.0 - (drift->b * drift->z1 + drift->z2);
+
+  return drift->ratio;
+}
+
+
 /* modifier */
 /* http://www.fftw.org/doc/One_002dDimensional-DFTs-of-Real-Data.html */
 
+/* channels are deinterleaved into planar blocks, and transformed at */
+/* once by plans over nchan blocks: one execution per direction, for */
+/* any channel count. */
+
+/* spectra are scaled by a mask of n / 2 + 1 real gains. when it is */
+/* replaced, the block is transformed back with both masks, and the */
+/* outputs crossfaded over its length: no step between blocks. */
+
 typedef struct
 {
-  void* buf;
+  /* nchan blocks of n samples, dist apart, padded for in place r2c */
+  double* buf;
   fftw_plan fplan;
   fftw_plan bplan;
   size_t n;
+  size_t nchan;
+  size_t dist;
+
+  /* the mask in use, and buf under the mask replacing it */
+  double* mask;
+  double* xbuf;
+
 } mod_handle_t;
 
-static int mod_open(mod_handle_t* mod, size_t n)
+static size_t mod_get_size(size_t n, size_t nchan)
+{
+  const size_t dist = 2 * (n / 2 + 1);
+
+  return
+    2 * arena_get_size(nchan * dist * sizeof(double)) +
+    arena_get_size((n / 2 + 1) * sizeof(double));
+}
+
+static int mod_open
+(mod_handle_t* mod, size_t n, size_t nchan, arena_handle_t* arena)
 {
+  const int nn = (int)n;
+  size_t i;
+
   mod->n = n;
+  mod->nchan = nchan;
+  mod->dist = 2 * (n / 2 + 1);
 
-  mod->buf = fftw_malloc((n / 2 + 1) * sizeof(fftw_complex));
-  if (mod->buf == NULL) goto on_error_0;
+  /* arena blocks are aligned as fftw_malloc ones. xbuf has the layout */
+  /* of buf, for the plans to run on it. */
 
-  mod->fplan = fftw_plan_dft_r2c_1d(n, mod->buf, mod->buf, FFTW_ESTIMATE);
-  if (mod->fplan == NULL) goto on_error_1;
+  mod->buf = arena_alloc(arena, nchan * mod->dist * sizeof(double));
+  if (mod->buf == NULL) goto on_error_0;
 
-  mod->bplan = fftw_plan_dft_c2r_1d(n, mod->buf, mod->buf, FFTW_ESTIMATE);
-  if (mod->bplan == NULL) goto on_error_2;
+  mod->xbuf = arena_alloc(arena, nchan * mod->dist * sizeof(double));
+  if (mod->xbuf == NULL) goto on_error_0;
+
+  mod->mask = arena_alloc(arena, (n / 2 + 1) * sizeof(double));
+  if (mod->mask == NULL) goto on_error_0;
+  for (i = 0; i != (n / 2 + 1); ++i) mod->mask[i] = 1.0;
+
+  mod->fplan = fftw_plan_many_dft_r2c
+  (
+   1, &nn, (int)nchan,
+   mod->buf, NULL, 1, (int)mod->dist,
+   (fftw_complex*)mod->buf, NULL, 1, (int)mod->dist / 2,
+   FFTW_ESTIMATE
+  );
+  if (mod->fplan == NULL) goto on_error_0;
+
+  mod->bplan = fftw_plan_many_dft_c2r
+  (
+   1, &nn, (int)nchan,
+   (fftw_complex*)mod->buf, NULL, 1, (int)mod->dist / 2,
+   mod->buf, NULL, 1, (int)mod->dist,
+   FFTW_ESTIMATE
+  );
+  if (mod->bplan == NULL) goto on_error_1;
 
   return 0;
 
- on_error_2:
-  fftw_destroy_plan(mod->fplan);
  on_error_1:
-  fftw_free(mod->buf);
+  fftw_destroy_plan(mod->fplan);
  on_error_0:
   return -1;
 }
@@ -315,196 +960,2051 @@ static void mod_close(mod_handle_t* mod)
 {
   fftw_destroy_plan(mod->bplan);
   fftw_destroy_plan(mod->fplan);
-  fftw_free(mod->buf);
 }
 
-static size_t mod_apply
+static void mod_load
 (
- mod_handle_t* mod,
- uint8_t* buf, size_t size,
+ mod_handle_t* mod, unsigned int fmt,
+ const uint8_t* buf, size_t size,
  size_t off, size_t n
 )
 {
-  size_t i;
+  /* n frames from off of the ring buf of size frames, in the format */
+  /* fmt, into the planar block: the one conversion of the samples. a */
+  /* partial block is padded with zeros. */
 
-  if (n < mod->n) return 0;
-  n = mod->n;
+  const size_t fsize = mod->nchan * wav_fmt_get_width(fmt);
+  size_t k;
+  size_t c;
 
-  for (i = 0; i != n; ++i)
+  k = n;
+  if (k > (size - off)) k = size - off;
+  wav_fmt_to_planar
+    (fmt, mod->buf, mod->dist, buf + off * fsize, mod->nchan, k);
+
+  if (k != n)
   {
-    ((double*)mod->buf)[i] = (double)buf[(off + i) % size];
+    wav_fmt_to_planar
+      (fmt, mod->buf + k, mod->dist, buf, mod->nchan, n - k);
   }
 
-  fftw_execute(mod->fplan);
+  if (n == mod->n) return ;
 
-  /* TODO: process mod->buf, fftw_complex format */
+  for (c = 0; c != mod->nchan; ++c)
+    memset(mod->buf + c * mod->dist + n, 0, (mod->n - n) * sizeof(double));
+}
 
-  fftw_execute(mod->bplan);
+static void mod_mask(mod_handle_t* mod, double* buf, const double* mask)
+{
+  /* nchan spectra of n / 2 + 1 fftw_complex, interleaved re and im */
 
-  for (i = 0; i != n; ++i)
-  {
-    buf[(off + i) % size] = (int16_t)((double*)mod->buf)[i] / (int16_t)n;
-  }
+  size_t c;
 
-  return n;
+  for (c = 0; c != mod->nchan; ++c)
+    simd_mask(buf + c * mod->dist, mask, mod->n / 2 + 1);
 }
 
-
-#if 0 /* fir */
-
-__attribute__((unused))
-static int filter(pcm_handle_t* ipcm)
+static void mod_apply(mod_handle_t* mod, const double* xmask)
 {
-  static const double beta = 0.1;
-  double lfilt;
-  double rfilt;
-  size_t n;
+  /* xmask, if not NULL, replaces the mask from this block on */
+
+  const double scale = 1.0 / (double)mod->n;
+  double* p;
+  double* q;
+  double w;
   size_t i;
-  static size_t j = 0;
+  size_t c;
 
-  if (ipcm->wpos >= ipcm->rpos) n = ipcm->wpos - ipcm->rpos;
-  else n = ipcm->nsampl - ipcm->rpos;
+  fftw_execute(mod->fplan);
 
+  if (xmask != NULL)
   {
-    const size_t off = ipcm->rpos + 0 * ipcm->scale;
-    int16_t* const p = (int16_t*)(ipcm->buf + off);
+    memcpy(mod->xbuf, mod->buf, mod->nchan * mod->dist * sizeof(double));
+    mod_mask(mod, mod->xbuf, xmask);
+    fftw_execute_dft_c2r
+      (mod->bplan, (fftw_complex*)mod->xbuf, mod->xbuf);
+  }
+
+  mod_mask(mod, mod->buf, mod->mask);
+  fftw_execute(mod->bplan);
+
+  /* the transforms are unnormalized */
+
+  if (xmask == NULL)
+  {
+    for (c = 0; c != mod->nchan; ++c)
+    {
+      p = mod->buf + c * mod->dist;
+      for (i = 0; i != mod->n; ++i) p[i] *= scale;
+    }
+
+    return ;
+  }
+
+  for (c = 0; c != mod->nchan; ++c)
+  {
+    p = mod->buf + c * mod->dist;
+    q = mod->xbuf + c * mod->dist;
+    for (i = 0; i != mod->n; ++i)
+    {
+      w = (double)i / (double)mod->n;
+      p[i] = scale * (p[i] + w * (q[i] - p[i]));
+    }
+  }
+
+  memcpy(mod->mask, xmask, (mod->n / 2 + 1) * sizeof(double));
+}
+
+
+/* control */
+
+/* parameters are changed while running, over a unix socket, one */
+/* command per line, each answered by ok or error: */
+/*   bypass yes|no */
+/*   gain <dB> */
+/*   bands [<lo Hz>:<hi Hz>:<dB> ...], replacing all the bands */
+/*   seek <frame>, when playing a file */
+/* a thread serves the socket and turns parameters into a mask. masks */
+/* go through three buffers: the thread fills its back one and swaps */
+/* it with the middle one, the audio loop swaps its front one with the */
+/* middle one if fresh, at block boundaries. neither waits for the */
+/* other, and the audio loop takes no lock and allocates nothing. */
+
+#define CTL_NBAND 32
+#define CTL_LINE_SIZE 1024
+#define CTL_FRESH (1 << 2)
+#define CTL_SEEK_NONE ((uint64_t)-1)
+
+typedef struct
+{
+  double lo;
+  double hi;
+  double gain;
+} ctl_band_t;
+
+typedef struct
+{
+  unsigned int is_bypass;
+  double gain;
+  size_t nband;
+  ctl_band_t bands[CTL_NBAND];
+} ctl_params_t;
+
+typedef struct
+{
+  const char* path;
+  int lfd;
+  /* written to stop the thread */
+  int efd;
+  pthread_t thread;
+
+  size_t n;
+  unsigned int fsampl;
+
+  /* frame of the last seek command, CTL_SEEK_NONE once taken */
+  uint64_t seek;
+
+  /* three masks of n / 2 + 1 gains, and their owners. mid is shared, */
+  /* with CTL_FRESH set until the audio loop takes it */
+  double* masks;
+  unsigned int back;
+  unsigned int mid;
+  unsigned int front;
+
+  /* thread side */
+  ctl_params_t params;
+  char line[CTL_LINE_SIZE];
+  size_t nline;
+
+} ctl_handle_t;
+
+
+static double* ctl_get_mask(ctl_handle_t* ctl, unsigned int i)
+{
+  return ctl->masks + (size_t)i * (ctl->n / 2 + 1);
+}
+
+
+static void ctl_make_mask(ctl_handle_t* ctl, double* mask)
+{
+  const ctl_params_t* const p = &ctl->params;
+  double f;
+  double g;
+  size_t i;
+  size_t j;
+
+  for (i = 0; i != (ctl->n / 2 + 1); ++i)
+  {
+    mask[i] = 1.0;
+    if (p->is_bypass) continue ;
+
+    f = ((double)i * (double)ctl->fsampl) / (double)ctl->n;
+    g = p->gain;
+    for (j = 0; j != p->nband; ++j)
+    {
+      if ((f >= p->bands[j].lo) && (f < p->bands[j].hi))
+	g += p->bands[j].gain;
+    }
+
+    mask[i] = pow(10.0, g / 20.0);
+  }
+}
+
+
+static int ctl_parse(ctl_handle_t* ctl, char* line)
+{
+  /* apply the command of line to a copy of the parameters, kept if */
+  /* the whole line is valid. 1 if the mask is unchanged. */
+
+  ctl_params_t p = ctl->params;
+  uint64_t seek = CTL_SEEK_NONE;
+  ctl_band_t* b;
+  char* k;
+  char* v;
+  char* e;
+
+  k = strtok_r(line, " \t\r", &e);
+  if (k == NULL) return -1;
+
+  if (strcmp(k, "bypass") == 0)
+  {
+    v = strtok_r(NULL, " \t\r", &e);
+    if (v == NULL) return -1;
+    if (strcmp(v, "yes") == 0) p.is_bypass = 1;
+    else if (strcmp(v, "no") == 0) p.is_bypass = 0;
+    else return -1;
+  }
+  else if (strcmp(k, "gain") == 0)
+  {
+    v = strtok_r(NULL, " \t\r", &e);
+    if (v == NULL) return -1;
+    if (sscanf(v, "%lf", &p.gain) != 1) return -1;
+  }
+  else if (strcmp(k, "bands") == 0)
+  {
+    for (p.nband = 0; (v = strtok_r(NULL, " \t\r", &e)) != NULL; ++p.nband)
+    {
+      if (p.nband == CTL_NBAND) return -1;
+      b = &p.bands[p.nband];
+      if (sscanf(v, "%lf:%lf:%lf", &b->lo, &b->hi, &b->gain) != 3)
+	return -1;
+      if (b->lo >= b->hi) return -1;
+    }
+  }
+  else if (strcmp(k, "seek") == 0)
+  {
+    v = strtok_r(NULL, " \t\r", &e);
+    if (v == NULL) return -1;
+    seek = (uint64_t)strtoull(v, &k, 10);
+    if ((k == v) || (*k != 0) || (seek == CTL_SEEK_NONE)) return -1;
+  }
+  else return -1;
+
+  if (strtok_r(NULL, " \t\r", &e) != NULL) return -1;
+
+  if (seek != CTL_SEEK_NONE)
+  {
+    __atomic_store_n(&ctl->seek, seek, __ATOMIC_RELEASE);
+    return 1;
+  }
+
+  ctl->params = p;
+
+  return 0;
+}
+
+
+static void ctl_publish(ctl_handle_t* ctl)
+{
+  /* the back mask becomes the fresh middle one. the previous middle */
+  /* one, taken or not, is the next back. */
+
+  ctl_make_mask(ctl, ctl_get_mask(ctl, ctl->back));
+
+  ctl->back = __atomic_exchange_n
+    (&ctl->mid, ctl->back | CTL_FRESH, __ATOMIC_ACQ_REL);
+  ctl->back &= ~CTL_FRESH;
+}
+
+
+static int ctl_serve(ctl_handle_t* ctl, int fd)
+{
+  /* read from a client, answer its complete lines. -1 when closed. */
+
+  static const char* const ok = "ok\n";
+  static const char* const ko = "error\n";
+  const char* s;
+  ssize_t n;
+  char* p;
+  char* q;
+  int err;
+
+  n = read(fd, ctl->line + ctl->nline, CTL_LINE_SIZE - 1 - ctl->nline);
+  if (n <= 0) return -1;
+  ctl->nline += (size_t)n;
+  ctl->line[ctl->nline] = 0;
+
+  p = ctl->line;
+  while ((q = strchr(p, '\n')) != NULL)
+  {
+    *q = 0;
+    s = ko;
+    err = ctl_parse(ctl, p);
+    if (err >= 0)
+    {
+      if (err == 0) ctl_publish(ctl);
+      s = ok;
+    }
+    if (write(fd, s, strlen(s)) == -1) return -1;
+    p = q + 1;
+  }
+
+  /* a line too long is dropped */
+  ctl->nline -= (size_t)(p - ctl->line);
+  if (ctl->nline == (CTL_LINE_SIZE - 1)) ctl->nline = 0;
+  memmove(ctl->line, p, ctl->nline);
+
+  return 0;
+}
+
+
+static void* ctl_main(void* p)
+{
+  /* one client at a time, until efd is written */
+
+  ctl_handle_t* const ctl = p;
+  struct pollfd pfds[2];
+  int cfd = -1;
+
+  pfds[0].fd = ctl->efd;
+  pfds[0].events = POLLIN;
+  pfds[1].events = POLLIN;
+
+  while (1)
+  {
+    pfds[1].fd = (cfd == -1) ? ctl->lfd : cfd;
+
+    if (poll(pfds, 2, -1) == -1)
+    {
+      if (errno == EINTR) continue ;
+      break ;
+    }
+
+    if (pfds[0].revents & POLLIN) break ;
+    if ((pfds[1].revents & (POLLIN | POLLHUP | POLLERR)) == 0) continue ;
+
+    if (cfd == -1)
+    {
+      cfd = accept4(ctl->lfd, NULL, NULL, SOCK_CLOEXEC);
+      ctl->nline = 0;
+    }
+    else if (ctl_serve(ctl, cfd))
+    {
+      close(cfd);
+      cfd = -1;
+    }
+  }
+
+  if (cfd != -1) close(cfd);
+
+  return NULL;
+}
+
+
+static size_t ctl_get_size(size_t n)
+{
+  return arena_get_size(3 * (n / 2 + 1) * sizeof(double));
+}
+
+
+static int ctl_open
+(
+ ctl_handle_t* ctl, const char* path,
+ size_t n, unsigned int fsampl, unsigned int is_bypass,
+ arena_handle_t* arena
+)
+{
+  struct sockaddr_un sa;
+  size_t i;
+
+  ctl->path = path;
+  ctl->n = n;
+  ctl->fsampl = fsampl;
+
+  ctl->params.is_bypass = is_bypass;
+  ctl->params.gain = 0.0;
+  ctl->params.nband = 0;
+  ctl->seek = CTL_SEEK_NONE;
+
+  if (strlen(path) >= sizeof(sa.sun_path))
+    PERROR_GOTO("path too long", on_error_0);
+
+  /* the audio loop reads them */
+  ctl->masks = arena_alloc(arena, 3 * (n / 2 + 1) * sizeof(double));
+  if (ctl->masks == NULL) goto on_error_0;
+
+  /* all three, the audio loop starts from the same */
+  for (i = 0; i != 3; ++i) ctl_make_mask(ctl, ctl_get_mask(ctl, i));
+  ctl->back = 0;
+  ctl->mid = 1;
+  ctl->front = 2;
+
+  ctl->lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (ctl->lfd == -1) PERROR_GOTO(strerror(errno), on_error_0);
+
+  /* left by a previous run */
+  unlink(path);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, path);
+  if (bind(ctl->lfd, (const struct sockaddr*)&sa, sizeof(sa)))
+    PERROR_GOTO(strerror(errno), on_error_1);
+  if (listen(ctl->lfd, 1)) PERROR_GOTO(strerror(errno), on_error_2);
+
+  ctl->efd = eventfd(0, EFD_CLOEXEC);
+  if (ctl->efd == -1) PERROR_GOTO(strerror(errno), on_error_2);
+
+  if (pthread_create(&ctl->thread, NULL, ctl_main, ctl)) goto on_error_3;
+
+  return 0;
+
+ on_error_3:
+  close(ctl->efd);
+ on_error_2:
+  unlink(path);
+ on_error_1:
+  close(ctl->lfd);
+ on_error_0:
+  return -1;
+}
+
+
+static void ctl_close(ctl_handle_t* ctl)
+{
+  const uint64_t x = 1;
+
+  if (write(ctl->efd, &x, sizeof(x)) == sizeof(x))
+    pthread_join(ctl->thread, NULL);
+
+  close(ctl->efd);
+  unlink(ctl->path);
+  close(ctl->lfd);
+}
+
+
+static const double* ctl_take_mask(ctl_handle_t* ctl)
+{
+  /* audio loop side: the fresh mask, or NULL if unchanged */
+
+  unsigned int i;
+
+  if ((__atomic_load_n(&ctl->mid, __ATOMIC_ACQUIRE) & CTL_FRESH) == 0)
+    return NULL;
+
+  i = __atomic_exchange_n(&ctl->mid, ctl->front, __ATOMIC_ACQ_REL);
+  ctl->front = i & ~CTL_FRESH;
+
+  return ctl_get_mask(ctl, ctl->front);
+}
+
+
+static uint64_t ctl_take_seek(ctl_handle_t* ctl)
+{
+  /* audio loop side: the frame to seek to, or CTL_SEEK_NONE */
+
+  if (__atomic_load_n(&ctl->seek, __ATOMIC_ACQUIRE) == CTL_SEEK_NONE)
+    return CTL_SEEK_NONE;
+
+  return __atomic_exchange_n(&ctl->seek, CTL_SEEK_NONE, __ATOMIC_ACQ_REL);
+}
+
+
+#if 0 /* fir */
+
+__attribute__((unused))
+static int filter(pcm_handle_t* ipcm)
+{
+  static const double beta = 0.1;
+  double lfilt;
+  double rfilt;
+  size_t n;
+  size_t i;
+  static size_t j = 0;
+
+  if (ipcm->wpos >= ipcm->rpos) n = ipcm->wpos - ipcm->rpos;
+  else n = ipcm->nsampl - ipcm->rpos;
+
+  {
+    const size_t off = ipcm->rpos + 0 * ipcm->scale;
+    int16_t* const p = (int16_t*)(ipcm->buf + off);
     lfilt = (double)p[0];
     rfilt = (double)p[1];
   }
 
-  for (i = 1; i != n; ++i, ++j)
-  {
-    const size_t off = ipcm->rpos + i * ipcm->scale;
-    int16_t* const p = (int16_t*)(ipcm->buf + off);
+  for (i = 1; i != n; ++i, ++j)
+  {
+    const size_t off = ipcm->rpos + i * ipcm->scale;
+    int16_t* const p = (int16_t*)(ipcm->buf + off);
+
+    const double l = (double)p[0];
+    const double r = (double)p[1];
+
+    lfilt = lfilt - beta * (lfilt - l);
+    rfilt = rfilt - beta * (rfilt - r);
+
+    p[0] = (int16_t)lfilt;
+    p[1] = (int16_t)rfilt;
+
+    printf("%zu %lf %lf\n", j, l, lfilt);
+  }
+
+  return 0;
+}
+
+#endif /* fir */
+
+
+/* recorder */
+
+/* capture must never wait for the disk: frames are read straight into */
+/* a ring of REC_RING_SECS seconds, or dropped and counted if it is */
+/* full. a writer thread drains it into a REC_WSIZE staging buffer that */
+/* mirrors an aligned part of the file, header included, so that every */
+/* write is large and aligned, as O_DIRECT requires. the header is */
+/* patched at most every REC_SYNC_MS with the frames written so far, */
+/* then synced: a crash leaves a valid file of what was written. */
+
+#define REC_RING_SECS 10
+#define REC_WSIZE (1 << 20)
+#define REC_ALIGN 4096
+#define REC_SYNC_MS 1000
+
+#define REC_FMTS \
+ (PCM_FMT_MASK(WAV_FMT_S16) | \
+  PCM_FMT_MASK(WAV_FMT_S24_3) | \
+  PCM_FMT_MASK(WAV_FMT_S32))
+
+typedef struct
+{
+  int fd;
+  /* without O_DIRECT, for the header */
+  int hfd;
+  wav_handle_t w;
+
+  uint8_t* ring;
+  size_t size;
+  size_t scale;
+
+  /* bytes written into and read from the ring, ever */
+  uint64_t head;
+  uint64_t tail;
+
+  uint8_t* stage;
+  size_t spos;
+  uint64_t foff;
+
+  pthread_t thread;
+  sem_t sem;
+  volatile unsigned int is_done;
+  int err;
+
+  /* capture side */
+  uint64_t nframe;
+  uint64_t ndrop;
+  size_t nxrun;
+  size_t max_fill;
+
+} rec_handle_t;
+
+static uint64_t rec_get_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int rec_pwrite(int fd, const uint8_t* buf, size_t size, uint64_t off)
+{
+  ssize_t r;
+
+  while (size)
+  {
+    r = pwrite(fd, buf, size, (off_t)off);
+    if (r > 0)
+    {
+      buf += r;
+      size -= (size_t)r;
+      off += (uint64_t)r;
+    }
+    else if ((r == -1) && (errno == EINTR)) continue ;
+    else return -1;
+  }
+
+  return 0;
+}
+
+static int rec_patch(rec_handle_t* rec, uint64_t nbyte)
+{
+  /* header for the nbyte bytes of file on disk, then sync */
+
+  uint8_t h[WAV_HEADER_SIZE];
+
+  rec->w.nsampl = (size_t)((nbyte - WAV_HEADER_SIZE) / rec->scale);
+  wav_get_header(&rec->w, h);
+
+  if (fdatasync(rec->fd)) return -1;
+  if (rec_pwrite(rec->hfd, h, sizeof(h), 0)) return -1;
+  if (fdatasync(rec->hfd)) return -1;
+
+  return 0;
+}
+
+static int rec_flush(rec_handle_t* rec, size_t size)
+{
+  /* write size staged bytes, rounded up to the alignment */
+
+  const size_t asize = (size + REC_ALIGN - 1) & ~(size_t)(REC_ALIGN - 1);
+
+  memset(rec->stage + size, 0, asize - size);
+  if (rec_pwrite(rec->fd, rec->stage, asize, rec->foff)) return -1;
+
+  return 0;
+}
+
+static void* rec_main(void* p)
+{
+  rec_handle_t* const rec = p;
+  uint64_t sync_ms = rec_get_ms() + REC_SYNC_MS;
+  uint64_t head;
+  size_t off;
+  size_t n;
+  size_t k;
+  int err;
+
+  trace_attach("rec");
+
+  while (rec->err == 0)
+  {
+    sem_wait(&rec->sem);
+
+    head = __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE);
+
+    while (rec->tail != head)
+    {
+      off = (size_t)(rec->tail % rec->size);
+      n = (size_t)(head - rec->tail);
+      if (n > (rec->size - off)) n = rec->size - off;
+      k = REC_WSIZE - rec->spos;
+      if (n > k) n = k;
+
+      memcpy(rec->stage + rec->spos, rec->ring + off, n);
+      rec->spos += n;
+      __atomic_store_n(&rec->tail, rec->tail + n, __ATOMIC_RELEASE);
+
+      if (rec->spos != REC_WSIZE) continue ;
+
+      trace_begin("disk");
+      err = rec_flush(rec, REC_WSIZE);
+      trace_end("disk");
+
+      if (err)
+      {
+	rec->err = -1;
+	break ;
+      }
+
+      rec->foff += REC_WSIZE;
+      rec->spos = 0;
+    }
+
+    if (rec_get_ms() >= sync_ms)
+    {
+      if ((rec->foff > WAV_HEADER_SIZE) && rec_patch(rec, rec->foff))
+	rec->err = -1;
+      sync_ms = rec_get_ms() + REC_SYNC_MS;
+    }
+
+    if (rec->is_done && (rec->tail == head)) break ;
+  }
+
+  return NULL;
+}
+
+static size_t rec_get_size(const pcm_handle_t* pcm)
+{
+  /* the ring, and the staging buffer aligned for O_DIRECT */
+
+  return
+    arena_get_size((size_t)pcm->fsampl * REC_RING_SECS * pcm->scale) +
+    arena_get_size(REC_WSIZE + REC_ALIGN);
+}
+
+static int rec_open
+(
+ rec_handle_t* rec, const char* path, const pcm_handle_t* pcm, int odirect,
+ arena_handle_t* arena
+)
+{
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+  rec->scale = pcm->scale;
+  rec->size = (size_t)pcm->fsampl * REC_RING_SECS * pcm->scale;
+  rec->head = 0;
+  rec->tail = 0;
+  rec->foff = 0;
+  rec->is_done = 0;
+  rec->err = 0;
+  rec->nframe = 0;
+  rec->ndrop = 0;
+  rec->nxrun = 0;
+  rec->max_fill = 0;
+
+  rec->w.nchan = pcm->nchan;
+  rec->w.wsampl = pcm->wchan;
+  rec->w.nsampl = WAV_NSAMPL_STREAM;
+  rec->w.fsampl = pcm->fsampl;
+
+  if (odirect) flags |= O_DIRECT;
+
+  rec->fd = open(path, flags, 00644);
+  if ((rec->fd == -1) && odirect)
+  {
+    /* some file systems refuse it */
+    PERROR("O_DIRECT refused, writing through the page cache");
+    rec->fd = open(path, flags & ~O_DIRECT, 00644);
+  }
+  if (rec->fd == -1) PERROR_GOTO(strerror(errno), on_error_0);
+
+  rec->hfd = open(path, O_WRONLY);
+  if (rec->hfd == -1) PERROR_GOTO(strerror(errno), on_error_1);
+
+  /* touched by the arena, and pinned, so that capture does not fault. */
+  /* unpinned with the arena. */
+  rec->ring = arena_alloc(arena, rec->size);
+  if (rec->ring == NULL) goto on_error_2;
+  mlock(rec->ring, rec->size);
+
+  rec->stage = arena_alloc_aligned(arena, REC_WSIZE, REC_ALIGN);
+  if (rec->stage == NULL) goto on_error_2;
+
+  /* the first block holds the header, sizes set once known */
+  rec->spos = wav_get_header(&rec->w, rec->stage);
+
+  if (sem_init(&rec->sem, 0, 0)) goto on_error_2;
+
+  if (pthread_create(&rec->thread, NULL, rec_main, rec)) goto on_error_3;
+
+  return 0;
+
+ on_error_3:
+  sem_destroy(&rec->sem);
+ on_error_2:
+  close(rec->hfd);
+ on_error_1:
+  close(rec->fd);
+ on_error_0:
+  return -1;
+}
+
+static int rec_close(rec_handle_t* rec)
+{
+  /* drain the ring, write the tail and the final header */
+
+  uint64_t size;
+  int err;
+
+  rec->is_done = 1;
+  sem_post(&rec->sem);
+  pthread_join(rec->thread, NULL);
+
+  err = rec->err;
+
+  if (err == 0)
+  {
+    size = rec->foff + rec->spos;
+    if (rec->spos && rec_flush(rec, rec->spos)) err = -1;
+    else if (ftruncate(rec->fd, (off_t)size)) err = -1;
+    else if (rec_patch(rec, size)) err = -1;
+  }
+
+  sem_destroy(&rec->sem);
+  close(rec->hfd);
+  close(rec->fd);
+
+  return err;
+}
+
+static uint8_t* rec_get_buf(rec_handle_t* rec, size_t* n)
+{
+  /* contiguous free frames at the ring head, *n is 0 if full */
+
+  const uint64_t tail = __atomic_load_n(&rec->tail, __ATOMIC_ACQUIRE);
+  const size_t off = (size_t)(rec->head % rec->size);
+  const size_t fill = (size_t)(rec->head - tail);
+  size_t k;
+
+  if (fill > rec->max_fill) rec->max_fill = fill;
+
+  k = rec->size - fill;
+  if (k > (rec->size - off)) k = rec->size - off;
+  *n = k / rec->scale;
+
+  return rec->ring + off;
+}
+
+static void rec_commit(rec_handle_t* rec, size_t n)
+{
+  __atomic_store_n(&rec->head, rec->head + n * rec->scale, __ATOMIC_RELEASE);
+  rec->nframe += (uint64_t)n;
+  sem_post(&rec->sem);
+}
+
+static int main_rec(const cmdline_t* cmd)
+{
+  pcm_desc_t desc;
+  pcm_handle_t ipcm;
+  rec_handle_t rec;
+  meter_handle_t meter;
+  arena_handle_t arena;
+  void* p;
+  size_t size;
+  uint64_t nmax = (uint64_t)-1;
+  uint64_t report;
+  snd_pcm_sframes_t err;
+  uint8_t* buf;
+  size_t navail;
+  size_t n;
+  int ret = -1;
+
+  if ((cmd->flags & CMDLINE_FLAG(OPATH)) == 0)
+    PERROR_GOTO("missing -opath", on_error_0);
+
+  pcm_init_desc(&desc);
+  desc.flags |= PCM_FLAG_IN;
+  desc.nchan = cmd->nchan;
+  desc.fsampl = cmd->irate;
+  if (cmd->flags & CMDLINE_FLAG(IPCM)) desc.name = cmd->ipcm;
+  /* samples are written as captured, in a layout wav headers describe */
+  desc.fmts = cmd->fmts & REC_FMTS;
+  if (pcm_open(&ipcm, &desc)) goto on_error_0;
+
+  /* buffers of the session, now that the device is negotiated */
+
+  size = pcm_get_size(&ipcm) + rec_get_size(&ipcm);
+  if (cmd->flags & CMDLINE_FLAG(METER))
+    size += arena_get_size(meter_get_size(ipcm.nchan));
+
+  if (arena_init(&arena, size)) PERROR_GOTO("arena", on_error_1);
+  if (pcm_alloc(&ipcm, &arena)) goto on_error_2;
+
+  if (rec_open
+      (&rec, cmd->opath, &ipcm, cmd->flags & CMDLINE_FLAG(ODIRECT), &arena))
+    goto on_error_2;
+
+  if (cmd->flags & CMDLINE_FLAG(METER))
+  {
+    p = arena_alloc(&arena, meter_get_size(ipcm.nchan));
+    if (p == NULL) goto on_error_3;
+    if (meter_init_mem(&meter, ipcm.nchan, ipcm.fsampl, p)) goto on_error_3;
+  }
+
+  if (cmd->dur_ms)
+    nmax = ((uint64_t)cmd->dur_ms * (uint64_t)ipcm.fsampl) / 1000;
+
+  report = (uint64_t)ipcm.fsampl;
+
+  if (pcm_start(&ipcm)) goto on_error_4;
+
+  signal(SIGINT, on_sigint);
+  signal(SIGUSR1, on_sigusr1);
+
+  /* the loop allocates nothing, but the trace snapshot */
+  arena_enter_rt();
+
+  while ((is_sigint == 0) && (rec.nframe < nmax))
+  {
+    if (is_sigusr1)
+    {
+      is_sigusr1 = 0;
+      arena_leave_rt();
+      if (cmd->flags & CMDLINE_FLAG(TRACE)) trace_dump(cmd->trace);
+      arena_enter_rt();
+    }
+
+    trace_begin("wait");
+    err = snd_pcm_wait(ipcm.pcm, -1);
+    trace_end("wait");
+    if (is_sigint) break ;
+    if (err == -EINTR) continue ;
+    if (err < 0) goto on_xrun;
+
+    err = snd_pcm_avail_update(ipcm.pcm);
+    if (err < 0) goto on_xrun;
+    navail = (size_t)err;
+    if (navail == 0) continue ;
+    if ((uint64_t)navail > (nmax - rec.nframe))
+      navail = (size_t)(nmax - rec.nframe);
+
+    buf = rec_get_buf(&rec, &n);
+    if (n > navail) n = navail;
+
+    if (n == 0)
+    {
+      /* ring full, the disk is too slow: drop rather than block */
+      n = navail;
+      if (n > ipcm.nsampl) n = ipcm.nsampl;
+      err = snd_pcm_readi(ipcm.pcm, ipcm.buf, n);
+      if (err < 0) goto on_xrun;
+      rec.ndrop += (uint64_t)err;
+      continue ;
+    }
+
+    trace_begin("read");
+    err = snd_pcm_readi(ipcm.pcm, buf, n);
+    trace_end("read");
+    if (err < 0) goto on_xrun;
+    rec_commit(&rec, (size_t)err);
+
+    if (cmd->flags & CMDLINE_FLAG(METER))
+      pcm_meter(&ipcm, &meter, buf, (size_t)err);
+
+    if (rec.nframe >= report)
+    {
+      printf
+      (
+       "%.1f s, ring %.0f%%, dropped %llu, xruns %zu",
+       (double)rec.nframe / (double)ipcm.fsampl,
+       (100.0 * (double)rec.max_fill) / (double)rec.size,
+       (unsigned long long)rec.ndrop, rec.nxrun
+      );
+      if (cmd->flags & CMDLINE_FLAG(METER))
+	printf(", S: %6.1f LUFS", meter_get_short(&meter));
+      printf("\n");
+      fflush(stdout);
+      rec.max_fill = 0;
+      report += (uint64_t)ipcm.fsampl;
+    }
+
+    continue ;
+
+  on_xrun:
+    ++rec.nxrun;
+    trace_mark("xrun", 0);
+    if (pcm_recover_xrun(&ipcm, (int)err)) PERROR_GOTO("", on_error_4);
+  }
+
+  snd_pcm_drop(ipcm.pcm);
+  ret = 0;
+
+ on_error_4:
+  arena_leave_rt();
+  if (cmd->flags & CMDLINE_FLAG(METER)) meter_fini(&meter);
+ on_error_3:
+  if (rec_close(&rec))
+  {
+    PERROR("write failed");
+    ret = -1;
+  }
+  else
+  {
+    printf
+    (
+     "%s: %llu frames, dropped %llu, xruns %zu\n",
+     cmd->opath, (unsigned long long)rec.nframe,
+     (unsigned long long)rec.ndrop, rec.nxrun
+    );
+  }
+ on_error_2:
+  arena_fini(&arena);
+ on_error_1:
+  pcm_close(&ipcm);
+ on_error_0:
+  return ret;
+}
+
+
+/* player */
+
+/* a prefetch thread keeps up to ahead seconds of frames read ahead of */
+/* the playback pointer, so that disk stalls shorter than that are not */
+/* heard. the file is read through wav_io, from frame offsets given by */
+/* the wav layer: seeks are sample accurate. */
+
+#define PLAY_RSIZE (1 << 16)
+#define PLAY_ALIGN 4096
+
+typedef struct
+{
+  int fd;
+  wav_info_t info;
+  wav_io_t io;
+
+  uint8_t* ring;
+  size_t nsampl;
+  size_t scale;
+  unsigned int fmt;
+
+  /* frames written into and read from the ring, ever */
+  uint64_t head;
+  uint64_t tail;
+
+  /* next frame read from the file, and the playback one */
+  uint64_t isampl;
+  uint64_t pos;
+
+  pthread_t thread;
+  sem_t space;
+  sem_t data;
+  volatile unsigned int is_done;
+  volatile unsigned int is_eof;
+  int err;
+
+  /* the thread runs, until play_stop */
+  unsigned int is_started;
+
+  /* consumer side */
+  size_t nstall;
+  size_t min_fill;
+
+} play_handle_t;
+
+static void* play_main(void* p)
+{
+  play_handle_t* const play = p;
+  uint64_t tail;
+  size_t off;
+  size_t n;
+  size_t k;
+
+  trace_attach("play");
+
+  while (play->is_done == 0)
+  {
+    tail = __atomic_load_n(&play->tail, __ATOMIC_ACQUIRE);
+
+    if ((play->head - tail) == play->nsampl)
+    {
+      sem_wait(&play->space);
+      continue ;
+    }
+
+    off = (size_t)(play->head % play->nsampl);
+    n = play->nsampl - (size_t)(play->head - tail);
+    if (n > (play->nsampl - off)) n = play->nsampl - off;
+    if (n > (PLAY_RSIZE / play->scale)) n = PLAY_RSIZE / play->scale;
+    if ((uint64_t)n > (play->info.nsampl - play->isampl))
+      n = (size_t)(play->info.nsampl - play->isampl);
+
+    k = 0;
+    trace_begin("disk");
+    if (n) k = wav_io_read(&play->io, play->ring + off * play->scale,
+			   n * play->scale) / play->scale;
+    trace_end("disk");
+
+    play->isampl += (uint64_t)k;
+    __atomic_store_n(&play->head, play->head + k, __ATOMIC_RELEASE);
+    sem_post(&play->data);
+
+    if (k != n)
+    {
+      play->err = -1;
+      play->is_eof = 1;
+      break ;
+    }
+
+    if (play->isampl == play->info.nsampl)
+    {
+      play->is_eof = 1;
+      break ;
+    }
+  }
+
+  sem_post(&play->data);
 
-    const double l = (double)p[0];
-    const double r = (double)p[1];
+  /* the next seek restarts the thread, into the same ring */
+  trace_detach();
 
-    lfilt = lfilt - beta * (lfilt - l);
-    rfilt = rfilt - beta * (rfilt - r);
+  return NULL;
+}
 
-    p[0] = (int16_t)lfilt;
-    p[1] = (int16_t)rfilt;
+static int play_start(play_handle_t* play, uint64_t i, size_t nwait)
+{
+  /* start prefetching from frame i, and wait for nwait frames of it. */
+  /* the thread reads the rest of the ring meanwhile. */
 
-    printf("%zu %lf %lf\n", j, l, lfilt);
+  const off_t off = wav_get_sampl_off(&play->info, i);
+
+  if (off == (off_t)-1) return -1;
+
+  play->head = 0;
+  play->tail = 0;
+  play->isampl = i;
+  play->pos = i;
+  play->is_done = 0;
+  play->is_eof = 0;
+  play->err = 0;
+
+  if (wav_io_init(&play->io, play->fd, off, (off_t)-1,
+		  WAV_IO_FLAG_READ | WAV_IO_FLAG_URING))
+    goto on_error_0;
+
+  if (sem_init(&play->space, 0, 0)) goto on_error_1;
+  if (sem_init(&play->data, 0, 0)) goto on_error_2;
+
+  if (pthread_create(&play->thread, NULL, play_main, play)) goto on_error_3;
+  play->is_started = 1;
+
+  if (nwait > play->nsampl) nwait = play->nsampl;
+
+  while (play->is_eof == 0)
+  {
+    if (__atomic_load_n(&play->head, __ATOMIC_ACQUIRE) >= nwait) break ;
+    sem_wait(&play->data);
   }
 
   return 0;
+
+ on_error_3:
+  sem_destroy(&play->data);
+ on_error_2:
+  sem_destroy(&play->space);
+ on_error_1:
+  wav_io_fini(&play->io);
+ on_error_0:
+  return -1;
+}
+
+static void play_stop(play_handle_t* play)
+{
+  if (play->is_started == 0) return ;
+  play->is_started = 0;
+  play->is_done = 1;
+  sem_post(&play->space);
+  pthread_join(play->thread, NULL);
+  sem_destroy(&play->data);
+  sem_destroy(&play->space);
+  wav_io_fini(&play->io);
+}
+
+static int play_seek(play_handle_t* play, uint64_t i, size_t nwait)
+{
+  /* the ring is dropped and refilled from frame i. the frames queued */
+  /* in the device are still played. */
+  play_stop(play);
+  return play_start(play, i, nwait);
+}
+
+static int play_open(play_handle_t* play, const char* path, size_t ahead_secs)
+{
+  /* the ring is taken by play_alloc, once the session is sized, and */
+  /* prefetching started by play_start */
+
+  struct stat st;
+
+  play->fd = open(path, O_RDONLY);
+  if (play->fd == -1) PERROR_GOTO(strerror(errno), on_error_0);
+
+  if (fstat(play->fd, &st)) PERROR_GOTO(strerror(errno), on_error_1);
+
+  if (wav_probe(&play->info, play->fd, (uint64_t)st.st_size))
+    PERROR_GOTO("invalid wav file", on_error_1);
+
+  /* converted once, by the modifier */
+  play->fmt = wav_fmt_find(play->info.format, play->info.wsampl);
+  if (play->fmt == WAV_FMT_COUNT)
+    PERROR_GOTO("sample format not supported", on_error_1);
+
+  play->scale = play->info.nchan * play->info.wsampl;
+  /* a whole count of modifier blocks, so that they never wrap */
+  play->nsampl = (size_t)play->info.fsampl * ahead_secs;
+  if (play->nsampl == 0) play->nsampl = (size_t)play->info.fsampl;
+  play->nsampl = (play->nsampl + PLAY_ALIGN - 1) & ~(size_t)(PLAY_ALIGN - 1);
+
+  play->ring = NULL;
+  play->nstall = 0;
+  play->min_fill = play->nsampl;
+  play->is_started = 0;
+
+  return 0;
+
+ on_error_1:
+  close(play->fd);
+ on_error_0:
+  return -1;
 }
 
-#endif /* fir */
+static size_t play_get_size(const play_handle_t* play)
+{
+  return arena_get_size(play->nsampl * play->scale);
+}
+
+static int play_alloc(play_handle_t* play, arena_handle_t* arena)
+{
+  /* touched by the arena, and pinned, so that playback does not fault. */
+  /* unpinned with the arena. */
+
+  play->ring = arena_alloc(arena, play->nsampl * play->scale);
+  if (play->ring == NULL) return -1;
+  mlock(play->ring, play->nsampl * play->scale);
+
+  return 0;
+}
+
+static void play_close(play_handle_t* play)
+{
+  play_stop(play);
+  close(play->fd);
+}
+
+static size_t play_get_buf(play_handle_t* play, size_t* off)
+{
+  /* contiguous frames at the ring tail, from *off */
+
+  const uint64_t head = __atomic_load_n(&play->head, __ATOMIC_ACQUIRE);
+  const size_t fill = (size_t)(head - play->tail);
+  size_t n;
+
+  if (fill < play->min_fill) play->min_fill = fill;
+
+  *off = (size_t)(play->tail % play->nsampl);
+  n = fill;
+  if (n > (play->nsampl - *off)) n = play->nsampl - *off;
+
+  return n;
+}
+
+static void play_commit(play_handle_t* play, size_t n)
+{
+  __atomic_store_n(&play->tail, play->tail + n, __ATOMIC_RELEASE);
+  play->pos += (uint64_t)n;
+  sem_post(&play->space);
+}
+
+static int main_play(const cmdline_t* cmd)
+{
+  pcm_desc_t desc;
+  pcm_handle_t opcm;
+  play_handle_t play;
+  mod_handle_t mod;
+  resampl_handle_t resampl;
+  resampl_handle_t* rsp = NULL;
+  meter_handle_t meter;
+  ctl_handle_t ctl;
+  arena_handle_t arena;
+  const double* xmask = NULL;
+  void* p;
+  size_t size;
+  uint64_t nmax;
+  uint64_t report;
+  uint64_t seek;
+  snd_pcm_sframes_t err;
+  size_t navail;
+  size_t off;
+  size_t n;
+  unsigned int is_stall = 0;
+  unsigned int is_filt;
+  int ret = -1;
+
+  if ((cmd->flags & CMDLINE_FLAG(IPATH)) == 0)
+    PERROR_GOTO("missing -ipath", on_error_0);
+
+  /* the control socket implies the modifier, as when capturing */
+  is_filt = (cmd->flags & (CMDLINE_FLAG(FILT) | CMDLINE_FLAG(CTL))) != 0;
+
+  if (play_open(&play, cmd->ipath, cmd->ahead_s)) goto on_error_0;
+
+  pcm_init_desc(&desc);
+  desc.flags |= PCM_FLAG_OUT;
+  desc.nchan = play.info.nchan;
+  desc.fsampl = play.info.fsampl;
+  if (cmd->flags & CMDLINE_FLAG(ORATE)) desc.fsampl = cmd->orate;
+  if (cmd->flags & CMDLINE_FLAG(OPCM)) desc.name = cmd->opcm;
+  if (pcm_open(&opcm, &desc)) goto on_error_1;
+
+  if (opcm.nchan != play.info.nchan)
+    PERROR_GOTO("channel count not supported", on_error_2);
+
+  /* buffers of the session, now that the file and the device are known */
+
+  size = play_get_size(&play) + pcm_get_size(&opcm);
+  size += mod_get_size(512, opcm.nchan);
+  if (cmd->flags & CMDLINE_FLAG(METER))
+    size += arena_get_size(meter_get_size(play.info.nchan));
+  if (play.info.fsampl != opcm.fsampl)
+  {
+    size += arena_get_size
+      (resampl_get_size(play.info.fsampl, opcm.fsampl, opcm.nchan));
+  }
+  if (cmd->flags & CMDLINE_FLAG(CTL)) size += ctl_get_size(512);
+
+  if (arena_init(&arena, size)) PERROR_GOTO("arena", on_error_2);
+  if (play_alloc(&play, &arena)) goto on_error_3;
+  if (pcm_alloc(&opcm, &arena)) goto on_error_3;
+
+  if (mod_open(&mod, 512, opcm.nchan, &arena)) goto on_error_3;
+
+  if (cmd->flags & CMDLINE_FLAG(METER))
+  {
+    p = arena_alloc(&arena, meter_get_size(play.info.nchan));
+    if (p == NULL) goto on_error_4;
+    if (meter_init_mem(&meter, play.info.nchan, play.info.fsampl, p))
+      goto on_error_4;
+  }
+
+  if (play.info.fsampl != opcm.fsampl)
+  {
+    p = arena_alloc
+      (&arena, resampl_get_size(play.info.fsampl, opcm.fsampl, opcm.nchan));
+    if (p == NULL) goto on_error_5;
+    if (resampl_init_mem
+	(&resampl, play.info.fsampl, opcm.fsampl, opcm.nchan, p))
+      goto on_error_5;
+    rsp = &resampl;
+  }
+
+  /* parameters and seeks, from the control socket */
+  if (cmd->flags & CMDLINE_FLAG(CTL))
+  {
+    if (ctl_open
+	(
+	 &ctl, cmd->ctl, mod.n, play.info.fsampl,
+	 (cmd->flags & CMDLINE_FLAG(FILT)) == 0, &arena
+	))
+      goto on_error_6;
+  }
+
+  /* prefetching, from the first frame played. the device is not */
+  /* started yet: the whole ring is waited for. */
+  if (play_start(&play, cmd->seek, play.nsampl))
+    PERROR_GOTO("invalid position", on_error_7);
+
+  nmax = play.info.nsampl;
+  if (cmd->dur_ms)
+  {
+    nmax = play.pos + ((uint64_t)cmd->dur_ms * play.info.fsampl) / 1000;
+    if (nmax > play.info.nsampl) nmax = play.info.nsampl;
+  }
+
+  report = play.pos + (uint64_t)play.info.fsampl;
+
+  signal(SIGINT, on_sigint);
+  signal(SIGUSR1, on_sigusr1);
+
+  /* the device starts on the first write. the loop allocates nothing, */
+  /* but the trace snapshot. */
+
+  arena_enter_rt();
+
+  while ((is_sigint == 0) && (play.pos < nmax))
+  {
+    if (is_sigusr1)
+    {
+      is_sigusr1 = 0;
+      arena_leave_rt();
+      if (cmd->flags & CMDLINE_FLAG(TRACE)) trace_dump(cmd->trace);
+      arena_enter_rt();
+    }
+
+    trace_begin("wait");
+    err = snd_pcm_wait(opcm.pcm, -1);
+    trace_end("wait");
+    if (is_sigint) break ;
+    if (err == -EINTR) continue ;
+    if (err < 0) goto on_xrun;
+
+    err = snd_pcm_avail_update(opcm.pcm);
+    if (err < 0) goto on_xrun;
+    navail = (size_t)err;
+
+    /* input frames whose output fits in the device */
+    if (rsp != NULL)
+    {
+      if (navail <= 1) continue ;
+      navail = ((navail - 1) * rsp->m) / rsp->l;
+      if (navail > (opcm.nsampl / 2)) navail = opcm.nsampl / 2;
+    }
+
+    /* seeks, at block boundaries. out of the real time section, only */
+    /* the first block is waited for, the frames queued in the device */
+    /* covering it. the ring fills while it plays. */
+    seek = CTL_SEEK_NONE;
+    if (cmd->flags & CMDLINE_FLAG(CTL)) seek = ctl_take_seek(&ctl);
+    if ((seek != CTL_SEEK_NONE) && (seek < play.info.nsampl))
+    {
+      arena_leave_rt();
+      trace_begin("seek");
+      if (play_seek(&play, seek, mod.n)) PERROR_GOTO("seek failed", on_error_7);
+      trace_end("seek");
+      arena_enter_rt();
+
+      if (rsp != NULL) resampl_reset(rsp);
+      is_stall = 0;
+
+      /* -dur counts from the new position */
+      if (cmd->dur_ms)
+      {
+	nmax = play.pos + ((uint64_t)cmd->dur_ms * play.info.fsampl) / 1000;
+	if (nmax > play.info.nsampl) nmax = play.info.nsampl;
+      }
+      report = play.pos + (uint64_t)play.info.fsampl;
+    }
+
+    n = play_get_buf(&play, &off);
+
+    if (n == 0)
+    {
+      if (play.is_eof) break ;
+      /* prefetching fell behind, the device may underrun */
+      if (is_stall == 0) ++play.nstall;
+      is_stall = 1;
+      sem_wait(&play.data);
+      continue ;
+    }
+
+    is_stall = 0;
+
+    if (n > navail) n = navail;
+    if ((uint64_t)n > (nmax - play.pos)) n = (size_t)(nmax - play.pos);
+    if (n > mod.n) n = mod.n;
+
+    if (is_filt && (n != mod.n))
+    {
+      /* whole blocks only, but for the last frames played */
+      if (navail < mod.n) continue ;
+      if (((uint64_t)n != (nmax - play.pos)) && (play.is_eof == 0))
+	continue ;
+    }
+
+    trace_begin("process");
+
+    /* parameter changes, at block boundaries */
+    if (cmd->flags & CMDLINE_FLAG(CTL)) xmask = ctl_take_mask(&ctl);
+
+    mod_load(&mod, play.fmt, play.ring, play.nsampl, off, n);
+
+    if (cmd->flags & CMDLINE_FLAG(METER))
+      meter_add_planar(&meter, mod.buf, mod.dist, n);
+
+    if (is_filt) mod_apply(&mod, xmask);
+
+    /* bounded by the device space, queued frames are all written */
+    pcm_queue(&opcm, rsp, mod.buf, mod.dist, n);
+
+    trace_end("process");
+
+    trace_begin("write");
+    err = pcm_flush(&opcm);
+    trace_end("write");
+    if (err < 0) goto on_xrun;
+    play_commit(&play, n);
+
+    if (play.pos >= report)
+    {
+      printf
+      (
+       "%.3f s, ahead min %.1f s, stalls %zu",
+       (double)play.pos / (double)play.info.fsampl,
+       (double)play.min_fill / (double)play.info.fsampl, play.nstall
+      );
+      if (cmd->flags & CMDLINE_FLAG(METER))
+	printf(", S: %6.1f LUFS", meter_get_short(&meter));
+      printf("\n");
+      fflush(stdout);
+      play.min_fill = play.nsampl;
+      report += (uint64_t)play.info.fsampl;
+    }
+
+    continue ;
+
+  on_xrun:
+    trace_mark("xrun", 1);
+    if (pcm_recover_xrun(&opcm, (int)err)) PERROR_GOTO("", on_error_7);
+  }
+
+  if (play.err) PERROR("read failed");
+
+  if (is_sigint == 0)
+  {
+    snd_pcm_nonblock(opcm.pcm, 0);
+    snd_pcm_drain(opcm.pcm);
+  }
+
+  ret = play.err;
+
+ on_error_7:
+  arena_leave_rt();
+  if (cmd->flags & CMDLINE_FLAG(CTL)) ctl_close(&ctl);
+ on_error_6:
+  if (rsp != NULL) resampl_fini(rsp);
+ on_error_5:
+  if (cmd->flags & CMDLINE_FLAG(METER)) meter_fini(&meter);
+ on_error_4:
+  mod_close(&mod);
+ on_error_3:
+  /* the prefetch thread writes to the ring */
+  play_stop(&play);
+  arena_fini(&arena);
+ on_error_2:
+  pcm_close(&opcm);
+ on_error_1:
+  play_close(&play);
+ on_error_0:
+  return ret;
+}
 
 
 /* main */
 
 int main(int ac, char** av)
 {
+  /* capture and playback are served as each gets ready, from a single */
+  /* poll over their descriptors, a report timer and the signals. reads */
+  /* never wait for writes: processed frames are queued, in the device */
+  /* format, and written as the device takes them. */
+
   pcm_desc_t desc;
   pcm_handle_t ipcm;
   pcm_handle_t opcm;
   mod_handle_t mod;
+  resampl_handle_t resampl;
+  resampl_handle_t* rsp = NULL;
+  drift_handle_t drift;
+  meter_handle_t meter;
+  stats_handle_t stats;
+  ctl_handle_t ctl;
+  fanout_handle_t fanout;
+  fixed_handle_t fixed;
+  arena_handle_t arena;
+  const double* xmask;
+  void* p;
+  size_t size;
+  struct pollfd* pfds;
+  struct itimerspec its;
+  struct signalfd_siginfo si;
+  sigset_t sigs;
+  int tfd;
+  int sfd;
+  size_t nin;
+  size_t nout;
+  size_t npfd;
+  unsigned short revents;
+  uint64_t nread = 0;
+  uint64_t nmax = (uint64_t)-1;
+  uint64_t x;
+  size_t ndrop = 0;
+  size_t nxrun = 0;
+  double stats_time = 0.0;
+  size_t stats_count = 0;
+  double latency = 0.0;
+  double t;
+  size_t npad;
+  size_t nsampl;
+  size_t navail;
+  size_t nclient;
   int err;
   cmdline_t cmd;
-  size_t i;
+  static char obuf[BUFSIZ];
 
   err = -1;
 
+  /* stdio allocates buffers on first use, that may be in a loop */
+  setvbuf(stdout, obuf, _IOLBF, sizeof(obuf));
+
   if (get_cmdline(&cmd, ac - 1, av + 1)) goto on_error_0;
 
+  /* kernels are selected now, not at the first period */
+  simd_get_level();
+
+  /* this thread, and those of the recorder and the player */
+  if (cmd.flags & CMDLINE_FLAG(TRACE))
+  {
+    if (trace_init()) goto on_error_0;
+    trace_attach("main");
+  }
+
+  if (cmd.flags & CMDLINE_FLAG(REC))
+  {
+    err = main_rec(&cmd);
+    goto on_error_1;
+  }
+
+  if (cmd.flags & CMDLINE_FLAG(PLAY))
+  {
+    err = main_play(&cmd);
+    goto on_error_1;
+  }
+
   pcm_init_desc(&desc);
   desc.flags |= PCM_FLAG_IN;
+  desc.nchan = cmd.nchan;
+  desc.fsampl = cmd.irate;
+  desc.fmts = cmd.fmts;
+  if (cmd.flags & CMDLINE_FLAG(FIXED))
+  {
+    desc.fmts &= PCM_FMT_MASK(WAV_FMT_S16);
+    if (desc.fmts == 0) PERROR_GOTO("fixed point is S16_LE", on_error_1);
+  }
   if (cmd.flags & CMDLINE_FLAG(IPCM)) desc.name = cmd.ipcm;
-  if (pcm_open(&ipcm, &desc)) goto on_error_0;
+  if (pcm_open(&ipcm, &desc)) goto on_error_1;
+
+  /* playback takes the channels negotiated by capture, and its format */
+  /* if supported */
 
   pcm_init_desc(&desc);
   desc.flags |= PCM_FLAG_OUT;
+  desc.nchan = ipcm.nchan;
+  desc.fmt = ipcm.fmt;
+  desc.fsampl = cmd.orate;
   if (cmd.flags & CMDLINE_FLAG(OPCM)) desc.name = cmd.opcm;
-  if (pcm_open(&opcm, &desc)) goto on_error_1;
+  if (pcm_open(&opcm, &desc)) goto on_error_2;
 
-  if (mod_open(&mod, 512)) goto on_error_2;
+  if (opcm.nchan != ipcm.nchan)
+    PERROR_GOTO("channel count not supported", on_error_3);
 
-  if (pcm_start(&ipcm)) goto on_error_3;
-  if (pcm_start(&opcm)) goto on_error_3;
+  /* buffers of the session, now that the devices are negotiated: */
+  /* capture, timer, signals then playback are polled */
 
-  signal(SIGINT, on_sigint);
+  nin = (size_t)snd_pcm_poll_descriptors_count(ipcm.pcm);
+  nout = (size_t)snd_pcm_poll_descriptors_count(opcm.pcm);
+
+  size = pcm_get_size(&ipcm) + pcm_get_size(&opcm);
+  size += mod_get_size(512, ipcm.nchan);
+  if (cmd.flags & CMDLINE_FLAG(FIXED))
+    size += arena_get_size(fixed_get_size(512));
+  if (cmd.flags & CMDLINE_FLAG(METER))
+    size += arena_get_size(meter_get_size(ipcm.nchan));
+  if (cmd.flags & CMDLINE_FLAG(DRIFT))
+  {
+    size += arena_get_size
+      (resampl_get_size_var(ipcm.fsampl, opcm.fsampl, ipcm.nchan));
+  }
+  else if (ipcm.fsampl != opcm.fsampl)
+  {
+    size += arena_get_size
+      (resampl_get_size(ipcm.fsampl, opcm.fsampl, ipcm.nchan));
+  }
+  if (cmd.flags & CMDLINE_FLAG(CTL)) size += ctl_get_size(512);
+  size += arena_get_size((nin + 2 + nout) * sizeof(struct pollfd));
+
+  if (arena_init(&arena, size)) PERROR_GOTO("arena", on_error_3);
+  if (pcm_alloc(&ipcm, &arena)) goto on_error_4;
+  if (pcm_alloc(&opcm, &arena)) goto on_error_4;
+
+  if (mod_open(&mod, 512, ipcm.nchan, &arena)) goto on_error_4;
+
+  /* in fixed point, mod only converts */
+  if (cmd.flags & CMDLINE_FLAG(FIXED))
+  {
+    p = arena_alloc(&arena, fixed_get_size(mod.n));
+    if (p == NULL) goto on_error_5;
+    if (fixed_init_mem(&fixed, mod.n, ipcm.nchan, p)) goto on_error_5;
+  }
 
-  for (i = 0; is_sigint == 0; i += 1)
+  if (cmd.flags & CMDLINE_FLAG(METER))
   {
-    size_t nsampl;
-    size_t navail;
-    size_t off;
+    p = arena_alloc(&arena, meter_get_size(ipcm.nchan));
+    if (p == NULL) goto on_error_6;
+    if (meter_init_mem(&meter, ipcm.nchan, ipcm.fsampl, p)) goto on_error_6;
+  }
 
-    /* read ipcm */
+  /* capture and playback at different rates, or from different clocks */
 
-    err = snd_pcm_wait(ipcm.pcm, -1);
-    if (is_sigint) break ;
-    if (err < 0) goto on_ipcm_xrun;
+  if (cmd.flags & CMDLINE_FLAG(DRIFT))
+  {
+    p = arena_alloc
+      (&arena, resampl_get_size_var(ipcm.fsampl, opcm.fsampl, ipcm.nchan));
+    if (p == NULL) goto on_error_7;
+    if (resampl_init_var_mem
+	(&resampl, ipcm.fsampl, opcm.fsampl, ipcm.nchan, p))
+      goto on_error_7;
+    rsp = &resampl;
+  }
+  else if (ipcm.fsampl != opcm.fsampl)
+  {
+    p = arena_alloc
+      (&arena, resampl_get_size(ipcm.fsampl, opcm.fsampl, ipcm.nchan));
+    if (p == NULL) goto on_error_7;
+    if (resampl_init_mem(&resampl, ipcm.fsampl, opcm.fsampl, ipcm.nchan, p))
+      goto on_error_7;
+    rsp = &resampl;
+  }
+
+  /* playback is padded with the latency, at start and after underruns */
+
+  if ((cmd.flags & CMDLINE_FLAG(DRIFT)) && (cmd.latency_ms == 0))
+    cmd.latency_ms = DRIFT_LATENCY_MS;
+
+  t = (double)(DRIFT_MIN_PERIODS * PCM_NPERIOD * 1000) / ipcm.fsampl;
+  if (cmd.latency_ms && (cmd.latency_ms < t))
+    cmd.latency_ms = (unsigned int)ceil(t);
+
+  npad = ((size_t)cmd.latency_ms * (size_t)opcm.fsampl) / 1000;
+  drift_init(&drift, (double)cmd.latency_ms / 1000.0);
+
+  /* statistics, published after each capture */
+
+  if (cmd.flags & CMDLINE_FLAG(SHM))
+  {
+    if (stats_create(&stats, cmd.shm)) PERROR_GOTO("shm", on_error_8);
+    pcm_init_stats(&ipcm, &stats.data.devs[STATS_DEV_IN]);
+    pcm_init_stats(&opcm, &stats.data.devs[STATS_DEV_OUT]);
+    stats.data.ratio = 1.0;
+    stats_publish(&stats);
+  }
+
+  /* the processed stream, for other processes to read */
+
+  if (cmd.flags & CMDLINE_FLAG(FANOUT))
+  {
+    if (fanout_create(&fanout, cmd.fanout, ipcm.fsampl, ipcm.nchan))
+      PERROR_GOTO("fanout", on_error_9);
+  }
+
+  /* parameters, from the control socket. without -filter, it starts */
+  /* bypassed: the modifier runs, and takes changes without a gap */
+
+  if (cmd.flags & CMDLINE_FLAG(CTL))
+  {
+    if (ctl_open
+	(
+	 &ctl, cmd.ctl, mod.n, ipcm.fsampl,
+	 (cmd.flags & CMDLINE_FLAG(FILT)) == 0, &arena
+	))
+      goto on_error_10;
+    cmd.flags |= CMDLINE_FLAG(FILT);
+  }
+
+  /* reports, every second */
 
-    navail = (size_t)snd_pcm_avail_update(ipcm.pcm);
+  tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (tfd == -1) PERROR_GOTO(strerror(errno), on_error_11);
 
-    if (ipcm.wpos >= ipcm.rpos) nsampl = ipcm.nsampl - ipcm.wpos;
-    else nsampl = ipcm.rpos - ipcm.wpos;
-    if (nsampl > navail) nsampl = navail;
+  its.it_value.tv_sec = 1;
+  its.it_value.tv_nsec = 0;
+  its.it_interval = its.it_value;
+  if (timerfd_settime(tfd, 0, &its, NULL))
+    PERROR_GOTO(strerror(errno), on_error_12);
 
-    off = ipcm.wpos * ipcm.scale;
-    err = snd_pcm_readi(ipcm.pcm, ipcm.buf + off, nsampl);
-    if (err < 0) goto on_ipcm_xrun;
+  /* signals, as events rather than interruptions */
 
-    ipcm.wpos += (size_t)err;
-    if (ipcm.wpos == ipcm.nsampl) ipcm.wpos = 0;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGUSR1);
+  if (sigprocmask(SIG_BLOCK, &sigs, NULL))
+    PERROR_GOTO(strerror(errno), on_error_12);
 
-    /* apply modifier */
+  sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (sfd == -1) PERROR_GOTO(strerror(errno), on_error_12);
 
-  redo_mod:
-    if (ipcm.wpos >= ipcm.rpos) nsampl = ipcm.wpos - ipcm.rpos;
-    else nsampl = ipcm.nsampl - ipcm.rpos + ipcm.wpos;
+  /* playback is only polled when frames are queued: it would be */
+  /* always ready otherwise */
 
-    if (cmd.flags & CMDLINE_FLAG(FILT))
+  pfds = arena_alloc(&arena, (nin + 2 + nout) * sizeof(struct pollfd));
+  if (pfds == NULL) goto on_error_13;
+
+  snd_pcm_poll_descriptors(ipcm.pcm, pfds, (unsigned int)nin);
+  pfds[nin + 0].fd = tfd;
+  pfds[nin + 0].events = POLLIN;
+  pfds[nin + 1].fd = sfd;
+  pfds[nin + 1].events = POLLIN;
+  snd_pcm_poll_descriptors(opcm.pcm, pfds + nin + 2, (unsigned int)nout);
+
+  if (cmd.dur_ms)
+    nmax = ((uint64_t)cmd.dur_ms * (uint64_t)ipcm.fsampl) / 1000;
+
+  if (cmd.flags & CMDLINE_FLAG(STATS))
+  {
+    printf
+    (
+     "%s %u Hz -> %s %u Hz, %zu chan, simd %s\n",
+     wav_fmt_get_name(ipcm.fmt), ipcm.fsampl,
+     wav_fmt_get_name(opcm.fmt), opcm.fsampl, ipcm.nchan,
+     simd_get_name(simd_get_level())
+    );
+  }
+
+  /* both start together, the padding is then all that is in flight */
+
+  if (pcm_start(&ipcm)) goto on_error_14;
+  pcm_pad(&opcm, npad);
+  if (pcm_flush(&opcm) < 0) goto on_error_14;
+
+  /* the loop allocates nothing, but the trace snapshot */
+  arena_enter_rt();
+
+  while (nread < nmax)
+  {
+    npfd = nin + 2;
+    if (pcm_get_queued(&opcm)) npfd += nout;
+
+    trace_begin("poll");
+    err = poll(pfds, (nfds_t)npfd, -1);
+    trace_end("poll");
+
+    if (err == -1)
+    {
+      if (errno == EINTR) continue ;
+      PERROR_GOTO(strerror(errno), on_error_14);
+    }
+
+    /* signals, SIGUSR1 dumps the trace */
+
+    if (pfds[nin + 1].revents & POLLIN)
     {
-      const size_t n = mod_apply
-	(&mod, ipcm.buf, ipcm.nsampl, ipcm.rpos, nsampl);
-      nsampl = n;
+      if (read(sfd, &si, sizeof(si)) != sizeof(si)) continue ;
+      if (si.ssi_signo != SIGUSR1) break ;
+      arena_leave_rt();
+      if (cmd.flags & CMDLINE_FLAG(TRACE)) trace_dump(cmd.trace);
+      arena_enter_rt();
     }
 
-    if (nsampl == 0) continue ;
+    /* capture, as much as available */
 
-    if ((ipcm.rpos + nsampl) > ipcm.nsampl)
+    snd_pcm_poll_descriptors_revents
+      (ipcm.pcm, pfds, (unsigned int)nin, &revents);
+
+    if (revents & (POLLIN | POLLERR))
     {
-      const size_t n = ipcm.nsampl - ipcm.rpos;
-      off = ipcm.rpos * ipcm.scale;
-      err = snd_pcm_writei(opcm.pcm, ipcm.buf + off, n);
+      ++stats_count;
+
+      trace_begin("read");
+
+      while (1)
+      {
+	/* one frame is kept free, to tell full from empty */
+	if (ipcm.wpos < ipcm.rpos) nsampl = ipcm.rpos - ipcm.wpos - 1;
+	else nsampl = ipcm.nsampl - ipcm.wpos - (ipcm.rpos == 0);
+	if (nsampl == 0) break ;
+
+	err = snd_pcm_readi
+	  (ipcm.pcm, ipcm.buf + ipcm.wpos * ipcm.scale, nsampl);
+	if (err == -EAGAIN) break ;
+	if (err < 0) break ;
+	if (err == 0) break ;
+
+	ipcm.wpos += (size_t)err;
+	if (ipcm.wpos == ipcm.nsampl) ipcm.wpos = 0;
+	nread += (uint64_t)err;
+	if ((size_t)err != nsampl) break ;
+      }
+
+      trace_end("read");
+      if ((err < 0) && (err != -EAGAIN)) goto on_ipcm_xrun;
+
+      /* blocks are converted once, metered, modified and queued in the */
+      /* playback format. without the modifier, partial blocks are not */
+      /* waited for. */
+
+      t = util_get_time();
+
+      while (1)
+      {
+	if (ipcm.wpos >= ipcm.rpos) nsampl = ipcm.wpos - ipcm.rpos;
+	else nsampl = ipcm.nsampl - ipcm.rpos + ipcm.wpos;
+
+	if (nsampl > mod.n) nsampl = mod.n;
+	if ((cmd.flags & CMDLINE_FLAG(FILT)) && (nsampl != mod.n)) break ;
+	if (nsampl == 0) break ;
+
+	/* parameter changes, at block boundaries */
+	xmask = NULL;
+	if (cmd.flags & CMDLINE_FLAG(CTL)) xmask = ctl_take_mask(&ctl);
+
+	/* in fixed point, the captured samples are modified in place, */
+	/* before the load: the meter then reads the modified stream */
+	if ((cmd.flags & CMDLINE_FLAG(FILT)) &&
+	    (cmd.flags & CMDLINE_FLAG(FIXED)))
+	{
+	  trace_begin("fixed");
+	  fixed_apply
+	    (&fixed, (int16_t*)ipcm.buf, ipcm.nsampl, ipcm.rpos, xmask);
+	  trace_end("fixed");
+	}
+
+	trace_begin("load");
+	mod_load(&mod, ipcm.fmt, ipcm.buf, ipcm.nsampl, ipcm.rpos, nsampl);
+	trace_end("load");
+
+	if (cmd.flags & CMDLINE_FLAG(METER))
+	{
+	  trace_begin("meter");
+	  meter_add_planar(&meter, mod.buf, mod.dist, nsampl);
+	  trace_end("meter");
+	}
+
+	if ((cmd.flags & CMDLINE_FLAG(FILT)) &&
+	    ((cmd.flags & CMDLINE_FLAG(FIXED)) == 0))
+	{
+	  trace_begin("fft");
+	  mod_apply(&mod, xmask);
+	  trace_end("fft");
+	}
+
+	if (cmd.flags & CMDLINE_FLAG(FANOUT))
+	{
+	  trace_begin("fanout");
+	  fanout_write(&fanout, mod.buf, mod.dist, nsampl);
+	  trace_end("fanout");
+	}
+
+	trace_begin("queue");
+	ndrop += pcm_queue(&opcm, rsp, mod.buf, mod.dist, nsampl);
+	trace_end("queue");
+
+	ipcm.rpos += nsampl;
+	if (ipcm.rpos >= ipcm.nsampl) ipcm.rpos -= ipcm.nsampl;
+      }
+
+      t = util_get_time() - t;
+      stats_time += t;
+
+      /* nothing waits here: the device takes what it has room for */
+      trace_begin("write");
+      err = pcm_flush(&opcm);
+      trace_end("write");
       if (err < 0) goto on_opcm_xrun;
-      nsampl -= n;
-      ipcm.rpos = 0;
+
+      if (cmd.flags & CMDLINE_FLAG(DRIFT))
+      {
+	if (drift_measure(&ipcm, &opcm, &latency) == 0)
+	  resampl_set_ratio
+	    (rsp, drift_update(&drift, latency, util_get_time()));
+      }
+
+      if (cmd.flags & CMDLINE_FLAG(SHM))
+      {
+	stats_add_time(&stats.data, (uint64_t)(t * 1000000000.0));
+	pcm_get_stats(&ipcm, &stats.data.devs[STATS_DEV_IN]);
+	pcm_get_stats(&opcm, &stats.data.devs[STATS_DEV_OUT]);
+	stats.data.ndrop = ndrop;
+	stats.data.latency = latency;
+	stats.data.ratio = drift.ratio;
+	stats_publish(&stats);
+      }
+    }
+
+    /* playback */
+
+    if (npfd != (nin + 2))
+    {
+      snd_pcm_poll_descriptors_revents
+	(opcm.pcm, pfds + nin + 2, (unsigned int)nout, &revents);
+
+      if (revents & (POLLOUT | POLLERR))
+      {
+	trace_begin("write");
+	err = pcm_flush(&opcm);
+	trace_end("write");
+	if (err < 0) goto on_opcm_xrun;
+      }
     }
 
-    off = ipcm.rpos * ipcm.scale;
-    err = snd_pcm_writei(opcm.pcm, ipcm.buf + off, nsampl);
-    if (err < 0) goto on_opcm_xrun;
-    ipcm.rpos += nsampl;
-    if (ipcm.rpos == ipcm.nsampl) ipcm.rpos = 0;
+    /* loudness and processing time */
 
-    goto redo_mod;
+    if (pfds[nin + 0].revents & POLLIN)
+    {
+      if (read(tfd, &x, sizeof(x)) != sizeof(x)) x = 0;
+
+      trace_begin("report");
+
+      if (cmd.flags & CMDLINE_FLAG(METER))
+      {
+	printf
+	(
+	 "M: %6.1f S: %6.1f I: %6.1f LUFS, tp: %6.1f dBTP\n",
+	 meter_get_momentary(&meter), meter_get_short(&meter),
+	 meter_get_integrated(&meter), meter_get_true_peak(&meter)
+	);
+      }
+
+      if (cmd.flags & CMDLINE_FLAG(STATS))
+      {
+	navail = pcm_get_queued(&opcm);
+	printf
+	(
+	 "process: %.1f us per period, %zu periods, "
+	 "queued %zu, dropped %zu, xruns %zu\n",
+	 (stats_time * 1000000.0) / (double)(stats_count ? stats_count : 1),
+	 stats_count, navail, ndrop, nxrun
+	);
+	stats_time = 0.0;
+	stats_count = 0;
+
+	if (cmd.flags & CMDLINE_FLAG(DRIFT))
+	{
+	  printf
+	  (
+	   "drift: latency %.1f ms, ratio %+.1f ppm\n",
+	   latency * 1000.0, (drift.ratio - 1.0) * 1000000.0
+	  );
+	}
+
+	if (cmd.flags & CMDLINE_FLAG(FANOUT))
+	{
+	  navail = fanout_get_nlag(&fanout, &nclient);
+	  printf("fanout: %zu clients, %zu behind\n", nclient, navail);
+	}
+      }
+
+      fflush(stdout);
+
+      trace_end("report");
+    }
 
     continue ;
 
   on_ipcm_xrun:
-    if (pcm_recover_xrun(&ipcm, err)) PERROR_GOTO("", on_error_2);
+    ++nxrun;
+    if (cmd.flags & CMDLINE_FLAG(SHM)) ++stats.data.devs[STATS_DEV_IN].nxrun;
+    trace_mark("xrun", 0);
+    if (pcm_recover_xrun(&ipcm, err)) PERROR_GOTO("", on_error_14);
     continue ;
 
   on_opcm_xrun:
-    if (pcm_recover_xrun(&opcm, err)) PERROR_GOTO("", on_error_2);
+    ++nxrun;
+    if (cmd.flags & CMDLINE_FLAG(SHM)) ++stats.data.devs[STATS_DEV_OUT].nxrun;
+    trace_mark("xrun", 1);
+    if (pcm_recover_xrun(&opcm, err)) PERROR_GOTO("", on_error_14);
+    pcm_pad(&opcm, npad);
     continue ;
   }
 
   err = 0;
 
- on_error_3:
+ on_error_14:
+  arena_leave_rt();
+ on_error_13:
+  close(sfd);
+ on_error_12:
+  close(tfd);
+ on_error_11:
+  if (cmd.flags & CMDLINE_FLAG(CTL)) ctl_close(&ctl);
+ on_error_10:
+  if (cmd.flags & CMDLINE_FLAG(FANOUT)) fanout_destroy(&fanout);
+ on_error_9:
+  if (cmd.flags & CMDLINE_FLAG(SHM)) stats_close(&stats);
+ on_error_8:
+  if (rsp != NULL) resampl_fini(rsp);
+ on_error_7:
+  if (cmd.flags & CMDLINE_FLAG(METER)) meter_fini(&meter);
+ on_error_6:
+  if (cmd.flags & CMDLINE_FLAG(FIXED)) fixed_fini(&fixed);
+ on_error_5:
   mod_close(&mod);
- on_error_2:
+ on_error_4:
+  arena_fini(&arena);
+ on_error_3:
   pcm_close(&opcm);
- on_error_1:
+ on_error_2:
   pcm_close(&ipcm);
+ on_error_1:
+  if (cmd.flags & CMDLINE_FLAG(TRACE))
+  {
+    trace_dump(cmd.trace);
+    trace_fini();
+  }
  on_error_0:
   return err;
 }
@@ -0,0 +1,2 @@
+#!/usr/bin/env sh
+gcc -Wall -O2 -I. -I../wav -I../util main.c meter.c ../wav/wav.c ../util/util.c -lm
@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "wav.h"
+#include "meter.h"
+#include "util.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+#define CMD_FLAG_IPATH (1 << 0)
+  uint32_t flags;
+  const char* ipath;
+  size_t nblock;
+  unsigned int period_ms;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->flags = 0;
+  cmd->ipath = NULL;
+  cmd->nblock = 4096;
+  cmd->period_ms = 0;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-ipath") == 0)
+    {
+      cmd->flags |= CMD_FLAG_IPATH;
+      cmd->ipath = v;
+    }
+    else if (strcmp(k, "-block") == 0)
+    {
+      cmd->nblock = (size_t)strtoul(v, NULL, 10);
+      if (cmd->nblock == 0) goto on_error;
+    }
+    else if (strcmp(k, "-period") == 0)
+    {
+      cmd->period_ms = (unsigned int)strtoul(v, NULL, 10);
+    }
+    else goto on_error;
+  }
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* main */
+
+int main(int ac, char** av)
+{
+  wav_handle_t iw;
+  meter_handle_t meter;
+  cmd_handle_t cmd;
+  const int16_t* p;
+  size_t nblock;
+  size_t period;
+  size_t next;
+  size_t i;
+  double t;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if ((cmd.flags & CMD_FLAG_IPATH) == 0)
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (wav_open(&iw, cmd.ipath))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (iw.wsampl != 2)
+  {
+    /* only int16_t supported */
+    PERROR();
+    goto on_error_1;
+  }
+
+  if (meter_init(&meter, iw.nchan, iw.fsampl))
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  /* feed the meter by blocks, as the live loop does with its periods */
+
+  period = ((size_t)iw.fsampl * (size_t)cmd.period_ms) / 1000;
+  next = period;
+  p = wav_get_sampl_buf(&iw);
+  t = util_get_time();
+
+  for (i = 0; i != iw.nsampl; i += nblock, p += nblock * iw.nchan)
+  {
+    nblock = iw.nsampl - i;
+    if (nblock > cmd.nblock) nblock = cmd.nblock;
+    if (period && ((i + nblock) > next)) nblock = next - i;
+
+    meter_add_int16(&meter, p, nblock);
+
+    if (period && ((i + nblock) == next))
+    {
+      printf
+      (
+       "%10.3f M: %6.1f S: %6.1f LUFS, rms: %6.1f dBFS, tp: %6.1f dBTP\n",
+       (double)next / (double)iw.fsampl,
+       meter_get_momentary(&meter), meter_get_short(&meter),
+       meter_get_window_rms(&meter), meter_get_true_peak(&meter)
+      );
+
+      next += period;
+    }
+  }
+
+  t = util_get_time() - t;
+
+  printf("integrated: %.1f LUFS\n", meter_get_integrated(&meter));
+  printf("momentary max: %.1f LUFS\n", meter.momentary_max);
+  printf("short term max: %.1f LUFS\n", meter.short_max);
+  printf("rms: %.1f dBFS\n", meter_get_rms(&meter));
+  printf("sample peak: %.1f dBFS\n", meter_get_sample_peak(&meter));
+  printf("true peak: %.1f dBTP\n", meter_get_true_peak(&meter));
+  printf
+  (
+   "time: %.3f s, %.1fx realtime\n",
+   t, ((double)iw.nsampl / (double)iw.fsampl) / (t > 0.0 ? t : 1e-9)
+  );
+
+  err = 0;
+
+  meter_fini(&meter);
+ on_error_1:
+  wav_close(&iw);
+ on_error_0:
+  return err;
+}
@@ -0,0 +1,613 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "meter.h"
+
+
+/* frames converted at once into the group major scratch buffer */
+#define METER_NBLOCK 256
+
+
+static size_t meter_get_nvec(size_t ngroup)
+{
+  /* kz, gain, acc and racc, tp_hist, tp_max and sp_max */
+  return ngroup * (4 + 1 + 2 + 2 * METER_TP_NTAP + 2);
+}
+
+
+static meter_vec_t meter_splat(double x)
+{
+  meter_vec_t v;
+  size_t i;
+  for (i = 0; i != METER_NLANE; ++i) v[i] = x;
+  return v;
+}
+
+
+/* lane masks, as produced by vector comparisons */
+typedef int64_t meter_mask_t __attribute__((vector_size(METER_NLANE * 8)));
+
+
+static meter_vec_t meter_max(meter_vec_t a, meter_vec_t b)
+{
+  const meter_mask_t m = a > b;
+  return (meter_vec_t)(((meter_mask_t)a & m) | ((meter_mask_t)b & ~m));
+}
+
+
+static meter_vec_t meter_abs(meter_vec_t a)
+{
+  /* clear the sign bits */
+  const meter_mask_t m = (meter_mask_t)meter_splat(-0.0);
+  return (meter_vec_t)((meter_mask_t)a & ~m);
+}
+
+
+static double meter_hmax(meter_vec_t a)
+{
+  double x = a[0];
+  size_t i;
+  for (i = 1; i != METER_NLANE; ++i) if (a[i] > x) x = a[i];
+  return x;
+}
+
+
+static double meter_energy_to_lufs(double e)
+{
+  if (e <= 0.0) return -HUGE_VAL;
+  return -0.691 + 10.0 * log10(e);
+}
+
+
+static void meter_init_kweighting(meter_handle_t* m)
+{
+  /* pre filter (high shelf) and rlb filter (high pass) coefficients */
+  /* for any sampling frequency, from the analog prototypes given in */
+  /* BS.1770 for 48 kHz. same derivation as libebur128. */
+
+  const double fs = (double)m->fsampl;
+  double f0;
+  double g;
+  double q;
+  double k;
+  double vh;
+  double vb;
+  double a0;
+
+  f0 = 1681.974450955533;
+  g = 3.999843853973347;
+  q = 0.7071752369554196;
+
+  k = tan(M_PI * f0 / fs);
+  vh = pow(10.0, g / 20.0);
+  vb = pow(vh, 0.4996667741545416);
+  a0 = 1.0 + k / q + k * k;
+
+  m->kb[0][0] = (vh + vb * k / q + k * k) / a0;
+  m->kb[0][1] = 2.0 * (k * k - vh) / a0;
+  m->kb[0][2] = (vh - vb * k / q + k * k) / a0;
+  m->ka[0][0] = 2.0 * (k * k - 1.0) / a0;
+  m->ka[0][1] = (1.0 - k / q + k * k) / a0;
+
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+
+  k = tan(M_PI * f0 / fs);
+  a0 = 1.0 + k / q + k * k;
+
+  m->kb[1][0] = 1.0;
+  m->kb[1][1] = -2.0;
+  m->kb[1][2] = 1.0;
+  m->ka[1][0] = 2.0 * (k * k - 1.0) / a0;
+  m->ka[1][1] = (1.0 - k / q + k * k) / a0;
+}
+
+
+static void meter_init_true_peak(meter_handle_t* m)
+{
+  /* blackman windowed sinc, cutoff at the original nyquist. the */
+  /* coefficients are stored oldest sample first for each phase. */
+
+  static const size_t n = METER_TP_NPHASE * METER_TP_NTAP;
+  const double c = (double)(n - 1) / 2.0;
+  double h[METER_TP_NPHASE * METER_TP_NTAP];
+  double sum;
+  size_t i;
+  size_t j;
+
+  for (i = 0; i != n; ++i)
+  {
+    const double t = ((double)i - c) / (double)METER_TP_NPHASE;
+    const double a = (2.0 * M_PI * ((double)i + 0.5)) / (double)n;
+    const double w = 0.42 - 0.5 * cos(a) + 0.08 * cos(2.0 * a);
+    h[i] = w * (t == 0.0 ? 1.0 : sin(M_PI * t) / (M_PI * t));
+  }
+
+  for (i = 0; i != METER_TP_NPHASE; ++i)
+  {
+    sum = 0.0;
+
+    for (j = 0; j != METER_TP_NTAP; ++j)
+    {
+      const size_t k = i + METER_TP_NPHASE * (METER_TP_NTAP - 1 - j);
+      m->tp_coef[i][j] = h[k];
+      sum += h[k];
+    }
+
+    /* unity gain on each phase */
+    for (j = 0; j != METER_TP_NTAP; ++j) m->tp_coef[i][j] /= sum;
+  }
+}
+
+
+void meter_reset(meter_handle_t* m)
+{
+  const size_t ng = m->ngroup;
+
+  memset(m->kz, 0, ng * 4 * sizeof(meter_vec_t));
+  memset(m->acc, 0, ng * sizeof(meter_vec_t));
+  memset(m->racc, 0, ng * sizeof(meter_vec_t));
+  memset(m->tp_hist, 0, ng * 2 * METER_TP_NTAP * sizeof(meter_vec_t));
+  memset(m->tp_max, 0, ng * sizeof(meter_vec_t));
+  memset(m->sp_max, 0, ng * sizeof(meter_vec_t));
+  m->tp_pos = 0;
+
+  m->sub_pos = 0;
+  m->sub_count = 0;
+
+  memset(m->hist_count, 0, sizeof(m->hist_count));
+  memset(m->hist_energy, 0, sizeof(m->hist_energy));
+
+  m->rms_sum = 0.0;
+  m->nsampl = 0;
+
+  m->momentary_max = -HUGE_VAL;
+  m->short_max = -HUGE_VAL;
+}
+
+
+size_t meter_get_size(size_t nchan)
+{
+  /* bytes of the buffers, for meter_init_mem */
+  return meter_get_nvec((nchan + METER_NLANE - 1) / METER_NLANE) *
+    sizeof(meter_vec_t);
+}
+
+
+int meter_init_mem
+(meter_handle_t* m, size_t nchan, unsigned int fsampl, void* mem)
+{
+  /* buffers in mem, meter_get_size bytes 64 aligned, that the caller */
+  /* owns */
+
+  meter_vec_t* p = mem;
+  size_t i;
+
+  if ((nchan == 0) || (fsampl < 10)) return -1;
+
+  m->nchan = nchan;
+  m->ngroup = (nchan + METER_NLANE - 1) / METER_NLANE;
+  m->fsampl = fsampl;
+  m->sub_size = (size_t)((fsampl + 5) / 10);
+  m->mem = NULL;
+
+  memset(p, 0, meter_get_nvec(m->ngroup) * sizeof(meter_vec_t));
+
+  m->kz = p;
+  p += m->ngroup * 4;
+  m->gain = p;
+  p += m->ngroup;
+  m->acc = p;
+  m->racc = m->acc + m->ngroup;
+  p += m->ngroup * 2;
+  m->tp_hist = p;
+  m->tp_max = m->tp_hist + m->ngroup * 2 * METER_TP_NTAP;
+  m->sp_max = m->tp_max + m->ngroup;
+
+  /* channel weights, surround channels of a 5.1 layout get +1.5 dB */
+  /* and lfe is not measured. padding lanes are weighted 0. */
+
+  for (i = 0; i != (m->ngroup * METER_NLANE); ++i)
+  {
+    double g = 1.0;
+    if (i >= nchan) g = 0.0;
+    else if (nchan == 6)
+    {
+      if (i == 3) g = 0.0;
+      else if (i >= 4) g = 1.41;
+    }
+    m->gain[i / METER_NLANE][i % METER_NLANE] = g;
+  }
+
+  meter_init_kweighting(m);
+  meter_init_true_peak(m);
+  meter_reset(m);
+
+  return 0;
+}
+
+
+int meter_init(meter_handle_t* m, size_t nchan, unsigned int fsampl)
+{
+  void* p;
+
+  if (nchan == 0) return -1;
+  if (posix_memalign(&p, 64, meter_get_size(nchan))) return -1;
+
+  if (meter_init_mem(m, nchan, fsampl, p))
+  {
+    free(p);
+    return -1;
+  }
+
+  m->mem = p;
+
+  return 0;
+}
+
+
+void meter_fini(meter_handle_t* m)
+{
+  free(m->mem);
+}
+
+
+static void meter_add_block
+(meter_handle_t* m, const meter_vec_t* x, size_t g, size_t n)
+{
+  /* run n frames of group g. filters being recursive along time, the */
+  /* channels of the group are the vector lanes. */
+
+  const meter_vec_t b00 = meter_splat(m->kb[0][0]);
+  const meter_vec_t b01 = meter_splat(m->kb[0][1]);
+  const meter_vec_t b02 = meter_splat(m->kb[0][2]);
+  const meter_vec_t a01 = meter_splat(m->ka[0][0]);
+  const meter_vec_t a02 = meter_splat(m->ka[0][1]);
+  const meter_vec_t b10 = meter_splat(m->kb[1][0]);
+  const meter_vec_t b11 = meter_splat(m->kb[1][1]);
+  const meter_vec_t b12 = meter_splat(m->kb[1][2]);
+  const meter_vec_t a11 = meter_splat(m->ka[1][0]);
+  const meter_vec_t a12 = meter_splat(m->ka[1][1]);
+
+  meter_vec_t* const hist = m->tp_hist + g * 2 * METER_TP_NTAP;
+  meter_vec_t z0 = m->kz[g * 4 + 0];
+  meter_vec_t z1 = m->kz[g * 4 + 1];
+  meter_vec_t z2 = m->kz[g * 4 + 2];
+  meter_vec_t z3 = m->kz[g * 4 + 3];
+  meter_vec_t acc = m->acc[g];
+  meter_vec_t racc = m->racc[g];
+  meter_vec_t tp = m->tp_max[g];
+  meter_vec_t sp = m->sp_max[g];
+  size_t pos = m->tp_pos;
+  size_t i;
+  size_t j;
+  size_t k;
+
+  for (i = 0; i != n; ++i)
+  {
+    const meter_vec_t s = x[i];
+    meter_vec_t y;
+
+    /* k weighting */
+
+    y = b00 * s + z0;
+    z0 = b01 * s - a01 * y + z1;
+    z1 = b02 * s - a02 * y;
+
+    {
+      const meter_vec_t t = y;
+      y = b10 * t + z2;
+      z2 = b11 * t - a11 * y + z3;
+      z3 = b12 * t - a12 * y;
+    }
+
+    acc += y * y;
+    racc += s * s;
+
+    /* peaks */
+
+    sp = meter_max(sp, meter_abs(s));
+
+    hist[pos] = s;
+    hist[pos + METER_TP_NTAP] = s;
+    pos = (pos + 1) % METER_TP_NTAP;
+
+    for (j = 0; j != METER_TP_NPHASE; ++j)
+    {
+      const meter_vec_t* const h = hist + pos;
+      meter_vec_t v = meter_splat(0.0);
+      for (k = 0; k != METER_TP_NTAP; ++k) v += m->tp_coef[j][k] * h[k];
+      tp = meter_max(tp, meter_abs(v));
+    }
+  }
+
+  m->kz[g * 4 + 0] = z0;
+  m->kz[g * 4 + 1] = z1;
+  m->kz[g * 4 + 2] = z2;
+  m->kz[g * 4 + 3] = z3;
+  m->acc[g] = acc;
+  m->racc[g] = racc;
+  m->tp_max[g] = tp;
+  m->sp_max[g] = sp;
+}
+
+
+static void meter_end_sub(meter_handle_t* m)
+{
+  /* a 100 ms sub block is complete. each time 4 of them are available */
+  /* a 400 ms gating block (75% overlap) enters the histogram. */
+
+  const size_t nslot = METER_NSUB_SHORT;
+  const size_t ichan = m->ngroup * METER_NLANE;
+  double e = 0.0;
+  double r = 0.0;
+  double l;
+  size_t i;
+
+  for (i = 0; i != ichan; ++i)
+  {
+    const size_t g = i / METER_NLANE;
+    const size_t k = i % METER_NLANE;
+    e += m->gain[g][k] * m->acc[g][k];
+    r += m->racc[g][k];
+  }
+
+  memset(m->acc, 0, m->ngroup * 2 * sizeof(meter_vec_t));
+
+  m->rms_sum += r;
+  m->sub_energy[m->sub_count % nslot] = e / (double)m->sub_size;
+  m->sub_rms[m->sub_count % nslot] = r / (double)(m->sub_size * m->nchan);
+  ++m->sub_count;
+  m->sub_pos = 0;
+
+  l = meter_get_momentary(m);
+  if (l > m->momentary_max) m->momentary_max = l;
+
+  if (l >= METER_HIST_MIN)
+  {
+    const double d = METER_HIST_MAX - METER_HIST_MIN;
+    size_t b = (size_t)(((l - METER_HIST_MIN) * METER_HIST_NBIN) / d);
+    if (b >= METER_HIST_NBIN) b = METER_HIST_NBIN - 1;
+    ++m->hist_count[b];
+    m->hist_energy[b] += pow(10.0, (l + 0.691) / 10.0);
+  }
+
+  l = meter_get_short(m);
+  if (l > m->short_max) m->short_max = l;
+}
+
+
+void meter_add_int16(meter_handle_t* m, const int16_t* buf, size_t n)
+{
+  /* buf holds n interleaved frames */
+
+  static const double scale = 1.0 / 32768.0;
+
+  meter_vec_t x[METER_NBLOCK];
+  size_t nframe;
+  size_t g;
+  size_t i;
+  size_t k;
+
+  m->nsampl += (uint64_t)n;
+
+  while (n)
+  {
+    /* never cross a sub block boundary */
+
+    nframe = m->sub_size - m->sub_pos;
+    if (nframe > METER_NBLOCK) nframe = METER_NBLOCK;
+    if (nframe > n) nframe = n;
+
+    for (g = 0; g != m->ngroup; ++g)
+    {
+      for (i = 0; i != nframe; ++i)
+      {
+	const int16_t* const p = buf + i * m->nchan;
+
+	for (k = 0; k != METER_NLANE; ++k)
+	{
+	  const size_t c = g * METER_NLANE + k;
+	  x[i][k] = (c < m->nchan) ? (double)p[c] * scale : 0.0;
+	}
+      }
+
+      meter_add_block(m, x, g, nframe);
+    }
+
+    m->tp_pos = (m->tp_pos + nframe) % METER_TP_NTAP;
+
+    m->sub_pos += nframe;
+    if (m->sub_pos == m->sub_size) meter_end_sub(m);
+
+    buf += nframe * m->nchan;
+    n -= nframe;
+  }
+}
+
+
+void meter_add_planar
+(meter_handle_t* m, const double* buf, size_t dist, size_t n)
+{
+  /* buf holds nchan rows of n frames, dist apart, in [-1, 1] */
+
+  meter_vec_t x[METER_NBLOCK];
+  size_t nframe;
+  size_t g;
+  size_t i;
+  size_t k;
+
+  m->nsampl += (uint64_t)n;
+
+  while (n)
+  {
+    nframe = m->sub_size - m->sub_pos;
+    if (nframe > METER_NBLOCK) nframe = METER_NBLOCK;
+    if (nframe > n) nframe = n;
+
+    for (g = 0; g != m->ngroup; ++g)
+    {
+      for (k = 0; k != METER_NLANE; ++k)
+      {
+	const size_t c = g * METER_NLANE + k;
+	const double* const row = buf + c * dist;
+
+	if (c < m->nchan) for (i = 0; i != nframe; ++i) x[i][k] = row[i];
+	else for (i = 0; i != nframe; ++i) x[i][k] = 0.0;
+      }
+
+      meter_add_block(m, x, g, nframe);
+    }
+
+    m->tp_pos = (m->tp_pos + nframe) % METER_TP_NTAP;
+
+    m->sub_pos += nframe;
+    if (m->sub_pos == m->sub_size) meter_end_sub(m);
+
+    buf += nframe;
+    n -= nframe;
+  }
+}
+
+
+static double meter_get_window(const meter_handle_t* m, size_t n)
+{
+  double e = 0.0;
+  size_t i;
+
+  if (m->sub_count < n) return -HUGE_VAL;
+
+  for (i = 0; i != n; ++i)
+    e += m->sub_energy[(m->sub_count - 1 - i) % METER_NSUB_SHORT];
+
+  return meter_energy_to_lufs(e / (double)n);
+}
+
+
+double meter_get_momentary(const meter_handle_t* m)
+{
+  return meter_get_window(m, METER_NSUB_MOMENTARY);
+}
+
+
+double meter_get_short(const meter_handle_t* m)
+{
+  return meter_get_window(m, METER_NSUB_SHORT);
+}
+
+
+double meter_get_integrated(const meter_handle_t* m)
+{
+  /* absolute gate at -70 LUFS is the histogram lower bound, then the */
+  /* relative gate drops blocks more than 10 LU below their average */
+
+  const double d = METER_HIST_MAX - METER_HIST_MIN;
+  double e;
+  double l;
+  uint64_t n;
+  size_t b;
+  size_t i;
+
+  e = 0.0;
+  n = 0;
+  for (i = 0; i != METER_HIST_NBIN; ++i)
+  {
+    e += m->hist_energy[i];
+    n += m->hist_count[i];
+  }
+
+  if (n == 0) return -HUGE_VAL;
+
+  l = meter_energy_to_lufs(e / (double)n) - 10.0;
+
+  b = 0;
+  if (l > METER_HIST_MIN)
+    b = (size_t)ceil(((l - METER_HIST_MIN) * METER_HIST_NBIN) / d);
+
+  e = 0.0;
+  n = 0;
+  for (i = b; i < METER_HIST_NBIN; ++i)
+  {
+    e += m->hist_energy[i];
+    n += m->hist_count[i];
+  }
+
+  if (n == 0) return -HUGE_VAL;
+
+  return meter_energy_to_lufs(e / (double)n);
+}
+
+
+double meter_get_rms(const meter_handle_t* m)
+{
+  /* whole stream, dBFS, including the current partial sub block */
+
+  double r = m->rms_sum;
+  size_t g;
+  size_t k;
+
+  if (m->nsampl == 0) return -HUGE_VAL;
+
+  for (g = 0; g != m->ngroup; ++g)
+  {
+    for (k = 0; k != METER_NLANE; ++k) r += m->racc[g][k];
+  }
+
+  r /= (double)m->nsampl * (double)m->nchan;
+  if (r <= 0.0) return -HUGE_VAL;
+  return 10.0 * log10(r);
+}
+
+
+double meter_get_window_rms(const meter_handle_t* m)
+{
+  /* last 400 ms, dBFS */
+
+  double r = 0.0;
+  size_t i;
+
+  if (m->sub_count < METER_NSUB_MOMENTARY) return -HUGE_VAL;
+
+  for (i = 0; i != METER_NSUB_MOMENTARY; ++i)
+    r += m->sub_rms[(m->sub_count - 1 - i) % METER_NSUB_SHORT];
+
+  if (r <= 0.0) return -HUGE_VAL;
+  return 10.0 * log10(r / (double)METER_NSUB_MOMENTARY);
+}
+
+
+double meter_get_sample_peak(const meter_handle_t* m)
+{
+  double x = 0.0;
+  size_t g;
+
+  for (g = 0; g != m->ngroup; ++g)
+  {
+    const double y = meter_hmax(m->sp_max[g]);
+    if (y > x) x = y;
+  }
+
+  if (x <= 0.0) return -HUGE_VAL;
+  return 20.0 * log10(x);
+}
+
+
+double meter_get_true_peak(const meter_handle_t* m)
+{
+  /* dBTP. interpolated values never read below the sample peak. */
+
+  double x = 0.0;
+  size_t g;
+
+  for (g = 0; g != m->ngroup; ++g)
+  {
+    double y = meter_hmax(m->tp_max[g]);
+    const double z = meter_hmax(m->sp_max[g]);
+    if (z > y) y = z;
+    if (y > x) x = y;
+  }
+
+  if (x <= 0.0) return -HUGE_VAL;
+  return 20.0 * log10(x);
+}
@@ -0,0 +1,95 @@
+#ifndef METER_H_INCLUDED
+#define METER_H_INCLUDED
+
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* EBU R128 / ITU-R BS.1770 loudness and true peak meter */
+/* https://tech.ebu.ch/docs/tech/tech3341.pdf */
+/* https://www.itu.int/rec/R-REC-BS.1770 */
+
+/* channels are processed by groups of METER_NLANE, one per vector lane */
+#define METER_NLANE 2
+typedef double meter_vec_t __attribute__((vector_size(METER_NLANE * 8)));
+
+/* true peak, 4x oversampling polyphase interpolator */
+#define METER_TP_NPHASE 4
+#define METER_TP_NTAP 12
+
+/* 100 ms sub blocks, momentary is 4 of them, short term 30 */
+#define METER_NSUB_MOMENTARY 4
+#define METER_NSUB_SHORT 30
+
+/* gating histogram, 0.1 LU bins from -70 to +10 LUFS */
+#define METER_HIST_MIN -70.0
+#define METER_HIST_MAX 10.0
+#define METER_HIST_NBIN 800
+
+typedef struct meter_handle
+{
+  size_t nchan;
+  size_t ngroup;
+  unsigned int fsampl;
+
+  /* k weighting biquads, transposed direct form 2, per group state */
+  double kb[2][3];
+  double ka[2][2];
+  meter_vec_t* kz;
+
+  /* per group weighting factors, energy and rms accumulators */
+  meter_vec_t* gain;
+  meter_vec_t* acc;
+  meter_vec_t* racc;
+
+  /* true peak interpolator, history doubled to avoid wrapping */
+  double tp_coef[METER_TP_NPHASE][METER_TP_NTAP];
+  meter_vec_t* tp_hist;
+  meter_vec_t* tp_max;
+  meter_vec_t* sp_max;
+  size_t tp_pos;
+
+  /* current sub block */
+  size_t sub_size;
+  size_t sub_pos;
+
+  /* last sub block energies, weighted and unweighted */
+  double sub_energy[METER_NSUB_SHORT];
+  double sub_rms[METER_NSUB_SHORT];
+  size_t sub_count;
+
+  /* gating blocks */
+  uint64_t hist_count[METER_HIST_NBIN];
+  double hist_energy[METER_HIST_NBIN];
+
+  /* whole stream */
+  double rms_sum;
+  uint64_t nsampl;
+
+  double momentary_max;
+  double short_max;
+
+  /* the buffers, if meter_init took them */
+  void* mem;
+
+} meter_handle_t;
+
+
+size_t meter_get_size(size_t);
+int meter_init(meter_handle_t*, size_t, unsigned int);
+int meter_init_mem(meter_handle_t*, size_t, unsigned int, void*);
+void meter_fini(meter_handle_t*);
+void meter_reset(meter_handle_t*);
+void meter_add_int16(meter_handle_t*, const int16_t*, size_t);
+void meter_add_planar(meter_handle_t*, const double*, size_t, size_t);
+double meter_get_momentary(const meter_handle_t*);
+double meter_get_short(const meter_handle_t*);
+double meter_get_integrated(const meter_handle_t*);
+double meter_get_rms(const meter_handle_t*);
+double meter_get_window_rms(const meter_handle_t*);
+double meter_get_sample_peak(const meter_handle_t*);
+double meter_get_true_peak(const meter_handle_t*);
+
+
+#endif /* ! METER_H_INCLUDED */
@@ -0,0 +1,2 @@
+#!/usr/bin/env sh
+gcc -Wall -O2 -I. -I../wav -I../simd -I../util main.c peaks.c ../wav/wav.c ../wav/wav_fmt.c ../simd/simd.c ../util/util.c -lm
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include "wav.h"
+#include "peaks.h"
+#include "util.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+#define CMD_FLAG_IPATH (1 << 0)
+#define CMD_FLAG_OPATH (1 << 1)
+#define CMD_FLAG_UPDATE (1 << 2)
+#define CMD_FLAG_QUERY (1 << 3)
+  uint32_t flags;
+  const char* ipath;
+  const char* opath;
+  /* seconds between updates of a file being recorded, 0 for one */
+  unsigned int follow;
+  size_t chan;
+  uint64_t start;
+  uint64_t nframe;
+  size_t width;
+  char opath_buf[PATH_MAX];
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->flags = 0;
+  cmd->ipath = NULL;
+  cmd->opath = NULL;
+  cmd->follow = 0;
+  cmd->chan = 0;
+  cmd->start = 0;
+  cmd->nframe = 0;
+  cmd->width = 80;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-do") == 0)
+    {
+      if (strcmp(v, "update") == 0) cmd->flags |= CMD_FLAG_UPDATE;
+      else if (strcmp(v, "query") == 0) cmd->flags |= CMD_FLAG_QUERY;
+      else goto on_error;
+    }
+    else if (strcmp(k, "-ipath") == 0)
+    {
+      cmd->flags |= CMD_FLAG_IPATH;
+      cmd->ipath = v;
+    }
+    else if (strcmp(k, "-opath") == 0)
+    {
+      cmd->flags |= CMD_FLAG_OPATH;
+      cmd->opath = v;
+    }
+    else if (strcmp(k, "-follow") == 0)
+    {
+      cmd->follow = (unsigned int)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-chan") == 0)
+    {
+      cmd->chan = (size_t)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-start") == 0)
+    {
+      cmd->start = (uint64_t)strtoull(v, NULL, 10);
+    }
+    else if (strcmp(k, "-nframe") == 0)
+    {
+      /* 0 up to the end */
+      cmd->nframe = (uint64_t)strtoull(v, NULL, 10);
+    }
+    else if (strcmp(k, "-width") == 0)
+    {
+      cmd->width = (size_t)strtoul(v, NULL, 10);
+      if (cmd->width == 0) goto on_error;
+    }
+    else goto on_error;
+  }
+
+  if ((cmd->flags & CMD_FLAG_IPATH) == 0) goto on_error;
+
+  if ((cmd->flags & CMD_FLAG_OPATH) == 0)
+  {
+    /* the sidecar is next to the file */
+    snprintf(cmd->opath_buf, sizeof(cmd->opath_buf), "%s.peaks", cmd->ipath);
+    cmd->opath = cmd->opath_buf;
+  }
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* main */
+
+static int main_update(const cmd_handle_t* cmd)
+{
+  double t;
+
+  while (1)
+  {
+    t = util_get_time();
+
+    if (peaks_update(cmd->ipath, cmd->opath))
+    {
+      PERROR();
+      return -1;
+    }
+
+    printf("%s: %.3f s\n", cmd->opath, util_get_time() - t);
+    fflush(stdout);
+
+    if (cmd->follow == 0) break ;
+    sleep(cmd->follow);
+  }
+
+  return 0;
+}
+
+static int main_query(const cmd_handle_t* cmd)
+{
+  peaks_handle_t p;
+  peaks_entry_t* e;
+  uint64_t nframe;
+  double t;
+  size_t n;
+  size_t i;
+  int err = -1;
+
+  if (peaks_open(&p, cmd->opath))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  e = malloc(cmd->width * sizeof(peaks_entry_t));
+  if (e == NULL)
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  nframe = cmd->nframe;
+  if (nframe == 0) nframe = peaks_get_nframe(&p);
+
+  t = util_get_time();
+  n = peaks_query(&p, cmd->chan, cmd->start, nframe, cmd->width, e);
+  t = util_get_time() - t;
+
+  for (i = 0; i != n; ++i)
+    printf("%zu %f %f %f\n", i, e[i].min, e[i].max, e[i].rms);
+
+  printf("%zu entries in %.6f s\n", n, t);
+
+  err = 0;
+
+  free(e);
+ on_error_1:
+  peaks_close(&p);
+ on_error_0:
+  return err;
+}
+
+int main(int ac, char** av)
+{
+  cmd_handle_t cmd;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (cmd.flags & CMD_FLAG_UPDATE) err = main_update(&cmd);
+  else if (cmd.flags & CMD_FLAG_QUERY) err = main_query(&cmd);
+  else PERROR();
+
+ on_error_0:
+  return err;
+}
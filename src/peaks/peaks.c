@@ -0,0 +1,524 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <limits.h>
+#include <float.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "wav.h"
+#include "wav_fmt.h"
+#include "peaks.h"
+
+
+/* level 0 entries computed per read block */
+#define PEAKS_NBLOCK 256
+
+
+/* layout */
+
+static uint64_t peaks_get_count(uint64_t nframe, size_t level)
+{
+  /* entries at level summarizing nframe frames */
+
+  uint64_t size = PEAKS_BASE;
+  size_t i;
+
+  for (i = 0; i != level; ++i) size *= PEAKS_FANOUT;
+
+  return (nframe + size - 1) / size;
+}
+
+
+static size_t peaks_layout
+(peaks_header_t* h, size_t nchan, unsigned int fsampl, uint64_t capacity)
+{
+  /* fill h for capacity frames, return the file size. levels are added */
+  /* until one entry covers the whole capacity. */
+
+  size_t off;
+  size_t l;
+
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, PEAKS_MAGIC, sizeof(h->magic));
+  h->nchan = (uint32_t)nchan;
+  h->fsampl = (uint32_t)fsampl;
+  h->base = PEAKS_BASE;
+  h->fanout = PEAKS_FANOUT;
+  h->capacity = capacity;
+
+  off = (sizeof(peaks_header_t) + 63) & ~(size_t)63;
+
+  for (l = 0; l != PEAKS_MAX_LEVEL; ++l)
+  {
+    h->level_off[l] = (uint64_t)off;
+    off += peaks_get_count(capacity, l) * nchan * sizeof(peaks_entry_t);
+    if (peaks_get_count(capacity, l) <= 1) break ;
+  }
+
+  h->nlevel = (uint32_t)(l + (l != PEAKS_MAX_LEVEL));
+
+  return off;
+}
+
+
+static int peaks_check_header
+(const peaks_header_t* h, size_t size, size_t nchan, unsigned int fsampl)
+{
+  peaks_header_t x;
+
+  if (size < sizeof(peaks_header_t)) return -1;
+  if (memcmp(h->magic, PEAKS_MAGIC, sizeof(h->magic))) return -1;
+  if ((h->base != PEAKS_BASE) || (h->fanout != PEAKS_FANOUT)) return -1;
+
+  /* nchan and fsampl null to take those of the file */
+  if (nchan == 0) nchan = (size_t)h->nchan;
+  if (fsampl == 0) fsampl = (unsigned int)h->fsampl;
+  if ((h->nchan != nchan) || (h->fsampl != fsampl)) return -1;
+
+  if (peaks_layout(&x, nchan, fsampl, h->capacity) != size) return -1;
+  if (memcmp(x.level_off, h->level_off, sizeof(x.level_off))) return -1;
+  if (h->nframe > h->capacity) return -1;
+
+  return 0;
+}
+
+
+static peaks_entry_t* peaks_get_level
+(uint8_t* map, const peaks_header_t* h, size_t l)
+{
+  return (peaks_entry_t*)(map + h->level_off[l]);
+}
+
+
+/* entries */
+
+static void peaks_merge
+(peaks_entry_t* o, const peaks_entry_t* x, size_t n, size_t stride)
+{
+  /* n entries of one chan, stride apart */
+
+  float lo = FLT_MAX;
+  float hi = -FLT_MAX;
+  double sum = 0.0;
+  size_t i;
+
+  for (i = 0; i != n; ++i, x += stride)
+  {
+    if (x->min < lo) lo = x->min;
+    if (x->max > hi) hi = x->max;
+    sum += (double)x->rms * (double)x->rms;
+  }
+
+  if (n == 0) lo = hi = 0.0f;
+
+  o->min = lo;
+  o->max = hi;
+  o->rms = (float)(n ? sqrt(sum / (double)n) : 0.0);
+}
+
+
+static void peaks_compute
+(peaks_entry_t* o, const double* x, size_t nframe, size_t nchan)
+{
+  /* one level 0 entry per chan, from nframe planar frames, chans */
+  /* PEAKS_BASE samples apart */
+
+  size_t c;
+  size_t i;
+
+  for (c = 0; c != nchan; ++c, x += PEAKS_BASE)
+  {
+    double lo = x[0];
+    double hi = x[0];
+    double sum = 0.0;
+
+    for (i = 0; i != nframe; ++i)
+    {
+      if (x[i] < lo) lo = x[i];
+      if (x[i] > hi) hi = x[i];
+      sum += x[i] * x[i];
+    }
+
+    o[c].min = (float)lo;
+    o[c].max = (float)hi;
+    o[c].rms = (float)sqrt(sum / (double)nframe);
+  }
+}
+
+
+/* update */
+
+/* a sidecar is valid up to header nframe. an update recomputes level */
+/* 0 from the last, possibly partial, entry up to the current end of */
+/* the file, and the upper entries above them. a file outgrowing the */
+/* capacity is laid out again with twice as much, aside then renamed. */
+
+static ssize_t peaks_pread(int fd, void* buf, size_t size, off_t off)
+{
+  size_t n = 0;
+  ssize_t r;
+
+  while (n != size)
+  {
+    r = pread(fd, (uint8_t*)buf + n, size - n, off + (off_t)n);
+    if (r > 0) n += (size_t)r;
+    else if ((r == -1) && (errno == EINTR)) continue ;
+    else if (r == 0) break ;
+    else return -1;
+  }
+
+  return (ssize_t)n;
+}
+
+
+static int peaks_scan
+(
+ uint8_t* map, const peaks_header_t* h,
+ int fd, const wav_info_t* info, unsigned int fmt,
+ uint64_t from, uint64_t nframe
+)
+{
+  /* level 0 entries from the one holding frame from. a block is read */
+  /* as stored, and converted an entry at a time by the wav_fmt kernels */
+
+  const size_t nchan = (size_t)h->nchan;
+  const size_t fsize = nchan * info->wsampl;
+  peaks_entry_t* const e = peaks_get_level(map, h, 0);
+  uint8_t* buf;
+  double* planar;
+  uint64_t i;
+  uint64_t f;
+  size_t n;
+  size_t k;
+  size_t j;
+  int err = -1;
+
+  buf = malloc(PEAKS_NBLOCK * PEAKS_BASE * fsize);
+  if (buf == NULL) goto on_error_0;
+
+  planar = malloc(PEAKS_BASE * nchan * sizeof(double));
+  if (planar == NULL) goto on_error_1;
+
+  for (i = from / PEAKS_BASE; (i * PEAKS_BASE) < nframe; i += k)
+  {
+    f = i * PEAKS_BASE;
+    n = PEAKS_NBLOCK * PEAKS_BASE;
+    if (n > (nframe - f)) n = (size_t)(nframe - f);
+
+    if (peaks_pread(fd, buf, n * fsize, (off_t)(info->data_off + f * fsize))
+	!= (ssize_t)(n * fsize))
+      goto on_error_2;
+
+    k = (n + PEAKS_BASE - 1) / PEAKS_BASE;
+    for (j = 0; j != k; ++j)
+    {
+      size_t m = n - j * PEAKS_BASE;
+      if (m > PEAKS_BASE) m = PEAKS_BASE;
+      wav_fmt_to_planar
+	(fmt, planar, PEAKS_BASE, buf + j * PEAKS_BASE * fsize, nchan, m);
+      peaks_compute(e + (i + j) * nchan, planar, m, nchan);
+    }
+  }
+
+  err = 0;
+
+ on_error_2:
+  free(planar);
+ on_error_1:
+  free(buf);
+ on_error_0:
+  return err;
+}
+
+
+static void peaks_propagate
+(uint8_t* map, const peaks_header_t* h, uint64_t from, uint64_t nframe)
+{
+  /* upper entries holding frames from on */
+
+  const size_t nchan = (size_t)h->nchan;
+  uint64_t a = from / PEAKS_BASE;
+  uint64_t n;
+  uint64_t m;
+  uint64_t i;
+  size_t l;
+  size_t c;
+
+  for (l = 1; l != h->nlevel; ++l)
+  {
+    const peaks_entry_t* const x = peaks_get_level(map, h, l - 1);
+    peaks_entry_t* const o = peaks_get_level(map, h, l);
+
+    a /= PEAKS_FANOUT;
+    m = peaks_get_count(nframe, l - 1);
+    n = peaks_get_count(nframe, l);
+
+    for (i = a; i != n; ++i)
+    {
+      uint64_t k = m - i * PEAKS_FANOUT;
+      if (k > PEAKS_FANOUT) k = PEAKS_FANOUT;
+
+      for (c = 0; c != nchan; ++c)
+      {
+	peaks_merge
+	  (o + i * nchan + c, x + i * PEAKS_FANOUT * nchan + c, k, nchan);
+      }
+    }
+  }
+}
+
+
+static int peaks_create
+(
+ const char* path, uint64_t capacity,
+ const wav_info_t* info, unsigned int fmt,
+ const uint8_t* omap, const peaks_header_t* oh, uint64_t nold,
+ int* fd, uint8_t** map, size_t* size
+)
+{
+  /* laid out aside. the level 0 entries of the first nold frames are */
+  /* copied from omap, if any. */
+
+  peaks_header_t h;
+  char tmp[PATH_MAX + 16];
+
+  *size = peaks_layout(&h, info->nchan, info->fsampl, capacity);
+  h.data_off = info->data_off;
+  h.fmt = (uint32_t)fmt;
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+  *fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 00644);
+  if (*fd == -1) goto on_error_0;
+
+  if (ftruncate(*fd, (off_t)*size)) goto on_error_1;
+
+  *map = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  if (*map == MAP_FAILED) goto on_error_1;
+
+  memcpy(*map, &h, sizeof(h));
+
+  if (nold)
+  {
+    memcpy
+    (
+     peaks_get_level(*map, &h, 0),
+     omap + oh->level_off[0],
+     peaks_get_count(nold, 0) * info->nchan * sizeof(peaks_entry_t)
+    );
+  }
+
+  if (rename(tmp, path)) goto on_error_2;
+
+  return 0;
+
+ on_error_2:
+  munmap(*map, *size);
+ on_error_1:
+  close(*fd);
+  unlink(tmp);
+ on_error_0:
+  return -1;
+}
+
+
+int peaks_update(const char* wpath, const char* ppath)
+{
+  /* create the sidecar of wpath at ppath, or bring it up to date */
+
+  wav_info_t info;
+  struct stat st;
+  peaks_header_t* h;
+  uint8_t* map = MAP_FAILED;
+  uint8_t* nmap;
+  size_t size = 0;
+  size_t nsize;
+  uint64_t nframe;
+  uint64_t from = 0;
+  uint64_t capacity;
+  unsigned int fmt;
+  unsigned int is_new = 0;
+  int wfd;
+  int pfd;
+  int nfd;
+  int err = -1;
+
+  wfd = open(wpath, O_RDONLY);
+  if (wfd == -1) goto on_error_0;
+
+  if (fstat(wfd, &st)) goto on_error_1;
+  if (wav_probe(&info, wfd, (uint64_t)st.st_size)) goto on_error_1;
+
+  fmt = wav_fmt_find(info.format, info.wsampl);
+  if (fmt == WAV_FMT_COUNT) goto on_error_1;
+  if ((info.nchan == 0) || (info.nchan > WAV_FMT_NTILE)) goto on_error_1;
+  if (info.fsampl == 0) goto on_error_1;
+
+  /* a recording may hold a partial frame */
+  nframe = info.data_size / (info.nchan * info.wsampl);
+
+  pfd = open(ppath, O_RDWR);
+  if (pfd != -1)
+  {
+    if (fstat(pfd, &st) == 0)
+    {
+      size = (size_t)st.st_size;
+      map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pfd, 0);
+    }
+
+    h = (peaks_header_t*)map;
+
+    /* the last entry may be partial, it is done again */
+    if ((map != MAP_FAILED) &&
+	(peaks_check_header(h, size, info.nchan, info.fsampl) == 0) &&
+	(h->data_off == info.data_off) && (h->fmt == fmt) &&
+	(h->nframe <= nframe))
+      from = (h->nframe / PEAKS_BASE) * PEAKS_BASE;
+  }
+
+  if ((map == MAP_FAILED) || (nframe > ((peaks_header_t*)map)->capacity) ||
+      (from == 0))
+  {
+    capacity = nframe;
+    if (from)
+    {
+      /* growing, the levels above are all redone */
+      capacity = ((peaks_header_t*)map)->capacity * 2;
+      if (capacity < nframe) capacity = nframe;
+    }
+    if (capacity == 0) capacity = 1;
+
+    if (peaks_create
+	(ppath, capacity, &info, fmt, map, (peaks_header_t*)map, from,
+	 &nfd, &nmap, &nsize))
+      goto on_error_2;
+
+    if (map != MAP_FAILED) munmap(map, size);
+    if (pfd != -1) close(pfd);
+
+    pfd = nfd;
+    map = nmap;
+    size = nsize;
+    is_new = 1;
+  }
+
+  h = (peaks_header_t*)map;
+
+  if (peaks_scan(map, h, wfd, &info, fmt, from, nframe)) goto on_error_2;
+  peaks_propagate(map, h, is_new ? 0 : from, nframe);
+
+  /* readers trust the entries up to nframe */
+  __atomic_store_n(&h->nframe, nframe, __ATOMIC_RELEASE);
+
+  err = 0;
+
+ on_error_2:
+  if (map != MAP_FAILED) munmap(map, size);
+  if (pfd != -1) close(pfd);
+ on_error_1:
+  close(wfd);
+ on_error_0:
+  return err;
+}
+
+
+/* query */
+
+int peaks_open(peaks_handle_t* p, const char* path)
+{
+  struct stat st;
+
+  p->fd = open(path, O_RDONLY);
+  if (p->fd == -1) goto on_error_0;
+
+  if (fstat(p->fd, &st)) goto on_error_1;
+  p->size = (size_t)st.st_size;
+
+  p->map = mmap(NULL, p->size, PROT_READ, MAP_SHARED, p->fd, 0);
+  if (p->map == MAP_FAILED) goto on_error_1;
+
+  p->h = (const peaks_header_t*)p->map;
+  if (peaks_check_header(p->h, p->size, 0, 0)) goto on_error_2;
+
+  return 0;
+
+ on_error_2:
+  munmap(p->map, p->size);
+ on_error_1:
+  close(p->fd);
+ on_error_0:
+  return -1;
+}
+
+
+void peaks_close(peaks_handle_t* p)
+{
+  munmap(p->map, p->size);
+  close(p->fd);
+}
+
+
+uint64_t peaks_get_nframe(const peaks_handle_t* p)
+{
+  return __atomic_load_n(&p->h->nframe, __ATOMIC_ACQUIRE);
+}
+
+
+size_t peaks_query
+(
+ const peaks_handle_t* p,
+ size_t chan, uint64_t start, uint64_t nframe,
+ size_t width, peaks_entry_t* o
+)
+{
+  /* envelope of nframe frames from start in width entries, return the */
+  /* count of entries written, 0 if the range is not summarized yet */
+
+  const peaks_header_t* const h = p->h;
+  const size_t nchan = (size_t)h->nchan;
+  const uint64_t total = peaks_get_nframe(p);
+  const peaks_entry_t* e;
+  uint64_t bsize = PEAKS_BASE;
+  uint64_t count;
+  uint64_t f0;
+  uint64_t f1;
+  uint64_t i0;
+  uint64_t i1;
+  size_t l = 0;
+  size_t i;
+
+  if ((chan >= nchan) || (width == 0) || (start >= total)) return 0;
+  if (nframe > (total - start)) nframe = total - start;
+  if (nframe == 0) return 0;
+
+  /* the coarsest level with entries no larger than a pixel */
+  while (((l + 1) < h->nlevel) && ((bsize * PEAKS_FANOUT * width) <= nframe))
+  {
+    bsize *= PEAKS_FANOUT;
+    ++l;
+  }
+
+  e = peaks_get_level(p->map, h, l) + chan;
+  count = peaks_get_count(total, l);
+
+  for (i = 0; i != width; ++i)
+  {
+    f0 = start + (i * nframe) / width;
+    f1 = start + ((i + 1) * nframe) / width;
+    if (f1 == f0) ++f1;
+
+    i0 = f0 / bsize;
+    i1 = (f1 + bsize - 1) / bsize;
+    if (i1 > count) i1 = count;
+
+    peaks_merge(o + i, e + i0 * nchan, (size_t)(i1 - i0), nchan);
+  }
+
+  return width;
+}
@@ -0,0 +1,74 @@
+#ifndef PEAKS_H_INCLUDED
+#define PEAKS_H_INCLUDED
+
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* min, max and rms overview of a wav file, kept in a sidecar */
+
+/* level 0 summarizes PEAKS_BASE frames per entry, and each level above */
+/* PEAKS_FANOUT entries of the one below. a range drawn at a width of */
+/* W pixels is read from the coarsest level with entries no larger than */
+/* a pixel: a pixel then spans at most PEAKS_FANOUT + 1 entries, and a */
+/* query costs O(W) whatever the zoom. below PEAKS_BASE frames per pixel */
+/* level 0 is used, samples have to be read for a finer envelope. */
+
+#define PEAKS_BASE 256
+#define PEAKS_FANOUT 4
+#define PEAKS_MAX_LEVEL 24
+
+/* entries are interleaved by chan. levels are relative to the full */
+/* scale of the file format, so that any sample format is summarized */
+/* alike. rms is that of the samples, rms of an upper entry is that of */
+/* its children. */
+typedef struct peaks_entry
+{
+  float min;
+  float max;
+  float rms;
+} peaks_entry_t;
+
+typedef struct peaks_header
+{
+#define PEAKS_MAGIC "PEAKS002"
+  uint8_t magic[8];
+  uint32_t nchan;
+  uint32_t fsampl;
+  uint32_t base;
+  uint32_t fanout;
+  uint32_t nlevel;
+  /* WAV_FMT_xxx of the source samples */
+  uint32_t fmt;
+
+  /* frames summarized, and that the levels can hold */
+  uint64_t nframe;
+  uint64_t capacity;
+
+  /* where the source samples start, a moved one is rebuilt */
+  uint64_t data_off;
+
+  uint64_t level_off[PEAKS_MAX_LEVEL];
+
+} peaks_header_t;
+
+typedef struct peaks_handle
+{
+  int fd;
+  uint8_t* map;
+  size_t size;
+  const peaks_header_t* h;
+
+} peaks_handle_t;
+
+
+int peaks_update(const char*, const char*);
+int peaks_open(peaks_handle_t*, const char*);
+void peaks_close(peaks_handle_t*);
+uint64_t peaks_get_nframe(const peaks_handle_t*);
+size_t peaks_query
+(const peaks_handle_t*, size_t, uint64_t, uint64_t, size_t, peaks_entry_t*);
+
+
+#endif /* ! PEAKS_H_INCLUDED */
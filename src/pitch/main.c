@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "wav.h"
+#include "pitch.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+#define CMD_FLAG_IPATH (1 << 0)
+#define CMD_FLAG_OPATH (1 << 1)
+  uint32_t flags;
+  const char* ipath;
+  const char* opath;
+  size_t chan;
+  size_t hop;
+  size_t njob;
+  double fmin;
+  double fmax;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->flags = 0;
+  cmd->ipath = NULL;
+  cmd->opath = NULL;
+  cmd->chan = 0;
+  cmd->hop = 512;
+  cmd->njob = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+  cmd->fmin = 60.0;
+  cmd->fmax = 1500.0;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-ipath") == 0)
+    {
+      cmd->flags |= CMD_FLAG_IPATH;
+      cmd->ipath = v;
+    }
+    else if (strcmp(k, "-opath") == 0)
+    {
+      cmd->flags |= CMD_FLAG_OPATH;
+      cmd->opath = v;
+    }
+    else if (strcmp(k, "-chan") == 0)
+    {
+      cmd->chan = (size_t)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-hop") == 0)
+    {
+      cmd->hop = (size_t)strtoul(v, NULL, 10);
+      if (cmd->hop == 0) goto on_error;
+    }
+    else if (strcmp(k, "-njob") == 0)
+    {
+      cmd->njob = (size_t)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-fmin") == 0)
+    {
+      cmd->fmin = strtod(v, NULL);
+    }
+    else if (strcmp(k, "-fmax") == 0)
+    {
+      cmd->fmax = strtod(v, NULL);
+    }
+    else goto on_error;
+  }
+
+  if (cmd->njob == 0) cmd->njob = 1;
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* offline tracking */
+
+/* the hops are split in contiguous ranges, one per job. each job owns */
+/* its pitch handle, created beforehand since planning is not thread */
+/* safe, and reads its frames straight from the mapped file. */
+
+typedef struct
+{
+  pthread_t thread;
+  pitch_handle_t pitch;
+
+  const int16_t* sampl;
+  size_t nchan;
+  size_t nsampl;
+
+  size_t ihop;
+  size_t nhop;
+  double* f0;
+  double* prob;
+
+} track_job_t;
+
+static void* track_job_main(void* arg)
+{
+  track_job_t* const job = arg;
+  pitch_handle_t* const p = &job->pitch;
+  size_t i;
+
+  for (i = 0; i != job->nhop; ++i)
+  {
+    const size_t off = (job->ihop + i) * p->hop;
+    const int16_t* const x = job->sampl + off * job->nchan;
+    job->f0[i] = pitch_estimate_int16
+      (p, x, job->nsampl - off, job->nchan, &job->prob[i]);
+  }
+
+  return NULL;
+}
+
+static int track_file
+(
+ const wav_handle_t* w, const cmd_handle_t* cmd,
+ double* f0, double* prob, size_t nhop
+)
+{
+  track_job_t* jobs;
+  size_t njob;
+  size_t ninit;
+  size_t nthread;
+  size_t i;
+  int err = -1;
+
+  njob = cmd->njob;
+  if (njob > nhop) njob = nhop;
+  if (njob == 0) return 0;
+
+  jobs = malloc(njob * sizeof(track_job_t));
+  if (jobs == NULL) goto on_error_0;
+
+  for (ninit = 0; ninit != njob; ++ninit)
+  {
+    track_job_t* const job = &jobs[ninit];
+
+    if (pitch_init(&job->pitch, w->fsampl, cmd->fmin, cmd->fmax, cmd->hop))
+      goto on_error_1;
+
+    job->sampl = (const int16_t*)wav_get_sampl_buf((wav_handle_t*)w);
+    job->sampl += cmd->chan;
+    job->nchan = w->nchan;
+    job->nsampl = w->nsampl;
+    job->ihop = (ninit * nhop) / njob;
+    job->nhop = ((ninit + 1) * nhop) / njob - job->ihop;
+    job->f0 = f0 + job->ihop;
+    job->prob = prob + job->ihop;
+  }
+
+  for (nthread = 1; nthread != njob; ++nthread)
+  {
+    track_job_t* const job = &jobs[nthread];
+    if (pthread_create(&job->thread, NULL, track_job_main, job)) break ;
+  }
+
+  /* the calling thread runs the first job, and the ones not started */
+  track_job_main(&jobs[0]);
+  for (i = nthread; i != njob; ++i) track_job_main(&jobs[i]);
+
+  for (i = 1; i != nthread; ++i) pthread_join(jobs[i].thread, NULL);
+
+  err = 0;
+
+ on_error_1:
+  for (i = 0; i != ninit; ++i) pitch_fini(&jobs[i].pitch);
+  free(jobs);
+ on_error_0:
+  return err;
+}
+
+
+/* main */
+
+int main(int ac, char** av)
+{
+  wav_handle_t iw;
+  cmd_handle_t cmd;
+  double* f0;
+  double* prob;
+  size_t nhop;
+  size_t i;
+  FILE* file;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if ((cmd.flags & CMD_FLAG_IPATH) == 0)
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (wav_open(&iw, cmd.ipath))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (iw.wsampl != 2)
+  {
+    /* only int16_t supported */
+    PERROR();
+    goto on_error_1;
+  }
+
+  if (cmd.chan >= iw.nchan)
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  nhop = (iw.nsampl + cmd.hop - 1) / cmd.hop;
+
+  f0 = malloc(2 * (nhop + 1) * sizeof(double));
+  if (f0 == NULL)
+  {
+    PERROR();
+    goto on_error_1;
+  }
+  prob = f0 + nhop + 1;
+
+  if (track_file(&iw, &cmd, f0, prob, nhop))
+  {
+    PERROR();
+    goto on_error_2;
+  }
+
+  file = stdout;
+  if (cmd.flags & CMD_FLAG_OPATH)
+  {
+    file = fopen(cmd.opath, "w");
+    if (file == NULL)
+    {
+      PERROR();
+      goto on_error_2;
+    }
+  }
+
+  /* time of the frame start, f0 in Hz (0 if unvoiced), periodicity */
+
+  for (i = 0; i != nhop; ++i)
+  {
+    fprintf
+    (
+     file, "%.4f %.2f %.3f\n",
+     (double)(i * cmd.hop) / (double)iw.fsampl, f0[i], prob[i]
+    );
+  }
+
+  err = 0;
+
+  if (file != stdout)
+  {
+    if (fclose(file)) err = -1;
+  }
+
+ on_error_2:
+  free(f0);
+ on_error_1:
+  wav_close(&iw);
+ on_error_0:
+  return err;
+}
@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fftw3.h>
+#include "pitch.h"
+#include "util.h"
+
+
+int pitch_init
+(pitch_handle_t* p, unsigned int fsampl, double fmin, double fmax, size_t hop)
+{
+  if ((fmin <= 0.0) || (fmax <= fmin) || (hop == 0)) goto on_error_0;
+  if (fmax > ((double)fsampl / 4.0)) goto on_error_0;
+
+  p->fsampl = fsampl;
+  p->thresh = 0.1;
+
+  /* lags cover the period range plus one for the interpolation. the */
+  /* window is as long as the largest period. */
+
+  p->mintau = (size_t)floor((double)fsampl / fmax);
+  if (p->mintau < 2) p->mintau = 2;
+  p->maxtau = (size_t)ceil((double)fsampl / fmin) + 2;
+  p->w = p->maxtau;
+  p->size = p->w + p->maxtau;
+  p->hop = hop;
+
+  for (p->n = 1; p->n < p->size; p->n *= 2) ;
+
+  p->a = fftw_malloc((p->n / 2 + 1) * sizeof(fftw_complex));
+  if (p->a == NULL) goto on_error_0;
+
+  p->b = fftw_malloc((p->n / 2 + 1) * sizeof(fftw_complex));
+  if (p->b == NULL) goto on_error_1;
+
+  p->aplan = fftw_plan_dft_r2c_1d(p->n, p->a, (void*)p->a, FFTW_ESTIMATE);
+  if (p->aplan == NULL) goto on_error_2;
+
+  p->bplan = fftw_plan_dft_r2c_1d(p->n, p->b, (void*)p->b, FFTW_ESTIMATE);
+  if (p->bplan == NULL) goto on_error_3;
+
+  p->rplan = fftw_plan_dft_c2r_1d(p->n, (void*)p->a, p->a, FFTW_ESTIMATE);
+  if (p->rplan == NULL) goto on_error_4;
+
+  p->d = malloc((p->maxtau + (p->size + 1) + p->size) * sizeof(double));
+  if (p->d == NULL) goto on_error_5;
+  p->e = p->d + p->maxtau;
+  p->frame = p->e + p->size + 1;
+
+  /* the first estimate waits for a full frame */
+  p->next = p->size;
+
+  /* a quarter of the hop duration */
+  p->budget = (0.25 * (double)hop) / (double)fsampl;
+  p->time_sum = 0.0;
+  p->time_max = 0.0;
+  p->nhop = 0;
+  p->nover = 0;
+
+  return 0;
+
+ on_error_5:
+  fftw_destroy_plan(p->rplan);
+ on_error_4:
+  fftw_destroy_plan(p->bplan);
+ on_error_3:
+  fftw_destroy_plan(p->aplan);
+ on_error_2:
+  fftw_free(p->b);
+ on_error_1:
+  fftw_free(p->a);
+ on_error_0:
+  return -1;
+}
+
+
+void pitch_fini(pitch_handle_t* p)
+{
+  free(p->d);
+  fftw_destroy_plan(p->rplan);
+  fftw_destroy_plan(p->bplan);
+  fftw_destroy_plan(p->aplan);
+  fftw_free(p->b);
+  fftw_free(p->a);
+}
+
+
+double pitch_estimate(pitch_handle_t* p, const double* x, double* prob)
+{
+  /* x holds p->size samples. return the f0 in Hz, or 0 if unvoiced. */
+  /* prob is set to the periodicity of the best lag, in [0, 1]. */
+
+  fftw_complex* const ca = (fftw_complex*)p->a;
+  const fftw_complex* const cb = (const fftw_complex*)p->b;
+  const double t = util_get_time();
+  double* const d = p->d;
+  double sum;
+  double f0;
+  double dt;
+  size_t tau;
+  size_t i;
+
+  /* r(tau) = sum(x[j] * x[j + tau], j < w), through the spectra of */
+  /* the window and of the whole frame */
+
+  memcpy(p->a, x, p->w * sizeof(double));
+  memset(p->a + p->w, 0, (p->n - p->w) * sizeof(double));
+  memcpy(p->b, x, p->size * sizeof(double));
+  memset(p->b + p->size, 0, (p->n - p->size) * sizeof(double));
+
+  fftw_execute(p->aplan);
+  fftw_execute(p->bplan);
+
+  for (i = 0; i != (p->n / 2 + 1); ++i)
+  {
+    const double re = ca[i][0] * cb[i][0] + ca[i][1] * cb[i][1];
+    const double im = ca[i][0] * cb[i][1] - ca[i][1] * cb[i][0];
+    ca[i][0] = re;
+    ca[i][1] = im;
+  }
+
+  fftw_execute(p->rplan);
+
+  /* difference function from the cumulative energy, then its */
+  /* cumulative mean normalized version */
+
+  p->e[0] = 0.0;
+  for (i = 0; i != p->size; ++i) p->e[i + 1] = p->e[i] + x[i] * x[i];
+
+  d[0] = 1.0;
+  sum = 0.0;
+
+  for (tau = 1; tau != p->maxtau; ++tau)
+  {
+    const double r = p->a[tau] / (double)p->n;
+    double v = p->e[p->w] + (p->e[tau + p->w] - p->e[tau]) - 2.0 * r;
+    if (v < 0.0) v = 0.0;
+    sum += v;
+    d[tau] = (sum > 0.0) ? (v * (double)tau) / sum : 1.0;
+  }
+
+  /* first dip below the threshold, down to its local minimum. if none, */
+  /* the global minimum only gives the probability. */
+
+  for (tau = p->mintau; tau != (p->maxtau - 1); ++tau)
+  {
+    if (d[tau] >= p->thresh) continue ;
+    while (((tau + 2) != p->maxtau) && (d[tau + 1] < d[tau])) ++tau;
+    break ;
+  }
+
+  if (tau == (p->maxtau - 1))
+  {
+    size_t k = p->mintau;
+    for (tau = p->mintau; tau != (p->maxtau - 1); ++tau)
+      if (d[tau] < d[k]) k = tau;
+    *prob = 1.0 - d[k];
+    if (*prob < 0.0) *prob = 0.0;
+    f0 = 0.0;
+    goto on_done;
+  }
+
+  *prob = 1.0 - d[tau];
+
+  /* parabolic interpolation of the lag */
+
+  {
+    const double s0 = d[tau - 1];
+    const double s1 = d[tau];
+    const double s2 = d[tau + 1];
+    const double den = s0 - 2.0 * s1 + s2;
+    double shift = 0.0;
+    if (den > 0.0) shift = (0.5 * (s0 - s2)) / den;
+    if (shift < -1.0) shift = -1.0;
+    else if (shift > 1.0) shift = 1.0;
+    f0 = (double)p->fsampl / ((double)tau + shift);
+  }
+
+ on_done:
+  dt = util_get_time() - t;
+  p->time_sum += dt;
+  if (dt > p->time_max) p->time_max = dt;
+  if (dt > p->budget) ++p->nover;
+  ++p->nhop;
+
+  return f0;
+}
+
+
+double pitch_estimate_int16
+(
+ pitch_handle_t* p,
+ const int16_t* x, size_t n, size_t stride,
+ double* prob
+)
+{
+  /* estimate from n interleaved samples, zero padded to p->size */
+
+  size_t i;
+
+  if (n > p->size) n = p->size;
+  for (i = 0; i != n; ++i, x += stride) p->frame[i] = (double)*x;
+  for (; i != p->size; ++i) p->frame[i] = 0.0;
+
+  return pitch_estimate(p, p->frame, prob);
+}
+
+
+size_t pitch_add_int16
+(
+ pitch_handle_t* p,
+ const int16_t* x, size_t n, size_t stride,
+ double* f0, size_t nf0
+)
+{
+  /* stream n interleaved samples in. one estimate is made every hop, */
+  /* once the frame is full. return the number of estimates stored, at */
+  /* most nf0: this bounds the cost of a call whatever n. */
+
+  double prob;
+  size_t nout = 0;
+  size_t k;
+  size_t i;
+
+  while (n)
+  {
+    k = p->next;
+    if (k > n) k = n;
+
+    if (k < p->size)
+    {
+      memmove(p->frame, p->frame + k, (p->size - k) * sizeof(double));
+      for (i = p->size - k; i != p->size; ++i, x += stride)
+	p->frame[i] = (double)*x;
+    }
+    else
+    {
+      x += (k - p->size) * stride;
+      for (i = 0; i != p->size; ++i, x += stride) p->frame[i] = (double)*x;
+    }
+
+    p->next -= k;
+    n -= k;
+
+    if (p->next) continue ;
+
+    p->next = p->hop;
+
+    /* extra estimates would be dropped, do not spend time on them */
+    if (nout == nf0) continue ;
+
+    f0[nout++] = pitch_estimate(p, p->frame, &prob);
+  }
+
+  return nout;
+}
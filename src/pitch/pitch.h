@@ -0,0 +1,66 @@
+#ifndef PITCH_H_INCLUDED
+#define PITCH_H_INCLUDED
+
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <fftw3.h>
+
+
+/* YIN fundamental frequency estimator */
+/* http://audition.ens.fr/adc/pdf/2002_JASA_YIN.pdf */
+
+/* the difference function is computed from an fft cross correlation, */
+/* so that each hop costs 2 forward and 1 inverse transforms of fixed */
+/* size plus a linear pass over the lags, whatever the signal. */
+
+/* pitch_init and pitch_fini call the fftw planner, which is not thread */
+/* safe. estimations on distinct handles can run concurrently. */
+
+typedef struct pitch_handle
+{
+  unsigned int fsampl;
+  double thresh;
+
+  /* integration window, lag range, frame and fft sizes */
+  size_t w;
+  size_t mintau;
+  size_t maxtau;
+  size_t size;
+  size_t n;
+  size_t hop;
+
+  double* a;
+  double* b;
+  fftw_plan aplan;
+  fftw_plan bplan;
+  fftw_plan rplan;
+
+  /* difference function, cumulative energy */
+  double* d;
+  double* e;
+
+  /* streaming: last size samples, and samples until the next hop */
+  double* frame;
+  size_t next;
+
+  /* per hop cost, in seconds */
+  double budget;
+  double time_sum;
+  double time_max;
+  uint64_t nhop;
+  uint64_t nover;
+
+} pitch_handle_t;
+
+
+int pitch_init(pitch_handle_t*, unsigned int, double, double, size_t);
+void pitch_fini(pitch_handle_t*);
+double pitch_estimate(pitch_handle_t*, const double*, double*);
+double pitch_estimate_int16
+(pitch_handle_t*, const int16_t*, size_t, size_t, double*);
+size_t pitch_add_int16
+(pitch_handle_t*, const int16_t*, size_t, size_t, double*, size_t);
+
+
+#endif /* ! PITCH_H_INCLUDED */
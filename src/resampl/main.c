@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "wav.h"
+#include "resampl.h"
+#include "util.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+#define CMD_FLAG_IPATH (1 << 0)
+#define CMD_FLAG_OPATH (1 << 1)
+#define CMD_FLAG_ORATE (1 << 2)
+  uint32_t flags;
+  const char* ipath;
+  const char* opath;
+  unsigned int orate;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->flags = 0;
+  cmd->ipath = NULL;
+  cmd->opath = NULL;
+  cmd->orate = 0;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-ipath") == 0)
+    {
+      cmd->flags |= CMD_FLAG_IPATH;
+      cmd->ipath = v;
+    }
+    else if (strcmp(k, "-opath") == 0)
+    {
+      cmd->flags |= CMD_FLAG_OPATH;
+      cmd->opath = v;
+    }
+    else if (strcmp(k, "-orate") == 0)
+    {
+      cmd->flags |= CMD_FLAG_ORATE;
+      cmd->orate = (unsigned int)strtoul(v, NULL, 10);
+      if (cmd->orate == 0) goto on_error;
+    }
+    else goto on_error;
+  }
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* main */
+
+int main(int ac, char** av)
+{
+  wav_handle_t iw;
+  wav_handle_t ow;
+  resampl_handle_t r;
+  cmd_handle_t cmd;
+  double t;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if ((cmd.flags & (CMD_FLAG_IPATH | CMD_FLAG_OPATH | CMD_FLAG_ORATE)) !=
+      (CMD_FLAG_IPATH | CMD_FLAG_OPATH | CMD_FLAG_ORATE))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (wav_open(&iw, cmd.ipath))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (iw.wsampl != 2)
+  {
+    /* only int16_t supported */
+    PERROR();
+    goto on_error_1;
+  }
+
+  if (resampl_init(&r, iw.fsampl, cmd.orate, iw.nchan))
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  if (wav_create
+      (&ow, iw.nchan, iw.wsampl, resampl_get_nout(&r, iw.nsampl), cmd.orate))
+  {
+    PERROR();
+    goto on_error_2;
+  }
+
+  t = util_get_time();
+
+  if (resampl_int16_whole
+      (&r, wav_get_sampl_buf(&ow), wav_get_sampl_buf(&iw), iw.nsampl))
+  {
+    PERROR();
+    goto on_error_3;
+  }
+
+  t = util_get_time() - t;
+
+  printf
+  (
+   "%u -> %u Hz (%u / %u, %zu taps per phase), %.3f s, %.1fx realtime\n",
+   iw.fsampl, cmd.orate, r.l, r.m, r.ntap,
+   t, ((double)iw.nsampl / (double)iw.fsampl) / (t > 0.0 ? t : 1e-9)
+  );
+
+  if (wav_write(&ow, cmd.opath))
+  {
+    PERROR();
+    goto on_error_3;
+  }
+
+  err = 0;
+
+ on_error_3:
+  wav_close(&ow);
+ on_error_2:
+  resampl_fini(&r);
+ on_error_1:
+  wav_close(&iw);
+ on_error_0:
+  return err;
+}
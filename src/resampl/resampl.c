@@ -0,0 +1,752 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "resampl.h"
+
+
+/* table cache */
+
+/* unreferenced tables are kept until their slot is needed, so that */
+/* handles created again at the same ratio do not redesign the filter */
+
+#define RESAMPL_NCACHE 16
+
+/* coefficient tables larger than this are refused, in doubles */
+#define RESAMPL_MAX_COEFS (1 << 23)
+
+static pthread_mutex_t resampl_lock = PTHREAD_MUTEX_INITIALIZER;
+static resampl_table_t resampl_cache[RESAMPL_NCACHE];
+
+
+static unsigned int resampl_gcd(unsigned int a, unsigned int b)
+{
+  unsigned int t;
+
+  while (b)
+  {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+
+  return a;
+}
+
+
+static double resampl_i0(double x)
+{
+  /* modified bessel function of the first kind, order 0 */
+
+  const double y = (x * x) / 4.0;
+  double sum = 1.0;
+  double term = 1.0;
+  double k;
+
+  for (k = 1.0; term > (sum * 1e-12); k += 1.0)
+  {
+    term *= y / (k * k);
+    sum += term;
+  }
+
+  return sum;
+}
+
+
+static int resampl_build_table
+(resampl_table_t* t, unsigned int l, unsigned int m, size_t ntap)
+{
+  /* kaiser windowed sinc at l times the input rate, cutoff slightly */
+  /* below the lowest nyquist frequency, then split into phases. the */
+  /* sinc is centered on a tap so that the delay is a whole number of */
+  /* upsampled periods, see resampl_reset. */
+
+  static const double beta = 8.6;
+  static const double rolloff = 0.92;
+
+  const size_t n = (size_t)l * ntap;
+  const double fc = (0.5 * rolloff) / (double)(l > m ? l : m);
+  const double c = (double)(n - 1) / 2.0;
+  const double c0 = (double)((n - 1) / 2);
+  const double i0beta = resampl_i0(beta);
+  void* p;
+  double* h;
+  double sum;
+  size_t i;
+  size_t j;
+
+  if (n > RESAMPL_MAX_COEFS) return -1;
+
+  h = malloc(n * sizeof(double));
+  if (h == NULL) return -1;
+
+  if (posix_memalign(&p, 64, n * sizeof(double)))
+  {
+    free(h);
+    return -1;
+  }
+
+  for (i = 0; i != n; ++i)
+  {
+    const double r = (n == 1) ? 0.0 : ((double)i - c) / c;
+    const double w = resampl_i0(beta * sqrt(1.0 - r * r)) / i0beta;
+    const double x = (double)i - c0;
+    const double a = 2.0 * M_PI * fc * x;
+    h[i] = 2.0 * fc * (x == 0.0 ? 1.0 : sin(a) / a) * w;
+  }
+
+  t->l = l;
+  t->m = m;
+  t->ntap = ntap;
+  t->coefs = p;
+
+  for (i = 0; i != l; ++i)
+  {
+    double* const coefs = t->coefs + i * ntap;
+
+    sum = 0.0;
+    for (j = 0; j != ntap; ++j)
+    {
+      coefs[j] = h[i + l * (ntap - 1 - j)];
+      sum += coefs[j];
+    }
+
+    /* unity gain on each phase */
+    if (sum != 0.0) for (j = 0; j != ntap; ++j) coefs[j] /= sum;
+  }
+
+  free(h);
+
+  return 0;
+}
+
+
+static const resampl_table_t* resampl_get_table
+(unsigned int l, unsigned int m, size_t ntap)
+{
+  resampl_table_t* t = NULL;
+  size_t i;
+
+  pthread_mutex_lock(&resampl_lock);
+
+  for (i = 0; i != RESAMPL_NCACHE; ++i)
+  {
+    t = &resampl_cache[i];
+    if (t->coefs == NULL) continue ;
+    if ((t->l == l) && (t->m == m) && (t->ntap == ntap)) goto on_found;
+  }
+
+  /* an empty slot, or else an unreferenced one */
+
+  for (i = 0; i != RESAMPL_NCACHE; ++i)
+  {
+    t = &resampl_cache[i];
+    if (t->coefs == NULL) break ;
+  }
+
+  if (i == RESAMPL_NCACHE)
+  {
+    for (i = 0; i != RESAMPL_NCACHE; ++i)
+    {
+      t = &resampl_cache[i];
+      if (t->nref == 0) break ;
+    }
+
+    if (i == RESAMPL_NCACHE) goto on_error;
+
+    free(t->coefs);
+    t->coefs = NULL;
+  }
+
+  if (resampl_build_table(t, l, m, ntap)) goto on_error;
+  t->nref = 0;
+
+ on_found:
+  ++t->nref;
+  pthread_mutex_unlock(&resampl_lock);
+  return t;
+
+ on_error:
+  pthread_mutex_unlock(&resampl_lock);
+  return NULL;
+}
+
+
+static void resampl_put_table(const resampl_table_t* t)
+{
+  pthread_mutex_lock(&resampl_lock);
+  --((resampl_table_t*)t)->nref;
+  pthread_mutex_unlock(&resampl_lock);
+}
+
+
+/* handle */
+
+static size_t resampl_get_ntap(unsigned int fin, unsigned int fout)
+{
+  /* 1 if fin is fout: the handle copies */
+
+  const unsigned int d = resampl_gcd(fin, fout);
+  const unsigned int l = fout / d;
+  const unsigned int m = fin / d;
+  size_t ntap;
+
+  if (l == m) return 1;
+
+  /* decimating narrows the cutoff, widen the phases as much */
+  ntap = RESAMPL_NTAP;
+  if (m > l) ntap = (RESAMPL_NTAP * (size_t)m + l - 1) / l;
+  return (ntap + RESAMPL_NLANE - 1) & ~(size_t)(RESAMPL_NLANE - 1);
+}
+
+
+static size_t resampl_get_ntap_var(unsigned int fin, unsigned int fout)
+{
+  size_t ntap = RESAMPL_NTAP;
+  if (fin > fout) ntap = (RESAMPL_NTAP * (size_t)fin + fout - 1) / fout;
+  return (ntap + RESAMPL_NLANE - 1) & ~(size_t)(RESAMPL_NLANE - 1);
+}
+
+
+size_t resampl_get_size(unsigned int fin, unsigned int fout, size_t nchan)
+{
+  /* bytes of the buffers, for resampl_init_mem */
+
+  if ((fin == 0) || (fout == 0)) return 0;
+  return nchan * (resampl_get_ntap(fin, fout) - 1 + RESAMPL_NBLOCK) *
+    sizeof(double);
+}
+
+
+size_t resampl_get_size_var
+(unsigned int fin, unsigned int fout, size_t nchan)
+{
+  /* one more sample of history, for the next phase past the last */
+
+  if ((fin == 0) || (fout == 0)) return 0;
+  return nchan * (resampl_get_ntap_var(fin, fout) + RESAMPL_NBLOCK) *
+    sizeof(double);
+}
+
+
+int resampl_init_mem
+(
+ resampl_handle_t* r, unsigned int fin, unsigned int fout, size_t nchan,
+ void* mem
+)
+{
+  /* buffers in mem, resampl_get_size bytes, that the caller owns. the */
+  /* table is shared, out of mem. */
+
+  unsigned int d;
+
+  if ((fin == 0) || (fout == 0) || (nchan == 0)) return -1;
+
+  d = resampl_gcd(fin, fout);
+
+  r->fin = fin;
+  r->fout = fout;
+  r->l = fout / d;
+  r->m = fin / d;
+  r->nchan = nchan;
+  r->table = NULL;
+  r->ntap = resampl_get_ntap(fin, fout);
+  r->step = 0;
+  r->mem = NULL;
+
+  if (r->l != r->m)
+  {
+    r->table = resampl_get_table(r->l, r->m, r->ntap);
+    if (r->table == NULL) return -1;
+  }
+
+  r->xsize = r->ntap - 1 + RESAMPL_NBLOCK;
+  r->x = mem;
+
+  resampl_reset(r);
+
+  return 0;
+}
+
+
+int resampl_init_var_mem
+(
+ resampl_handle_t* r, unsigned int fin, unsigned int fout, size_t nchan,
+ void* mem
+)
+{
+  /* the table is designed as for a fixed ratio of RESAMPL_NPHASE over */
+  /* m, with m giving the cutoff of the lowest nyquist frequency */
+
+  unsigned int m = RESAMPL_NPHASE;
+  unsigned int d;
+
+  if ((fin == 0) || (fout == 0) || (nchan == 0)) return -1;
+
+  d = resampl_gcd(fin, fout);
+
+  r->fin = fin;
+  r->fout = fout;
+  r->l = fout / d;
+  r->m = fin / d;
+  r->nchan = nchan;
+  r->mem = NULL;
+
+  r->ntap = resampl_get_ntap_var(fin, fout);
+  if (fin > fout)
+    m = (unsigned int)(((uint64_t)RESAMPL_NPHASE * fin + fout - 1) / fout);
+
+  r->table = resampl_get_table(RESAMPL_NPHASE, m, r->ntap);
+  if (r->table == NULL) return -1;
+
+  r->xsize = r->ntap + RESAMPL_NBLOCK;
+  r->x = mem;
+
+  resampl_set_ratio(r, 1.0);
+  resampl_reset(r);
+
+  return 0;
+}
+
+
+int resampl_init
+(resampl_handle_t* r, unsigned int fin, unsigned int fout, size_t nchan)
+{
+  void* p;
+
+  p = malloc(resampl_get_size(fin, fout, nchan));
+  if (p == NULL) return -1;
+
+  if (resampl_init_mem(r, fin, fout, nchan, p))
+  {
+    free(p);
+    return -1;
+  }
+
+  r->mem = p;
+
+  return 0;
+}
+
+
+int resampl_init_var
+(resampl_handle_t* r, unsigned int fin, unsigned int fout, size_t nchan)
+{
+  void* p;
+
+  p = malloc(resampl_get_size_var(fin, fout, nchan));
+  if (p == NULL) return -1;
+
+  if (resampl_init_var_mem(r, fin, fout, nchan, p))
+  {
+    free(p);
+    return -1;
+  }
+
+  r->mem = p;
+
+  return 0;
+}
+
+
+void resampl_fini(resampl_handle_t* r)
+{
+  free(r->mem);
+  if (r->table != NULL) resampl_put_table(r->table);
+}
+
+
+void resampl_reset(resampl_handle_t* r)
+{
+  /* the first output is taken late by the part of the filter center */
+  /* beyond a whole output period, the delay is then exactly integral */
+
+  size_t t;
+
+  memset(r->x, 0, r->nchan * r->xsize * sizeof(double));
+
+  if (r->step)
+  {
+    r->phase = 0;
+    r->pos = 0;
+    r->frac = 0;
+    return ;
+  }
+
+  t = ((size_t)r->l * r->ntap - 1) / 2 - resampl_get_delay(r) * r->m;
+  r->phase = t % r->l;
+  r->pos = t / r->l;
+}
+
+
+void resampl_set_ratio(resampl_handle_t* r, double ratio)
+{
+  /* output frames per input, relative to fout / fin */
+
+  if (ratio < (1.0 - RESAMPL_MAX_DEV)) ratio = 1.0 - RESAMPL_MAX_DEV;
+  else if (ratio > (1.0 + RESAMPL_MAX_DEV)) ratio = 1.0 + RESAMPL_MAX_DEV;
+
+  r->step = (uint64_t)
+    (((double)r->fin * 4294967296.0) / ((double)r->fout * ratio));
+}
+
+
+size_t resampl_get_max_out(const resampl_handle_t* r, size_t nin)
+{
+  /* bound on the frames output for nin input frames */
+
+  if (r->step)
+  {
+    return (size_t)
+      (((double)nin * r->l * (1.0 + RESAMPL_MAX_DEV)) / r->m) + 2;
+  }
+
+  return (size_t)(((uint64_t)nin * r->l) / r->m) + 1;
+}
+
+
+size_t resampl_get_max_in(const resampl_handle_t* r, size_t nout)
+{
+  /* input frames that give at most nout output frames */
+
+  if (nout < 2) return 0;
+
+  if (r->step)
+  {
+    return (size_t)
+      (((double)(nout - 2) * r->m) / (r->l * (1.0 + RESAMPL_MAX_DEV)));
+  }
+
+  return (size_t)(((uint64_t)(nout - 1) * r->m) / r->l);
+}
+
+
+size_t resampl_get_nout(const resampl_handle_t* r, size_t nin)
+{
+  /* frames of a whole signal of nin frames once converted */
+  return (size_t)(((uint64_t)nin * r->l + r->m - 1) / r->m);
+}
+
+
+size_t resampl_get_delay(const resampl_handle_t* r)
+{
+  /* group delay, in output frames. nominal if the ratio varies. */
+  if (r->step) return ((r->ntap / 2 + 1) * r->l) / r->m;
+  return (((size_t)r->l * r->ntap - 1) / 2) / r->m;
+}
+
+
+static double resampl_dot(const double* c, const double* x, size_t n)
+{
+  /* c is aligned, x is not */
+
+  resampl_vec_t acc0 = { 0.0 };
+  resampl_vec_t acc1 = { 0.0 };
+  resampl_vec_t a;
+  double sum;
+  size_t i;
+
+  for (i = 0; (i + 2 * RESAMPL_NLANE) <= n; i += 2 * RESAMPL_NLANE)
+  {
+    memcpy(&a, x + i, sizeof(a));
+    acc0 += *(const resampl_vec_t*)(c + i) * a;
+    memcpy(&a, x + i + RESAMPL_NLANE, sizeof(a));
+    acc1 += *(const resampl_vec_t*)(c + i + RESAMPL_NLANE) * a;
+  }
+
+  if (i != n)
+  {
+    memcpy(&a, x + i, sizeof(a));
+    acc0 += *(const resampl_vec_t*)(c + i) * a;
+  }
+
+  acc0 += acc1;
+  sum = 0.0;
+  for (i = 0; i != RESAMPL_NLANE; ++i) sum += acc0[i];
+
+  return sum;
+}
+
+
+static int16_t resampl_to_int16(double x)
+{
+  x = floor(x + 0.5);
+  if (x > 32767.0) return 32767;
+  if (x < -32768.0) return -32768;
+  return (int16_t)x;
+}
+
+
+size_t resampl_int16
+(resampl_handle_t* r, int16_t* obuf, const int16_t* ibuf, size_t nin)
+{
+  /* convert nin interleaved input frames, return the count written to */
+  /* obuf, at most resampl_get_max_out(nin). fixed ratio handles only. */
+
+  const size_t nchan = r->nchan;
+  const size_t h = r->ntap - 1;
+  size_t nout = 0;
+  size_t phase = 0;
+  size_t pos = 0;
+  size_t n = 0;
+  size_t k;
+  size_t c;
+  size_t i;
+
+  if (r->table == NULL)
+  {
+    memcpy(obuf, ibuf, nin * nchan * sizeof(int16_t));
+    return nin;
+  }
+
+  while (nin)
+  {
+    k = nin;
+    if (k > RESAMPL_NBLOCK) k = RESAMPL_NBLOCK;
+
+    for (c = 0; c != nchan; ++c)
+    {
+      double* const x = r->x + c * r->xsize;
+      const int16_t* p = ibuf + c;
+      int16_t* o = obuf + nout * nchan + c;
+
+      for (i = 0; i != k; ++i, p += nchan) x[h + i] = (double)*p;
+
+      /* the outputs whose newest input lies in this block */
+
+      phase = r->phase;
+      pos = r->pos;
+      n = 0;
+
+      while (pos < k)
+      {
+	const double* const coefs = r->table->coefs + phase * r->ntap;
+	*o = resampl_to_int16(resampl_dot(coefs, x + pos, r->ntap));
+	o += nchan;
+	++n;
+
+	phase += r->m;
+	pos += phase / r->l;
+	phase %= r->l;
+      }
+
+      memmove(x, x + k, h * sizeof(double));
+    }
+
+    r->phase = phase;
+    r->pos = pos - k;
+
+    ibuf += k * nchan;
+    nin -= k;
+    nout += n;
+  }
+
+  return nout;
+}
+
+
+static size_t resampl_planar_var
+(
+ resampl_handle_t* r,
+ double* obuf, size_t odist,
+ const double* ibuf, size_t idist, size_t nin
+)
+{
+  /* as resampl_planar, interpolating between adjacent phases. the */
+  /* phase past the last is the first one, one input sample later. */
+
+  const unsigned int shift = 32 - RESAMPL_NPHASE_BITS;
+  const double wscale = 1.0 / (double)(1 << shift);
+
+  const size_t h = r->ntap;
+  const double* const coefs = r->table->coefs;
+  uint64_t frac = 0;
+  size_t nout = 0;
+  size_t pos = 0;
+  size_t n = 0;
+  size_t k;
+  size_t c;
+
+  while (nin)
+  {
+    k = nin;
+    if (k > RESAMPL_NBLOCK) k = RESAMPL_NBLOCK;
+
+    for (c = 0; c != r->nchan; ++c)
+    {
+      double* const x = r->x + c * r->xsize;
+      double* o = obuf + c * odist + nout;
+
+      memcpy(x + h, ibuf + c * idist, k * sizeof(double));
+
+      frac = r->frac;
+      pos = r->pos;
+      n = 0;
+
+      while (pos < k)
+      {
+	const size_t phase = (size_t)(frac >> shift);
+	const double w = (double)(frac & ((1 << shift) - 1)) * wscale;
+	const double* const c0 = coefs + phase * r->ntap;
+	const double y0 = resampl_dot(c0, x + pos, r->ntap);
+	double y1;
+
+	if ((phase + 1) != RESAMPL_NPHASE)
+	  y1 = resampl_dot(c0 + r->ntap, x + pos, r->ntap);
+	else
+	  y1 = resampl_dot(coefs, x + pos + 1, r->ntap);
+
+	*o++ = y0 + w * (y1 - y0);
+	++n;
+
+	frac += r->step;
+	pos += (size_t)(frac >> 32);
+	frac &= 0xffffffff;
+      }
+
+      memmove(x, x + k, h * sizeof(double));
+    }
+
+    r->frac = frac;
+    r->pos = pos - k;
+
+    ibuf += k;
+    nin -= k;
+    nout += n;
+  }
+
+  return nout;
+}
+
+
+size_t resampl_planar
+(
+ resampl_handle_t* r,
+ double* obuf, size_t odist,
+ const double* ibuf, size_t idist, size_t nin
+)
+{
+  /* as resampl_int16, on nchan rows dist apart, without quantizing */
+
+  const size_t h = r->ntap - 1;
+  size_t nout = 0;
+  size_t phase = 0;
+  size_t pos = 0;
+  size_t n = 0;
+  size_t k;
+  size_t c;
+
+  if (r->step) return resampl_planar_var(r, obuf, odist, ibuf, idist, nin);
+
+  if (r->table == NULL)
+  {
+    for (c = 0; c != r->nchan; ++c)
+      memcpy(obuf + c * odist, ibuf + c * idist, nin * sizeof(double));
+    return nin;
+  }
+
+  while (nin)
+  {
+    k = nin;
+    if (k > RESAMPL_NBLOCK) k = RESAMPL_NBLOCK;
+
+    for (c = 0; c != r->nchan; ++c)
+    {
+      double* const x = r->x + c * r->xsize;
+      double* o = obuf + c * odist + nout;
+
+      memcpy(x + h, ibuf + c * idist, k * sizeof(double));
+
+      phase = r->phase;
+      pos = r->pos;
+      n = 0;
+
+      while (pos < k)
+      {
+	const double* const coefs = r->table->coefs + phase * r->ntap;
+	*o++ = resampl_dot(coefs, x + pos, r->ntap);
+	++n;
+
+	phase += r->m;
+	pos += phase / r->l;
+	phase %= r->l;
+      }
+
+      memmove(x, x + k, h * sizeof(double));
+    }
+
+    r->phase = phase;
+    r->pos = pos - k;
+
+    ibuf += k;
+    nin -= k;
+    nout += n;
+  }
+
+  return nout;
+}
+
+
+int resampl_int16_whole
+(resampl_handle_t* r, int16_t* obuf, const int16_t* ibuf, size_t nin)
+{
+  /* convert a whole signal from a reset handle. the filter delay is */
+  /* compensated: leading outputs are dropped, and trailing zeros are */
+  /* input until obuf holds resampl_get_nout(nin) frames. */
+
+  const size_t nout = resampl_get_nout(r, nin);
+  const size_t fsize = r->nchan * sizeof(int16_t);
+  size_t nskip = resampl_get_delay(r);
+  size_t ndone = 0;
+  int16_t* tmp;
+  int16_t* zeros;
+  size_t n;
+  size_t k;
+
+  if (r->table == NULL)
+  {
+    memcpy(obuf, ibuf, nin * fsize);
+    return 0;
+  }
+
+  tmp = malloc(resampl_get_max_out(r, RESAMPL_NBLOCK) * fsize);
+  if (tmp == NULL) return -1;
+
+  zeros = calloc(RESAMPL_NBLOCK, fsize);
+  if (zeros == NULL)
+  {
+    free(tmp);
+    return -1;
+  }
+
+  while (ndone != nout)
+  {
+    k = nin;
+    if (k > RESAMPL_NBLOCK) k = RESAMPL_NBLOCK;
+
+    if (k)
+    {
+      n = resampl_int16(r, tmp, ibuf, k);
+      ibuf += k * r->nchan;
+      nin -= k;
+    }
+    else
+    {
+      n = resampl_int16(r, tmp, zeros, RESAMPL_NBLOCK);
+    }
+
+    k = n < nskip ? n : nskip;
+    nskip -= k;
+    n -= k;
+    if (n > (nout - ndone)) n = nout - ndone;
+
+    memcpy(obuf + ndone * r->nchan, tmp + k * r->nchan, n * fsize);
+    ndone += n;
+  }
+
+  free(zeros);
+  free(tmp);
+
+  return 0;
+}
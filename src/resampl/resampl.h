@@ -0,0 +1,103 @@
+#ifndef RESAMPL_H_INCLUDED
+#define RESAMPL_H_INCLUDED
+
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* polyphase windowed sinc resampler, any rational ratio L / M */
+/* https://ccrma.stanford.edu/~jos/resample/ */
+
+/* the prototype low pass is designed at L times the input rate, and */
+/* split into L phases of ntap coefficients. an output sample is then */
+/* the dot product of one phase with the last ntap input samples. */
+/* tables only depend on L, M and ntap: they are built once and shared */
+/* by all the handles converting at the same ratio, whatever thread. */
+
+/* dot products run over RESAMPL_NLANE taps at once */
+#define RESAMPL_NLANE 4
+typedef double resampl_vec_t __attribute__((vector_size(RESAMPL_NLANE * 8)));
+
+/* taps per phase when not decimating. the kaiser window gives about */
+/* -90 dB from the lowest nyquist frequency, and a flat pass band up */
+/* to 0.83 of it. decimating widens phases by M / L. */
+#define RESAMPL_NTAP 64
+
+/* input frames converted at once */
+#define RESAMPL_NBLOCK 1024
+
+/* variable ratio handles, to follow a drifting clock: the ratio is */
+/* trimmed at any time by up to RESAMPL_MAX_DEV around fout / fin. */
+/* outputs are interpolated between the two nearest of RESAMPL_NPHASE */
+/* phases, from an input position kept in 32.32 fixed point. */
+#define RESAMPL_NPHASE_BITS 8
+#define RESAMPL_NPHASE (1 << RESAMPL_NPHASE_BITS)
+#define RESAMPL_MAX_DEV 0.01
+
+typedef struct resampl_table
+{
+  unsigned int l;
+  unsigned int m;
+  size_t ntap;
+
+  /* l phases of ntap coefficients, oldest sample first */
+  double* coefs;
+
+  size_t nref;
+
+} resampl_table_t;
+
+typedef struct resampl_handle
+{
+  unsigned int fin;
+  unsigned int fout;
+  unsigned int l;
+  unsigned int m;
+  size_t nchan;
+
+  const resampl_table_t* table;
+  size_t ntap;
+
+  /* per chan, ntap - 1 samples of history then the current block */
+  double* x;
+  size_t xsize;
+
+  /* next output: phase, and input index past the history */
+  size_t phase;
+  size_t pos;
+
+  /* variable ratio: input frames per output, 0 if fixed, and the */
+  /* fraction of the next output position */
+  uint64_t step;
+  uint64_t frac;
+
+  /* x, if resampl_init took it */
+  void* mem;
+
+} resampl_handle_t;
+
+
+size_t resampl_get_size(unsigned int, unsigned int, size_t);
+size_t resampl_get_size_var(unsigned int, unsigned int, size_t);
+int resampl_init(resampl_handle_t*, unsigned int, unsigned int, size_t);
+int resampl_init_var(resampl_handle_t*, unsigned int, unsigned int, size_t);
+int resampl_init_mem
+(resampl_handle_t*, unsigned int, unsigned int, size_t, void*);
+int resampl_init_var_mem
+(resampl_handle_t*, unsigned int, unsigned int, size_t, void*);
+void resampl_fini(resampl_handle_t*);
+void resampl_reset(resampl_handle_t*);
+void resampl_set_ratio(resampl_handle_t*, double);
+size_t resampl_get_max_out(const resampl_handle_t*, size_t);
+size_t resampl_get_max_in(const resampl_handle_t*, size_t);
+size_t resampl_get_delay(const resampl_handle_t*);
+size_t resampl_get_nout(const resampl_handle_t*, size_t);
+size_t resampl_int16(resampl_handle_t*, int16_t*, const int16_t*, size_t);
+size_t resampl_planar
+(resampl_handle_t*, double*, size_t, const double*, size_t, size_t);
+int resampl_int16_whole
+(resampl_handle_t*, int16_t*, const int16_t*, size_t);
+
+
+#endif /* ! RESAMPL_H_INCLUDED */
@@ -0,0 +1,2 @@
+#!/usr/bin/env sh
+gcc -Wall -O2 -I. -I../wav -I../util main.c simd.c ../wav/wav_fmt.c ../util/util.c -lm
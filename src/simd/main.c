@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "simd.h"
+#include "wav_fmt.h"
+#include "util.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+  /* spectrum bins, or frames for conversions */
+  size_t n;
+  size_t nchan;
+  size_t niter;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->n = 4097;
+  cmd->nchan = 2;
+  cmd->niter = 10000;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-n") == 0)
+    {
+      cmd->n = (size_t)strtoul(v, NULL, 10);
+      if (cmd->n == 0) goto on_error;
+    }
+    else if (strcmp(k, "-nchan") == 0)
+    {
+      cmd->nchan = (size_t)strtoul(v, NULL, 10);
+      if (cmd->nchan == 0) goto on_error;
+      if (cmd->nchan > WAV_FMT_NTILE) goto on_error;
+    }
+    else if (strcmp(k, "-niter") == 0)
+    {
+      cmd->niter = (size_t)strtoul(v, NULL, 10);
+      if (cmd->niter == 0) goto on_error;
+    }
+    else goto on_error;
+  }
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+static double get_diff(const double* a, const double* b, size_t n)
+{
+  double x = 0.0;
+  size_t i;
+
+  for (i = 0; i != n; ++i)
+    if (fabs(a[i] - b[i]) > x) x = fabs(a[i] - b[i]);
+
+  return x;
+}
+
+
+/* main */
+
+/* each kernel timed at each level the host runs, in ns per bin or */
+/* sample, with the largest difference to the base level outputs. */
+/* conversions go to planar and back, so their difference is the */
+/* round trip error of the format. */
+
+static const unsigned int fmts[] =
+{
+  WAV_FMT_S16, WAV_FMT_S24, WAV_FMT_S32, WAV_FMT_FLOAT
+};
+
+#define NFMT (sizeof(fmts) / sizeof(fmts[0]))
+
+int main(int ac, char** av)
+{
+  cmd_handle_t cmd;
+  double* spec;
+  double* mask;
+  double* imask;
+  double* mag;
+  double* mag0;
+  double* planar;
+  double* ref;
+  void* inter;
+  size_t nsampl;
+  unsigned int level;
+  unsigned int max;
+  unsigned int f;
+  double t;
+  size_t i;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  nsampl = cmd.n * cmd.nchan;
+
+  spec = malloc(2 * cmd.n * sizeof(double));
+  mask = malloc(cmd.n * sizeof(double));
+  imask = malloc(cmd.n * sizeof(double));
+  mag = malloc(cmd.n * sizeof(double));
+  mag0 = malloc(cmd.n * sizeof(double));
+  planar = malloc(nsampl * sizeof(double));
+  ref = malloc(nsampl * sizeof(double));
+  inter = malloc(nsampl * 4);
+
+  if ((spec == NULL) || (mask == NULL) || (imask == NULL) ||
+      (mag == NULL) || (mag0 == NULL) ||
+      (planar == NULL) || (ref == NULL) || (inter == NULL))
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  srand(0);
+  for (i = 0; i != nsampl; ++i)
+    ref[i] = 2.0 * (double)rand() / (double)RAND_MAX - 1.0;
+  for (i = 0; i != cmd.n; ++i)
+  {
+    mask[i] = 0.5 + 0.5 * (double)rand() / (double)RAND_MAX;
+    imask[i] = 1.0 / mask[i];
+  }
+
+  max = simd_get_level();
+
+  for (level = SIMD_LEVEL_BASE; level <= max; ++level)
+  {
+    simd_set_level(level);
+    printf("%s:\n", simd_get_name(level));
+
+    /* a gain then its inverse, that would go denormal otherwise */
+    for (i = 0; i != 2 * cmd.n; ++i) spec[i] = ref[i % nsampl];
+    t = util_get_time();
+    for (i = 0; i != cmd.niter; ++i)
+    {
+      simd_mask(spec, mask, cmd.n);
+      simd_mask(spec, imask, cmd.n);
+    }
+    t = util_get_time() - t;
+    printf
+    (
+     "  mask: %.3f ns, diff %g\n",
+     (t * 1e9) / (double)(2 * cmd.niter * cmd.n),
+     get_diff(spec, ref, 2 * cmd.n < nsampl ? 2 * cmd.n : nsampl)
+    );
+
+    for (i = 0; i != 2 * cmd.n; ++i) spec[i] = ref[i % nsampl];
+    t = util_get_time();
+    for (i = 0; i != cmd.niter; ++i) simd_mag(mag, spec, cmd.n);
+    t = util_get_time() - t;
+    if (level == SIMD_LEVEL_BASE) memcpy(mag0, mag, cmd.n * sizeof(double));
+    printf
+    (
+     "  mag: %.3f ns, diff %g\n",
+     (t * 1e9) / (double)(cmd.niter * cmd.n), get_diff(mag, mag0, cmd.n)
+    );
+
+    for (f = 0; f != NFMT; ++f)
+    {
+      const unsigned int fmt = fmts[f];
+      double tto = 0.0;
+      double tfrom = 0.0;
+
+      for (i = 0; i != cmd.niter; ++i)
+      {
+	t = util_get_time();
+	wav_fmt_from_planar(fmt, inter, ref, cmd.n, cmd.nchan, cmd.n);
+	tfrom += util_get_time() - t;
+
+	t = util_get_time();
+	wav_fmt_to_planar(fmt, planar, cmd.n, inter, cmd.nchan, cmd.n);
+	tto += util_get_time() - t;
+      }
+
+      printf
+      (
+       "  %s: to %.3f ns, from %.3f ns, diff %g\n",
+       wav_fmt_get_name(fmt),
+       (tto * 1e9) / (double)(cmd.niter * nsampl),
+       (tfrom * 1e9) / (double)(cmd.niter * nsampl),
+       get_diff(planar, ref, nsampl)
+      );
+    }
+  }
+
+  err = 0;
+
+ on_error_1:
+  free(spec);
+  free(mask);
+  free(imask);
+  free(mag);
+  free(mag0);
+  free(planar);
+  free(ref);
+  free(inter);
+ on_error_0:
+  return err;
+}
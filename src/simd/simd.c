@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "simd.h"
+
+
+static const char* const simd_names[SIMD_LEVEL_COUNT] =
+{
+  "base", "avx2", "avx512"
+};
+
+/* -1 until the first call */
+static int simd_level = -1;
+static unsigned int simd_max = SIMD_LEVEL_BASE;
+
+
+static unsigned int simd_detect(void)
+{
+  /* the best the host runs, then lowered by SIMD_LEVEL */
+
+  const char* s;
+  unsigned int i;
+
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+  {
+    simd_max = SIMD_LEVEL_AVX2;
+    if (__builtin_cpu_supports("avx512f") &&
+	__builtin_cpu_supports("avx512bw") &&
+	__builtin_cpu_supports("avx512vl"))
+      simd_max = SIMD_LEVEL_AVX512;
+  }
+#endif
+
+  s = getenv("SIMD_LEVEL");
+  if (s == NULL) return simd_max;
+
+  for (i = 0; i != SIMD_LEVEL_COUNT; ++i)
+    if (strcmp(s, simd_names[i]) == 0) break ;
+
+  return i < simd_max ? i : simd_max;
+}
+
+
+unsigned int simd_get_level(void)
+{
+  int level;
+
+  level = __atomic_load_n(&simd_level, __ATOMIC_RELAXED);
+  if (level >= 0) return (unsigned int)level;
+
+  /* racing first calls find the same */
+  level = (int)simd_detect();
+  __atomic_store_n(&simd_level, level, __ATOMIC_RELAXED);
+
+  return (unsigned int)level;
+}
+
+
+unsigned int simd_set_level(unsigned int level)
+{
+  /* at most what the host runs, return the level set */
+
+  simd_get_level();
+  if (level > simd_max) level = simd_max;
+  __atomic_store_n(&simd_level, (int)level, __ATOMIC_RELAXED);
+
+  return level;
+}
+
+
+const char* simd_get_name(unsigned int level)
+{
+  return simd_names[level];
+}
+
+
+/* mask: bins scaled by real gains */
+
+static void simd_mask_1(double* p, const double* m, size_t i, size_t n)
+{
+  for (; i != n; ++i)
+  {
+    p[2 * i + 0] *= m[i];
+    p[2 * i + 1] *= m[i];
+  }
+}
+
+
+static void simd_mask_base(double* p, const double* m, size_t n)
+{
+  size_t i = 0;
+
+#if defined(__x86_64__)
+  /* a bin per register */
+  for (; i != n; ++i)
+    _mm_storeu_pd(p + 2 * i, _mm_loadu_pd(p + 2 * i) * _mm_set1_pd(m[i]));
+#endif
+
+  simd_mask_1(p, m, i, n);
+}
+
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2,fma")))
+static void simd_mask_avx2(double* p, const double* m, size_t n)
+{
+  /* 2 bins, gains spread as m0 m0 m1 m1 */
+
+  __m256d g;
+  size_t i;
+
+  for (i = 0; (i + 2) <= n; i += 2)
+  {
+    g = _mm256_castpd128_pd256(_mm_loadu_pd(m + i));
+    g = _mm256_permute4x64_pd(g, 0x50);
+    _mm256_storeu_pd(p + 2 * i, _mm256_mul_pd(_mm256_loadu_pd(p + 2 * i), g));
+  }
+
+  simd_mask_1(p, m, i, n);
+}
+
+
+__attribute__((target("avx512f")))
+static void simd_mask_avx512(double* p, const double* m, size_t n)
+{
+  /* 4 bins */
+
+  const __m512i k = _mm512_set_epi64(3, 3, 2, 2, 1, 1, 0, 0);
+  __m512d g;
+  size_t i;
+
+  for (i = 0; (i + 4) <= n; i += 4)
+  {
+    g = _mm512_castpd256_pd512(_mm256_loadu_pd(m + i));
+    g = _mm512_permutexvar_pd(k, g);
+    _mm512_storeu_pd(p + 2 * i, _mm512_mul_pd(_mm512_loadu_pd(p + 2 * i), g));
+  }
+
+  simd_mask_1(p, m, i, n);
+}
+
+#else
+
+#define simd_mask_avx2 simd_mask_base
+#define simd_mask_avx512 simd_mask_base
+
+#endif
+
+
+void simd_mask(double* p, const double* m, size_t n)
+{
+  static void (*const fns[SIMD_LEVEL_COUNT])(double*, const double*, size_t) =
+  {
+    simd_mask_base, simd_mask_avx2, simd_mask_avx512
+  };
+
+  fns[simd_get_level()](p, m, n);
+}
+
+
+/* mag: bin magnitudes */
+
+static void simd_mag_1(double* d, const double* s, size_t i, size_t n)
+{
+  for (; i != n; ++i)
+    d[i] = sqrt(s[2 * i + 0] * s[2 * i + 0] + s[2 * i + 1] * s[2 * i + 1]);
+}
+
+
+static void simd_mag_base(double* d, const double* s, size_t n)
+{
+  size_t i = 0;
+
+#if defined(__x86_64__)
+  /* 2 bins, deinterleaved to re0 re1 and im0 im1 */
+
+  __m128d a;
+  __m128d b;
+  __m128d re;
+  __m128d im;
+
+  for (; (i + 2) <= n; i += 2)
+  {
+    a = _mm_loadu_pd(s + 2 * i + 0);
+    b = _mm_loadu_pd(s + 2 * i + 2);
+    re = _mm_unpacklo_pd(a, b);
+    im = _mm_unpackhi_pd(a, b);
+    _mm_storeu_pd(d + i, _mm_sqrt_pd(re * re + im * im));
+  }
+#endif
+
+  simd_mag_1(d, s, i, n);
+}
+
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2,fma")))
+static void simd_mag_avx2(double* d, const double* s, size_t n)
+{
+  /* 4 bins. unpacks work within 128 bits: bins come out as 0 2 1 3 */
+
+  __m256d a;
+  __m256d b;
+  __m256d re;
+  __m256d im;
+  __m256d x;
+  size_t i;
+
+  for (i = 0; (i + 4) <= n; i += 4)
+  {
+    a = _mm256_loadu_pd(s + 2 * i + 0);
+    b = _mm256_loadu_pd(s + 2 * i + 4);
+    re = _mm256_unpacklo_pd(a, b);
+    im = _mm256_unpackhi_pd(a, b);
+    x = _mm256_sqrt_pd(_mm256_fmadd_pd(re, re, _mm256_mul_pd(im, im)));
+    _mm256_storeu_pd(d + i, _mm256_permute4x64_pd(x, 0xd8));
+  }
+
+  simd_mag_1(d, s, i, n);
+}
+
+
+__attribute__((target("avx512f")))
+static void simd_mag_avx512(double* d, const double* s, size_t n)
+{
+  /* 8 bins, gathered across both registers */
+
+  const __m512i kre = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+  const __m512i kim = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+  __m512d a;
+  __m512d b;
+  __m512d re;
+  __m512d im;
+  size_t i;
+
+  for (i = 0; (i + 8) <= n; i += 8)
+  {
+    a = _mm512_loadu_pd(s + 2 * i + 0);
+    b = _mm512_loadu_pd(s + 2 * i + 8);
+    re = _mm512_permutex2var_pd(a, kre, b);
+    im = _mm512_permutex2var_pd(a, kim, b);
+    _mm512_storeu_pd
+      (d + i, _mm512_sqrt_pd(_mm512_fmadd_pd(re, re, _mm512_mul_pd(im, im))));
+  }
+
+  simd_mag_1(d, s, i, n);
+}
+
+#else
+
+#define simd_mag_avx2 simd_mag_base
+#define simd_mag_avx512 simd_mag_base
+
+#endif
+
+
+void simd_mag(double* d, const double* s, size_t n)
+{
+  static void (*const fns[SIMD_LEVEL_COUNT])(double*, const double*, size_t) =
+  {
+    simd_mag_base, simd_mag_avx2, simd_mag_avx512
+  };
+
+  fns[simd_get_level()](d, s, n);
+}
@@ -0,0 +1,31 @@
+#ifndef SIMD_H_INCLUDED
+#define SIMD_H_INCLUDED
+
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* the hot kernels are compiled for several instruction sets, and one */
+/* is selected at the first call, from cpuid: builds run anywhere, at */
+/* the speed of the host. the environment variable SIMD_LEVEL set to */
+/* one of the names below lowers the selection, for comparisons. */
+
+/* base is sse2, that every x86-64 has, and the only one elsewhere. */
+/* avx2 comes with fma, avx512 is the f, bw and vl subsets. */
+#define SIMD_LEVEL_BASE 0
+#define SIMD_LEVEL_AVX2 1
+#define SIMD_LEVEL_AVX512 2
+#define SIMD_LEVEL_COUNT 3
+
+
+unsigned int simd_get_level(void);
+unsigned int simd_set_level(unsigned int);
+const char* simd_get_name(unsigned int);
+
+/* spectra of n bins, interleaved re and im */
+void simd_mask(double*, const double*, size_t);
+void simd_mag(double*, const double*, size_t);
+
+
+#endif /* ! SIMD_H_INCLUDED */
@@ -0,0 +1,2 @@
+#!/usr/bin/env sh
+gcc -Wall -O2 -I../wav main.c ../wav/wav.c -lm -lfftw3 -lpthread
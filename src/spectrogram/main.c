@@ -0,0 +1,805 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fftw3.h>
+#include "wav.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+#define CMD_FLAG_IPATH (1 << 0)
+#define CMD_FLAG_OPATH (1 << 1)
+#define CMD_FLAG_PNG (1 << 2)
+#define CMD_FLAG_MEAN (1 << 3)
+  uint32_t flags;
+  const char* ipath;
+  const char* opath;
+  unsigned int width;
+  unsigned int height;
+  size_t nfft;
+  size_t hop;
+  size_t nframe;
+  size_t njob;
+  double fmax;
+  double db_min;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->flags = 0;
+  cmd->ipath = NULL;
+  cmd->opath = NULL;
+  cmd->width = 1920;
+  cmd->height = 512;
+  cmd->nfft = 2048;
+  cmd->hop = 0;
+  cmd->nframe = 0;
+  cmd->njob = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+  cmd->fmax = 0.0;
+  cmd->db_min = -100.0;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-ipath") == 0)
+    {
+      cmd->flags |= CMD_FLAG_IPATH;
+      cmd->ipath = v;
+    }
+    else if (strcmp(k, "-opath") == 0)
+    {
+      const size_t len = strlen(v);
+      cmd->flags |= CMD_FLAG_OPATH;
+      cmd->opath = v;
+      if ((len >= 4) && (strcmp(v + len - 4, ".png") == 0))
+	cmd->flags |= CMD_FLAG_PNG;
+    }
+    else if (strcmp(k, "-format") == 0)
+    {
+      if (strcmp(v, "png") == 0) cmd->flags |= CMD_FLAG_PNG;
+      else if (strcmp(v, "ppm") == 0) cmd->flags &= ~CMD_FLAG_PNG;
+      else goto on_error;
+    }
+    else if (strcmp(k, "-agg") == 0)
+    {
+      if (strcmp(v, "mean") == 0) cmd->flags |= CMD_FLAG_MEAN;
+      else if (strcmp(v, "max") == 0) cmd->flags &= ~CMD_FLAG_MEAN;
+      else goto on_error;
+    }
+    else if (strcmp(k, "-width") == 0)
+    {
+      cmd->width = (unsigned int)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-height") == 0)
+    {
+      cmd->height = (unsigned int)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-nfft") == 0)
+    {
+      cmd->nfft = (size_t)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-hop") == 0)
+    {
+      cmd->hop = (size_t)strtoul(v, NULL, 10);
+      if (cmd->hop == 0) goto on_error;
+    }
+    else if (strcmp(k, "-nframe") == 0)
+    {
+      /* sparse sampling, frames per column. 0 for all of them */
+      cmd->nframe = (size_t)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-njob") == 0)
+    {
+      cmd->njob = (size_t)strtoul(v, NULL, 10);
+    }
+    else if (strcmp(k, "-fmax") == 0)
+    {
+      cmd->fmax = strtod(v, NULL);
+    }
+    else if (strcmp(k, "-db_min") == 0)
+    {
+      cmd->db_min = strtod(v, NULL);
+    }
+    else goto on_error;
+  }
+
+  if ((cmd->width == 0) || (cmd->height == 0)) goto on_error;
+  if (cmd->nfft < 16) goto on_error;
+  if (cmd->hop == 0) cmd->hop = cmd->nfft / 2;
+  if (cmd->db_min >= 0.0) goto on_error;
+  if (cmd->njob == 0) cmd->njob = 1;
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* spectrogram */
+
+/* each column of the image covers nsampl / width samples. it aggregates */
+/* the frames of a short time transform of the whole file, hop samples */
+/* apart, that start in the column: every sample is seen, and so is any */
+/* transient. columns shorter than hop get the one frame centered on */
+/* them. jobs take columns by chunks, the memory is the image and one */
+/* transform buffer per job. */
+
+/* with nframe, columns instead sample that many frames spread over */
+/* them: the cost is then bounded by width * nframe transforms whatever */
+/* the file length, for previews of long files. */
+
+typedef struct
+{
+  /* shared, read only */
+  const int16_t* sampl;
+  size_t nchan;
+  size_t nsampl;
+  unsigned int fsampl;
+
+  size_t n;
+  size_t nbin;
+  size_t hop;
+  size_t nframe;
+  fftw_plan plan;
+  const double* win;
+  double ref;
+
+  unsigned int width;
+  unsigned int height;
+  uint32_t flags;
+  double db_min;
+
+  uint8_t* pixels;
+
+  /* next column chunk to process */
+  pthread_mutex_t lock;
+  unsigned int next_col;
+
+} spectro_handle_t;
+
+typedef struct
+{
+  spectro_handle_t* s;
+  pthread_t thread;
+  void* buf;
+  double* col;
+  double* row;
+} spectro_job_t;
+
+static void spectro_get_color(uint8_t* rgb, double db, double db_min)
+{
+  /* black, blue, magenta, red, yellow, white */
+
+  static const uint8_t map[6][3] =
+  {
+    { 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0xa0 },
+    { 0xa0, 0x00, 0xa0 },
+    { 0xff, 0x20, 0x00 },
+    { 0xff, 0xe0, 0x00 },
+    { 0xff, 0xff, 0xff }
+  };
+
+  double x;
+  size_t i;
+  size_t j;
+
+  x = 1.0 - db / db_min;
+  if (x < 0.0) x = 0.0;
+  else if (x > 1.0) x = 1.0;
+
+  x *= 5.0;
+  i = (size_t)x;
+  if (i == 5) i = 4;
+  x -= (double)i;
+
+  for (j = 0; j != 3; ++j)
+  {
+    const double a = (double)map[i + 0][j];
+    const double b = (double)map[i + 1][j];
+    rgb[j] = (uint8_t)(a + (b - a) * x);
+  }
+}
+
+static void spectro_load_frame
+(const spectro_handle_t* s, double* obuf, size_t off)
+{
+  /* mix down the channels and apply the window */
+
+  const int16_t* p = s->sampl + off * s->nchan;
+  const double scale = 1.0 / (double)s->nchan;
+  size_t n = s->n;
+  size_t i;
+  size_t j;
+
+  if ((off + n) > s->nsampl) n = s->nsampl - off;
+
+  for (i = 0; i != n; ++i)
+  {
+    double x = 0.0;
+    for (j = 0; j != s->nchan; ++j, ++p) x += (double)*p;
+    obuf[i] = x * scale * s->win[i];
+  }
+
+  for (; i != s->n; ++i) obuf[i] = 0.0;
+}
+
+static size_t spectro_clamp_frame(const spectro_handle_t* s, size_t off)
+{
+  /* a frame from off, kept in the file if it is long enough */
+
+  if ((off + s->n) > s->nsampl)
+  {
+    if (s->nsampl > s->n) off = s->nsampl - s->n;
+    else off = 0;
+  }
+
+  return off;
+}
+
+static void spectro_add_frame(spectro_job_t* job, size_t off)
+{
+  const spectro_handle_t* const s = job->s;
+  const fftw_complex* const cbuf = job->buf;
+  size_t j;
+
+  spectro_load_frame(s, job->buf, off);
+  fftw_execute_dft_r2c(s->plan, job->buf, job->buf);
+
+  for (j = 0; j != s->nbin; ++j)
+  {
+    const double re = cbuf[j][0];
+    const double im = cbuf[j][1];
+    const double power = re * re + im * im;
+
+    if (s->flags & CMD_FLAG_MEAN) job->col[j] += power;
+    else if (power > job->col[j]) job->col[j] = power;
+  }
+}
+
+static void spectro_one_col(spectro_job_t* job, unsigned int x)
+{
+  const spectro_handle_t* const s = job->s;
+  const size_t lo = (size_t)(((uint64_t)s->nsampl * x) / s->width);
+  const size_t hi = (size_t)(((uint64_t)s->nsampl * (x + 1)) / s->width);
+  size_t nframe = 0;
+  size_t hop;
+  size_t off;
+  size_t i;
+  size_t j;
+
+  for (i = 0; i != s->nbin; ++i) job->col[i] = 0.0;
+
+  if (s->nframe)
+  {
+    /* sparse, each frame centered in its slot */
+
+    hop = (hi - lo) / s->nframe;
+    nframe = hop ? s->nframe : 1;
+
+    for (i = 0; i != nframe; ++i)
+    {
+      off = lo + i * hop + hop / 2;
+      if (off >= (s->n / 2)) off -= s->n / 2;
+      else off = 0;
+      spectro_add_frame(job, spectro_clamp_frame(s, off));
+    }
+  }
+  else
+  {
+    /* the frames starting in [lo, hi), on the hop grid */
+
+    for (off = ((lo + s->hop - 1) / s->hop) * s->hop; off < hi; off += s->hop)
+    {
+      spectro_add_frame(job, off);
+      ++nframe;
+    }
+
+    if (nframe == 0)
+    {
+      off = (lo + hi) / 2;
+      if (off >= (s->n / 2)) off -= s->n / 2;
+      else off = 0;
+      spectro_add_frame(job, spectro_clamp_frame(s, off));
+      nframe = 1;
+    }
+  }
+
+  if (s->flags & CMD_FLAG_MEAN)
+  {
+    for (j = 0; j != s->nbin; ++j) job->col[j] /= (double)nframe;
+  }
+
+  /* aggregate bins into rows, lowest frequency at the bottom */
+
+  for (i = 0; i != s->height; ++i)
+  {
+    size_t blo = (i * s->nbin) / s->height;
+    size_t bhi = ((i + 1) * s->nbin) / s->height;
+    double power = 0.0;
+
+    if (bhi == blo) bhi = blo + 1;
+
+    for (j = blo; j != bhi; ++j)
+    {
+      if (s->flags & CMD_FLAG_MEAN) power += job->col[j];
+      else if (job->col[j] > power) power = job->col[j];
+    }
+
+    if (s->flags & CMD_FLAG_MEAN) power /= (double)(bhi - blo);
+
+    job->row[i] = power;
+  }
+
+  for (i = 0; i != s->height; ++i)
+  {
+    const size_t y = s->height - 1 - i;
+    uint8_t* const rgb = s->pixels + (y * s->width + x) * 3;
+    double db = s->db_min;
+    if (job->row[i] > 0.0) db = 10.0 * log10(job->row[i] / s->ref);
+    spectro_get_color(rgb, db, s->db_min);
+  }
+}
+
+static void* spectro_job_main(void* p)
+{
+  /* columns are handed out by chunks to balance the load while */
+  /* keeping each job reading a contiguous region of the file */
+
+  static const unsigned int chunk = 16;
+
+  spectro_job_t* const job = p;
+  spectro_handle_t* const s = job->s;
+  unsigned int x;
+  unsigned int n;
+
+  while (1)
+  {
+    pthread_mutex_lock(&s->lock);
+    x = s->next_col;
+    s->next_col += chunk;
+    pthread_mutex_unlock(&s->lock);
+
+    if (x >= s->width) break ;
+
+    n = x + chunk;
+    if (n > s->width) n = s->width;
+    for (; x != n; ++x) spectro_one_col(job, x);
+  }
+
+  return NULL;
+}
+
+static int spectro_job_init(spectro_job_t* job, spectro_handle_t* s)
+{
+  job->s = s;
+
+  job->buf = fftw_malloc((s->n / 2 + 1) * sizeof(fftw_complex));
+  if (job->buf == NULL) goto on_error_0;
+
+  job->col = malloc(s->nbin * sizeof(double));
+  if (job->col == NULL) goto on_error_1;
+
+  job->row = malloc(s->height * sizeof(double));
+  if (job->row == NULL) goto on_error_2;
+
+  return 0;
+
+ on_error_2:
+  free(job->col);
+ on_error_1:
+  fftw_free(job->buf);
+ on_error_0:
+  return -1;
+}
+
+static void spectro_job_fini(spectro_job_t* job)
+{
+  free(job->row);
+  free(job->col);
+  fftw_free(job->buf);
+}
+
+static int spectro_render
+(
+ uint8_t* pixels,
+ const wav_handle_t* w,
+ const cmd_handle_t* cmd
+)
+{
+  spectro_handle_t s;
+  spectro_job_t* jobs;
+  double* win;
+  void* buf;
+  double sum;
+  size_t njob;
+  size_t ninit;
+  size_t i;
+  int err = -1;
+
+  s.sampl = wav_get_sampl_buf((wav_handle_t*)w);
+  s.nchan = w->nchan;
+  s.nsampl = w->nsampl;
+  s.fsampl = w->fsampl;
+  s.n = cmd->nfft;
+  s.hop = cmd->hop;
+  s.nframe = cmd->nframe;
+  s.width = cmd->width;
+  s.height = cmd->height;
+  s.flags = cmd->flags;
+  s.db_min = cmd->db_min;
+  s.pixels = pixels;
+  s.next_col = 0;
+
+  s.nbin = s.n / 2 + 1;
+  if ((cmd->fmax > 0.0) && (cmd->fmax < ((double)s.fsampl / 2.0)))
+    s.nbin = (size_t)((cmd->fmax * (double)s.n) / (double)s.fsampl) + 1;
+
+  /* hann window, and the power of a full scale sine through it */
+
+  win = malloc(s.n * sizeof(double));
+  if (win == NULL) goto on_error_0;
+
+  sum = 0.0;
+  for (i = 0; i != s.n; ++i)
+  {
+    win[i] = 0.5 - 0.5 * cos((2.0 * M_PI * (double)i) / (double)s.n);
+    sum += win[i];
+  }
+
+  s.win = win;
+  s.ref = (32768.0 * sum / 2.0) * (32768.0 * sum / 2.0);
+
+  /* the planner is not thread safe: plan once, execute from all jobs */
+
+  buf = fftw_malloc((s.n / 2 + 1) * sizeof(fftw_complex));
+  if (buf == NULL) goto on_error_1;
+  s.plan = fftw_plan_dft_r2c_1d(s.n, buf, buf, FFTW_ESTIMATE);
+  fftw_free(buf);
+  if (s.plan == NULL) goto on_error_1;
+
+  /* sparse frames would make sequential read ahead load the whole file */
+
+  if (s.nframe && ((s.nsampl / s.width / s.nframe) > (4 * s.n)))
+    madvise(w->data, w->size, MADV_RANDOM);
+  else
+    madvise(w->data, w->size, MADV_SEQUENTIAL);
+
+  njob = cmd->njob;
+  if (njob > s.width) njob = s.width;
+
+  jobs = malloc(njob * sizeof(spectro_job_t));
+  if (jobs == NULL) goto on_error_2;
+
+  if (pthread_mutex_init(&s.lock, NULL)) goto on_error_3;
+
+  for (ninit = 0; ninit != njob; ++ninit)
+  {
+    if (spectro_job_init(&jobs[ninit], &s)) goto on_error_4;
+  }
+
+  for (i = 1; i != njob; ++i)
+  {
+    if (pthread_create(&jobs[i].thread, NULL, spectro_job_main, &jobs[i]))
+      break ;
+  }
+
+  /* the calling thread is the first job. if a thread could not be */
+  /* created, the remaining jobs simply take its share of columns. */
+  spectro_job_main(&jobs[0]);
+
+  njob = i;
+  for (i = 1; i != njob; ++i) pthread_join(jobs[i].thread, NULL);
+
+  err = 0;
+
+ on_error_4:
+  for (i = 0; i != ninit; ++i) spectro_job_fini(&jobs[i]);
+  pthread_mutex_destroy(&s.lock);
+ on_error_3:
+  free(jobs);
+ on_error_2:
+  fftw_destroy_plan(s.plan);
+ on_error_1:
+  free(win);
+ on_error_0:
+  return err;
+}
+
+
+/* image output */
+
+static int write_ppm
+(const char* path, const uint8_t* pixels, unsigned int w, unsigned int h)
+{
+  const size_t size = (size_t)w * (size_t)h * 3;
+  FILE* file;
+  int err = -1;
+
+  file = fopen(path, "w");
+  if (file == NULL) goto on_error_0;
+
+  fprintf(file, "P6\n%u %u\n255\n", w, h);
+  if (fwrite(pixels, 1, size, file) != size) goto on_error_1;
+
+  err = 0;
+
+ on_error_1:
+  if (fclose(file)) err = -1;
+ on_error_0:
+  return err;
+}
+
+/* http://www.libpng.org/pub/png/spec/1.2/PNG-Structure.html */
+/* the zlib stream uses stored (uncompressed) deflate blocks, which keeps */
+/* the writer dependency free. spectrograms compress poorly anyway. */
+
+typedef struct
+{
+  FILE* file;
+  uint32_t crc;
+  uint32_t adler_a;
+  uint32_t adler_b;
+} png_handle_t;
+
+static uint32_t png_crc_table[256];
+
+static void png_init_crc_table(void)
+{
+  uint32_t c;
+  uint32_t i;
+  uint32_t j;
+
+  for (i = 0; i != 256; ++i)
+  {
+    c = i;
+    for (j = 0; j != 8; ++j)
+    {
+      if (c & 1) c = 0xedb88320 ^ (c >> 1);
+      else c >>= 1;
+    }
+    png_crc_table[i] = c;
+  }
+}
+
+static void png_put(png_handle_t* png, const void* data, size_t size)
+{
+  const uint8_t* p = data;
+  size_t i;
+
+  for (i = 0; i != size; ++i)
+    png->crc = png_crc_table[(png->crc ^ p[i]) & 0xff] ^ (png->crc >> 8);
+
+  fwrite(data, 1, size, png->file);
+}
+
+static void png_put_u32(png_handle_t* png, uint32_t x)
+{
+  uint8_t buf[4];
+  buf[0] = (uint8_t)(x >> 24);
+  buf[1] = (uint8_t)(x >> 16);
+  buf[2] = (uint8_t)(x >> 8);
+  buf[3] = (uint8_t)(x >> 0);
+  png_put(png, buf, sizeof(buf));
+}
+
+static void png_put_data(png_handle_t* png, const uint8_t* p, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i != size; ++i)
+  {
+    png->adler_a = (png->adler_a + p[i]) % 65521;
+    png->adler_b = (png->adler_b + png->adler_a) % 65521;
+  }
+
+  png_put(png, p, size);
+}
+
+static void png_begin_chunk(png_handle_t* png, const char* type, uint32_t len)
+{
+  png_put_u32(png, len);
+  png->crc = 0xffffffff;
+  png_put(png, type, 4);
+}
+
+static void png_end_chunk(png_handle_t* png)
+{
+  png_put_u32(png, png->crc ^ 0xffffffff);
+}
+
+static int write_png
+(const char* path, const uint8_t* pixels, unsigned int w, unsigned int h)
+{
+  static const uint8_t magic[8] =
+    { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
+  static const size_t max_block = 65535;
+
+  const size_t row_size = 1 + (size_t)w * 3;
+  const size_t raw_size = row_size * (size_t)h;
+  const size_t nblock = (raw_size + max_block - 1) / max_block;
+  png_handle_t png;
+  size_t block_left;
+  size_t nleft;
+  size_t x;
+  unsigned int y;
+  uint8_t buf[8];
+  int err = -1;
+
+  if ((2 + raw_size + nblock * 5 + 4) > 0x7fffffff) goto on_error_0;
+
+  png_init_crc_table();
+
+  png.file = fopen(path, "w");
+  if (png.file == NULL) goto on_error_0;
+  png.adler_a = 1;
+  png.adler_b = 0;
+
+  fwrite(magic, 1, sizeof(magic), png.file);
+
+  png_begin_chunk(&png, "IHDR", 13);
+  png_put_u32(&png, w);
+  png_put_u32(&png, h);
+  buf[0] = 8; /* bit depth */
+  buf[1] = 2; /* truecolor */
+  buf[2] = 0; /* deflate */
+  buf[3] = 0; /* adaptive filtering */
+  buf[4] = 0; /* no interlace */
+  png_put(&png, buf, 5);
+  png_end_chunk(&png);
+
+  png_begin_chunk(&png, "IDAT", (uint32_t)(2 + raw_size + nblock * 5 + 4));
+
+  buf[0] = 0x78;
+  buf[1] = 0x01;
+  png_put(&png, buf, 2);
+
+  /* walk the filtered rows, cutting stored blocks at max_block */
+
+  nleft = raw_size;
+  block_left = 0;
+
+  for (y = 0; y != h; ++y)
+  {
+    const uint8_t* const row = pixels + (size_t)y * (row_size - 1);
+
+    for (x = 0; x != row_size; )
+    {
+      size_t n;
+
+      if (block_left == 0)
+      {
+	block_left = nleft < max_block ? nleft : max_block;
+	buf[0] = (nleft == block_left) ? 1 : 0;
+	buf[1] = (uint8_t)(block_left >> 0);
+	buf[2] = (uint8_t)(block_left >> 8);
+	buf[3] = (uint8_t)~buf[1];
+	buf[4] = (uint8_t)~buf[2];
+	png_put(&png, buf, 5);
+      }
+
+      if (x == 0)
+      {
+	/* filter type none */
+	buf[0] = 0;
+	png_put_data(&png, buf, 1);
+	n = 1;
+      }
+      else
+      {
+	n = row_size - x;
+	if (n > block_left) n = block_left;
+	png_put_data(&png, row + x - 1, n);
+      }
+
+      x += n;
+      nleft -= n;
+      block_left -= n;
+    }
+  }
+
+  png_put_u32(&png, (png.adler_b << 16) | png.adler_a);
+  png_end_chunk(&png);
+
+  png_begin_chunk(&png, "IEND", 0);
+  png_end_chunk(&png);
+
+  if (ferror(png.file) == 0) err = 0;
+
+  if (fclose(png.file)) err = -1;
+ on_error_0:
+  return err;
+}
+
+
+/* main */
+
+int main(int ac, char** av)
+{
+  wav_handle_t iw;
+  cmd_handle_t cmd;
+  uint8_t* pixels;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if ((cmd.flags & CMD_FLAG_IPATH) == 0)
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if ((cmd.flags & CMD_FLAG_OPATH) == 0)
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (wav_open(&iw, cmd.ipath))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (iw.wsampl != 2)
+  {
+    /* only int16_t supported */
+    PERROR();
+    goto on_error_1;
+  }
+
+  pixels = malloc((size_t)cmd.width * (size_t)cmd.height * 3);
+  if (pixels == NULL)
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  if (spectro_render(pixels, &iw, &cmd))
+  {
+    PERROR();
+    goto on_error_2;
+  }
+
+  if (cmd.flags & CMD_FLAG_PNG)
+    err = write_png(cmd.opath, pixels, cmd.width, cmd.height);
+  else
+    err = write_ppm(cmd.opath, pixels, cmd.width, cmd.height);
+
+  if (err) PERROR();
+
+ on_error_2:
+  free(pixels);
+ on_error_1:
+  wav_close(&iw);
+ on_error_0:
+  return err;
+}
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include "stats.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+  const char* name;
+  /* between reports, in ms */
+  unsigned int period;
+  /* reports, 0 until interrupted */
+  size_t n;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->name = "aspect";
+  cmd->period = 1000;
+  cmd->n = 0;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-name") == 0)
+    {
+      cmd->name = v;
+    }
+    else if (strcmp(k, "-period") == 0)
+    {
+      cmd->period = (unsigned int)strtoul(v, NULL, 10);
+      if (cmd->period == 0) goto on_error;
+    }
+    else if (strcmp(k, "-n") == 0)
+    {
+      cmd->n = (size_t)strtoul(v, NULL, 10);
+    }
+    else goto on_error;
+  }
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* report */
+
+/* percentiles are over the reporting period, from the difference of */
+/* two histograms. the rest is as published. */
+
+static volatile unsigned int is_sigint = 0;
+
+static void on_sigint(int n)
+{
+  is_sigint = 1;
+}
+
+
+static void print_dev(const char* name, const stats_dev_t* dev)
+{
+  printf
+  (
+   "%s: %u Hz, %u chan, xruns %llu, "
+   "delay %lld [%lld, %lld], fill %llu [%llu] of %llu\n",
+   name, dev->fsampl, dev->nchan,
+   (unsigned long long)dev->nxrun,
+   (long long)dev->delay, (long long)dev->delay_min,
+   (long long)dev->delay_max,
+   (unsigned long long)dev->fill, (unsigned long long)dev->fill_max,
+   (unsigned long long)dev->size
+  );
+}
+
+
+static void print_report(const stats_data_t* cur, const stats_data_t* prev)
+{
+  uint64_t hist[STATS_NBUCKET];
+  size_t i;
+
+  for (i = 0; i != STATS_NBUCKET; ++i) hist[i] = cur->hist[i] - prev->hist[i];
+
+  printf
+  (
+   "periods %llu (+%llu), dropped %llu\n",
+   (unsigned long long)cur->nperiod,
+   (unsigned long long)(cur->nperiod - prev->nperiod),
+   (unsigned long long)cur->ndrop
+  );
+
+  print_dev("in ", &cur->devs[STATS_DEV_IN]);
+  print_dev("out", &cur->devs[STATS_DEV_OUT]);
+
+  printf
+  (
+   "process: p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f us\n",
+   (double)stats_get_percentile(hist, 0.5) / 1000.0,
+   (double)stats_get_percentile(hist, 0.99) / 1000.0,
+   (double)stats_get_percentile(hist, 0.999) / 1000.0,
+   (double)cur->hist_max / 1000.0
+  );
+
+  if (cur->latency != 0.0)
+  {
+    printf
+    (
+     "drift: latency %.1f ms, ratio %+.1f ppm\n",
+     cur->latency * 1000.0, (cur->ratio - 1.0) * 1000000.0
+    );
+  }
+
+  printf("\n");
+  fflush(stdout);
+}
+
+
+/* main */
+
+int main(int ac, char** av)
+{
+  stats_handle_t stats;
+  stats_data_t datas[2];
+  stats_data_t* cur = &datas[0];
+  stats_data_t* prev = &datas[1];
+  stats_data_t* tmp;
+  struct timespec ts;
+  cmd_handle_t cmd;
+  size_t i;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (stats_open(&stats, cmd.name))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  signal(SIGINT, on_sigint);
+
+  memset(prev, 0, sizeof(stats_data_t));
+
+  ts.tv_sec = cmd.period / 1000;
+  ts.tv_nsec = (long)(cmd.period % 1000) * 1000000;
+
+  for (i = 0; (cmd.n == 0) || (i != cmd.n); ++i)
+  {
+    if (is_sigint) break ;
+
+    if (stats_read(&stats, cur))
+    {
+      PERROR();
+      goto on_error_1;
+    }
+
+    /* the writer is gone */
+    if (kill((pid_t)stats.shm->pid, 0) && (errno == ESRCH)) break ;
+
+    print_report(cur, prev);
+
+    tmp = prev;
+    prev = cur;
+    cur = tmp;
+
+    nanosleep(&ts, NULL);
+  }
+
+  err = 0;
+
+ on_error_1:
+  stats_close(&stats);
+ on_error_0:
+  return err;
+}
@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+#include "util.h"
+
+
+/* readers give up after this many copies raced with the writer */
+#define STATS_NRETRY 64
+
+
+int stats_create(stats_handle_t* stats, const char* name)
+{
+  stats_shm_t* shm;
+
+  if (util_get_shm_name(stats->name, sizeof(stats->name), name))
+    goto on_error_0;
+
+  stats->fd = shm_open(stats->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (stats->fd == -1) goto on_error_0;
+
+  if (ftruncate(stats->fd, sizeof(stats_shm_t))) goto on_error_2;
+
+  shm = mmap
+  (
+   NULL, sizeof(stats_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+   stats->fd, 0
+  );
+  if (shm == MAP_FAILED) goto on_error_2;
+
+  /* the pages are touched now rather than on the first period */
+  memset(shm, 0, sizeof(stats_shm_t));
+  memset(&stats->data, 0, sizeof(stats_data_t));
+
+  shm->version = STATS_VERSION;
+  shm->size = sizeof(stats_shm_t);
+  shm->pid = (int32_t)getpid();
+  __atomic_store_n(&shm->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+
+  stats->shm = shm;
+  stats->is_writer = 1;
+
+  return 0;
+
+ on_error_2:
+  close(stats->fd);
+  shm_unlink(stats->name);
+ on_error_0:
+  return -1;
+}
+
+
+int stats_open(stats_handle_t* stats, const char* name)
+{
+  stats_shm_t* shm;
+  struct stat st;
+
+  if (util_get_shm_name(stats->name, sizeof(stats->name), name))
+    goto on_error_0;
+
+  stats->fd = shm_open(stats->name, O_RDONLY, 0);
+  if (stats->fd == -1) goto on_error_0;
+
+  if (fstat(stats->fd, &st)) goto on_error_2;
+  if (st.st_size < sizeof(stats_shm_t)) goto on_error_2;
+
+  shm = mmap(NULL, sizeof(stats_shm_t), PROT_READ, MAP_SHARED, stats->fd, 0);
+  if (shm == MAP_FAILED) goto on_error_2;
+
+  if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC)
+    goto on_error_3;
+  if (shm->version != STATS_VERSION) goto on_error_3;
+  if (shm->size != sizeof(stats_shm_t)) goto on_error_3;
+
+  stats->shm = shm;
+  stats->is_writer = 0;
+
+  return 0;
+
+ on_error_3:
+  munmap(shm, sizeof(stats_shm_t));
+ on_error_2:
+  close(stats->fd);
+ on_error_0:
+  return -1;
+}
+
+
+void stats_close(stats_handle_t* stats)
+{
+  munmap(stats->shm, sizeof(stats_shm_t));
+  close(stats->fd);
+  if (stats->is_writer) shm_unlink(stats->name);
+}
+
+
+void stats_publish(stats_handle_t* stats)
+{
+  /* copy data to the segment. the sequence is made odd before any */
+  /* store to the copy is seen, and even after all of them are. */
+
+  stats_shm_t* const shm = stats->shm;
+  const uint32_t seq = shm->seq;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  stats->data.time = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+
+  __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  memcpy(&shm->data, &stats->data, sizeof(stats_data_t));
+
+  __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+int stats_read(stats_handle_t* stats, stats_data_t* data)
+{
+  /* a consistent copy of the segment, or -1 if every try raced */
+
+  const stats_shm_t* const shm = stats->shm;
+  uint32_t seq;
+  size_t i;
+
+  for (i = 0; i != STATS_NRETRY; ++i)
+  {
+    seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+    {
+      sched_yield();
+      continue ;
+    }
+
+    memcpy(data, (const void*)&shm->data, sizeof(stats_data_t));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq) return 0;
+  }
+
+  return -1;
+}
+
+
+uint64_t stats_get_percentile(const uint64_t* hist, double p)
+{
+  /* least value of the bucket holding the p-th percentile, p in [0, 1] */
+
+  uint64_t n = 0;
+  uint64_t k;
+  unsigned int i;
+
+  for (i = 0; i != STATS_NBUCKET; ++i) n += hist[i];
+  if (n == 0) return 0;
+
+  k = (uint64_t)(p * (double)n);
+  if (k >= n) k = n - 1;
+
+  for (i = 0; i != STATS_NBUCKET; ++i)
+  {
+    if (k < hist[i]) break ;
+    k -= hist[i];
+  }
+
+  return stats_get_value(i);
+}
@@ -0,0 +1,160 @@
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+
+
+/* live statistics of the audio loop, published in a shared memory */
+/* segment for another process to read. the writer updates a private */
+/* copy as it goes, and publishes it whole once per period under a */
+/* sequence lock: the count is odd while the copy is in progress. */
+/* readers map the segment read only, and retry a copy that raced */
+/* with the writer. the writer never waits for them. */
+
+/* per period processing times go to a log linear histogram, as hdr */
+/* histograms: each power of 2 of nanoseconds is split in 2^SUB linear */
+/* buckets, for a relative error of at most 2^-SUB. values up to 2^SUB */
+/* have a bucket each, those past 2^BITS go to the last one. */
+
+#define STATS_MAGIC 0x61737473
+#define STATS_VERSION 1
+
+#define STATS_HIST_SUB 4
+#define STATS_HIST_BITS 36
+#define STATS_NBUCKET ((STATS_HIST_BITS - STATS_HIST_SUB + 1) << STATS_HIST_SUB)
+
+#define STATS_DEV_IN 0
+#define STATS_DEV_OUT 1
+#define STATS_NDEV 2
+
+typedef struct stats_dev
+{
+  uint32_t fsampl;
+  uint32_t nchan;
+
+  uint64_t nxrun;
+
+  /* snd_pcm_delay samples, in frames */
+  int64_t delay;
+  int64_t delay_min;
+  int64_t delay_max;
+  uint64_t ndelay;
+
+  /* frames in the application ring, and its size */
+  uint64_t fill;
+  uint64_t fill_max;
+  uint64_t size;
+
+} stats_dev_t;
+
+typedef struct stats_data
+{
+  /* last publication, CLOCK_MONOTONIC ns */
+  uint64_t time;
+
+  uint64_t nperiod;
+  uint64_t ndrop;
+
+  /* capture to playback, in seconds, and resampler ratio */
+  double latency;
+  double ratio;
+
+  stats_dev_t devs[STATS_NDEV];
+
+  /* processing time per period, in ns */
+  uint64_t hist_max;
+  uint64_t hist[STATS_NBUCKET];
+
+} stats_data_t;
+
+typedef struct stats_shm
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  int32_t pid;
+
+  /* odd while the writer copies */
+  uint32_t seq;
+
+  stats_data_t data;
+
+} stats_shm_t;
+
+typedef struct stats_handle
+{
+  /* shm_open name, with its leading slash */
+  char name[NAME_MAX + 1];
+  int fd;
+  stats_shm_t* shm;
+  unsigned int is_writer;
+
+  /* updated by the writer, copied to shm on publication */
+  stats_data_t data;
+
+} stats_handle_t;
+
+
+int stats_create(stats_handle_t*, const char*);
+int stats_open(stats_handle_t*, const char*);
+void stats_close(stats_handle_t*);
+void stats_publish(stats_handle_t*);
+int stats_read(stats_handle_t*, stats_data_t*);
+uint64_t stats_get_percentile(const uint64_t*, double);
+
+
+static inline unsigned int stats_get_bucket(uint64_t x)
+{
+  unsigned int m;
+
+  if (x < (1 << STATS_HIST_SUB)) return (unsigned int)x;
+  if (x >> STATS_HIST_BITS) return STATS_NBUCKET - 1;
+
+  /* most significant bit, then the STATS_HIST_SUB bits below it */
+  m = 63 - (unsigned int)__builtin_clzll(x) - STATS_HIST_SUB;
+  return ((m + 1) << STATS_HIST_SUB) +
+    (unsigned int)((x >> m) & ((1 << STATS_HIST_SUB) - 1));
+}
+
+
+static inline uint64_t stats_get_value(unsigned int i)
+{
+  /* the least value of bucket i */
+
+  const unsigned int m = i >> STATS_HIST_SUB;
+
+  if (m == 0) return (uint64_t)i;
+  return
+    ((uint64_t)(1 << STATS_HIST_SUB) + (i & ((1 << STATS_HIST_SUB) - 1)))
+    << (m - 1);
+}
+
+
+static inline void stats_add_time(stats_data_t* data, uint64_t x)
+{
+  ++data->hist[stats_get_bucket(x)];
+  if (x > data->hist_max) data->hist_max = x;
+  ++data->nperiod;
+}
+
+
+static inline void stats_add_delay(stats_dev_t* dev, int64_t x)
+{
+  if ((dev->ndelay == 0) || (x < dev->delay_min)) dev->delay_min = x;
+  if ((dev->ndelay == 0) || (x > dev->delay_max)) dev->delay_max = x;
+  dev->delay = x;
+  ++dev->ndelay;
+}
+
+
+static inline void stats_add_fill(stats_dev_t* dev, uint64_t x)
+{
+  if (x > dev->fill_max) dev->fill_max = x;
+  dev->fill = x;
+}
+
+
+#endif /* ! STATS_H_INCLUDED */
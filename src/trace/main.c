@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "trace.h"
+#include "util.h"
+
+
+#if 1
+#include <stdio.h>
+#define PERROR() \
+ do { printf("[!] %s,%u\n", __FILE__, __LINE__); fflush(stdout); } while(0)
+#else
+#define PERROR()
+#endif
+
+
+
+/* cmd */
+
+typedef struct
+{
+#define CMD_FLAG_OPATH (1 << 0)
+  uint32_t flags;
+  const char* opath;
+  /* stage pairs per thread, and threads */
+  size_t n;
+  size_t nthread;
+} cmd_handle_t;
+
+static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
+{
+  size_t i;
+
+  cmd->flags = 0;
+  cmd->opath = NULL;
+  cmd->n = 1000000;
+  cmd->nthread = 2;
+
+  if ((ac % 2)) goto on_error;
+
+  for (i = 0; i != ac; i += 2)
+  {
+    const char* const k = av[i + 0];
+    const char* const v = av[i + 1];
+
+    if (strcmp(k, "-opath") == 0)
+    {
+      cmd->flags |= CMD_FLAG_OPATH;
+      cmd->opath = v;
+    }
+    else if (strcmp(k, "-n") == 0)
+    {
+      cmd->n = (size_t)strtoul(v, NULL, 10);
+      if (cmd->n == 0) goto on_error;
+    }
+    else if (strcmp(k, "-nthread") == 0)
+    {
+      cmd->nthread = (size_t)strtoul(v, NULL, 10);
+      if ((cmd->nthread == 0) || (cmd->nthread > TRACE_NTHREAD))
+	goto on_error;
+    }
+    else goto on_error;
+  }
+
+  return 0;
+
+ on_error:
+  return -1;
+}
+
+
+/* bench */
+
+/* the cost of a stage pair, against the same loop untraced. the stage */
+/* body is a short dependent chain, a stand in for a period of work. */
+
+#define BENCH_NWORK 64
+
+typedef struct
+{
+  size_t n;
+  unsigned int is_traced;
+  double t;
+  uint64_t x;
+} bench_handle_t;
+
+
+static uint64_t bench_work(uint64_t x)
+{
+  size_t i;
+  for (i = 0; i != BENCH_NWORK; ++i) x = x * 6364136223846793005ULL + 1;
+  return x;
+}
+
+
+static void* bench_main(void* p)
+{
+  bench_handle_t* const b = p;
+  uint64_t x = b->x;
+  size_t i;
+
+  if (b->is_traced) trace_attach("bench");
+
+  b->t = util_get_time();
+
+  for (i = 0; i != b->n; ++i)
+  {
+    trace_begin("work");
+    x = bench_work(x);
+    trace_end("work");
+  }
+
+  b->t = util_get_time() - b->t;
+  b->x = x;
+
+  return NULL;
+}
+
+
+static int bench_run
+(bench_handle_t* b, size_t nthread, size_t n, unsigned int is_traced)
+{
+  pthread_t threads[TRACE_NTHREAD];
+  size_t i;
+
+  for (i = 0; i != nthread; ++i)
+  {
+    b[i].n = n;
+    b[i].is_traced = is_traced;
+    b[i].x = (uint64_t)i;
+    if (pthread_create(&threads[i], NULL, bench_main, &b[i])) break ;
+  }
+
+  nthread = i;
+  for (i = 0; i != nthread; ++i) pthread_join(threads[i], NULL);
+
+  return nthread ? 0 : -1;
+}
+
+
+/* main */
+
+int main(int ac, char** av)
+{
+  bench_handle_t base[TRACE_NTHREAD];
+  bench_handle_t traced[TRACE_NTHREAD];
+  cmd_handle_t cmd;
+  double tbase = 0.0;
+  double ttraced = 0.0;
+  size_t i;
+  int err = -1;
+
+  if (cmd_init(&cmd, ac - 1, av + 1))
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (trace_init())
+  {
+    PERROR();
+    goto on_error_0;
+  }
+
+  if (bench_run(base, cmd.nthread, cmd.n, 0))
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  if (bench_run(traced, cmd.nthread, cmd.n, 1))
+  {
+    PERROR();
+    goto on_error_1;
+  }
+
+  for (i = 0; i != cmd.nthread; ++i)
+  {
+    tbase += base[i].t;
+    ttraced += traced[i].t;
+  }
+
+  printf
+  (
+   "%zu threads, %zu stages each: %.1f ns per stage, %.1f ns traced, "
+   "%.1f ns per event\n",
+   cmd.nthread, cmd.n,
+   (tbase * 1e9) / (double)(cmd.n * cmd.nthread),
+   (ttraced * 1e9) / (double)(cmd.n * cmd.nthread),
+   ((ttraced - tbase) * 1e9) / (double)(2 * cmd.n * cmd.nthread)
+  );
+
+  if (cmd.flags & CMD_FLAG_OPATH)
+  {
+    if (trace_dump(cmd.opath))
+    {
+      PERROR();
+      goto on_error_1;
+    }
+  }
+
+  err = 0;
+
+ on_error_1:
+  trace_fini();
+ on_error_0:
+  return err;
+}
@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "trace.h"
+#include "util.h"
+
+
+__thread trace_ring_t* trace_ring = NULL;
+
+/* rings are only added, under the lock, and freed by trace_fini. a */
+/* detached one is kept, and taken back by a thread of the same name */
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t trace_rings[TRACE_NTHREAD];
+static size_t trace_nring = 0;
+static unsigned int trace_is_init = 0;
+
+/* clock readings at init, for the tick rate */
+static uint64_t trace_tsc0;
+static double trace_time0;
+
+/* a snapshot being written */
+typedef struct
+{
+  char* path;
+  size_t nring;
+  trace_ring_t rings[TRACE_NTHREAD];
+  size_t counts[TRACE_NTHREAD];
+} trace_dump_t;
+
+static pthread_t trace_thread;
+static unsigned int trace_is_dumping = 0;
+
+
+int trace_init(void)
+{
+  trace_tsc0 = trace_get_tsc();
+  trace_time0 = util_get_time();
+  trace_is_init = 1;
+  return 0;
+}
+
+
+void trace_fini(void)
+{
+  /* attached threads must be done */
+
+  size_t i;
+
+  trace_wait();
+
+  for (i = 0; i != trace_nring; ++i) free(trace_rings[i].events);
+  trace_nring = 0;
+  trace_is_init = 0;
+  trace_ring = NULL;
+}
+
+
+static trace_ring_t* trace_find(const char* name)
+{
+  /* a detached ring of that name, under the lock */
+
+  size_t i;
+
+  for (i = 0; i != trace_nring; ++i)
+  {
+    trace_ring_t* const r = &trace_rings[i];
+    if (r->is_detached == 0) continue ;
+    if (strncmp(r->name, name, TRACE_NAME_SIZE - 1) == 0) return r;
+  }
+
+  return NULL;
+}
+
+
+int trace_attach(const char* name)
+{
+  /* give the calling thread a ring. pages are touched now rather than */
+  /* on the hot path. a thread restarted under the same name continues */
+  /* the ring of the previous one. */
+
+  trace_ring_t* r;
+  trace_event_t* events;
+
+  if (trace_is_init == 0) return -1;
+
+  pthread_mutex_lock(&trace_lock);
+  r = trace_find(name);
+  if (r != NULL)
+  {
+    r->tid = (pid_t)syscall(SYS_gettid);
+    r->is_detached = 0;
+  }
+  pthread_mutex_unlock(&trace_lock);
+
+  if (r != NULL)
+  {
+    trace_ring = r;
+    return 0;
+  }
+
+  events = malloc(TRACE_NEVENT * sizeof(trace_event_t));
+  if (events == NULL) return -1;
+  memset(events, 0, TRACE_NEVENT * sizeof(trace_event_t));
+
+  pthread_mutex_lock(&trace_lock);
+
+  if (trace_nring == TRACE_NTHREAD)
+  {
+    pthread_mutex_unlock(&trace_lock);
+    free(events);
+    return -1;
+  }
+
+  r = &trace_rings[trace_nring];
+  strncpy(r->name, name, TRACE_NAME_SIZE - 1);
+  r->name[TRACE_NAME_SIZE - 1] = 0;
+  r->tid = (pid_t)syscall(SYS_gettid);
+  r->head = 0;
+  r->events = events;
+  r->is_detached = 0;
+  ++trace_nring;
+
+  pthread_mutex_unlock(&trace_lock);
+
+  trace_ring = r;
+
+  return 0;
+}
+
+
+void trace_detach(void)
+{
+  /* the calling thread is done with its ring. its events are kept. */
+
+  if (trace_ring == NULL) return ;
+
+  pthread_mutex_lock(&trace_lock);
+  trace_ring->is_detached = 1;
+  pthread_mutex_unlock(&trace_lock);
+
+  trace_ring = NULL;
+}
+
+
+static void trace_snap(trace_ring_t* dst, size_t* count, trace_ring_t* src)
+{
+  /* the last events of src, oldest first. the owner keeps writing: */
+  /* those it may have overwritten during the copy are dropped. */
+
+  uint64_t head;
+  uint64_t tail;
+  uint64_t i;
+  size_t k;
+
+  head = __atomic_load_n(&src->head, __ATOMIC_ACQUIRE);
+  tail = head > TRACE_NEVENT ? head - TRACE_NEVENT : 0;
+
+  for (i = tail; i != head; ++i)
+    dst->events[i - tail] = src->events[i & (TRACE_NEVENT - 1)];
+
+  i = __atomic_load_n(&src->head, __ATOMIC_ACQUIRE);
+  k = 0;
+  if ((i - tail) > TRACE_NEVENT) k = (size_t)(i - tail - TRACE_NEVENT);
+  if (k > (head - tail)) k = (size_t)(head - tail);
+
+  *count = (size_t)(head - tail) - k;
+  memmove(dst->events, dst->events + k, *count * sizeof(trace_event_t));
+
+  memcpy(dst->name, src->name, TRACE_NAME_SIZE);
+  dst->tid = src->tid;
+}
+
+
+static void* trace_main(void* p)
+{
+  /* format and write a snapshot, then replace the file with it */
+
+  trace_dump_t* const d = p;
+  const pid_t pid = getpid();
+  double freq;
+  double t;
+  uint64_t tsc;
+  char* tmp;
+  FILE* file;
+  size_t i;
+  size_t j;
+  const char* sep = "";
+
+  /* the tick rate, over at least 10 ms */
+  t = util_get_time() - trace_time0;
+  if (t < 0.01) usleep((useconds_t)((0.01 - t) * 1000000.0) + 1);
+  tsc = trace_get_tsc();
+  t = util_get_time();
+  freq = (double)(tsc - trace_tsc0) / (t - trace_time0);
+
+  tmp = malloc(strlen(d->path) + 5);
+  if (tmp == NULL) goto on_error_0;
+  sprintf(tmp, "%s.tmp", d->path);
+
+  file = fopen(tmp, "w");
+  if (file == NULL) goto on_error_1;
+
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+  for (i = 0; i != d->nring; ++i)
+  {
+    const trace_ring_t* const r = &d->rings[i];
+
+    fprintf
+    (
+     file,
+     "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+     "\"args\":{\"name\":\"%s\"}}\n",
+     sep, (int)pid, (int)r->tid, r->name
+    );
+    sep = ",";
+
+    for (j = 0; j != d->counts[i]; ++j)
+    {
+      const trace_event_t* const e = &r->events[j];
+      const double ts = ((double)(e->tsc - trace_tsc0) * 1e6) / freq;
+
+      fprintf
+      (
+       file,
+       ",{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+       e->name, (char)e->ph, ts, (int)pid, (int)r->tid
+      );
+
+      if (e->ph == TRACE_PH_MARK)
+	fprintf(file, ",\"s\":\"t\",\"args\":{\"arg\":%u}", e->arg);
+
+      fprintf(file, "}\n");
+    }
+  }
+
+  fprintf(file, "]}\n");
+
+  if (fclose(file) == 0) rename(tmp, d->path);
+  else unlink(tmp);
+
+ on_error_1:
+  free(tmp);
+ on_error_0:
+  for (i = 0; i != d->nring; ++i) free(d->rings[i].events);
+  free(d->path);
+  free(d);
+  return NULL;
+}
+
+
+int trace_dump(const char* path)
+{
+  /* snapshot the rings now, write them to path in the background. */
+  /* fails if the previous dump is still being written. */
+
+  trace_dump_t* d;
+  size_t nring;
+  size_t i;
+
+  if (trace_is_init == 0) return -1;
+
+  if (trace_is_dumping)
+  {
+    if (pthread_tryjoin_np(trace_thread, NULL)) return -1;
+    trace_is_dumping = 0;
+  }
+
+  d = malloc(sizeof(trace_dump_t));
+  if (d == NULL) goto on_error_0;
+
+  d->path = strdup(path);
+  if (d->path == NULL) goto on_error_1;
+
+  pthread_mutex_lock(&trace_lock);
+  nring = trace_nring;
+  pthread_mutex_unlock(&trace_lock);
+
+  for (d->nring = 0; d->nring != nring; ++d->nring)
+  {
+    trace_ring_t* const r = &d->rings[d->nring];
+    r->events = malloc(TRACE_NEVENT * sizeof(trace_event_t));
+    if (r->events == NULL) goto on_error_2;
+    trace_snap(r, &d->counts[d->nring], &trace_rings[d->nring]);
+  }
+
+  if (pthread_create(&trace_thread, NULL, trace_main, d)) goto on_error_2;
+  trace_is_dumping = 1;
+
+  return 0;
+
+ on_error_2:
+  for (i = 0; i != d->nring; ++i) free(d->rings[i].events);
+  free(d->path);
+ on_error_1:
+  free(d);
+ on_error_0:
+  return -1;
+}
+
+
+void trace_wait(void)
+{
+  /* the last dump is written */
+
+  if (trace_is_dumping == 0) return ;
+  pthread_join(trace_thread, NULL);
+  trace_is_dumping = 0;
+}
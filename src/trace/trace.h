@@ -0,0 +1,117 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+
+#include <stdint.h>
+#include <sys/types.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+
+/* stage entry and exit events of the hot loops, for when the time of */
+/* a period has to be accounted for. each thread attaches a ring of */
+/* TRACE_NEVENT events that only it writes: an event is the tsc and a */
+/* static name, then the head is published. nothing is shared on the */
+/* hot path, and a thread that is not attached pays one test. */
+
+/* trace_dump snapshots the rings and formats them in the background, */
+/* in the json trace event format of chrome://tracing, that perfetto */
+/* reads too. ticks are converted to time from two clock readings. */
+
+#define TRACE_NEVENT (1 << 16)
+#define TRACE_NTHREAD 16
+#define TRACE_NAME_SIZE 16
+
+/* chrome trace phases */
+#define TRACE_PH_BEGIN 'B'
+#define TRACE_PH_END 'E'
+#define TRACE_PH_MARK 'i'
+
+typedef struct trace_event
+{
+  uint64_t tsc;
+  const char* name;
+  uint32_t ph;
+  uint32_t arg;
+} trace_event_t;
+
+typedef struct trace_ring
+{
+  char name[TRACE_NAME_SIZE];
+  pid_t tid;
+
+  /* events written, the last TRACE_NEVENT are kept */
+  uint64_t head;
+  trace_event_t* events;
+
+  /* the thread is gone, the next one of the same name takes the ring */
+  unsigned int is_detached;
+
+} trace_ring_t;
+
+
+/* the ring of the calling thread, NULL if not attached */
+extern __thread trace_ring_t* trace_ring;
+
+
+int trace_init(void);
+void trace_fini(void);
+int trace_attach(const char*);
+void trace_detach(void);
+int trace_dump(const char*);
+void trace_wait(void);
+
+
+static inline uint64_t trace_get_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+
+static inline void trace_add(const char* name, uint32_t ph, uint32_t arg)
+{
+  /* name must outlive the trace, a literal usually */
+
+  trace_ring_t* const r = trace_ring;
+  trace_event_t* e;
+
+  if (r == NULL) return ;
+
+  e = &r->events[r->head & (TRACE_NEVENT - 1)];
+  e->tsc = trace_get_tsc();
+  e->name = name;
+  e->ph = ph;
+  e->arg = arg;
+
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+
+static inline void trace_begin(const char* name)
+{
+  trace_add(name, TRACE_PH_BEGIN, 0);
+}
+
+
+static inline void trace_end(const char* name)
+{
+  trace_add(name, TRACE_PH_END, 0);
+}
+
+
+static inline void trace_mark(const char* name, uint32_t arg)
+{
+  trace_add(name, TRACE_PH_MARK, arg);
+}
+
+
+#endif /* ! TRACE_H_INCLUDED */
@@ -0,0 +1,29 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "util.h"
+
+
+double util_get_time(void)
+{
+  /* monotonic, in seconds */
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+
+int util_get_shm_name(char* s, size_t size, const char* name)
+{
+  /* shm_open wants a single leading slash. -1 if size is too short. */
+
+  const size_t n = strlen(name) + (name[0] == '/' ? 0 : 1);
+
+  if (n >= size) return -1;
+
+  s[0] = '/';
+  strcpy(s + (name[0] == '/' ? 0 : 1), name);
+
+  return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef UTIL_H_INCLUDED
+#define UTIL_H_INCLUDED
+
+
+#include <sys/types.h>
+
+
+/* helpers shared by the modules and the tools */
+
+double util_get_time(void);
+int util_get_shm_name(char*, size_t, const char*);
+
+
+#endif /* ! UTIL_H_INCLUDED */
@@ -1,2 +1,2 @@
 #!/usr/bin/env sh
-gcc -Wall -O2 -I. main.c wav.c
+gcc -Wall -O2 -I. -I../util main.c wav.c ../util/util.c -lpthread
@@ -1,7 +1,18 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "wav.h"
+#include "util.h"
 
 
 #if 1
@@ -16,17 +27,26 @@
 
 /* cmd */
 
+#define CMD_MAX_IPATH 32
+
 typedef struct
 {
 #define CMD_FLAG_IPATH (1 << 0)
 #define CMD_FLAG_OPATH (1 << 1)
 #define CMD_FLAG_START (1 << 2)
 #define CMD_FLAG_LENGTH (1 << 3)
+#define CMD_FLAG_INFO (1 << 4)
+#define CMD_FLAG_JSON (1 << 5)
+#define CMD_FLAG_CHECK (1 << 6)
   uint32_t flags;
   const char* ipath;
   const char* opath;
   uint32_t start;
   uint32_t length;
+  /* info: files or directories, scanned recursively */
+  size_t nipath;
+  const char* ipaths[CMD_MAX_IPATH];
+  size_t njob;
 } cmd_handle_t;
 
 static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
@@ -38,6 +58,8 @@ static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
   cmd->opath = NULL;
   cmd->start = 0;
   cmd->length = 0;
+  cmd->nipath = 0;
+  cmd->njob = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
 
   if ((ac % 2)) goto on_error;
 
@@ -46,10 +68,20 @@ static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
     const char* const k = av[i + 0];
     const char* const v = av[i + 1];
 
-    if (strcmp(k, "-ipath") == 0)
+    if (strcmp(k, "-do") == 0)
+    {
+      cmd->flags &= ~(CMD_FLAG_INFO | CMD_FLAG_CHECK);
+      if (strcmp(v, "copy") == 0) ;
+      else if (strcmp(v, "info") == 0) cmd->flags |= CMD_FLAG_INFO;
+      else if (strcmp(v, "check") == 0) cmd->flags |= CMD_FLAG_CHECK;
+      else goto on_error;
+    }
+    else if (strcmp(k, "-ipath") == 0)
     {
       cmd->flags |= CMD_FLAG_IPATH;
       cmd->ipath = v;
+      if (cmd->nipath == CMD_MAX_IPATH) goto on_error;
+      cmd->ipaths[cmd->nipath++] = v;
     }
     else if (strcmp(k, "-opath") == 0)
     {
@@ -66,9 +98,21 @@ static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
       cmd->flags |= CMD_FLAG_LENGTH;
       cmd->length = (uint32_t)strtoul(v, NULL, 10);
     }
+    else if (strcmp(k, "-oformat") == 0)
+    {
+      if (strcmp(v, "csv") == 0) cmd->flags &= ~CMD_FLAG_JSON;
+      else if (strcmp(v, "json") == 0) cmd->flags |= CMD_FLAG_JSON;
+      else goto on_error;
+    }
+    else if (strcmp(k, "-njob") == 0)
+    {
+      cmd->njob = (size_t)strtoul(v, NULL, 10);
+    }
     else goto on_error;
   }
 
+  if (cmd->njob == 0) cmd->njob = 1;
+
   return 0;
 
  on_error:
@@ -76,6 +120,615 @@ static int cmd_init(cmd_handle_t* cmd, int ac, char** av)
 }
 
 
+/* info */
+
+/* -njob threads share a stack of directories to scan. a file is taken */
+/* through the fd of its directory: statx gives its type and size, then */
+/* wav_probe most often a single pread of its first block. records are */
+/* formatted in a per thread buffer, and written out in large pieces. */
+
+#define INFO_BUF_SIZE (256 * 1024)
+#define INFO_MAX_RECORD (2 * PATH_MAX + 256)
+
+typedef struct
+{
+  const cmd_handle_t* cmd;
+
+  /* directories left to scan, and threads waiting for one */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char** dirs;
+  size_t ndir;
+  size_t maxdir;
+  size_t nwait;
+  size_t nthread;
+  unsigned int is_done;
+
+  /* output */
+  pthread_mutex_t olock;
+  unsigned int is_first;
+
+  size_t nfile;
+  size_t nerr;
+  size_t nscan;
+
+} info_handle_t;
+
+typedef struct
+{
+  pthread_t thread;
+  info_handle_t* h;
+
+  char* buf;
+  size_t size;
+
+  size_t nfile;
+  size_t nerr;
+  size_t nscan;
+
+} info_job_t;
+
+static int info_push(info_handle_t* h, char* path)
+{
+  /* path is owned by the stack */
+
+  char** dirs;
+  int err = 0;
+
+  pthread_mutex_lock(&h->lock);
+
+  if (h->ndir == h->maxdir)
+  {
+    const size_t max = h->maxdir ? h->maxdir * 2 : 1024;
+    dirs = realloc(h->dirs, max * sizeof(char*));
+    if (dirs == NULL)
+    {
+      err = -1;
+      goto on_error;
+    }
+    h->dirs = dirs;
+    h->maxdir = max;
+  }
+
+  h->dirs[h->ndir++] = path;
+  pthread_cond_signal(&h->cond);
+
+ on_error:
+  pthread_mutex_unlock(&h->lock);
+  if (err) free(path);
+  return err;
+}
+
+static char* info_pop(info_handle_t* h)
+{
+  /* NULL once the stack is empty and no thread can fill it again */
+
+  char* path = NULL;
+
+  pthread_mutex_lock(&h->lock);
+
+  while ((h->ndir == 0) && (h->is_done == 0))
+  {
+    if (++h->nwait == h->nthread)
+    {
+      h->is_done = 1;
+      pthread_cond_broadcast(&h->cond);
+      break ;
+    }
+
+    pthread_cond_wait(&h->cond, &h->lock);
+    --h->nwait;
+  }
+
+  if (h->ndir) path = h->dirs[--h->ndir];
+
+  pthread_mutex_unlock(&h->lock);
+
+  return path;
+}
+
+static void info_flush(info_job_t* job)
+{
+  info_handle_t* const h = job->h;
+  const char* buf = job->buf;
+  size_t size = job->size;
+
+  if (size == 0) return ;
+
+  pthread_mutex_lock(&h->olock);
+
+  /* json records are each preceded by a separator */
+  if ((h->cmd->flags & CMD_FLAG_JSON) && h->is_first)
+  {
+    buf += 1;
+    size -= 1;
+  }
+
+  h->is_first = 0;
+  fwrite(buf, 1, size, stdout);
+
+  pthread_mutex_unlock(&h->olock);
+
+  job->size = 0;
+}
+
+static size_t info_put_str
+(char* buf, const char* s, unsigned int is_json)
+{
+  /* quoted and escaped path, return the size written */
+
+  size_t n = 0;
+
+  buf[n++] = '"';
+
+  for (; *s; ++s)
+  {
+    if (is_json)
+    {
+      if ((*s == '"') || (*s == '\\')) buf[n++] = '\\';
+      else if ((unsigned char)*s < 0x20)
+      {
+	n += (size_t)sprintf(buf + n, "\\u%04x", (unsigned int)*s);
+	continue ;
+      }
+    }
+    else if (*s == '"')
+    {
+      buf[n++] = '"';
+    }
+
+    buf[n++] = *s;
+  }
+
+  buf[n++] = '"';
+
+  return n;
+}
+
+static const char* info_get_format(uint16_t format, char* tmp)
+{
+  switch (format)
+  {
+  case WAV_FORMAT_PCM: return "pcm";
+  case WAV_FORMAT_FLOAT: return "float";
+  case WAV_FORMAT_ALAW: return "alaw";
+  case WAV_FORMAT_MULAW: return "mulaw";
+  default: break ;
+  }
+
+  sprintf(tmp, "0x%04x", (unsigned int)format);
+  return tmp;
+}
+
+static void info_emit
+(
+ info_job_t* job,
+ const char* dir, const char* name,
+ const wav_info_t* info, uint64_t size, int64_t mtime
+)
+{
+  /* info is NULL if the file could not be probed */
+
+  const unsigned int is_json = (job->h->cmd->flags & CMD_FLAG_JSON) ? 1 : 0;
+  char path[PATH_MAX];
+  char tmp[8];
+  const char* format = "invalid";
+  double secs = 0.0;
+  char* p;
+
+  if (dir != NULL) snprintf(path, sizeof(path), "%s/%s", dir, name);
+  else snprintf(path, sizeof(path), "%s", name);
+
+  if ((job->size + INFO_MAX_RECORD) > INFO_BUF_SIZE) info_flush(job);
+  p = job->buf + job->size;
+
+  if (info != NULL)
+  {
+    format = info_get_format(info->format, tmp);
+    if (info->fsampl) secs = (double)info->nsampl / (double)info->fsampl;
+  }
+
+  if (is_json)
+  {
+    p += sprintf(p, ",\n{\"path\":");
+    p += info_put_str(p, path, 1);
+    p += sprintf(p, ",\"format\":\"%s\"", format);
+
+    if (info != NULL)
+    {
+      p += sprintf
+      (
+       p, ",\"nchan\":%zu,\"bits\":%zu,\"fsampl\":%u,"
+       "\"nsampl\":%llu,\"duration\":%.6f",
+       info->nchan, info->wsampl * 8, info->fsampl,
+       (unsigned long long)info->nsampl, secs
+      );
+    }
+
+    p += sprintf
+    (
+     p, ",\"size\":%llu,\"mtime\":%lld}",
+     (unsigned long long)size, (long long)mtime
+    );
+  }
+  else
+  {
+    p += info_put_str(p, path, 0);
+
+    if (info != NULL)
+    {
+      p += sprintf
+      (
+       p, ",%s,%zu,%zu,%u,%llu,%.6f",
+       format, info->nchan, info->wsampl * 8, info->fsampl,
+       (unsigned long long)info->nsampl, secs
+      );
+    }
+    else
+    {
+      p += sprintf(p, ",%s,,,,,", format);
+    }
+
+    p += sprintf
+    (
+     p, ",%llu,%lld\n",
+     (unsigned long long)size, (long long)mtime
+    );
+  }
+
+  job->size = (size_t)(p - job->buf);
+}
+
+static void info_file
+(info_job_t* job, int dirfd, const char* dir, const char* name)
+{
+  /* the type is checked here, entries may not report it */
+
+  static const unsigned int mask = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+  static const int flags = AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC;
+  struct statx st;
+  wav_info_t info;
+  int err = -1;
+  int fd;
+
+  if (statx(dirfd, name, flags, mask, &st)) return ;
+  if (S_ISREG(st.stx_mode) == 0) return ;
+
+  fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd != -1)
+  {
+    err = wav_probe(&info, fd, st.stx_size);
+    close(fd);
+  }
+
+  ++job->nfile;
+  if (err) ++job->nerr;
+
+  info_emit
+  (
+   job, dir, name, err ? NULL : &info,
+   st.stx_size, (int64_t)st.stx_mtime.tv_sec
+  );
+}
+
+static void info_dir(info_job_t* job, const char* path)
+{
+  struct dirent* de;
+  struct statx st;
+  char* sub;
+  size_t len;
+  DIR* dir;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) return ;
+
+  dir = fdopendir(fd);
+  if (dir == NULL)
+  {
+    close(fd);
+    return ;
+  }
+
+  ++job->nscan;
+
+  while ((de = readdir(dir)) != NULL)
+  {
+    unsigned int type = de->d_type;
+
+    if (strcmp(de->d_name, ".") == 0) continue ;
+    if (strcmp(de->d_name, "..") == 0) continue ;
+
+    if (type == DT_UNKNOWN)
+    {
+      if (statx(fd, de->d_name, AT_SYMLINK_NOFOLLOW, STATX_TYPE, &st))
+	continue ;
+      if (S_ISDIR(st.stx_mode)) type = DT_DIR;
+    }
+
+    len = strlen(de->d_name);
+
+    if (type == DT_DIR)
+    {
+      /* symlinks are not followed, there can be no cycle */
+      sub = malloc(strlen(path) + 1 + len + 1);
+      if (sub == NULL) continue ;
+      sprintf(sub, "%s/%s", path, de->d_name);
+      info_push(job->h, sub);
+      continue ;
+    }
+
+    if ((len < 4) || strcasecmp(de->d_name + len - 4, ".wav")) continue ;
+
+    info_file(job, fd, path, de->d_name);
+  }
+
+  closedir(dir);
+}
+
+static void* info_main(void* arg)
+{
+  info_job_t* const job = arg;
+  char* path;
+
+  while ((path = info_pop(job->h)) != NULL)
+  {
+    info_dir(job, path);
+    free(path);
+  }
+
+  info_flush(job);
+
+  return NULL;
+}
+
+static int main_info(const cmd_handle_t* cmd)
+{
+  info_handle_t h;
+  info_job_t* jobs;
+  struct stat st;
+  double t;
+  size_t nthread;
+  size_t i;
+  char* path;
+  int err = -1;
+
+  h.cmd = cmd;
+  h.dirs = NULL;
+  h.ndir = 0;
+  h.maxdir = 0;
+  h.nwait = 0;
+  h.nthread = cmd->njob;
+  h.is_done = 0;
+  h.is_first = 1;
+  h.nfile = 0;
+  h.nerr = 0;
+  h.nscan = 0;
+
+  pthread_mutex_init(&h.lock, NULL);
+  pthread_cond_init(&h.cond, NULL);
+  pthread_mutex_init(&h.olock, NULL);
+
+  jobs = malloc(cmd->njob * sizeof(info_job_t));
+  if (jobs == NULL) goto on_error_0;
+
+  for (i = 0; i != cmd->njob; ++i)
+  {
+    jobs[i].h = &h;
+    jobs[i].size = 0;
+    jobs[i].nfile = 0;
+    jobs[i].nerr = 0;
+    jobs[i].nscan = 0;
+    jobs[i].buf = malloc(INFO_BUF_SIZE);
+    if (jobs[i].buf == NULL) goto on_error_1;
+  }
+
+  t = util_get_time();
+
+  if (cmd->flags & CMD_FLAG_JSON) printf("[");
+  else printf("path,format,nchan,bits,fsampl,nsampl,duration,size,mtime\n");
+
+  /* files given as such are taken whatever their name */
+
+  for (i = 0; i != cmd->nipath; ++i)
+  {
+    if (stat(cmd->ipaths[i], &st)) continue ;
+
+    if (S_ISDIR(st.st_mode))
+    {
+      path = strdup(cmd->ipaths[i]);
+      if (path != NULL) info_push(&h, path);
+    }
+    else
+    {
+      info_file(&jobs[0], AT_FDCWD, NULL, cmd->ipaths[i]);
+    }
+  }
+
+  info_flush(&jobs[0]);
+
+  for (nthread = 1; nthread != cmd->njob; ++nthread)
+  {
+    info_job_t* const job = &jobs[nthread];
+    if (pthread_create(&job->thread, NULL, info_main, job)) break ;
+  }
+
+  /* threads that could not be created must not be waited for */
+  pthread_mutex_lock(&h.lock);
+  h.nthread = nthread;
+  pthread_mutex_unlock(&h.lock);
+
+  info_main(&jobs[0]);
+
+  for (i = 1; i != nthread; ++i) pthread_join(jobs[i].thread, NULL);
+
+  if (cmd->flags & CMD_FLAG_JSON) printf("\n]\n");
+  fflush(stdout);
+
+  for (i = 0; i != nthread; ++i)
+  {
+    h.nfile += jobs[i].nfile;
+    h.nerr += jobs[i].nerr;
+    h.nscan += jobs[i].nscan;
+  }
+
+  fprintf
+  (
+   stderr, "%zu files, %zu invalid, %zu directories in %.3f s\n",
+   h.nfile, h.nerr, h.nscan, util_get_time() - t
+  );
+
+  err = 0;
+
+  i = cmd->njob;
+ on_error_1:
+  while (i--) free(jobs[i].buf);
+  free(jobs);
+ on_error_0:
+  free(h.dirs);
+  pthread_cond_destroy(&h.cond);
+  pthread_mutex_destroy(&h.lock);
+  pthread_mutex_destroy(&h.olock);
+  return err;
+}
+
+
+/* check */
+
+/* headers of recordings around the 4 GiB limit of the riff sizes. a */
+/* sparse file of each size is written at -opath with the header main */
+/* patches in, and must probe and open back to its whole data. */
+
+static int check_open(const char* path, size_t nsampl)
+{
+  wav_handle_t w;
+  int err = -1;
+
+  if (wav_open(&w, path)) return -1;
+  if (w.nsampl == nsampl) err = 0;
+  wav_close(&w);
+
+  return err;
+}
+
+static int check_patch(const char* path, size_t nchan, size_t wsampl)
+{
+  /* a recording patched in progress: the file holds whole blocks, */
+  /* the header whole frames, and the bytes past them are ignored */
+
+  const uint64_t size = (uint64_t)3 << 20;
+  wav_handle_t w;
+  uint8_t h[WAV_HEADER_SIZE];
+  int err = -1;
+  int fd;
+
+  w.flags = 0;
+  w.nchan = nchan;
+  w.wsampl = wsampl;
+  w.fsampl = 48000;
+  w.nsampl = (size_t)((size - WAV_HEADER_SIZE) / (nchan * wsampl));
+
+  wav_get_header(&w, h);
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 00644);
+  if (fd == -1) goto on_error_0;
+
+  if (pwrite(fd, h, sizeof(h), 0) != (ssize_t)sizeof(h)) goto on_error_1;
+  if (ftruncate(fd, (off_t)size)) goto on_error_1;
+
+  if (check_open(path, w.nsampl)) goto on_error_1;
+
+  err = 0;
+
+ on_error_1:
+  close(fd);
+  unlink(path);
+ on_error_0:
+  printf("patched %zux%zu: %s\n", nchan, wsampl, err ? "error" : "ok");
+  return err;
+}
+
+static int check_one(const char* path, uint64_t size)
+{
+  wav_handle_t w;
+  wav_info_t info;
+  uint8_t h[WAV_HEADER_SIZE];
+  uint32_t riff_size;
+  uint32_t data_size;
+  int err = -1;
+  int fd;
+
+  w.flags = 0;
+  w.nchan = 2;
+  w.wsampl = 2;
+  w.fsampl = 48000;
+  w.nsampl = (size_t)(size / (w.nchan * w.wsampl));
+  size = (uint64_t)w.nsampl * w.nchan * w.wsampl;
+
+  wav_get_header(&w, h);
+
+  /* exact below the limit, maximum past it */
+  memcpy(&riff_size, h + 4, sizeof(uint32_t));
+  memcpy(&data_size, h + 40, sizeof(uint32_t));
+  if ((size + WAV_HEADER_SIZE - 8) <= 0xffffffff)
+  {
+    if (data_size != size) goto on_error_0;
+    if (riff_size != (size + WAV_HEADER_SIZE - 8)) goto on_error_0;
+  }
+  else
+  {
+    if ((data_size != 0xffffffff) || (riff_size != 0xffffffff))
+      goto on_error_0;
+  }
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 00644);
+  if (fd == -1) goto on_error_0;
+
+  if (pwrite(fd, h, sizeof(h), 0) != (ssize_t)sizeof(h)) goto on_error_1;
+  if (ftruncate(fd, (off_t)(WAV_HEADER_SIZE + size))) goto on_error_1;
+
+  if (wav_probe(&info, fd, WAV_HEADER_SIZE + size)) goto on_error_1;
+  if ((info.data_off != WAV_HEADER_SIZE) || (info.data_size != size))
+    goto on_error_1;
+
+  if (check_open(path, w.nsampl)) goto on_error_1;
+
+  err = 0;
+
+ on_error_1:
+  close(fd);
+  unlink(path);
+ on_error_0:
+  printf("%llu: %s\n", (unsigned long long)size, err ? "error" : "ok");
+  return err;
+}
+
+static int main_check(const cmd_handle_t* cmd)
+{
+  static const uint64_t sizes[] =
+  {
+    0xffffffffULL - WAV_HEADER_SIZE - 3,
+    0xffffffffULL - WAV_HEADER_SIZE + 8 + 4,
+    0x100000000ULL,
+    0x180000000ULL
+  };
+
+  size_t i;
+  int err = 0;
+
+  if ((cmd->flags & CMD_FLAG_OPATH) == 0) return -1;
+
+  for (i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i)
+    err |= check_one(cmd->opath, sizes[i]);
+
+  err |= check_patch(cmd->opath, 2, 3);
+  err |= check_patch(cmd->opath, 2, 4);
+  err |= check_patch(cmd->opath, 3, 2);
+
+  return err;
+}
+
+
 /* main */
 
 int main(int ac, char** av)
@@ -91,6 +744,18 @@ int main(int ac, char** av)
     goto on_error_0;
   }
 
+  if (cmd.flags & CMD_FLAG_INFO)
+  {
+    err = main_info(&cmd);
+    goto on_error_0;
+  }
+
+  if (cmd.flags & CMD_FLAG_CHECK)
+  {
+    err = main_check(&cmd);
+    goto on_error_0;
+  }
+
   if ((cmd.flags & CMD_FLAG_IPATH) == 0)
   {
     PERROR();
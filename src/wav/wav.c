@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include "wav.h"
@@ -61,11 +62,19 @@ static int wav_check_header(const struct wav_header* h, size_t file_size)
 
   if (MEMCMP(h->data_magic, WAV_DATA_MAGIC)) return -1;
 
-  /* sizes */
+  /* sizes. null or maximum ones are those of a stream or of a file */
+  /* past 4 GiB. bytes past them are ignored: a recording patched */
+  /* while in progress holds whole frames, the file whole blocks. */
 
-  if ((file_size - 8) != h->file_size) return -1;
+  if ((h->file_size != 0) && (h->file_size != 0xffffffff))
+  {
+    if ((file_size - 8) < h->file_size) return -1;
+  }
 
-  if ((file_size - sizeof(wav_header_t)) < h->data_size) return -1;
+  if ((h->data_size != 0) && (h->data_size != 0xffffffff))
+  {
+    if ((file_size - sizeof(wav_header_t)) < h->data_size) return -1;
+  }
 
   return 0;
 }
@@ -84,6 +93,7 @@ int wav_open(wav_handle_t* w, const char* path)
   int err = -1;
   struct stat st;
   const wav_header_t* h;
+  size_t data_size;
 
   w->flags = 0;
 
@@ -108,7 +118,12 @@ int wav_open(wav_handle_t* w, const char* path)
   w->nchan = (size_t)h->channels;
   if ((h->bits_per_sample % 8)) goto on_error_2;
   w->wsampl = (size_t)h->bits_per_sample / 8;
-  w->nsampl = (size_t)(h->data_size / (w->wsampl * w->nchan));
+
+  /* null or maximum: the data goes up to the end of file */
+  data_size = (size_t)h->data_size;
+  if ((h->data_size == 0) || (h->data_size == 0xffffffff))
+    data_size = w->size - sizeof(wav_header_t);
+  w->nsampl = data_size / (w->wsampl * w->nchan);
 
   w->fsampl = (unsigned int)h->freq;
 
@@ -168,18 +183,17 @@ int wav_copy(wav_handle_t* ow, const wav_handle_t* iw)
 }
 
 
-int wav_write(wav_handle_t* w, const char* path)
+static void wav_fill_header
+(wav_header_t* h, const wav_handle_t* w, size_t data_size)
 {
-  wav_header_t* const h = (wav_header_t*)w->data;
-  int err = -1;
-  int fd;
-
-  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 00755);
-  if (fd == -1) goto on_error_0;
+  /* sizes past 4 GiB do not fit: both are then the maximum, as for */
+  /* a stream, and readers take the data up to the end of file */
+  uint64_t file_size = (uint64_t)data_size + sizeof(wav_header_t) - 8;
+  if (file_size > 0xffffffff) file_size = data_size = 0xffffffff;
 
 #define MEMCPY(A, B) memcpy(A, B, sizeof(B) - 1)
   MEMCPY(h->riff_magic, WAV_RIFF_MAGIC);
-  h->file_size = w->size - 8;
+  h->file_size = (uint32_t)file_size;
 
   MEMCPY(h->wave_magic, WAV_WAVE_MAGIC);
 
@@ -193,9 +207,31 @@ int wav_write(wav_handle_t* w, const char* path)
   h->bits_per_sample = (uint16_t)(w->wsampl * 8);
 
   MEMCPY(h->data_magic, WAV_DATA_MAGIC);
-  h->data_size = w->size - sizeof(wav_header_t);
+  h->data_size = (uint32_t)data_size;
+}
+
+
+int wav_write(wav_handle_t* w, const char* path)
+{
+  wav_header_t* const h = (wav_header_t*)w->data;
+  size_t n = 0;
+  ssize_t r;
+  int err = -1;
+  int fd;
 
-  if ((size_t)write(fd, w->data, w->size) != w->size) goto on_error_1;
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 00755);
+  if (fd == -1) goto on_error_0;
+
+  wav_fill_header(h, w, w->size - sizeof(wav_header_t));
+
+  /* a single write stops short of 2 GiB */
+  while (n != w->size)
+  {
+    r = write(fd, (const uint8_t*)w->data + n, w->size - n);
+    if (r > 0) n += (size_t)r;
+    else if ((r == -1) && (errno == EINTR)) continue ;
+    else goto on_error_1;
+  }
 
   err = 0;
 
@@ -210,3 +246,280 @@ void* wav_get_sampl_buf(wav_handle_t* w)
 {
   return w->data + sizeof(wav_header_t);
 }
+
+
+/* stream headers */
+
+/* pipes cannot be mapped nor seeked: the header is read as it comes, */
+/* unknown chunks being skipped up to the data one, and written with */
+/* the maximum sizes if the length is not known yet. */
+
+size_t wav_read_full(int fd, void* buf, size_t size)
+{
+  /* return the count read, less than size on end of file or error */
+
+  size_t n = 0;
+  ssize_t r;
+
+  while (n != size)
+  {
+    r = read(fd, (uint8_t*)buf + n, size - n);
+    if (r > 0) n += (size_t)r;
+    else if ((r == -1) && (errno == EINTR)) continue ;
+    else break ;
+  }
+
+  return n;
+}
+
+
+static int skip_full(int fd, size_t size)
+{
+  uint8_t buf[256];
+  size_t n;
+
+  while (size)
+  {
+    n = size < sizeof(buf) ? size : sizeof(buf);
+    if (wav_read_full(fd, buf, n) != n) return -1;
+    size -= n;
+  }
+
+  return 0;
+}
+
+
+int wav_read_header(wav_handle_t* w, int fd)
+{
+  /* on success, fd is at the first sample. the handle holds no data. */
+
+  uint8_t riff[12];
+  uint8_t chunk[8];
+  uint8_t fmt[40];
+  uint32_t size;
+  uint16_t format;
+  uint16_t nchan;
+  uint16_t bits;
+  unsigned int has_fmt = 0;
+
+  w->flags = 0;
+  w->data = NULL;
+  w->size = 0;
+
+  if (wav_read_full(fd, riff, sizeof(riff)) != sizeof(riff)) return -1;
+  if (MEMCMP(riff + 0, WAV_RIFF_MAGIC)) return -1;
+  if (MEMCMP(riff + 8, WAV_WAVE_MAGIC)) return -1;
+
+  while (1)
+  {
+    if (wav_read_full(fd, chunk, sizeof(chunk)) != sizeof(chunk)) return -1;
+    memcpy(&size, chunk + 4, sizeof(uint32_t));
+
+    if (MEMCMP(chunk, WAV_DATA_MAGIC) == 0) break ;
+
+    if (MEMCMP(chunk, WAV_FORMAT_MAGIC) == 0)
+    {
+      if ((size < 16) || (size > sizeof(fmt))) return -1;
+      if (wav_read_full(fd, fmt, size) != size) return -1;
+      if ((size & 1) && skip_full(fd, 1)) return -1;
+
+      memcpy(&format, fmt + 0, sizeof(uint16_t));
+      if (format == WAV_FORMAT_EXTENSIBLE)
+      {
+	/* the sub format guid starts with the format tag */
+	if (size < 26) return -1;
+	memcpy(&format, fmt + 24, sizeof(uint16_t));
+      }
+      if (format != WAV_PCM_FORMAT) return -1;
+
+      memcpy(&nchan, fmt + 2, sizeof(uint16_t));
+      memcpy(&w->fsampl, fmt + 4, sizeof(uint32_t));
+      memcpy(&bits, fmt + 14, sizeof(uint16_t));
+      if ((nchan == 0) || (bits == 0) || (bits % 8)) return -1;
+      w->nchan = (size_t)nchan;
+      w->wsampl = (size_t)bits / 8;
+
+      has_fmt = 1;
+      continue ;
+    }
+
+    /* chunks are word aligned */
+    if (skip_full(fd, (size_t)size + (size & 1))) return -1;
+  }
+
+  if (has_fmt == 0) return -1;
+
+  /* writers that cannot seek leave the data size null or maximum */
+  if ((size == 0) || (size == 0xffffffff)) w->nsampl = WAV_NSAMPL_STREAM;
+  else w->nsampl = (size_t)size / (w->nchan * w->wsampl);
+
+  return 0;
+}
+
+
+size_t wav_get_header(const wav_handle_t* w, void* buf)
+{
+  /* fill buf with the header, return its size. WAV_NSAMPL_STREAM gives */
+  /* the maximum sizes. */
+
+  wav_header_t h;
+  size_t size;
+
+  size = 0xffffffff - sizeof(wav_header_t);
+  if (w->nsampl != WAV_NSAMPL_STREAM)
+    size = w->nsampl * w->nchan * w->wsampl;
+
+  wav_fill_header(&h, w, size);
+  memcpy(buf, &h, sizeof(h));
+
+  return sizeof(h);
+}
+
+
+int wav_write_header(const wav_handle_t* w, int fd)
+{
+  /* write at the current position. a seekable fd can have it rewritten */
+  /* once the length known. */
+
+  wav_header_t h;
+  ssize_t r;
+
+  wav_get_header(w, &h);
+
+  do r = write(fd, &h, sizeof(h));
+  while ((r == -1) && (errno == EINTR));
+
+  if (r != (ssize_t)sizeof(h)) return -1;
+
+  return 0;
+}
+
+
+/* probe */
+
+/* catalogs only need the format: the chunks are walked by pread, from */
+/* a first block that usually holds them all up to the data one. the */
+/* samples are never read, and any format tag is reported. */
+
+#define WAV_PROBE_SIZE 4096
+
+static int probe_read
+(
+ int fd, const uint8_t* buf, size_t nbuf,
+ void* p, size_t size, uint64_t off
+)
+{
+  /* size bytes at off, from buf if it holds them */
+
+  ssize_t r;
+
+  if ((off + size) <= nbuf)
+  {
+    memcpy(p, buf + off, size);
+    return 0;
+  }
+
+  do r = pread(fd, p, size, (off_t)off);
+  while ((r == -1) && (errno == EINTR));
+
+  return (r == (ssize_t)size) ? 0 : -1;
+}
+
+
+int wav_probe(wav_info_t* info, int fd, uint64_t file_size)
+{
+  /* file_size bounds the chunk walk and the data size */
+
+  uint8_t buf[WAV_PROBE_SIZE];
+  uint8_t chunk[8];
+  uint8_t fmt[40];
+  uint64_t off;
+  uint32_t size;
+  uint16_t nchan;
+  uint16_t bits;
+  uint16_t block = 0;
+  unsigned int has_fmt = 0;
+  unsigned int has_data = 0;
+  size_t nbuf;
+  ssize_t r;
+
+  nbuf = sizeof(buf);
+  if (file_size < nbuf) nbuf = (size_t)file_size;
+
+  do r = pread(fd, buf, nbuf, 0);
+  while ((r == -1) && (errno == EINTR));
+  if (r != (ssize_t)nbuf) return -1;
+
+  if (nbuf < 12) return -1;
+  if (MEMCMP(buf + 0, WAV_RIFF_MAGIC)) return -1;
+  if (MEMCMP(buf + 8, WAV_WAVE_MAGIC)) return -1;
+
+  /* the data chunk may come before the format one */
+
+  off = 12;
+
+  while ((has_fmt & has_data) == 0)
+  {
+    if ((off + 8) > file_size) return -1;
+    if (probe_read(fd, buf, nbuf, chunk, sizeof(chunk), off)) return -1;
+    memcpy(&size, chunk + 4, sizeof(uint32_t));
+
+    if (MEMCMP(chunk, WAV_DATA_MAGIC) == 0)
+    {
+      info->data_off = off + 8;
+      info->data_size = (uint64_t)size;
+
+      /* unknown or truncated length, up to the end of file */
+      if ((size == 0) || (size == 0xffffffff) ||
+	  ((info->data_off + size) > file_size))
+	info->data_size = file_size - info->data_off;
+
+      has_data = 1;
+
+      /* nothing can follow a data chunk of unknown length */
+      if ((size == 0) || (size == 0xffffffff)) break ;
+    }
+    else if (MEMCMP(chunk, WAV_FORMAT_MAGIC) == 0)
+    {
+      if (size < 16) return -1;
+      memset(fmt, 0, sizeof(fmt));
+      if (probe_read
+	  (fd, buf, nbuf, fmt, size < sizeof(fmt) ? size : sizeof(fmt), off + 8))
+	return -1;
+
+      memcpy(&info->format, fmt + 0, sizeof(uint16_t));
+      if ((info->format == WAV_FORMAT_EXTENSIBLE) && (size >= 26))
+	memcpy(&info->format, fmt + 24, sizeof(uint16_t));
+
+      memcpy(&nchan, fmt + 2, sizeof(uint16_t));
+      memcpy(&info->fsampl, fmt + 4, sizeof(uint32_t));
+      memcpy(&block, fmt + 12, sizeof(uint16_t));
+      memcpy(&bits, fmt + 14, sizeof(uint16_t));
+
+      info->nchan = (size_t)nchan;
+      info->wsampl = ((size_t)bits + 7) / 8;
+
+      has_fmt = 1;
+    }
+
+    off += 8 + (uint64_t)size + (size & 1);
+  }
+
+  if ((has_fmt & has_data) == 0) return -1;
+
+  info->nsampl = 0;
+  if (block == 0) block = (uint16_t)(info->nchan * info->wsampl);
+  if (block) info->nsampl = info->data_size / block;
+
+  return 0;
+}
+
+
+off_t wav_get_sampl_off(const wav_info_t* info, uint64_t i)
+{
+  /* file offset of the frame i, -1 past the end. i == nsampl is the end */
+  /* of the data, so that a reader positioned there reads nothing. */
+
+  if (i > info->nsampl) return (off_t)-1;
+  return (off_t)(info->data_off + i * info->nchan * info->wsampl);
+}
@@ -2,6 +2,7 @@
 #define WAV_H_INCLUDED
 
 
+#include <stdint.h>
 #include <sys/types.h>
 
 
@@ -16,11 +17,37 @@ typedef struct wav_handle
 
   unsigned int fsampl;
 
+  /* streams of unknown length */
+#define WAV_NSAMPL_STREAM ((size_t)-1)
+
+  /* size of the header written by wav_write and wav_get_header */
+#define WAV_HEADER_SIZE 44
+
   void* data;
   size_t size;
 
 } wav_handle_t;
 
+typedef struct wav_info
+{
+  /* format tag, the sub format one for extensible files */
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_FLOAT 0x0003
+#define WAV_FORMAT_ALAW 0x0006
+#define WAV_FORMAT_MULAW 0x0007
+#define WAV_FORMAT_EXTENSIBLE 0xfffe
+  uint16_t format;
+
+  size_t nchan;
+  size_t wsampl;
+  unsigned int fsampl;
+  uint64_t nsampl;
+
+  uint64_t data_off;
+  uint64_t data_size;
+
+} wav_info_t;
+
 
 int wav_open(wav_handle_t*, const char*);
 int wav_create(wav_handle_t*, size_t, size_t, size_t, unsigned int);
@@ -29,6 +56,12 @@ int wav_copy(wav_handle_t*, const wav_handle_t*);
 void wav_close(wav_handle_t*);
 int wav_write(wav_handle_t*, const char*);
 void* wav_get_sampl_buf(wav_handle_t*);
+size_t wav_read_full(int, void*, size_t);
+int wav_read_header(wav_handle_t*, int);
+int wav_write_header(const wav_handle_t*, int);
+size_t wav_get_header(const wav_handle_t*, void*);
+int wav_probe(wav_info_t*, int, uint64_t);
+off_t wav_get_sampl_off(const wav_info_t*, uint64_t);
 
 
 #endif /* ! WAV_H_INCLUDED */
@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <string.h>
+#include "wav.h"
+#include "wav_fmt.h"
+#include "simd.h"
+
+
+static const struct
+{
+  size_t width;
+  /* full scale, 0 for float */
+  double full;
+  const char* name;
+} wav_fmt_descs[WAV_FMT_COUNT] =
+{
+  { 2, 32768.0, "S16_LE" },
+  { 3, 8388608.0, "S24_3LE" },
+  { 4, 8388608.0, "S24_LE" },
+  { 4, 2147483648.0, "S32_LE" },
+  { 4, 0.0, "FLOAT_LE" }
+};
+
+
+unsigned int wav_fmt_find(unsigned int format, size_t wsampl)
+{
+  /* the format of samples of wsampl bytes tagged format in a wav */
+  /* file, WAV_FMT_COUNT if none */
+
+  if (format == WAV_FORMAT_PCM)
+  {
+    if (wsampl == 2) return WAV_FMT_S16;
+    if (wsampl == 3) return WAV_FMT_S24_3;
+    if (wsampl == 4) return WAV_FMT_S32;
+  }
+  else if (format == WAV_FORMAT_FLOAT)
+  {
+    if (wsampl == 4) return WAV_FMT_FLOAT;
+  }
+
+  return WAV_FMT_COUNT;
+}
+
+
+size_t wav_fmt_get_width(unsigned int fmt)
+{
+  return wav_fmt_descs[fmt].width;
+}
+
+
+const char* wav_fmt_get_name(unsigned int fmt)
+{
+  return wav_fmt_descs[fmt].name;
+}
+
+
+static double wav_fmt_get1(unsigned int fmt, const uint8_t* p)
+{
+  /* one sample, for the S24_3 format and vector tails */
+
+  const double full = wav_fmt_descs[fmt].full;
+  int16_t s16;
+  int32_t s32;
+  float f;
+
+  switch (fmt)
+  {
+  case WAV_FMT_S16:
+    memcpy(&s16, p, sizeof(s16));
+    return (double)s16 / full;
+
+  case WAV_FMT_S24_3:
+    s32 = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 |
+		    (uint32_t)p[2] << 24) >> 8;
+    return (double)s32 / full;
+
+  case WAV_FMT_S24:
+    memcpy(&s32, p, sizeof(s32));
+    s32 = (int32_t)((uint32_t)s32 << 8) >> 8;
+    return (double)s32 / full;
+
+  case WAV_FMT_S32:
+    memcpy(&s32, p, sizeof(s32));
+    return (double)s32 / full;
+
+  default:
+    memcpy(&f, p, sizeof(f));
+    return (double)f;
+  }
+}
+
+
+static void wav_fmt_put1(unsigned int fmt, uint8_t* p, double x)
+{
+  const double full = wav_fmt_descs[fmt].full;
+  int16_t s16;
+  int32_t s32;
+  float f;
+
+  if (fmt == WAV_FMT_FLOAT)
+  {
+    f = (float)x;
+    memcpy(p, &f, sizeof(f));
+    return ;
+  }
+
+  x *= full;
+  x += (x < 0.0) ? -0.5 : 0.5;
+  if (x < -full) x = -full;
+  else if (x > (full - 1.0)) x = full - 1.0;
+  s32 = (int32_t)x;
+
+  switch (fmt)
+  {
+  case WAV_FMT_S16:
+    s16 = (int16_t)s32;
+    memcpy(p, &s16, sizeof(s16));
+    break ;
+
+  case WAV_FMT_S24_3:
+    p[0] = (uint8_t)(s32 >> 0);
+    p[1] = (uint8_t)(s32 >> 8);
+    p[2] = (uint8_t)(s32 >> 16);
+    break ;
+
+  default:
+    memcpy(p, &s32, sizeof(s32));
+    break ;
+  }
+}
+
+
+/* kernels */
+
+#define KERN_NLANE WAV_FMT_NLANE
+#define KERN(__x) wav_fmt_ ## __x ## _base
+#include "wav_fmt_kern.h"
+#undef KERN
+#undef KERN_NLANE
+
+#if defined(__x86_64__)
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define KERN_NLANE 4
+#define KERN(__x) wav_fmt_ ## __x ## _avx2
+#include "wav_fmt_kern.h"
+#undef KERN
+#undef KERN_NLANE
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vl")
+#define KERN_NLANE 8
+#define KERN(__x) wav_fmt_ ## __x ## _avx512
+#include "wav_fmt_kern.h"
+#undef KERN
+#undef KERN_NLANE
+#pragma GCC pop_options
+
+#else
+
+#define wav_fmt_to_planar_avx2 wav_fmt_to_planar_base
+#define wav_fmt_from_planar_avx2 wav_fmt_from_planar_base
+#define wav_fmt_to_planar_avx512 wav_fmt_to_planar_base
+#define wav_fmt_from_planar_avx512 wav_fmt_from_planar_base
+
+#endif
+
+
+void wav_fmt_to_planar
+(
+ unsigned int fmt,
+ double* dst, size_t dist,
+ const void* src, size_t nchan, size_t n
+)
+{
+  static void (*const fns[SIMD_LEVEL_COUNT])
+    (unsigned int, double*, size_t, const void*, size_t, size_t) =
+  {
+    wav_fmt_to_planar_base, wav_fmt_to_planar_avx2, wav_fmt_to_planar_avx512
+  };
+
+  fns[simd_get_level()](fmt, dst, dist, src, nchan, n);
+}
+
+
+void wav_fmt_from_planar
+(
+ unsigned int fmt,
+ void* dst,
+ const double* src, size_t dist, size_t nchan, size_t n
+)
+{
+  static void (*const fns[SIMD_LEVEL_COUNT])
+    (unsigned int, void*, const double*, size_t, size_t, size_t) =
+  {
+    wav_fmt_from_planar_base,
+    wav_fmt_from_planar_avx2,
+    wav_fmt_from_planar_avx512
+  };
+
+  fns[simd_get_level()](fmt, dst, src, dist, nchan, n);
+}
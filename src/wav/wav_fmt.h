@@ -0,0 +1,39 @@
+#ifndef WAV_FMT_H_INCLUDED
+#define WAV_FMT_H_INCLUDED
+
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* conversions between interleaved samples, in the formats devices and */
+/* files use natively, and planar doubles in [-1, 1] for processing. */
+/* a block of frames is converted in place as contiguous vectors, then */
+/* transposed while still in cache. the kernels are built for each */
+/* simd level, WAV_FMT_NLANE being the lanes of the base one. */
+
+/* little endian, S24 is the low 3 bytes of 4 */
+#define WAV_FMT_S16 0
+#define WAV_FMT_S24_3 1
+#define WAV_FMT_S24 2
+#define WAV_FMT_S32 3
+#define WAV_FMT_FLOAT 4
+#define WAV_FMT_COUNT 5
+
+#define WAV_FMT_NLANE 2
+typedef double wav_fmt_vec_t __attribute__((vector_size(WAV_FMT_NLANE * 8)));
+
+/* samples per transposed block, bounds the channel count */
+#define WAV_FMT_NTILE 2048
+
+
+unsigned int wav_fmt_find(unsigned int, size_t);
+size_t wav_fmt_get_width(unsigned int);
+const char* wav_fmt_get_name(unsigned int);
+void wav_fmt_to_planar
+(unsigned int, double*, size_t, const void*, size_t, size_t);
+void wav_fmt_from_planar
+(unsigned int, void*, const double*, size_t, size_t, size_t);
+
+
+#endif /* ! WAV_FMT_H_INCLUDED */
@@ -0,0 +1,229 @@
+/* the vector kernels of wav_fmt.c, included once per instruction set */
+/* with KERN_NLANE doubles per vector and KERN(x) naming x for it. */
+/* not a header: no guard, and nothing outside wav_fmt.c includes it. */
+
+typedef double KERN(vec_t) __attribute__((vector_size(KERN_NLANE * 8)));
+typedef int16_t KERN(s16v_t) __attribute__((vector_size(KERN_NLANE * 2)));
+typedef int32_t KERN(s32v_t) __attribute__((vector_size(KERN_NLANE * 4)));
+typedef float KERN(fv_t) __attribute__((vector_size(KERN_NLANE * 4)));
+
+/* lane masks, as produced by vector comparisons */
+typedef int64_t KERN(mask_t) __attribute__((vector_size(KERN_NLANE * 8)));
+
+
+static KERN(vec_t) KERN(splat)(double x)
+{
+  KERN(vec_t) v;
+  size_t i;
+  for (i = 0; i != KERN_NLANE; ++i) v[i] = x;
+  return v;
+}
+
+
+static KERN(vec_t) KERN(clamp)
+(KERN(vec_t) x, KERN(vec_t) lo, KERN(vec_t) hi)
+{
+  KERN(mask_t) m;
+
+  m = x < lo;
+  x = (KERN(vec_t))(((KERN(mask_t))lo & m) | ((KERN(mask_t))x & ~m));
+  m = x > hi;
+  x = (KERN(vec_t))(((KERN(mask_t))hi & m) | ((KERN(mask_t))x & ~m));
+
+  return x;
+}
+
+
+static KERN(vec_t) KERN(round)(KERN(vec_t) x)
+{
+  /* half away from zero, before the conversion truncates */
+
+  const KERN(mask_t) sign = (KERN(mask_t))KERN(splat)(-0.0);
+  const KERN(mask_t) half = (KERN(mask_t))KERN(splat)(0.5);
+
+  return x + (KERN(vec_t))(((KERN(mask_t))x & sign) | half);
+}
+
+
+static void KERN(to_double)
+(unsigned int fmt, double* dst, const uint8_t* src, size_t n)
+{
+  /* n contiguous samples */
+
+  const size_t width = wav_fmt_descs[fmt].width;
+  const KERN(vec_t) k = KERN(splat)
+    (fmt == WAV_FMT_FLOAT ? 1.0 : 1.0 / wav_fmt_descs[fmt].full);
+  KERN(s16v_t) a16;
+  KERN(s32v_t) a32;
+  KERN(fv_t) af;
+  KERN(vec_t) v;
+  size_t i = 0;
+
+  switch (fmt)
+  {
+  case WAV_FMT_S16:
+    for (; (i + KERN_NLANE) <= n; i += KERN_NLANE)
+    {
+      memcpy(&a16, src + i * width, sizeof(a16));
+      v = __builtin_convertvector(a16, KERN(vec_t)) * k;
+      memcpy(dst + i, &v, sizeof(v));
+    }
+    break ;
+
+  case WAV_FMT_S24:
+  case WAV_FMT_S32:
+    for (; (i + KERN_NLANE) <= n; i += KERN_NLANE)
+    {
+      memcpy(&a32, src + i * width, sizeof(a32));
+      /* sign extend the low 3 bytes */
+      if (fmt == WAV_FMT_S24) a32 = (KERN(s32v_t))((a32 << 8) >> 8);
+      v = __builtin_convertvector(a32, KERN(vec_t)) * k;
+      memcpy(dst + i, &v, sizeof(v));
+    }
+    break ;
+
+  case WAV_FMT_FLOAT:
+    for (; (i + KERN_NLANE) <= n; i += KERN_NLANE)
+    {
+      memcpy(&af, src + i * width, sizeof(af));
+      v = __builtin_convertvector(af, KERN(vec_t));
+      memcpy(dst + i, &v, sizeof(v));
+    }
+    break ;
+
+  default: break ;
+  }
+
+  for (; i != n; ++i) dst[i] = wav_fmt_get1(fmt, src + i * width);
+}
+
+
+static void KERN(from_double)
+(unsigned int fmt, uint8_t* dst, const double* src, size_t n)
+{
+  const size_t width = wav_fmt_descs[fmt].width;
+  const double full = wav_fmt_descs[fmt].full;
+  const KERN(vec_t) k = KERN(splat)(full);
+  const KERN(vec_t) lo = KERN(splat)(-full);
+  const KERN(vec_t) hi = KERN(splat)(full - 1.0);
+  KERN(s16v_t) a16;
+  KERN(s32v_t) a32;
+  KERN(fv_t) af;
+  KERN(vec_t) v;
+  size_t i = 0;
+
+  switch (fmt)
+  {
+  case WAV_FMT_S16:
+    for (; (i + KERN_NLANE) <= n; i += KERN_NLANE)
+    {
+      memcpy(&v, src + i, sizeof(v));
+      v = KERN(clamp)(KERN(round)(v * k), lo, hi);
+      a16 = __builtin_convertvector(v, KERN(s16v_t));
+      memcpy(dst + i * width, &a16, sizeof(a16));
+    }
+    break ;
+
+  case WAV_FMT_S24:
+  case WAV_FMT_S32:
+    for (; (i + KERN_NLANE) <= n; i += KERN_NLANE)
+    {
+      memcpy(&v, src + i, sizeof(v));
+      v = KERN(clamp)(KERN(round)(v * k), lo, hi);
+      a32 = __builtin_convertvector(v, KERN(s32v_t));
+      memcpy(dst + i * width, &a32, sizeof(a32));
+    }
+    break ;
+
+  case WAV_FMT_FLOAT:
+    for (; (i + KERN_NLANE) <= n; i += KERN_NLANE)
+    {
+      memcpy(&v, src + i, sizeof(v));
+      af = __builtin_convertvector(v, KERN(fv_t));
+      memcpy(dst + i * width, &af, sizeof(af));
+    }
+    break ;
+
+  default: break ;
+  }
+
+  for (; i != n; ++i) wav_fmt_put1(fmt, dst + i * width, src[i]);
+}
+
+
+static void KERN(to_planar)
+(
+ unsigned int fmt,
+ double* dst, size_t dist,
+ const void* src, size_t nchan, size_t n
+)
+{
+  /* n interleaved frames of src to nchan rows of dst, dist apart */
+
+  const size_t fsize = nchan * wav_fmt_descs[fmt].width;
+  const size_t nblock = WAV_FMT_NTILE / nchan;
+  double tile[WAV_FMT_NTILE];
+  size_t i;
+  size_t j;
+  size_t k;
+  size_t c;
+
+  if (nchan == 1)
+  {
+    KERN(to_double)(fmt, dst, src, n);
+    return ;
+  }
+
+  for (i = 0; i != n; i += k)
+  {
+    k = n - i;
+    if (k > nblock) k = nblock;
+
+    KERN(to_double)(fmt, tile, (const uint8_t*)src + i * fsize, k * nchan);
+
+    for (c = 0; c != nchan; ++c)
+    {
+      double* const row = dst + c * dist + i;
+      for (j = 0; j != k; ++j) row[j] = tile[j * nchan + c];
+    }
+  }
+}
+
+
+static void KERN(from_planar)
+(
+ unsigned int fmt,
+ void* dst,
+ const double* src, size_t dist, size_t nchan, size_t n
+)
+{
+  /* nchan rows of n frames, dist apart, to interleaved frames */
+
+  const size_t fsize = nchan * wav_fmt_descs[fmt].width;
+  const size_t nblock = WAV_FMT_NTILE / nchan;
+  double tile[WAV_FMT_NTILE];
+  size_t i;
+  size_t j;
+  size_t k;
+  size_t c;
+
+  if (nchan == 1)
+  {
+    KERN(from_double)(fmt, dst, src, n);
+    return ;
+  }
+
+  for (i = 0; i != n; i += k)
+  {
+    k = n - i;
+    if (k > nblock) k = nblock;
+
+    for (c = 0; c != nchan; ++c)
+    {
+      const double* const row = src + c * dist + i;
+      for (j = 0; j != k; ++j) tile[j * nchan + c] = row[j];
+    }
+
+    KERN(from_double)(fmt, (uint8_t*)dst + i * fsize, tile, k * nchan);
+  }
+}
@@ -0,0 +1,472 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include "wav_io.h"
+
+/* no liburing, the ring is driven by the raw system calls */
+#if defined(__NR_io_uring_setup)
+#define WAV_IO_CONFIG_URING 1
+#include <linux/io_uring.h>
+#else
+#define WAV_IO_CONFIG_URING 0
+#endif
+
+
+/* io_uring */
+
+#if WAV_IO_CONFIG_URING
+
+static int ring_init(wav_io_t* io)
+{
+  struct io_uring_params p;
+  struct iovec iovs[WAV_IO_NBUF];
+  uint8_t* sq;
+  uint8_t* cq;
+  size_t i;
+
+  memset(&p, 0, sizeof(p));
+  io->ring_fd = (int)syscall(__NR_io_uring_setup, WAV_IO_NBUF, &p);
+  if (io->ring_fd < 0) goto on_error_0;
+
+  io->sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  io->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  /* one mapping holds both rings since 5.4 */
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (io->cq_size > io->sq_size) io->sq_size = io->cq_size;
+    io->cq_size = 0;
+  }
+
+  io->sq_ptr = mmap
+  (
+   NULL, io->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+   io->ring_fd, IORING_OFF_SQ_RING
+  );
+  if (io->sq_ptr == MAP_FAILED) goto on_error_1;
+
+  io->cq_ptr = io->sq_ptr;
+  if (io->cq_size)
+  {
+    io->cq_ptr = mmap
+    (
+     NULL, io->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+     io->ring_fd, IORING_OFF_CQ_RING
+    );
+    if (io->cq_ptr == MAP_FAILED) goto on_error_2;
+  }
+
+  io->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  io->sqes = mmap
+  (
+   NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+   io->ring_fd, IORING_OFF_SQES
+  );
+  if (io->sqes == MAP_FAILED) goto on_error_3;
+
+  sq = io->sq_ptr;
+  io->sq_head = (uint32_t*)(sq + p.sq_off.head);
+  io->sq_tail = (uint32_t*)(sq + p.sq_off.tail);
+  io->sq_mask = (uint32_t*)(sq + p.sq_off.ring_mask);
+  io->sq_array = (uint32_t*)(sq + p.sq_off.array);
+
+  cq = io->cq_ptr;
+  io->cq_head = (uint32_t*)(cq + p.cq_off.head);
+  io->cq_tail = (uint32_t*)(cq + p.cq_off.tail);
+  io->cq_mask = (uint32_t*)(cq + p.cq_off.ring_mask);
+  io->cqes = cq + p.cq_off.cqes;
+
+  io->flags |= WAV_IO_FLAG_RING;
+
+  /* pinned buffers save the per io page lookup. the memlock limit */
+  /* may forbid it, plain reads and writes are then used. */
+
+  for (i = 0; i != WAV_IO_NBUF; ++i)
+  {
+    iovs[i].iov_base = io->bufs + i * WAV_IO_BSIZE;
+    iovs[i].iov_len = WAV_IO_BSIZE;
+  }
+
+  if (syscall
+      (__NR_io_uring_register, io->ring_fd,
+       IORING_REGISTER_BUFFERS, iovs, WAV_IO_NBUF) == 0)
+    io->flags |= WAV_IO_FLAG_FIXED;
+
+  return 0;
+
+ on_error_3:
+  if (io->cq_size) munmap(io->cq_ptr, io->cq_size);
+ on_error_2:
+  munmap(io->sq_ptr, io->sq_size);
+ on_error_1:
+  close(io->ring_fd);
+ on_error_0:
+  return -1;
+}
+
+
+static void ring_fini(wav_io_t* io)
+{
+  munmap(io->sqes, io->sqes_size);
+  if (io->cq_size) munmap(io->cq_ptr, io->cq_size);
+  munmap(io->sq_ptr, io->sq_size);
+  close(io->ring_fd);
+}
+
+
+static int ring_enter(wav_io_t* io, unsigned int nsub, unsigned int nwait)
+{
+  const unsigned int flags = nwait ? IORING_ENTER_GETEVENTS : 0;
+  long err;
+
+  do err = syscall
+       (__NR_io_uring_enter, io->ring_fd, nsub, nwait, flags, NULL, 0);
+  while ((err == -1) && (errno == EINTR));
+
+  return (err == -1) ? -1 : 0;
+}
+
+
+static int ring_submit(wav_io_t* io, size_t i)
+{
+  const uint32_t tail = *io->sq_tail;
+  const uint32_t index = tail & *io->sq_mask;
+  struct io_uring_sqe* const sqe = (struct io_uring_sqe*)io->sqes + index;
+  const unsigned int is_write = io->flags & WAV_IO_FLAG_WRITE;
+
+  memset(sqe, 0, sizeof(*sqe));
+
+  if (io->flags & WAV_IO_FLAG_FIXED)
+  {
+    sqe->opcode = is_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->buf_index = (uint16_t)i;
+  }
+  else
+  {
+    sqe->opcode = is_write ? IORING_OP_WRITE : IORING_OP_READ;
+  }
+
+  sqe->fd = io->fd;
+  sqe->off = (uint64_t)io->slots[i].off;
+  sqe->addr = (uint64_t)(uintptr_t)(io->bufs + i * WAV_IO_BSIZE);
+  sqe->len = (uint32_t)io->slots[i].size;
+  sqe->user_data = (uint64_t)i;
+
+  io->sq_array[index] = index;
+  __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  return ring_enter(io, 1, 0);
+}
+
+
+static unsigned int ring_reap(wav_io_t* io)
+{
+  /* return the count of completions */
+
+  uint32_t head = *io->cq_head;
+  const uint32_t tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+  const struct io_uring_cqe* cqe;
+  wav_io_slot_t* s;
+  unsigned int n = 0;
+
+  for (; head != tail; ++head, ++n)
+  {
+    cqe = (const struct io_uring_cqe*)io->cqes + (head & *io->cq_mask);
+    s = &io->slots[(size_t)cqe->user_data];
+    s->res = (ssize_t)cqe->res;
+    s->is_done = 1;
+  }
+
+  __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+
+  return n;
+}
+
+#else /* WAV_IO_CONFIG_URING == 0 */
+
+static int ring_init(wav_io_t* io)
+{
+  return -1;
+}
+
+static void ring_fini(wav_io_t* io)
+{
+}
+
+static int ring_enter(wav_io_t* io, unsigned int nsub, unsigned int nwait)
+{
+  return -1;
+}
+
+static int ring_submit(wav_io_t* io, size_t i)
+{
+  return -1;
+}
+
+static unsigned int ring_reap(wav_io_t* io)
+{
+  return 0;
+}
+
+#endif /* WAV_IO_CONFIG_URING */
+
+
+/* slots */
+
+static ssize_t slot_sync(wav_io_t* io, size_t i, size_t done)
+{
+  /* move the slot bytes from done on, return the total */
+
+  wav_io_slot_t* const s = &io->slots[i];
+  uint8_t* const buf = io->bufs + i * WAV_IO_BSIZE;
+  ssize_t r;
+
+  while (done != s->size)
+  {
+    if (io->flags & WAV_IO_FLAG_WRITE)
+      r = pwrite(io->fd, buf + done, s->size - done, s->off + done);
+    else
+      r = pread(io->fd, buf + done, s->size - done, s->off + done);
+
+    if (r > 0) done += (size_t)r;
+    else if ((r == -1) && (errno == EINTR)) continue ;
+    else if (r == 0) break ;
+    else return -1;
+  }
+
+  return (ssize_t)done;
+}
+
+
+static void slot_submit(wav_io_t* io, size_t i)
+{
+  wav_io_slot_t* const s = &io->slots[i];
+
+  s->is_done = 0;
+
+  if (((io->flags & (WAV_IO_FLAG_RING | WAV_IO_FLAG_SYNC)) == WAV_IO_FLAG_RING)
+      && (ring_submit(io, i) == 0))
+    return ;
+
+  s->res = slot_sync(io, i, 0);
+  s->is_done = 1;
+}
+
+
+static int slot_wait(wav_io_t* io, size_t i)
+{
+  wav_io_slot_t* const s = &io->slots[i];
+
+  while (s->is_done == 0)
+  {
+    if (ring_reap(io)) continue ;
+    if (ring_enter(io, 0, 1)) return -1;
+  }
+
+  if ((s->res == -EINVAL) || (s->res == -EOPNOTSUPP))
+  {
+    /* opcode unknown to an older kernel, do without the ring */
+    io->flags |= WAV_IO_FLAG_SYNC;
+    s->res = slot_sync(io, i, 0);
+  }
+  else if (s->res < 0)
+  {
+    errno = (int)-s->res;
+    s->res = -1;
+  }
+  else if ((io->flags & WAV_IO_FLAG_WRITE) && ((size_t)s->res < s->size))
+  {
+    /* complete short writes, short reads mean the end of file */
+    s->res = slot_sync(io, i, (size_t)s->res);
+  }
+
+  if (s->res < 0)
+  {
+    io->flags |= WAV_IO_FLAG_ERR;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static void slot_read_next(wav_io_t* io)
+{
+  const size_t i = (io->head + io->nbusy) % WAV_IO_NBUF;
+  wav_io_slot_t* const s = &io->slots[i];
+
+  if (io->off >= io->end) return ;
+
+  s->off = io->off;
+  s->size = WAV_IO_BSIZE;
+  if ((off_t)s->size > (io->end - io->off)) s->size = io->end - io->off;
+  io->off += (off_t)s->size;
+  ++io->nbusy;
+
+  slot_submit(io, i);
+}
+
+
+static int slot_retire(wav_io_t* io)
+{
+  /* wait for the oldest busy slot and free it */
+
+  const size_t i = io->head;
+  int err;
+
+  err = slot_wait(io, i);
+  if (io->flags & WAV_IO_FLAG_WRITE)
+  {
+    if ((size_t)io->slots[i].res != io->slots[i].size) err = -1;
+  }
+
+  io->head = (io->head + 1) % WAV_IO_NBUF;
+  --io->nbusy;
+
+  return err;
+}
+
+
+/* exported */
+
+int wav_io_init(wav_io_t* io, int fd, off_t off, off_t size, uint32_t flags)
+{
+  /* size bounds the read, -1 to read until the end of file. data is */
+  /* moved from off on, the fd position is not used. */
+
+  void* p;
+  size_t i;
+
+  flags &= WAV_IO_FLAG_READ | WAV_IO_FLAG_WRITE | WAV_IO_FLAG_URING;
+  io->flags = flags;
+  io->fd = fd;
+  io->off = off;
+  io->end = (size == (off_t)-1) ? (off_t)INT64_MAX : off + size;
+  io->head = 0;
+  io->nbusy = 0;
+  io->pos = 0;
+
+  if (posix_memalign(&p, 4096, WAV_IO_NBUF * WAV_IO_BSIZE)) return -1;
+  io->bufs = p;
+
+  for (i = 0; i != WAV_IO_NBUF; ++i) io->slots[i].is_done = 1;
+
+  if (flags & WAV_IO_FLAG_URING) ring_init(io);
+
+  if (io->flags & WAV_IO_FLAG_READ)
+  {
+    posix_fadvise(fd, off, 0, POSIX_FADV_SEQUENTIAL);
+    for (i = 0; i != WAV_IO_NBUF; ++i) slot_read_next(io);
+  }
+
+  return 0;
+}
+
+
+int wav_io_fini(wav_io_t* io)
+{
+  /* pending writes are completed, pending reads dropped */
+
+  const size_t i = (io->head + io->nbusy) % WAV_IO_NBUF;
+
+  if ((io->flags & WAV_IO_FLAG_WRITE) && io->pos)
+  {
+    io->slots[i].off = io->off;
+    io->slots[i].size = io->pos;
+    io->off += (off_t)io->pos;
+    ++io->nbusy;
+    slot_submit(io, i);
+  }
+
+  /* the kernel may still access the buffers */
+  while (io->nbusy) slot_retire(io);
+
+  if (io->flags & WAV_IO_FLAG_RING) ring_fini(io);
+  free(io->bufs);
+
+  return (io->flags & WAV_IO_FLAG_ERR) ? -1 : 0;
+}
+
+
+size_t wav_io_read(wav_io_t* io, void* buf, size_t size)
+{
+  /* return the count read, less than size on end of file or error */
+
+  wav_io_slot_t* s;
+  size_t n = 0;
+  size_t k;
+
+  while ((n != size) && io->nbusy)
+  {
+    s = &io->slots[io->head];
+    if (slot_wait(io, io->head)) break ;
+
+    k = (size_t)s->res - io->pos;
+    if (k > (size - n)) k = size - n;
+    memcpy
+      ((uint8_t*)buf + n, io->bufs + io->head * WAV_IO_BSIZE + io->pos, k);
+    io->pos += k;
+    n += k;
+
+    if (io->pos != (size_t)s->res) continue ;
+
+    /* a short block ends the file, later ones read nothing */
+    if ((size_t)s->res != s->size) io->end = s->off + s->res;
+
+    io->pos = 0;
+    io->head = (io->head + 1) % WAV_IO_NBUF;
+    --io->nbusy;
+    slot_read_next(io);
+  }
+
+  return n;
+}
+
+
+int wav_io_write(wav_io_t* io, const void* buf, size_t size)
+{
+  size_t i;
+  size_t k;
+
+  while (size)
+  {
+    if (io->nbusy == WAV_IO_NBUF)
+    {
+      if (slot_retire(io)) return -1;
+      continue ;
+    }
+
+    i = (io->head + io->nbusy) % WAV_IO_NBUF;
+
+    k = WAV_IO_BSIZE - io->pos;
+    if (k > size) k = size;
+    memcpy(io->bufs + i * WAV_IO_BSIZE + io->pos, buf, k);
+    buf = (const uint8_t*)buf + k;
+    size -= k;
+    io->pos += k;
+
+    if (io->pos != WAV_IO_BSIZE) continue ;
+
+    io->slots[i].off = io->off;
+    io->slots[i].size = WAV_IO_BSIZE;
+    io->off += WAV_IO_BSIZE;
+    io->pos = 0;
+    ++io->nbusy;
+    slot_submit(io, i);
+  }
+
+  return (io->flags & WAV_IO_FLAG_ERR) ? -1 : 0;
+}
+
+
+unsigned int wav_io_is_uring(const wav_io_t* io)
+{
+  const uint32_t flags = io->flags & (WAV_IO_FLAG_RING | WAV_IO_FLAG_SYNC);
+  return (flags == WAV_IO_FLAG_RING) ? 1 : 0;
+}
@@ -0,0 +1,80 @@
+#ifndef WAV_IO_H_INCLUDED
+#define WAV_IO_H_INCLUDED
+
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/* sequential block io on the samples of a file, with read ahead or */
+/* write behind: WAV_IO_NBUF blocks are in flight while the caller */
+/* consumes or fills another one. io_uring is used when available, */
+/* with buffers registered once. otherwise, or if the kernel refuses */
+/* the ring, blocks are moved by pread and pwrite when needed. */
+
+#define WAV_IO_BSIZE (1 << 20)
+#define WAV_IO_NBUF 8
+
+typedef struct wav_io_slot
+{
+  off_t off;
+  size_t size;
+  ssize_t res;
+  unsigned int is_done;
+} wav_io_slot_t;
+
+typedef struct wav_io
+{
+#define WAV_IO_FLAG_READ (1 << 0)
+#define WAV_IO_FLAG_WRITE (1 << 1)
+  /* requested by the caller, the ring may still be unavailable */
+#define WAV_IO_FLAG_URING (1 << 2)
+  /* the ring is used, and its buffers registered */
+#define WAV_IO_FLAG_RING (1 << 3)
+#define WAV_IO_FLAG_FIXED (1 << 4)
+  /* the ring refused the opcode, blocks are moved synchronously */
+#define WAV_IO_FLAG_SYNC (1 << 5)
+#define WAV_IO_FLAG_ERR (1 << 6)
+  uint32_t flags;
+
+  int fd;
+
+  /* next offset to submit, and the read end */
+  off_t off;
+  off_t end;
+
+  /* busy slots from head, filled or consumed up to pos */
+  uint8_t* bufs;
+  wav_io_slot_t slots[WAV_IO_NBUF];
+  size_t head;
+  size_t nbusy;
+  size_t pos;
+
+  /* io_uring */
+  int ring_fd;
+  void* sq_ptr;
+  size_t sq_size;
+  void* cq_ptr;
+  size_t cq_size;
+  void* sqes;
+  size_t sqes_size;
+  uint32_t* sq_head;
+  uint32_t* sq_tail;
+  uint32_t* sq_mask;
+  uint32_t* sq_array;
+  uint32_t* cq_head;
+  uint32_t* cq_tail;
+  uint32_t* cq_mask;
+  void* cqes;
+
+} wav_io_t;
+
+
+int wav_io_init(wav_io_t*, int, off_t, off_t, uint32_t);
+int wav_io_fini(wav_io_t*);
+size_t wav_io_read(wav_io_t*, void*, size_t);
+int wav_io_write(wav_io_t*, const void*, size_t);
+unsigned int wav_io_is_uring(const wav_io_t*);
+
+
+#endif /* ! WAV_IO_H_INCLUDED */